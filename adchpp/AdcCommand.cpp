@@ -37,6 +37,23 @@ namespace adchpp
 		addParam(desc);
 	}
 
+	AdcCommand::Traffic AdcCommand::getTraffic(const uint8_t* data, size_t len)
+	{
+		if (len < 5 || (data[4] != ' ' && data[4] != '\n')) return TRAFFIC_CONTROL;
+
+		switch (toCMD(data[1], data[2], data[3]))
+		{
+			case CMD_MSG: return data[0] == TYPE_BROADCAST || data[0] == TYPE_FEATURE ? TRAFFIC_CHAT : TRAFFIC_PM;
+			case CMD_INF: return TRAFFIC_INF;
+			case CMD_QUI: return TRAFFIC_QUI;
+			case CMD_SCH: return TRAFFIC_SEARCH;
+			case CMD_RES: return TRAFFIC_RESULT;
+			case CMD_CTM:
+			case CMD_RCM: return TRAFFIC_CTM;
+		}
+		return TRAFFIC_CONTROL;
+	}
+
 	void AdcCommand::escape(const string& s, string& out)
 	{
 		out.reserve(out.length() + static_cast<size_t>(s.length() * 1.1));
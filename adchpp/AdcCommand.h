@@ -86,6 +86,19 @@ namespace adchpp
 			PRIORITY_IGNORE	 // Ignore, command will not be put in send queue
 		};
 
+		/** Kinds of traffic that output queueing, egress scheduling and rate limits tell apart */
+		enum Traffic
+		{
+			TRAFFIC_CONTROL, // anything not listed below
+			TRAFFIC_CHAT,    // broadcast and feature MSG
+			TRAFFIC_PM,      // direct and echo MSG
+			TRAFFIC_INF,     // INF
+			TRAFFIC_QUI,     // QUI
+			TRAFFIC_SEARCH,  // SCH
+			TRAFFIC_RESULT,  // RES
+			TRAFFIC_CTM      // CTM and RCM
+		};
+
 		static const char TYPE_BROADCAST = 'B';
 		static const char TYPE_CLIENT = 'C';
 		static const char TYPE_DIRECT = 'D';
@@ -147,6 +160,13 @@ namespace adchpp
 			return toCMD(str[0], str[1], str[2]);
 		}
 
+		/**
+		 * @return Traffic kind of the raw command line at the start of data;
+		 * TRAFFIC_CONTROL if data doesn't start with a command, such as the rest
+		 * of a partially written buffer
+		 */
+		static Traffic getTraffic(const uint8_t* data, size_t len);
+
 		static uint16_t toField(const char* x)
 		{
 			return *((uint16_t*)x);
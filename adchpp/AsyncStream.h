@@ -16,6 +16,9 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#ifndef ADCHPP_ASYNCSTREAM_H
+#define ADCHPP_ASYNCSTREAM_H
+
 #include "Buffer.h"
 #include <boost/system/error_code.hpp>
 
@@ -37,9 +40,23 @@ namespace adchpp
 		virtual void shutdown(const Handler& handler) = 0;
 		virtual void close() = 0;
 
+		/**
+		 * Stop receiving so that the connection can be handed over to another process.
+		 * @param fd The descriptor, -1 if the stream can't be handed over
+		 * @param pending Data received but not read yet
+		 * @return false while a receive is still winding down
+		 */
+		virtual bool handOff(int& fd, std::string&)
+		{
+			fd = -1;
+			return true;
+		}
+
 		virtual ~AsyncStream() {}
 	};
 
 	typedef std::shared_ptr<AsyncStream> AsyncStreamPtr;
 
 } // namespace adchpp
+
+#endif // ADCHPP_ASYNCSTREAM_H
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "BatchWriter.h"
+#include "AppPaths.h"
+#include "Utils.h"
+#include <baselib/ParamExpander.h>
+#include <baselib/PathUtil.h>
+
+namespace adchpp
+{
+	using namespace std;
+
+	RotatingFile::RotatingFile(const string& fileTemplate, const string& basePath, const string& header, const char* name) :
+		fileTemplate(fileTemplate), basePath(basePath), header(header), name(name)
+	{
+	}
+
+	time_t RotatingFile::open(time_t t)
+	{
+		string fileName = fileTemplate;
+		Util::toNativePathSeparators(fileName);
+		time_t next = Utils::getNextRollover(fileName, t);
+
+		Util::TimeParamExpander ex(t);
+		fileName = Util::formatParams(AppPaths::makeAbsolutePath(basePath, fileName), &ex, false);
+		if (fileName == currentFileName) return next;
+
+		try
+		{
+			currentFileName.clear();
+			file.close();
+			File::ensureDirectory(fileName);
+#ifdef _WIN32
+			file.init(Text::utf8ToWide(fileName), File::WRITE, File::OPEN | File::CREATE);
+#else
+			file.init(fileName, File::WRITE, File::OPEN | File::CREATE);
+#endif
+			if (file.setEndPos(0) == 0) file.write(header);
+			currentFileName = fileName;
+		}
+		catch (const FileException& e)
+		{
+			file.close();
+			dcdebug("%s: %s\n", name, e.getError().c_str());
+		}
+		return next;
+	}
+
+	void RotatingFile::write(const string& data)
+	{
+		if (!file.isOpen()) return;
+		try
+		{
+			file.write(data);
+		}
+		catch (const FileException& e)
+		{
+			dcdebug("%s: %s\n", name, e.getError().c_str());
+		}
+	}
+
+} // namespace adchpp
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef ADCHPP_BATCH_WRITER_H
+#define ADCHPP_BATCH_WRITER_H
+
+#include "RingBuffer.h"
+#include <baselib/File.h>
+#include <baselib/Thread.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+namespace adchpp
+{
+
+	/**
+	 * Writer thread that drains a queue of entries into files that roll over with
+	 * time. Producers never block, and entries are encoded and written in batches,
+	 * so a flood of them costs one write per batch instead of one per entry.
+	 * Subclasses encode the entries and pick the file they go to.
+	 */
+	template <typename Entry> class BatchWriter : public Thread
+	{
+	public:
+		BatchWriter(size_t queueSize, size_t maxBatch, std::atomic<int64_t>& written) :
+			queue(queueSize), maxBatch(maxBatch), written(written), stopping(false), sleeping(false), nextRollover(0)
+		{
+		}
+
+		/** @return false if the queue is full */
+		bool push(Entry&& e)
+		{
+			if (!queue.push(std::move(e))) return false;
+			if (sleeping.load(std::memory_order_relaxed))
+			{
+				std::lock_guard<std::mutex> l(waitMutex);
+				cv.notify_one();
+			}
+			return true;
+		}
+
+		/** Write what's queued and end the thread */
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> l(waitMutex);
+				stopping = true;
+				cv.notify_one();
+			}
+			join();
+		}
+
+		/** Pick the file again for the next entry, for example because its name changed */
+		void resetFileName()
+		{
+			nextRollover.store(0);
+		}
+
+		size_t size() const
+		{
+			return queue.size();
+		}
+
+	protected:
+		/** @return Time of an entry, in seconds since the epoch */
+		virtual time_t getTime(const Entry& e) const = 0;
+		virtual void encode(const Entry& e, std::string& batch) = 0;
+		/** Switch to the file that entries of the given time go to. @return When to switch again */
+		virtual time_t openFile(time_t t) = 0;
+		/** Called with every batch before it's written, even an empty one */
+		virtual void finishBatch(std::string&) { }
+		virtual void write(const std::string& batch) = 0;
+
+		int run() override
+		{
+			std::string batch;
+			Entry e;
+			for (;;)
+			{
+				size_t n = 0;
+				while (n < maxBatch && queue.pop(e))
+				{
+					time_t t = getTime(e);
+					if (t >= nextRollover.load())
+					{
+						// What belongs to the old file goes there first
+						flush(batch);
+						nextRollover.store(openFile(t));
+					}
+					encode(e, batch);
+					++n;
+				}
+
+				finishBatch(batch);
+				flush(batch);
+				written += n;
+
+				if (n < maxBatch)
+				{
+					std::unique_lock<std::mutex> l(waitMutex);
+					if (stopping && queue.size() == 0) break;
+					sleeping.store(true);
+					// A producer may have pushed just before we announced that we're sleeping; the
+					// timeout keeps such an entry from waiting longer than this
+					if (queue.size() == 0) cv.wait_for(l, std::chrono::milliseconds(250));
+					sleeping.store(false);
+				}
+			}
+			return 0;
+		}
+
+	private:
+		void flush(std::string& batch)
+		{
+			if (batch.empty()) return;
+			write(batch);
+			batch.clear();
+		}
+
+		RingBuffer<Entry> queue;
+		const size_t maxBatch;
+		std::atomic<int64_t>& written;
+
+		std::mutex waitMutex;
+		std::condition_variable cv;
+		bool stopping;
+		std::atomic<bool> sleeping;
+
+		std::atomic<time_t> nextRollover;
+	};
+
+	/**
+	 * Binary file named by a template with strftime-like time fields, for use by a
+	 * BatchWriter. New files start with the header of their format.
+	 */
+	class RotatingFile
+	{
+	public:
+		/** @param name Used in debug messages */
+		RotatingFile(const std::string& fileTemplate, const std::string& basePath, const std::string& header,
+			const char* name);
+
+		/** Switch to the file of the given time. @return When to switch again */
+		time_t open(time_t t);
+		/** Errors are ignored; the data is lost */
+		void write(const std::string& data);
+
+	private:
+		const std::string fileTemplate;
+		const std::string basePath;
+		const std::string header;
+		const char* name;
+
+		File file;
+		std::string currentFileName;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_BATCH_WRITER_H
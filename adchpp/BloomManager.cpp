@@ -22,6 +22,7 @@
 #include "Core.h"
 #include "LogManager.h"
 #include "PluginManager.h"
+#include "WorkerPool.h"
 #include <baselib/StrUtil.h>
 #include <baselib/FormatUtil.h>
 
@@ -36,7 +37,7 @@ const size_t h = 24;
 
 struct PendingItem
 {
-	PendingItem(size_t m_, size_t k_) : m(m_), k(k_)
+	PendingItem(size_t m_, size_t k_, uint64_t generation_) : m(m_), k(k_), generation(generation_), building(false)
 	{
 		buffer.reserve(m / 8);
 	}
@@ -44,9 +45,11 @@ struct PendingItem
 	ByteVector buffer;
 	size_t m;
 	size_t k;
+	uint64_t generation; // tells this upload apart from later ones that reuse the memory
+	bool building; // the filter is being expanded by a worker
 };
 
-BloomManager::BloomManager(Core& core) : searches(0), tthSearches(0), stopped(0), core(core)
+BloomManager::BloomManager(Core& core) : searches(0), tthSearches(0), stopped(0), generations(0), core(core)
 {
 	LOG(className, "Starting");
 }
@@ -123,7 +126,7 @@ void BloomManager::onReceive(Entity& e, AdcCommand& cmd, bool& ok)
 			size_t k = HashBloom::get_k(n, h);
 			size_t m = HashBloom::get_m(n, k);
 
-			e.setPluginData(pendingHandle, new PendingItem(m, k));
+			e.setPluginData(pendingHandle, new PendingItem(m, k, ++generations));
 
 			AdcCommand get(AdcCommand::CMD_GET);
 			get.addParam("blom");
@@ -144,7 +147,7 @@ void BloomManager::onReceive(Entity& e, AdcCommand& cmd, bool& ok)
 			return;
 
 		PendingItem* pending = reinterpret_cast<PendingItem*>(e.getPluginData(pendingHandle));
-		if (!pending)
+		if (!pending || pending->building)
 		{
 			c.send(AdcCommand(AdcCommand::SEV_FATAL, AdcCommand::ERROR_BAD_STATE, "Unexpected bloom filter update"));
 			c.disconnect(REASON_BAD_STATE);
@@ -219,15 +222,36 @@ void BloomManager::onData(Entity& c, const uint8_t* data, size_t len)
 
 	if (pending->buffer.size() == pending->m / 8)
 	{
-		HashBloom* bloom = new HashBloom();
-		c.setPluginData(bloomHandle, bloom);
-		bloom->reset(pending->buffer, pending->k, h);
-		c.clearPluginData(pendingHandle);
-		/* Mark the new filter as received */
-		signalBloomReady_(c);
+		// Expanding a filter of a large share into bits takes milliseconds; do it off the reactor
+		auto buffer = std::make_shared<ByteVector>(std::move(pending->buffer));
+		auto bloom = std::make_shared<std::unique_ptr<HashBloom>>(new HashBloom());
+		size_t k = pending->k;
+		uint32_t sid = c.getSID();
+		uint64_t generation = pending->generation;
+		pending->building = true;
+		core.addWork([buffer, bloom, k] { (*bloom)->reset(*buffer, k, h); },
+			[this, sid, generation, bloom] { onBloomBuilt(sid, generation, bloom->release()); });
 	}
 }
 
+void BloomManager::onBloomBuilt(uint32_t sid, uint64_t generation, HashBloom* bloom)
+{
+	// The entity may have left while the filter was being built, and its SID and memory
+	// may have been reused since
+	Entity* c = core.getClientManager().getEntity(sid);
+	PendingItem* pending = c ? reinterpret_cast<PendingItem*>(c->getPluginData(pendingHandle)) : nullptr;
+	if (!pending || pending->generation != generation)
+	{
+		delete bloom;
+		return;
+	}
+
+	c->setPluginData(bloomHandle, bloom);
+	c->clearPluginData(pendingHandle);
+	/* Mark the new filter as received */
+	signalBloomReady_(*c);
+}
+
 void BloomManager::onStats(Entity& c)
 {
 	string stats = "\nBloom filter statistics:";
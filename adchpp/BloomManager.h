@@ -72,6 +72,7 @@ private:
 	int64_t searches;
 	int64_t tthSearches;
 	int64_t stopped;
+	uint64_t generations; // of pending filter uploads
 
 	ClientManager::SignalReceive::ManagedConnection receiveConn;
 	ClientManager::SignalSend::ManagedConnection sendConn;
@@ -81,6 +82,7 @@ private:
 	void onReceive(Entity& c, AdcCommand& cmd, bool&);
 	void onSend(Entity& c, const AdcCommand& cmd, bool&);
 	void onData(Entity& c, const uint8_t* data, size_t len);
+	void onBloomBuilt(uint32_t sid, uint64_t generation, HashBloom* bloom);
 	void onStats(Entity& c);
 
 	Core& core;
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_CAPTURE_FORMAT_H
+#define ADCHPP_CAPTURE_FORMAT_H
+
+#include "JournalFormat.h"
+
+namespace adchpp
+{
+
+	/**
+	 * On-disk layout of a traffic capture. All integers are little endian.
+	 *
+	 * File header:
+	 *   char     magic[4]  "ADCT"
+	 *   uint16   version
+	 *   uint16   header size
+	 *
+	 * Each record:
+	 *   uint32   size      total record size, including this field
+	 *   uint8    type      capture::Event
+	 *   uint8    reason    journal::REASONS code of a disconnect, NO_REASON otherwise
+	 *   uint16   reserved
+	 *   uint32   sid
+	 *   int64    time      microseconds since the epoch (UTC)
+	 *   char     data[]    size - RECORD_SIZE bytes: the IP address of a connect, the
+	 *                      line without its newline, or the reason text of a disconnect
+	 *
+	 * The PD field of INF lines is removed before the line is stored.
+	 *
+	 * Version 1 stored the Reason enum bound in records without a reason; readers
+	 * ignore the reason of anything but a disconnect.
+	 */
+	namespace capture
+	{
+		enum Event
+		{
+			EVENT_CONNECT = 1,
+			EVENT_LINE,
+			EVENT_DISCONNECT,
+			EVENT_LAST
+		};
+
+		static const char MAGIC[4] = { 'A', 'D', 'C', 'T' };
+		static const uint16_t VERSION = 2;
+		static const size_t HEADER_SIZE = 8;
+		static const size_t RECORD_SIZE = 20;
+
+		struct Record
+		{
+			uint8_t type;
+			uint8_t reason;
+			uint32_t sid;
+			int64_t time;
+		};
+
+		using journal::NO_REASON;
+		using journal::getReasonCode;
+		using journal::getReasonName;
+
+		using journal::get16;
+		using journal::get32;
+		using journal::get64;
+		using journal::put16;
+		using journal::put32;
+		using journal::put64;
+
+		inline void writeHeader(uint8_t* out)
+		{
+			memcpy(out, MAGIC, 4);
+			put16(out + 4, VERSION);
+			put16(out + 6, (uint16_t) HEADER_SIZE);
+		}
+
+		/** @return Header size, 0 if this isn't a capture file */
+		inline size_t readHeader(const uint8_t* in, size_t len)
+		{
+			if (len < HEADER_SIZE || memcmp(in, MAGIC, 4) != 0 || get16(in + 4) > VERSION) return 0;
+			return get16(in + 6);
+		}
+
+		/** Encode the fixed part of a record; out must have room for RECORD_SIZE bytes */
+		inline void writeRecord(uint8_t* out, const Record& r, size_t dataLen)
+		{
+			put32(out, (uint32_t) (RECORD_SIZE + dataLen));
+			out[4] = r.type;
+			out[5] = r.reason;
+			put16(out + 6, 0);
+			put32(out + 8, r.sid);
+			put64(out + 12, (uint64_t) r.time);
+		}
+
+		/** @return Total record size, 0 if the data is truncated or corrupt */
+		inline size_t readRecord(const uint8_t* in, size_t len, Record& r)
+		{
+			if (len < RECORD_SIZE) return 0;
+			size_t size = get32(in);
+			if (size < RECORD_SIZE || size > len) return 0;
+			r.type = in[4];
+			r.reason = r.type == EVENT_DISCONNECT ? in[5] : NO_REASON;
+			r.sid = get32(in + 8);
+			r.time = (int64_t) get64(in + 12);
+			return size;
+		}
+	} // namespace capture
+
+} // namespace adchpp
+
+#endif // ADCHPP_CAPTURE_FORMAT_H
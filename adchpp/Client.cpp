@@ -18,6 +18,9 @@
 
 #include "Client.h"
 #include "ClientManager.h"
+#include "Core.h"
+#include "TrafficCapture.h"
+#include <baselib/TimeUtil.h>
 
 namespace adchpp
 {
@@ -41,54 +44,11 @@ namespace adchpp
 	{
 	}
 
-	namespace
-	{
-		// Lightweight call forwarders, instead of std::bind
-		template <void (Client::*F)()> struct Handler0
-		{
-			Handler0(Client* c_) : c(c_)
-			{
-			}
-			void operator()()
-			{
-				(c->*F)();
-			}
-			Client* c;
-		};
-
-		template <typename T, void (Client::*F)(const T&)> struct Handler1
-		{
-			Handler1(Client* c_) : c(c_)
-			{
-			}
-			void operator()(const T& bv)
-			{
-				(c->*F)(bv);
-			}
-			Client* c;
-		};
-
-		template <typename T, typename T2, void (Client::*F)(T, const T2&)> struct Handler2
-		{
-			Handler2(Client* c_) : c(c_)
-			{
-			}
-			void operator()(const T& t, const T2& t2)
-			{
-				(c->*F)(t, t2);
-			}
-			Client* c;
-		};
-	} // namespace
-
 	void Client::setSocket(const ManagedSocketPtr& aSocket) noexcept
 	{
 		dcassert(!socket);
 		socket = aSocket;
-		socket->setConnectedHandler(Handler0<&Client::onConnected>(this));
-		socket->setReadyHandler(Handler0<&Client::onReady>(this));
-		socket->setDataHandler(Handler1<BufferPtr, &Client::onData>(this));
-		socket->setFailedHandler(Handler2<Reason, std::string, &Client::onFailed>(this));
+		socket->setEventHandler(this);
 	}
 
 	void Client::onConnected() noexcept
@@ -102,6 +62,31 @@ namespace adchpp
 	}
 
 	void Client::onData(const BufferPtr& buf) noexcept
+	{
+		RateLimiter& limiter = cm.getRateLimiter();
+		if (!limiter.getEnabled() && !rate)
+		{
+			processData(buf);
+			return;
+		}
+
+		if (!rate) rate = limiter.createState(getIp());
+		uint64_t wait = limiter.chargeBytes(*rate, buf->size());
+		processData(buf);
+		if (wait && !disconnecting) socket->pauseRead(wait);
+	}
+
+	void Client::onResumed() noexcept
+	{
+		if (held)
+		{
+			BufferPtr buf;
+			buf.swap(held);
+			processData(buf);
+		}
+	}
+
+	void Client::processData(const BufferPtr& buf) noexcept
 	{
 		uint8_t* data = buf->data();
 		size_t done = 0;
@@ -171,10 +156,37 @@ namespace adchpp
 					continue;
 				}
 
+				if (rate)
+				{
+					uint64_t wait = cm.getRateLimiter().takeCommand(*rate, buffer->data(), buffer->size());
+					if (wait)
+					{
+						// Keep the line and whatever came after it until there are tokens again
+						if (done < len) buffer->append(data + done, data + len);
+						held.swap(buffer);
+						buffer.reset();
+						socket->pauseRead(wait);
+						return;
+					}
+				}
+
+				TrafficCapture& tc = cm.getCore().getTrafficCapture();
+				if (tc.getEnabled()) tc.recordLine(*this, buffer->data(), buffer->size() - 1);
+
 				try
 				{
+					CommandStats& cs = cm.getCore().getCommandStats();
+					uint64_t start = cs.getEnabled() ? Util::getHighResTimestamp() : 0;
+
 					AdcCommand cmd(buffer);
 
+					if (start)
+					{
+						CommandStats::Command* stats = cs.get(cmd);
+						stats->phases[CommandStats::PHASE_PARSE].add(Util::getHighResTimestamp() - start);
+						CommandStats::inc(stats->bytesIn, buffer->size());
+					}
+
 					if (cmd.getType() == 'H')
 					{
 						cmd.setFrom(getSID());
@@ -197,6 +209,29 @@ namespace adchpp
 		}
 	}
 
+	bool Client::compress() noexcept
+	{
+		if (disconnecting || !hasSupport(AdcCommand::toFourCC("ZLIF"))) return false;
+		return socket->compress();
+	}
+
+	bool Client::handOff(int& fd, std::string& pending) noexcept
+	{
+		if (!socket->handOff(fd, pending)) return false;
+		if (disconnecting || dataBytes > 0)
+		{
+			fd = -1;
+			return true;
+		}
+
+		// Input that's been read already goes first
+		string input;
+		if (buffer) input.append((const char*)buffer->data(), buffer->size());
+		if (held) input.append((const char*)held->data(), held->size());
+		pending.insert(0, input);
+		return true;
+	}
+
 	void Client::disconnect(Reason reason, const std::string& info) noexcept
 	{
 		dcassert(socket);
@@ -24,6 +24,7 @@
 #include "Entity.h"
 #include "FastAlloc.h"
 #include "ManagedSocket.h"
+#include "RateLimiter.h"
 
 namespace adchpp
 {
@@ -31,7 +32,7 @@ namespace adchpp
 	/**
 	 * The client represents one connection to a user.
 	 */
-	class Client : public Entity, public FastAlloc<Client>
+	class Client : public Entity, public FastAlloc<Client>, private SocketEventHandler
 	{
 	public:
 		static Client* create(ClientManager& cm, const ManagedSocketPtr& ms_, uint32_t sid_) noexcept;
@@ -71,11 +72,47 @@ namespace adchpp
 		{
 			return socket->getQueuedBytes();
 		}
+		size_t getQueuedBytes(ManagedSocket::SendClass c) const
+		{
+			return socket->getQueuedBytes(c);
+		}
+		uint64_t getBacklogAge() const
+		{
+			return socket->getBacklogAge();
+		}
+		double getDrainRate() const
+		{
+			return socket->getDrainRate();
+		}
+		size_t dropSearches(size_t bytes)
+		{
+			return socket->dropSearches(bytes);
+		}
 		virtual time::ptime getOverflow() const
 		{
 			return socket->getOverflow();
 		}
 
+		void loggedIn() noexcept
+		{
+			socket->loggedIn();
+		}
+
+		/** Compress the output if the client supports ZLIF @see ManagedSocket::compress */
+		bool compress() noexcept;
+		bool isCompressed() const
+		{
+			return socket->isCompressed();
+		}
+
+		/** @see ManagedSocket::handOff; the fd is -1 for clients in the middle of something */
+		bool handOff(int& fd, std::string& pending) noexcept;
+		/** @see ManagedSocket::detach */
+		void detach() noexcept
+		{
+			socket->detach();
+		}
+
 	private:
 		Client(ClientManager& cm, uint32_t sid_) noexcept;
 		virtual ~Client();
@@ -86,13 +123,20 @@ namespace adchpp
 		ManagedSocketPtr socket;
 		int64_t dataBytes;
 
+		/** Rate limiter buckets, created on the first read when limits are set */
+		std::unique_ptr<RateLimiter::State> rate;
+		/** Input held back by a rate limit, processed when reading resumes */
+		BufferPtr held;
+
 		DataFunction dataHandler;
 		void setSocket(const ManagedSocketPtr& aSocket) noexcept;
 
-		void onConnected() noexcept;
-		void onReady() noexcept;
-		void onData(const BufferPtr&) noexcept;
-		void onFailed(Reason reason, const std::string& info) noexcept;
+		virtual void onConnected() noexcept;
+		virtual void onReady() noexcept;
+		virtual void onData(const BufferPtr&) noexcept;
+		virtual void onResumed() noexcept;
+		void processData(const BufferPtr&) noexcept;
+		virtual void onFailed(Reason reason, const std::string& info) noexcept;
 	};
 
 } // namespace adchpp
@@ -21,6 +21,7 @@
 #include "Core.h"
 #include "LogManager.h"
 #include "SocketManager.h"
+#include "Watchdog.h"
 #include "version.h"
 
 #include <baselib/File.h>
@@ -28,6 +29,7 @@
 #include <baselib/TigerHash.h>
 #include <baselib/Random.h>
 #include <baselib/StrUtil.h>
+#include <baselib/TimeUtil.h>
 
 #include <codecvt>
 #include <locale>
@@ -40,14 +42,23 @@ using namespace std;
 using adchpp::ClientManager;
 using adchpp::AdcCommand;
 using adchpp::Bot;
+using adchpp::Client;
 using adchpp::Entity;
 
 	const string ClientManager::className = "ClientManager";
 
+	// Milliseconds between releases from the login queue
+	static const long ADMISSION_INTERVAL = 100;
+	// How many LogTimeouts a login may wait in the login queue
+	static const long QUEUE_TIMEOUT_FACTOR = 4;
+
 	ClientManager::ClientManager(Core& core) noexcept
-	: core(core), hub(*this), maxCommandSize(16 * 1024), logTimeout(30 * 1000), hbriTimeout(5000)
+	: core(core), hub(*this), maxCommandSize(16 * 1024), logTimeout(30 * 1000), hbriTimeout(5000),
+	  loginRate(0), loginLagTarget(50), loginCredit(0), lastAdmission(0), slowTimeout(0), slowSearches(0), slowInfs(0),
+	  slowResyncs(0), sendCount(0)
 	{
 		core.getSocketManager().addTimedJob(1000, std::bind(&ClientManager::onTimerSecond, this));
+		core.getSocketManager().addTimedJob(ADMISSION_INTERVAL, std::bind(&ClientManager::admitLogins, this));
 	}
 
 	void ClientManager::prepareSupports(bool addHbri)
@@ -56,6 +67,7 @@ using adchpp::Entity;
 		hub.addSupports(AdcCommand::toFourCC("TIGR"));
 
 		if (addHbri) hub.addSupports(AdcCommand::toFourCC("HBRI"));
+		if (core.getSocketManager().getCompressionLevel() > 0) hub.addSupports(AdcCommand::toFourCC("ZLIF"));
 	}
 
 	void ClientManager::failHBRI(Client& cc)
@@ -96,6 +108,62 @@ using adchpp::Entity;
 			cc->disconnect(REASON_LOGIN_TIMEOUT);
 			logins.pop_front();
 		}
+
+		// The queue doesn't count against the login timeout, but it can't hold logins forever either
+		uint64_t queueTimeout = getLogTimeout() * (uint64_t) QUEUE_TIMEOUT_FACTOR * 1000000;
+		uint64_t now = Util::getHighResTimestamp();
+		for (auto& queue : loginQueue)
+		{
+			while (!queue.empty() && now - queue.front().since > queueTimeout)
+			{
+				auto cc = queue.front().c;
+				dcdebug("ClientManager: Login queue timeout in state %d\n", cc->getState());
+				removeLogins(*cc);
+				cc->disconnect(REASON_LOGIN_TIMEOUT);
+			}
+		}
+
+		if (slowTimeout > 0) checkSlow();
+	}
+
+	void ClientManager::checkSlow()
+	{
+		for (auto i = entities.begin(); i != entities.end(); ++i)
+		{
+			if (i->second->getType() != Entity::TYPE_CLIENT) continue;
+			Client& cc = static_cast<Client&>(*i->second);
+			uint64_t age = cc.getBacklogAge();
+
+			if (!cc.isSet(Entity::FLAG_SLOW))
+			{
+				if (age < slowTimeout) continue;
+
+				cc.setFlag(Entity::FLAG_SLOW);
+				// Whatever searches are still queued are stale by now
+				cc.dropSearches(static_cast<size_t>(-1));
+				LOG(className, "Withholding searches and INF updates from " + cc.getField("NI") + " (" + cc.getIp() +
+					"), " + Util::toString(cc.getQueuedBytes()) + " bytes queued for " + Util::toString(age) + " ms");
+			}
+			else if (age < slowTimeout / 2)
+			{
+				// Caught up, send the current INF of everyone whose updates it missed
+				cc.unsetFlag(Entity::FLAG_SLOW);
+				auto stale = staleInfs.find(cc.getSID());
+				if (stale != staleInfs.end())
+				{
+					for (auto sid : stale->second)
+					{
+						Entity* e = getEntity(sid);
+						if (e && e->getState() == Entity::STATE_NORMAL)
+						{
+							cc.send(e->getINF());
+							slowResyncs++;
+						}
+					}
+					staleInfs.erase(stale);
+				}
+			}
+		}
 	}
 
 	Bot* ClientManager::createBot(const Bot::SendHandler& handler)
@@ -150,9 +218,32 @@ using adchpp::Entity;
 
 	void ClientManager::maybeSend(Entity& c, const AdcCommand& cmd)
 	{
+		if (c.isSet(Entity::FLAG_SLOW) && withholdSlow(c, cmd)) return;
+
 		bool ok = true;
 		signalSend_(c, cmd, ok);
-		if (ok) c.send(cmd);
+		if (ok)
+		{
+			c.send(cmd);
+			++sendCount;
+		}
+	}
+
+	bool ClientManager::withholdSlow(Entity& c, const AdcCommand& cmd)
+	{
+		if (cmd.getCommand() == AdcCommand::CMD_SCH)
+		{
+			slowSearches++;
+			return true;
+		}
+		// Joins don't come through here, only updates of users the client already knows
+		if (cmd.getCommand() == AdcCommand::CMD_INF && cmd.getFrom() != c.getSID())
+		{
+			staleInfs[c.getSID()].insert(cmd.getFrom());
+			slowInfs++;
+			return true;
+		}
+		return false;
 	}
 
 	void ClientManager::sendToAll(const BufferPtr& buf) noexcept
@@ -161,6 +252,20 @@ using adchpp::Entity;
 			i->second->send(buf);
 	}
 
+	void ClientManager::getStateCounts(size_t (&counts)[Entity::STATE_DATA + 1]) const noexcept
+	{
+		for (auto& count : counts)
+			count = 0;
+		for (auto i = logins.begin(); i != logins.end(); ++i)
+			counts[i->first->getState()]++;
+		for (auto& queue : loginQueue)
+			for (auto i = queue.begin(); i != queue.end(); ++i)
+				counts[i->c->getState()]++;
+		for (auto i = entities.begin(); i != entities.end(); ++i)
+			if (i->second->getType() == Entity::TYPE_CLIENT)
+				counts[i->second->getState()]++;
+	}
+
 	size_t ClientManager::getQueuedBytes() noexcept
 	{
 		size_t total = 0;
@@ -180,6 +285,32 @@ using adchpp::Entity;
 		Client::create(*this, socket, makeSID());
 	}
 
+	Client* ClientManager::adopt(const ManagedSocketPtr& socket, uint32_t sid, const CID& cid, const AdcCommand& sup,
+		const AdcCommand& inf, size_t flags) noexcept
+	{
+		// Reserved by Handoff::receive, so that bots created in the meantime don't take it
+		reservedSids.erase(sid);
+
+		string nick;
+		if (sid == AdcCommand::HUB_SID || entities.find(sid) != entities.end() || cids.find(cid) != cids.end() ||
+			!inf.getParam("NI", 0, nick) || nicks.find(nick) != nicks.end())
+			return nullptr;
+
+		// Straight to NORMAL; the other users know it already
+		Client* c = Client::create(*this, socket, sid);
+		c->setCID(cid);
+		c->updateSupports(sup);
+		c->updateFields(inf);
+		c->setFlag(flags);
+		c->setState(Entity::STATE_NORMAL);
+		c->loggedIn();
+
+		entities.insert(make_pair(sid, c));
+		cids.insert(make_pair(cid, c));
+		nicks.insert(make_pair(nick, c));
+		return c;
+	}
+
 	uint32_t ClientManager::makeSID()
 	{
 		const char* table = Util::getBase32Chars();
@@ -196,9 +327,11 @@ using adchpp::Entity;
 				sid.chars[i] = table[value & 31];
 				value >>= 5;
 			}
-			if (sid.sid && entities.find(sid.sid) == entities.end())
+			if (sid.sid && entities.find(sid.sid) == entities.end() && reservedSids.find(sid.sid) == reservedSids.end())
 				break;
 		}
+		// Until the entity is in NORMAL, another connection could otherwise get the same SID
+		reservedSids.insert(sid.sid);
 		return sid.sid;
 	}
 
@@ -229,6 +362,15 @@ using adchpp::Entity;
 			return;
 		}
 
+		Watchdog::Scope scope(core.getWatchdog(), "command", &cmd);
+
+		CommandStats::Command* stats = core.getCommandStats().get(cmd);
+		if (stats)
+		{
+			onReceive(c, cmd, *stats);
+			return;
+		}
+
 		bool ok = true;
 		signalReceive_(c, cmd, ok);
 
@@ -236,6 +378,42 @@ using adchpp::Entity;
 		send(cmd);
 	}
 
+	void ClientManager::onReceive(Entity& c, AdcCommand& cmd, CommandStats::Command& stats) noexcept
+	{
+		uint64_t start = Util::getHighResTimestamp();
+		uint64_t sent = sendCount;
+		CommandStats::inc(stats.received);
+
+		bool ok = true;
+		signalReceive_(c, cmd, ok);
+		uint64_t now = Util::getHighResTimestamp();
+		stats.phases[CommandStats::PHASE_PLUGINS].add(now - start);
+
+		bool forward = true;
+		if (ok)
+		{
+			start = now;
+			forward = dispatch(c, cmd);
+			now = Util::getHighResTimestamp();
+			stats.phases[CommandStats::PHASE_HUB].add(now - start);
+		}
+
+		if (forward)
+		{
+			start = now;
+			send(cmd);
+			now = Util::getHighResTimestamp();
+			stats.phases[CommandStats::PHASE_SEND].add(now - start);
+		}
+
+		sent = sendCount - sent;
+		if (sent)
+		{
+			CommandStats::inc(stats.sent, sent);
+			CommandStats::inc(stats.bytesOut, sent * cmd.getBuffer()->size());
+		}
+	}
+
 	void ClientManager::onBadLine(Client& c, const string& aLine) noexcept
 	{
 		if (c.isSet(Entity::FLAG_GHOST)) return;
@@ -846,11 +1024,81 @@ using adchpp::Entity;
 			c.unsetFlag(Entity::FLAG_VALIDATE_HBRI);
 		}
 
+		if (c.getType() == Entity::TYPE_CLIENT && loginRate > 0)
+		{
+			if (loginQueue[0].empty() && loginQueue[1].empty() && loginCredit >= 1)
+			{
+				loginCredit -= 1;
+				loginWait.add(0);
+			}
+			else
+			{
+				if (!c.isSet(Entity::FLAG_QUEUED)) queueLogin(static_cast<Client&>(c), sendData, sendOwnInf);
+				return true;
+			}
+		}
+
+		return completeNormal(c, sendData, sendOwnInf);
+	}
+
+	void ClientManager::queueLogin(Client& c, bool sendData, bool sendOwnInf) noexcept
+	{
+		// The wait doesn't count against the login timeout
+		removeLogins(c);
+		c.setFlag(Entity::FLAG_QUEUED);
+
+		bool registered = c.isAnySet(Entity::FLAG_REGISTERED | Entity::FLAG_OP | Entity::FLAG_SU | Entity::FLAG_OWNER) ||
+			c.getState() == Entity::STATE_VERIFY;
+		auto& queue = loginQueue[registered ? 0 : 1];
+		queuedLogins[&c] = queue.insert(queue.end(), QueuedLogin { &c, sendData, sendOwnInf, registered, Util::getHighResTimestamp() });
+	}
+
+	void ClientManager::admitLogins() noexcept
+	{
+		uint64_t now = Util::getHighResTimestamp();
+		double elapsed = lastAdmission ? (now - lastAdmission) / 1e9 : 0;
+		lastAdmission = now;
+
+		// Everybody goes in once pacing is turned off
+		bool paced = loginRate > 0;
+		if (paced)
+		{
+			double rate = loginRate;
+			auto& wd = core.getWatchdog();
+			uint64_t target = loginLagTarget * (uint64_t) 1000000;
+			if (wd.getEnabled() && target > 0 && wd.getRecentLag() > target)
+				rate *= std::max(0.1, (double) target / wd.getRecentLag());
+
+			// No more than an interval's worth at once
+			loginCredit = std::min(loginCredit + rate * elapsed, std::max(1.0, rate * ADMISSION_INTERVAL / 1000));
+		}
+
+		while (!paced || loginCredit >= 1)
+		{
+			auto& queue = loginQueue[0].empty() ? loginQueue[1] : loginQueue[0];
+			if (queue.empty()) break;
+
+			QueuedLogin l = queue.front();
+			queue.pop_front();
+			queuedLogins.erase(l.c);
+			l.c->unsetFlag(Entity::FLAG_QUEUED);
+
+			if (paced) loginCredit -= 1;
+			loginWait.add(now - l.since);
+			completeNormal(*l.c, l.sendData, l.sendOwnInf);
+		}
+	}
+
+	bool ClientManager::completeNormal(Entity& c, bool sendData, bool sendOwnInf) noexcept
+	{
 		dcassert(c.getState() == Entity::STATE_IDENTIFY || c.getState() == Entity::STATE_VERIFY);
 		dcdebug("%s entering NORMAL\n", AdcCommand::fromSID(c.getSID()).c_str());
 
 		if (sendData)
 		{
+			// The user list is what compresses best
+			if (c.getType() == Entity::TYPE_CLIENT) static_cast<Client&>(c).compress();
+
 			for (EntityIter i = entities.begin(); i != entities.end(); ++i)
 				c.send(i->second->getINF());
 		}
@@ -863,8 +1111,10 @@ using adchpp::Entity;
 		}
 
 		removeLogins(c);
+		if (c.getType() == Entity::TYPE_CLIENT) static_cast<Client&>(c).loggedIn();
 
 		entities.insert(make_pair(c.getSID(), &c));
+		reservedSids.erase(c.getSID());
 
 		setState(c, Entity::STATE_NORMAL);
 		return true;
@@ -882,6 +1132,17 @@ using adchpp::Entity;
 				break;
 			}
 
+		if (e.isSet(Entity::FLAG_QUEUED))
+		{
+			auto i = queuedLogins.find(c);
+			if (i != queuedLogins.end())
+			{
+				loginQueue[i->second->registered ? 0 : 1].erase(i->second);
+				queuedLogins.erase(i);
+			}
+			e.unsetFlag(Entity::FLAG_QUEUED);
+		}
+
 		if (e.hasSupport(AdcCommand::toFourCC("HBRI")))
 		{
 			for (auto i = hbriTokens.begin(); i != hbriTokens.end(); ++i)
@@ -899,6 +1160,7 @@ using adchpp::Entity;
 
 		dcdebug("Removing %s - %s\n", AdcCommand::fromSID(c.getSID()).c_str(), c.getCID().toBase32().c_str());
 		c.setFlag(Entity::FLAG_GHOST);
+		if (c.isSet(Entity::FLAG_SLOW)) staleInfs.erase(c.getSID());
 
 		signalDisconnected_(c, reason, info);
 
@@ -911,7 +1173,10 @@ using adchpp::Entity;
 				.getBuffer());
 		}
 		else
+		{
 			removeLogins(c);
+			reservedSids.erase(c.getSID());
+		}
 
 		nicks.erase(c.getField("NI"));
 		cids.erase(c.getCID());
@@ -24,9 +24,13 @@
 #include "Bot.h"
 #include "CID.h"
 #include "Client.h"
+#include "CommandStats.h"
 #include "Hub.h"
+#include "RateLimiter.h"
 #include "Signal.h"
 
+#include <unordered_set>
+
 namespace adchpp
 {
 	/**
@@ -61,6 +65,9 @@ namespace adchpp
 			return entities;
 		}
 
+		/** Count the connected clients in each state, including the ones that are still logging in */
+		void getStateCounts(size_t (&counts)[Entity::STATE_DATA + 1]) const noexcept;
+
 		/** Send a command to according to its type */
 		void send(const AdcCommand& cmd) noexcept;
 
@@ -90,7 +97,8 @@ namespace adchpp
 
 		/**
 		 * Enter NORMAL state. Call this if you stop an INF of a password-less
-		 * client in IDENTIFY state or a PAS in VERIFY state.
+		 * client in IDENTIFY state or a PAS in VERIFY state. Clients may wait in
+		 * the login queue first, see setLoginRate.
 		 *
 		 * @param sendData Send all data as mandated by the protocol, including list
 		 * of connected clients.
@@ -195,6 +203,74 @@ namespace adchpp
 			return logTimeout;
 		}
 
+		/**
+		 * Clients with output that has been waiting to be sent for this long are
+		 * marked FLAG_SLOW and stop getting searches and INF updates until they've caught
+		 * up; 0 disables the check.
+		 */
+		void setSlowTimeout(size_t millis)
+		{
+			slowTimeout = millis;
+		}
+		size_t getSlowTimeout() const
+		{
+			return slowTimeout;
+		}
+		/** @return Number of searches / INF updates withheld from slow clients */
+		int64_t getSlowSearches() const
+		{
+			return slowSearches;
+		}
+		int64_t getSlowInfs() const
+		{
+			return slowInfs;
+		}
+		/** @return Number of INFs sent again to clients that have caught up */
+		int64_t getSlowResyncs() const
+		{
+			return slowResyncs;
+		}
+
+		/**
+		 * Logins let into NORMAL per second, 0 to let them in right away. Each one
+		 * costs an INF to everybody and the user list to the newcomer, so after a
+		 * restart the rest wait in IDENTIFY / VERIFY, registered users first, for
+		 * at most four times the login timeout.
+		 */
+		void setLoginRate(size_t perSecond)
+		{
+			loginRate = perSecond;
+		}
+		size_t getLoginRate() const
+		{
+			return loginRate;
+		}
+		/** The login rate is scaled down while the watchdog's loop lag is above this many milliseconds */
+		void setLoginLagTarget(size_t millis)
+		{
+			loginLagTarget = millis;
+		}
+		size_t getLoginLagTarget() const
+		{
+			return loginLagTarget;
+		}
+		/** @return Number of logins waiting to be let in */
+		size_t getQueuedLogins() const
+		{
+			return queuedLogins.size();
+		}
+		/** @return Time spent waiting by the logins that were let in, in nanoseconds */
+		const CommandStats::Histogram& getLoginWait() const
+		{
+			return loginWait;
+		}
+
+		/** Inbound rate limits of client connections */
+		RateLimiter& getRateLimiter()
+		{
+			return rateLimiter;
+		}
+
 		Core& getCore() const
 		{
 			return core;
@@ -206,6 +282,7 @@ namespace adchpp
 		friend class Client;
 		friend class Entity;
 		friend class Bot;
+		friend class Handoff;
 
 		Core& core;
 
@@ -215,6 +292,8 @@ namespace adchpp
 		TokenMap hbriTokens;
 
 		EntityMap entities;
+		/** SIDs handed out to entities that aren't in NORMAL yet */
+		std::unordered_set<uint32_t> reservedSids;
 		typedef std::unordered_map<std::string, Entity*> NickMap;
 		NickMap nicks;
 		typedef std::unordered_map<CID, Entity*> CIDMap;
@@ -226,6 +305,36 @@ namespace adchpp
 		size_t logTimeout;
 		size_t hbriTimeout;
 
+		RateLimiter rateLimiter;
+
+		struct QueuedLogin
+		{
+			Client* c;
+			bool sendData;
+			bool sendOwnInf;
+			bool registered;
+			uint64_t since;
+		};
+		typedef std::list<QueuedLogin> LoginQueue;
+		/** Registered users, then everybody else */
+		LoginQueue loginQueue[2];
+		std::unordered_map<const Client*, LoginQueue::iterator> queuedLogins;
+		size_t loginRate;
+		size_t loginLagTarget;
+		double loginCredit;
+		uint64_t lastAdmission;
+		CommandStats::Histogram loginWait;
+
+		size_t slowTimeout;
+		int64_t slowSearches;
+		int64_t slowInfs;
+		int64_t slowResyncs;
+		/** SIDs whose INF updates a slow client has missed, per slow client */
+		std::unordered_map<uint32_t, std::unordered_set<uint32_t>> staleInfs;
+
+		// Number of recipients so far, used by the command statistics
+		uint64_t sendCount;
+
 		static const std::string className;
 
 		friend class CommandHandler<ClientManager>;
@@ -238,6 +347,12 @@ namespace adchpp
 
 		bool sendHBRI(Client& c);
 		void maybeSend(Entity& c, const AdcCommand& cmd);
+		bool withholdSlow(Entity& c, const AdcCommand& cmd);
+		void checkSlow();
+
+		void queueLogin(Client& c, bool sendData, bool sendOwnInf) noexcept;
+		void admitLogins() noexcept;
+		bool completeNormal(Entity& c, bool sendData, bool sendOwnInf) noexcept;
 
 		void removeLogins(Entity& c) noexcept;
 		void removeEntity(Entity& c, Reason reason, const std::string& info) noexcept;
@@ -253,10 +368,17 @@ namespace adchpp
 		}
 
 		void handleIncoming(const ManagedSocketPtr& sock) noexcept;
+		/**
+		 * Add a logged in client that was handed over by another hub process.
+		 * @return The client, NULL if its SID, CID or nick is taken here
+		 */
+		Client* adopt(const ManagedSocketPtr& sock, uint32_t sid, const CID& cid, const AdcCommand& sup, const AdcCommand& inf,
+			size_t flags) noexcept;
 
 		void onConnected(Client&) noexcept;
 		void onReady(Client&) noexcept;
 		void onReceive(Entity&, AdcCommand&) noexcept;
+		void onReceive(Entity&, AdcCommand&, CommandStats::Command& stats) noexcept;
 		void onBadLine(Client&, const std::string&) noexcept;
 		void onFailed(Client&, Reason reason, const std::string& info) noexcept;
 
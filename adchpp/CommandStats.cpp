@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "CommandStats.h"
+#include "Core.h"
+#include "Entity.h"
+#include "LogManager.h"
+#include "PluginManager.h"
+#include <baselib/File.h>
+#include <baselib/FormatUtil.h>
+#include <baselib/StrUtil.h>
+
+#include <algorithm>
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace std::placeholders;
+
+	static const char* phaseNames[CommandStats::PHASE_LAST] = { "parse", "plugins", "hub", "send" };
+
+	static inline int getHighestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return (int) index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+
+	CommandStats::Histogram::Histogram() : count(0), sum(0), max(0)
+	{
+		for (int i = 0; i < BUCKETS; ++i)
+			counts[i].store(0, memory_order_relaxed);
+	}
+
+	size_t CommandStats::Histogram::getBucket(uint64_t value)
+	{
+		if (value < SUB_COUNT) return (size_t) value;
+		int exp = getHighestBit(value);
+		if (exp > MAX_EXP) return BUCKETS - 1;
+		return (exp - SUB_BITS + 1) * SUB_COUNT + ((value >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+	}
+
+	uint64_t CommandStats::Histogram::getBucketLimit(size_t bucket)
+	{
+		if (bucket < SUB_COUNT) return bucket;
+		int shift = (int) (bucket / SUB_COUNT) - 1;
+		uint64_t low = (uint64_t) (SUB_COUNT + bucket % SUB_COUNT) << shift;
+		return low + ((uint64_t) 1 << shift) - 1;
+	}
+
+	uint64_t CommandStats::Histogram::getPercentile(double p) const
+	{
+		uint64_t total = getCount();
+		if (!total) return 0;
+		uint64_t target = (uint64_t) (total * p / 100);
+		if (target >= total) target = total - 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			seen += counts[i].load(memory_order_relaxed);
+			if (seen > target) return min(getBucketLimit(i), getMax());
+		}
+		return getMax();
+	}
+
+	string CommandStats::Command::getFourCC() const
+	{
+		uint32_t k = key.load(memory_order_relaxed);
+		if (!k) return "other";
+		char tmp[4] = { (char) (k >> 24), (char) k, (char) (k >> 8), (char) (k >> 16) };
+		for (int i = 0; i < 4; ++i)
+			if (!((tmp[i] >= 'A' && tmp[i] <= 'Z') || (tmp[i] >= '0' && tmp[i] <= '9'))) tmp[i] = '?';
+		return string(tmp, 4);
+	}
+
+	CommandStats::CommandStats(Core& core) :
+		commands(new atomic<Command*>[MAX_COMMANDS]), used(0), enabled(true), dumpInterval(0), core(core)
+	{
+		for (size_t i = 0; i < MAX_COMMANDS; ++i)
+			commands[i].store(nullptr, memory_order_relaxed);
+	}
+
+	CommandStats::~CommandStats()
+	{
+		stop();
+		for (size_t i = 0; i < MAX_COMMANDS; ++i)
+			delete commands[i].load(memory_order_relaxed);
+	}
+
+	void CommandStats::start()
+	{
+		statsConn = manage(core.getPluginManager().onCommand("stats", std::bind(&CommandStats::onStats, this, _1)));
+		if (enabled && dumpInterval > 0) dumpTimer = core.addTimedJob(dumpInterval * 1000, std::bind(&CommandStats::dump, this));
+	}
+
+	void CommandStats::stop()
+	{
+		statsConn.reset();
+		if (dumpTimer)
+		{
+			dumpTimer();
+			dumpTimer = nullptr;
+			dump();
+		}
+	}
+
+	CommandStats::Command* CommandStats::findCommand(uint32_t key) noexcept
+	{
+		size_t i = (key * 2654435761u) >> 26;
+		for (size_t n = 0; n < MAX_COMMANDS; ++n, i = (i + 1) & (MAX_COMMANDS - 1))
+		{
+			Command* c = commands[i].load(memory_order_relaxed);
+			if (!c)
+			{
+				if (used == MAX_COMMANDS) break;
+				c = new Command;
+				c->key.store(key, memory_order_relaxed);
+				commands[i].store(c, memory_order_release);
+				++used;
+				return c;
+			}
+			if (c->key.load(memory_order_relaxed) == key) return c;
+		}
+		return &other;
+	}
+
+	static vector<const CommandStats::Command*> getSorted(const CommandStats& stats)
+	{
+		vector<const CommandStats::Command*> v;
+		stats.forEach([&v](const CommandStats::Command& c) { v.push_back(&c); });
+		sort(v.begin(), v.end(), [](const CommandStats::Command* a, const CommandStats::Command* b) {
+			return a->received.load(memory_order_relaxed) > b->received.load(memory_order_relaxed);
+		});
+		return v;
+	}
+
+	void CommandStats::getText(string& out) const
+	{
+		out += "\nCommand statistics (latency p50/p99 in microseconds):";
+		char buf[256];
+		auto v = getSorted(*this);
+		for (auto i = v.begin(); i != v.end(); ++i)
+		{
+			const Command& c = **i;
+			out += '\n';
+			out += c.getFourCC();
+			out += "\t" + Util::toString(c.received.load(memory_order_relaxed));
+			out += "\tin " + Util::formatBytes((int64_t) c.bytesIn.load(memory_order_relaxed));
+			out += "\tout " + Util::toString(c.sent.load(memory_order_relaxed)) + " (" +
+				Util::formatBytes((int64_t) c.bytesOut.load(memory_order_relaxed)) + ")";
+			for (int j = 0; j < PHASE_LAST; ++j)
+			{
+				const Histogram& h = c.phases[j];
+				if (!h.getCount()) continue;
+				snprintf(buf, sizeof(buf), "\t%s %.1f/%.1f", phaseNames[j],
+					h.getPercentile(50) / 1000.0, h.getPercentile(99) / 1000.0);
+				out += buf;
+			}
+		}
+	}
+
+	void CommandStats::getJSON(string& out) const
+	{
+		static const double percentiles[] = { 50, 90, 99, 99.9 };
+		static const char* percentileNames[] = { "p50", "p90", "p99", "p999" };
+
+		out += "{\"commands\":{";
+		bool first = true;
+		auto v = getSorted(*this);
+		for (auto i = v.begin(); i != v.end(); ++i)
+		{
+			const Command& c = **i;
+			if (!first) out += ',';
+			first = false;
+			out += "\"" + c.getFourCC() + "\":{";
+			out += "\"received\":" + Util::toString(c.received.load(memory_order_relaxed));
+			out += ",\"bytesIn\":" + Util::toString(c.bytesIn.load(memory_order_relaxed));
+			out += ",\"sent\":" + Util::toString(c.sent.load(memory_order_relaxed));
+			out += ",\"bytesOut\":" + Util::toString(c.bytesOut.load(memory_order_relaxed));
+			for (int j = 0; j < PHASE_LAST; ++j)
+			{
+				const Histogram& h = c.phases[j];
+				out += ",\"";
+				out += phaseNames[j];
+				out += "\":{\"count\":" + Util::toString(h.getCount());
+				out += ",\"sumNs\":" + Util::toString(h.getSum());
+				out += ",\"maxNs\":" + Util::toString(h.getMax());
+				for (size_t k = 0; k < sizeof(percentiles) / sizeof(percentiles[0]); ++k)
+				{
+					out += ",\"";
+					out += percentileNames[k];
+					out += "Ns\":" + Util::toString(h.getPercentile(percentiles[k]));
+				}
+				out += '}';
+			}
+			out += '}';
+		}
+		out += "}}\n";
+	}
+
+	void CommandStats::onStats(Entity& c)
+	{
+		if (!enabled) return;
+		string stats;
+		getText(stats);
+		c.send(AdcCommand(AdcCommand::CMD_MSG).addParam(stats));
+	}
+
+	void CommandStats::dump()
+	{
+		string json;
+		getJSON(json);
+
+		string fileName = core.getDataPath() + "commandstats.json";
+		string tmpName = fileName + ".tmp";
+		try
+		{
+			File f(tmpName, File::WRITE, File::CREATE | File::TRUNCATE);
+			f.write(json.data(), json.length());
+		}
+		catch (const FileException& e)
+		{
+			LOGC(core, "CommandStats", "Unable to write " + tmpName + ": " + e.getError());
+			return;
+		}
+		if (!File::renameFile(tmpName, fileName))
+		{
+			File::deleteFile(fileName);
+			File::renameFile(tmpName, fileName);
+		}
+	}
+
+} // namespace adchpp
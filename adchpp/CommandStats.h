@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_COMMAND_STATS_H
+#define ADCHPP_COMMAND_STATS_H
+
+#include "AdcCommand.h"
+#include "Signal.h"
+#include "forward.h"
+
+#include <atomic>
+#include <functional>
+
+namespace adchpp
+{
+
+	/**
+	 * Per-FourCC counters and latency histograms for the command path.
+	 * Counters are only written from the reactor thread and may be read from
+	 * any thread without locking.
+	 */
+	class CommandStats
+	{
+	public:
+		enum Phase
+		{
+			PHASE_PARSE,   // AdcCommand parsing in Client::onData
+			PHASE_PLUGINS, // signalReceive slots (plugins and scripts)
+			PHASE_HUB,     // built-in command handlers
+			PHASE_SEND,    // fan-out to the recipients
+			PHASE_LAST
+		};
+
+		/**
+		 * Log-linear latency histogram in nanoseconds with 8 sub-buckets per power
+		 * of two (12.5% precision), covering values up to about 64 seconds.
+		 */
+		class Histogram
+		{
+		public:
+			Histogram();
+
+			void add(uint64_t value)
+			{
+				inc(counts[getBucket(value)]);
+				inc(count);
+				inc(sum, value);
+				if (value > max.load(std::memory_order_relaxed)) max.store(value, std::memory_order_relaxed);
+			}
+
+			uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+			uint64_t getSum() const { return sum.load(std::memory_order_relaxed); }
+			uint64_t getMax() const { return max.load(std::memory_order_relaxed); }
+
+			/** @return Upper bound of the bucket containing the given percentile (0 - 100) */
+			uint64_t getPercentile(double p) const;
+
+		private:
+			static const int SUB_BITS = 3;
+			static const int SUB_COUNT = 1 << SUB_BITS;
+			static const int MAX_EXP = 36;
+			static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+			static size_t getBucket(uint64_t value);
+			static uint64_t getBucketLimit(size_t bucket);
+
+			std::atomic<uint64_t> counts[BUCKETS];
+			std::atomic<uint64_t> count;
+			std::atomic<uint64_t> sum;
+			std::atomic<uint64_t> max;
+		};
+
+		struct Command
+		{
+			Command() : key(0), received(0), bytesIn(0), sent(0), bytesOut(0) {}
+
+			std::string getFourCC() const;
+
+			std::atomic<uint32_t> key;
+			std::atomic<uint64_t> received; // commands that went through the handlers
+			std::atomic<uint64_t> bytesIn;
+			std::atomic<uint64_t> sent;     // number of recipients
+			std::atomic<uint64_t> bytesOut;
+			Histogram phases[PHASE_LAST];
+		};
+
+		/** @return Statistics slot for this command, nullptr when disabled */
+		Command* get(const AdcCommand& cmd) noexcept
+		{
+			return enabled ? findCommand(cmd.getCommand() | ((uint32_t) (uint8_t) cmd.getType() << 24)) : nullptr;
+		}
+
+		/** Single-writer increment; see the class comment */
+		static void inc(std::atomic<uint64_t>& v, uint64_t n = 1)
+		{
+			v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		/** Call f(const Command&) for every command seen so far */
+		template <typename F> void forEach(F f) const
+		{
+			for (size_t i = 0; i < MAX_COMMANDS; ++i)
+			{
+				const Command* c = commands[i].load(std::memory_order_acquire);
+				if (c) f(*c);
+			}
+			if (other.received.load(std::memory_order_relaxed)) f(other);
+		}
+
+		void setEnabled(bool flag) { enabled = flag; }
+		bool getEnabled() const { return enabled; }
+
+		/** Write the statistics as JSON to commandstats.json in the data path every n seconds; 0 disables */
+		void setDumpInterval(int seconds) { dumpInterval = seconds; }
+		int getDumpInterval() const { return dumpInterval; }
+
+		void getText(std::string& out) const;
+		void getJSON(std::string& out) const;
+
+		~CommandStats();
+
+	private:
+		friend class Core;
+
+		CommandStats(Core& core);
+
+		void start();
+		void stop();
+
+		Command* findCommand(uint32_t key) noexcept;
+
+		void onStats(Entity& c);
+		void dump();
+
+		// Clients can send arbitrary command names, so the table has a fixed size;
+		// anything past it is accounted for in "other".
+		static const size_t MAX_COMMANDS = 64;
+
+		std::unique_ptr<std::atomic<Command*>[]> commands;
+		size_t used;
+		Command other;
+
+		bool enabled;
+		int dumpInterval;
+		std::function<void()> dumpTimer;
+
+		ManagedConnectionPtr statsConn;
+
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_COMMAND_STATS_H
@@ -18,9 +18,16 @@
 
 #include "Core.h"
 #include "ClientManager.h"
+#include "CommandStats.h"
+#include "EventJournal.h"
+#include "Handoff.h"
 #include "LogManager.h"
+#include "MetricsServer.h"
 #include "PluginManager.h"
 #include "SocketManager.h"
+#include "TrafficCapture.h"
+#include "Watchdog.h"
+#include "WorkerPool.h"
 #include "version.h"
 #include <baselib/File.h>
 
@@ -48,7 +55,14 @@ namespace adchpp
 	{
 		lm->log("core", "Shutting down...");
 		// Order is significant...
+		wp.reset();
+		ms.reset();
+		hf.reset();
 		pm.reset();
+		wd.reset();
+		cs.reset();
+		tc.reset();
+		ej.reset();
 		cm.reset();
 		sm.reset();
 		lm.reset();
@@ -59,6 +73,13 @@ namespace adchpp
 		lm.reset(new LogManager(*this));
 		sm.reset(new SocketManager(*this));
 		cm.reset(new ClientManager(*this));
+		ej.reset(new EventJournal(*this));
+		tc.reset(new TrafficCapture(*this));
+		cs.reset(new CommandStats(*this));
+		ms.reset(new MetricsServer(*this));
+		hf.reset(new Handoff(*this));
+		wd.reset(new Watchdog(*this));
+		wp.reset(new WorkerPool(*this));
 		pm.reset(new PluginManager(*this));
 
 		sm->setIncomingHandler(std::bind(&ClientManager::handleIncoming, cm.get(), std::placeholders::_1));
@@ -67,7 +88,15 @@ namespace adchpp
 	void Core::run()
 	{
 		File::ensureDirectory(dataPath);
+		lm->start();
+		ej->start();
+		tc->start();
+		cs->start();
+		wd->start();
+		wp->start();
 		pm->load();
+		ms->start();
+		hf->start();
 		sm->run();
 	}
 
@@ -79,7 +108,12 @@ namespace adchpp
 
 	void Core::doShutdown()
 	{
+		ms->stop();
+		hf->stop();
+		wd->stop();
 		sm->shutdown();
+		// let pending work finish before plugins and scripts go away
+		wp->stop();
 		pm->shutdown();
 	}
 
@@ -103,6 +137,16 @@ namespace adchpp
 		return *cm;
 	}
 
+	EventJournal& Core::getEventJournal()
+	{
+		return *ej;
+	}
+
+	MetricsServer& Core::getMetricsServer()
+	{
+		return *ms;
+	}
+
 	void Core::addJob(const Callback& callback) noexcept
 	{
 		sm->addJob(callback);
@@ -128,4 +172,9 @@ namespace adchpp
 		return sm->addTimedJob(time, callback);
 	}
 
+	void Core::addWork(const Callback& work, const Callback& completion) noexcept
+	{
+		wp->add(work, completion);
+	}
+
 } // namespace adchpp
@@ -43,6 +43,13 @@ namespace adchpp
 		SocketManager& getSocketManager();
 		PluginManager& getPluginManager();
 		ClientManager& getClientManager();
+		EventJournal& getEventJournal();
+		TrafficCapture& getTrafficCapture() { return *tc; }
+		CommandStats& getCommandStats() { return *cs; }
+		MetricsServer& getMetricsServer();
+		Handoff& getHandoff() { return *hf; }
+		Watchdog& getWatchdog() { return *wd; }
+		WorkerPool& getWorkerPool() { return *wp; }
 
 		const std::string& getConfigPath() const { return configPath; }
 		const std::string& getDataPath() const { return dataPath; }
@@ -75,6 +82,11 @@ namespace adchpp
 		 */
 		Callback addTimedJob(const std::string& time, const Callback& callback);
 
+		/** execute a CPU-heavy function on a worker thread, then the completion on the
+		 * reactor thread (see WorkerPool)
+		 */
+		void addWork(const Callback& work, const Callback& completion) noexcept;
+
 		time::ptime getStartTime() const { return startTime; }
 
 	private:
@@ -88,6 +100,13 @@ namespace adchpp
 		std::unique_ptr<SocketManager> sm;
 		std::unique_ptr<PluginManager> pm;
 		std::unique_ptr<ClientManager> cm;
+		std::unique_ptr<EventJournal> ej;
+		std::unique_ptr<TrafficCapture> tc;
+		std::unique_ptr<CommandStats> cs;
+		std::unique_ptr<MetricsServer> ms;
+		std::unique_ptr<Handoff> hf;
+		std::unique_ptr<Watchdog> wd;
+		std::unique_ptr<WorkerPool> wp;
 
 		const std::string configPath;
 		std::string dataPath;
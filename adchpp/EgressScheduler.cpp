@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "EgressScheduler.h"
+#include "AdcCommand.h"
+#include "ManagedSocket.h"
+#include "SocketManager.h"
+#include <baselib/TimeUtil.h>
+
+namespace adchpp
+{
+
+	using namespace std;
+
+	// Scheduling interval while sockets are waiting for tokens
+	static const long TICK = 10;
+
+	EgressScheduler::EgressScheduler(SocketManager& sm)
+	: sm(sm), rate(0), quantum(4096), tokens(0), lastRefill(0), timerActive(false), deferred(0)
+	{
+		weights[CLASS_CONTROL] = 8;
+		weights[CLASS_CHAT] = 4;
+		weights[CLASS_INF] = 2;
+		weights[CLASS_SEARCH] = 1;
+		weights[CLASS_RESULT] = 2;
+		weights[CLASS_CTM] = 4;
+		std::fill(sent, sent + CLASS_LAST, 0);
+	}
+
+	const char* EgressScheduler::getClassName(int c)
+	{
+		static const char* names[CLASS_LAST] = { "control", "chat", "inf", "search", "result", "ctm" };
+		return c >= 0 && c < CLASS_LAST ? names[c] : "";
+	}
+
+	EgressScheduler::Class EgressScheduler::classify(const Buffer& buf)
+	{
+		switch (AdcCommand::getTraffic(buf.data(), buf.size()))
+		{
+			case AdcCommand::TRAFFIC_CHAT:
+			case AdcCommand::TRAFFIC_PM: return CLASS_CHAT;
+			case AdcCommand::TRAFFIC_INF: return CLASS_INF;
+			case AdcCommand::TRAFFIC_SEARCH: return CLASS_SEARCH;
+			case AdcCommand::TRAFFIC_RESULT: return CLASS_RESULT;
+			case AdcCommand::TRAFFIC_CTM: return CLASS_CTM;
+			default: return CLASS_CONTROL;
+		}
+	}
+
+	void EgressScheduler::setWeight(Class c, double weight)
+	{
+		// A zero weight would make the class infinitely expensive
+		weights[c] = max(weight, 0.01);
+	}
+
+	void EgressScheduler::activate(const ManagedSocketPtr& ms)
+	{
+		active.push_back(ms);
+		// Tokens given back by completed writes are handed out right away
+		if (!timerActive || tokens > 0) run();
+	}
+
+	void EgressScheduler::complete(ManagedSocket& ms, size_t bytes)
+	{
+		size_t left = bytes;
+		for (auto i = ms.outBuf.begin(); left > 0 && i != ms.outBuf.end(); ++i)
+		{
+			size_t n = min(left, (*i)->size());
+			sent[classify(**i)] += n;
+			left -= n;
+		}
+
+		// Streams write what they can in one go, give back the rest
+		if (bytes < ms.egressGrant)
+		{
+			size_t unused = ms.egressGrant - bytes;
+			tokens += unused;
+			ms.egressDeficit += unused * ms.egressCost;
+		}
+	}
+
+	size_t EgressScheduler::getGrant(ManagedSocket& ms, double& cost, size_t& bytes)
+	{
+		// Whole buffers only; like in classic DRR, a buffer larger than the deficit
+		// waits until the socket has saved up for it over several rounds
+		size_t count = 0;
+		cost = 0;
+		bytes = 0;
+		for (const auto& b : ms.outBuf)
+		{
+			double bufCost = b->size() / weights[classify(*b)];
+			if (cost + bufCost > ms.egressDeficit) break;
+
+			cost += bufCost;
+			bytes += b->size();
+			++count;
+
+			// The last buffer may overdraw the bucket, the next tick waits for it
+			if (bytes >= quantum || bytes >= tokens) break;
+		}
+		return count;
+	}
+
+	void EgressScheduler::run()
+	{
+		uint64_t now = Util::getHighResTimestamp();
+		double burst = max(rate / 20.0, 16384.0);
+		tokens = lastRefill ? min(burst, tokens + (now - lastRefill) * (rate / 1e9)) : burst;
+		lastRefill = now;
+
+		while (!active.empty() && (tokens > 0 || !getEnabled()))
+		{
+			ManagedSocketPtr ms = std::move(active.front());
+			active.pop_front();
+
+			ms->egressQueued = false;
+			if (ms->outBuf.empty() || ms->writing())
+			{
+				ms->egressDeficit = 0;
+				continue;
+			}
+
+			if (!getEnabled())
+			{
+				// The cap was removed while sockets were waiting
+				ms->writeGranted(ms->outBuf.size(), 0);
+				continue;
+			}
+
+			ms->egressDeficit += quantum;
+			double cost;
+			size_t bytes;
+			size_t count = getGrant(*ms, cost, bytes);
+			if (count == 0)
+			{
+				ms->egressQueued = true;
+				active.push_back(std::move(ms));
+				continue;
+			}
+
+			tokens -= bytes;
+			ms->egressDeficit -= cost;
+			ms->writeGranted(count, cost / bytes);
+		}
+
+		if (!active.empty() && !timerActive)
+		{
+			deferred++;
+			timerActive = true;
+			sm.addJob(TICK, [this] {
+				timerActive = false;
+				run();
+			});
+		}
+	}
+
+} // namespace adchpp
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_EGRESS_SCHEDULER_H
+#define ADCHPP_EGRESS_SCHEDULER_H
+
+#include "Buffer.h"
+#include "forward.h"
+
+#include <deque>
+
+namespace adchpp
+{
+
+	/**
+	 * Hub-wide output bandwidth cap. When a rate is set, sockets don't write
+	 * their output buffers directly but wait in a deficit round robin queue
+	 * and get bytes from a global token bucket in turns, so that a few busy
+	 * connections can't starve the others.
+	 *
+	 * Each socket's buffer is still sent in order. Traffic classes instead
+	 * change what the data costs: the deficit spent on a command is its size
+	 * divided by the weight of its class, so connections that are mostly being
+	 * sent chat get a larger share of a saturated uplink than those being
+	 * flooded with searches.
+	 */
+	class EgressScheduler
+	{
+	public:
+		enum Class
+		{
+			CLASS_CONTROL, // anything not listed below
+			CLASS_CHAT,    // MSG
+			CLASS_INF,     // INF
+			CLASS_SEARCH,  // SCH
+			CLASS_RESULT,  // RES
+			CLASS_CTM,     // CTM and RCM
+			CLASS_LAST
+		};
+
+		/** @return Name of the class in lower case, as used in the settings and metrics */
+		static const char* getClassName(int c);
+
+		/** @return Class of the command at the start of buf */
+		static Class classify(const Buffer& buf);
+
+		/** @param rate Bytes per second, 0 to disable the scheduler */
+		void setRate(size_t rate)
+		{
+			this->rate = rate;
+		}
+		size_t getRate() const
+		{
+			return rate;
+		}
+		bool getEnabled() const
+		{
+			return rate > 0;
+		}
+
+		void setWeight(Class c, double weight);
+		double getWeight(Class c) const
+		{
+			return weights[c];
+		}
+
+		/** Bytes of deficit each socket gets per round, also the largest single grant */
+		void setQuantum(size_t quantum)
+		{
+			this->quantum = quantum;
+		}
+
+		/** @return Number of sockets waiting for their turn */
+		size_t getWaiting() const
+		{
+			return active.size();
+		}
+		/** @return Bytes written under the scheduler per class */
+		int64_t getSent(Class c) const
+		{
+			return sent[c];
+		}
+		/** @return Number of ticks that sockets had to wait for tokens */
+		int64_t getDeferred() const
+		{
+			return deferred;
+		}
+
+	private:
+		friend class ManagedSocket;
+		friend class SocketManager;
+
+		EgressScheduler(SocketManager& sm);
+
+		/** Queue a socket that has data to write */
+		void activate(const ManagedSocketPtr& ms);
+
+		/** Account for a finished write and give back the unused part of the grant */
+		void complete(ManagedSocket& ms, size_t bytes);
+
+		void run();
+		size_t getGrant(ManagedSocket& ms, double& cost, size_t& bytes);
+
+		SocketManager& sm;
+
+		size_t rate;
+		size_t quantum;
+		double weights[CLASS_LAST];
+
+		std::deque<ManagedSocketPtr> active;
+
+		double tokens;
+		uint64_t lastRefill;
+		bool timerActive;
+
+		int64_t sent[CLASS_LAST];
+		int64_t deferred;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_EGRESS_SCHEDULER_H
@@ -38,6 +38,7 @@ public:
 	virtual void unloadScript(Script* script, bool force = false) = 0;
 
 	virtual void getStats(std::string& str) const = 0;
+	virtual size_t getMemoryUsage() const = 0;
 };
 
 }
@@ -35,15 +35,38 @@ namespace adchpp
 		cm.onReceive(*this, cmd);
 	}
 
+	namespace
+	{
+		struct FieldLess
+		{
+			bool operator()(const std::pair<uint16_t, std::string>& field, uint16_t code) const
+			{
+				return field.first < code;
+			}
+		};
+	} // namespace
+
+	Entity::FieldList::iterator Entity::findField(uint16_t code)
+	{
+		auto i = std::lower_bound(fields.begin(), fields.end(), code, FieldLess());
+		return i != fields.end() && i->first == code ? i : fields.end();
+	}
+
+	Entity::FieldList::const_iterator Entity::findField(uint16_t code) const
+	{
+		auto i = std::lower_bound(fields.begin(), fields.end(), code, FieldLess());
+		return i != fields.end() && i->first == code ? i : fields.end();
+	}
+
 	const std::string& Entity::getField(const char* name) const
 	{
-		auto i = fields.find(AdcCommand::toField(name));
+		auto i = findField(AdcCommand::toField(name));
 		return i == fields.end() ? Util::emptyString : i->second;
 	}
 
 	bool Entity::hasField(const char* name) const
 	{
-		return fields.find(AdcCommand::toField(name)) != fields.end();
+		return findField(AdcCommand::toField(name)) != fields.end();
 	}
 
 	void Entity::setField(const char* name, const std::string& value)
@@ -63,10 +86,18 @@ namespace adchpp
 			}
 		}
 
-		if (value.empty())
-			fields.erase(code);
-		else
-			fields[code] = value;
+		auto i = std::lower_bound(fields.begin(), fields.end(), code, FieldLess());
+		if (i != fields.end() && i->first == code)
+		{
+			if (value.empty())
+				fields.erase(i);
+			else
+				i->second = value;
+		}
+		else if (!value.empty())
+		{
+			fields.insert(i, std::make_pair(code, value));
+		}
 
 		INF = BufferPtr();
 	}
@@ -94,6 +125,9 @@ namespace adchpp
 			if (isFieldSupported(AdcCommand::toField(c)))
 				setField(c, j->substr(2));
 		}
+		// The first INF adds every field; don't keep the room it grew into. Later
+		// updates are broadcast and rarely add fields, they aren't worth reallocating for.
+		if (getState() < STATE_NORMAL) fields.shrink_to_fit();
 	}
 
 	const BufferPtr& Entity::getINF() const
@@ -178,7 +212,7 @@ namespace adchpp
 		auto f = std::find(filters.begin(), filters.end(), feature);
 		if (f == filters.end()) return false;
 		filters.erase(f);
-		auto& infSupports = fields.find(AdcCommand::toField("SU"))->second;
+		auto& infSupports = findField(AdcCommand::toField("SU"))->second;
 		auto p = infSupports.find(AdcCommand::fromFourCC(feature));
 		dcassert(p != std::string::npos);
 		infSupports.erase(p, 5);
@@ -210,18 +244,22 @@ namespace adchpp
 	void Entity::setPluginData(const PluginDataHandle& handle, void* data) noexcept
 	{
 		clearPluginData(handle);
-		pluginData.insert(std::make_pair(handle, data));
+		pluginData.push_back(std::make_pair(handle, data));
 	}
 
 	void* Entity::getPluginData(const PluginDataHandle& handle) const noexcept
 	{
-		PluginDataMap::const_iterator i = pluginData.find(handle);
-		return i == pluginData.end() ? 0 : i->second;
+		for (auto i = pluginData.begin(), iend = pluginData.end(); i != iend; ++i)
+		{
+			if (i->first == handle) return i->second;
+		}
+		return 0;
 	}
 
 	void Entity::clearPluginData(const PluginDataHandle& handle) noexcept
 	{
-		PluginDataMap::iterator i = pluginData.find(handle);
+		auto i = std::find_if(pluginData.begin(), pluginData.end(),
+			[&handle](const PluginDataMap::value_type& p) { return p.first == handle; });
 		if (i == pluginData.end()) return;
 
 		(*i->first)(i->second);
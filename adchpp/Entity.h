@@ -75,7 +75,14 @@ namespace adchpp
 
 			/** Set in the login phase if the users provides an IP for another protocol
 			 **/
-			FLAG_VALIDATE_HBRI = 0x1000
+			FLAG_VALIDATE_HBRI = 0x1000,
+
+			/** The client can't keep up with its output; searches and INF updates
+			 * are withheld until it has caught up */
+			FLAG_SLOW = 0x2000,
+
+			/** Waiting in the login admission queue of ClientManager */
+			FLAG_QUEUED = 0x4000
 		};
 
 		enum
@@ -165,6 +172,7 @@ namespace adchpp
 		State getState() const { return state; }
 		void setState(State state_) { state = state_; }
 
+		size_t getFlags() const { return flags.getFlags(); }
 		bool isSet(size_t flag) const { return flags.isSet(flag); }
 		bool isAnySet(size_t flag) const { return flags.isAnySet(flag); }
 		void setFlag(size_t flag);
@@ -173,7 +181,12 @@ namespace adchpp
 	protected:
 		virtual ~Entity();
 
-		typedef std::map<PluginDataHandle, void*> PluginDataMap;
+		/** Only a few plugins keep data per entity, so a vector is searched linearly */
+		typedef std::vector<std::pair<PluginDataHandle, void*>> PluginDataMap;
+		typedef std::vector<std::pair<uint16_t, std::string>> FieldList;
+
+		FieldList::iterator findField(uint16_t code);
+		FieldList::const_iterator findField(uint16_t code) const;
 
 		CID cid;
 		uint32_t sid;
@@ -186,8 +199,8 @@ namespace adchpp
 		/** INF SU */
 		std::vector<uint32_t> filters;
 
-		/** INF fields */
-		std::map<uint16_t, std::string> fields;
+		/** INF fields, sorted by code; a dozen of them take far less room than in a map */
+		FieldList fields;
 
 		/** Plugin data, see PluginManager::registerPluginData */
 		PluginDataMap pluginData;
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "EventJournal.h"
+#include "BatchWriter.h"
+#include "Client.h"
+#include "Core.h"
+#include "LogManager.h"
+
+#include <chrono>
+
+#include <boost/asio/ip/address.hpp>
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace std::placeholders;
+
+	class EventJournal::Writer : public BatchWriter<Entry>
+	{
+	public:
+		Writer(EventJournal& ej, const string& fileTemplate) : BatchWriter<Entry>(ej.queueSize, 1024, ej.written),
+			file(fileTemplate, ej.core.getDataPath(), getHeader(), "EventJournal")
+		{
+		}
+
+	protected:
+		time_t getTime(const Entry& e) const override
+		{
+			return (time_t) (e.rec.time / 1000);
+		}
+
+		void encode(const Entry& e, string& batch) override
+		{
+			size_t infoLen = min(e.info.length(), journal::MAX_INFO);
+			size_t pos = batch.size();
+			batch.resize(pos + journal::RECORD_SIZE);
+			journal::writeRecord((uint8_t*) &batch[pos], e.rec, infoLen);
+			batch.append(e.info, 0, infoLen);
+		}
+
+		time_t openFile(time_t t) override
+		{
+			return file.open(t);
+		}
+
+		void write(const string& batch) override
+		{
+			file.write(batch);
+		}
+
+	private:
+		static string getHeader()
+		{
+			string header(journal::HEADER_SIZE, '\0');
+			journal::writeHeader((uint8_t*) &header[0]);
+			return header;
+		}
+
+		RotatingFile file;
+	};
+
+	EventJournal::EventJournal(Core& core) : queueSize(65536), dropped(0), written(0), core(core)
+	{
+	}
+
+	EventJournal::~EventJournal()
+	{
+		stop();
+	}
+
+	void EventJournal::start()
+	{
+		if (writer || fileTemplate.empty()) return;
+
+		writer.reset(new Writer(*this, fileTemplate));
+		try
+		{
+			writer->start(0, "EventJournal");
+		}
+		catch (const ThreadException& e)
+		{
+			writer.reset();
+			LOGC(core, "EventJournal", "Unable to start the journal thread: " + e.getError());
+			return;
+		}
+
+		auto& cm = core.getClientManager();
+		connectedConn = manage(cm.signalConnected().connect(std::bind(&EventJournal::onConnected, this, _1)));
+		stateConn = manage(cm.signalState().connect(std::bind(&EventJournal::onState, this, _1, _2)));
+		disconnectedConn = manage(cm.signalDisconnected().connect(std::bind(&EventJournal::onDisconnected, this, _1, _2, _3)));
+	}
+
+	void EventJournal::stop()
+	{
+		if (!writer) return;
+		connectedConn.reset();
+		stateConn.reset();
+		disconnectedConn.reset();
+		writer->stop();
+		writer.reset();
+	}
+
+	void EventJournal::record(journal::Event type, const Entity& c, Reason reason, const string& info) noexcept
+	{
+		if (!writer) return;
+
+		Entry e;
+		journal::Record& r = e.rec;
+		r.type = (uint8_t) type;
+		r.reason = journal::getReasonCode(reason);
+		r.sid = c.getSID();
+		r.time = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+		memcpy(r.cid, c.getCID().data(), sizeof(r.cid));
+		memset(r.ip, 0, sizeof(r.ip));
+		if (c.getType() == Entity::TYPE_CLIENT)
+		{
+			boost::system::error_code ec;
+			auto addr = boost::asio::ip::address::from_string(static_cast<const Client&>(c).getIp(), ec);
+			if (!ec)
+			{
+				auto bytes = addr.is_v4() ? boost::asio::ip::address_v6::v4_mapped(addr.to_v4()).to_bytes() : addr.to_v6().to_bytes();
+				memcpy(r.ip, bytes.data(), sizeof(r.ip));
+			}
+		}
+		e.info = info;
+
+		if (!writer->push(std::move(e)))
+			dropped++;
+	}
+
+	void EventJournal::onConnected(Entity& c)
+	{
+		record(journal::EVENT_CONNECT, c, REASON_LAST);
+	}
+
+	void EventJournal::onState(Entity& c, int oldState)
+	{
+		if (c.getState() == Entity::STATE_NORMAL && oldState != Entity::STATE_NORMAL)
+			record(journal::EVENT_LOGIN, c, REASON_LAST, c.getField("NI"));
+	}
+
+	void EventJournal::onDisconnected(Entity& c, Reason reason, const string& info)
+	{
+		record(journal::EVENT_DISCONNECT, c, reason, info);
+	}
+
+} // namespace adchpp
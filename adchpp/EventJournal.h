@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_EVENT_JOURNAL_H
+#define ADCHPP_EVENT_JOURNAL_H
+
+#include "ClientManager.h"
+#include "JournalFormat.h"
+#include "Reason.h"
+#include "forward.h"
+
+namespace adchpp
+{
+
+	/**
+	 * Binary journal of connects, logins, disconnects, kicks and bans. Events are
+	 * stored as fixed-layout records (see JournalFormat.h) by a writer thread; use
+	 * the adchpp-journal tool to read them.
+	 */
+	class EventJournal
+	{
+	public:
+		/** Record an event for an entity; reason is REASON_LAST when there's none */
+		void record(journal::Event type, const Entity& c, Reason reason, const std::string& info = Util::emptyString) noexcept;
+
+		/** Journal file, may contain strftime-like time fields. The journal is disabled when empty. */
+		void setFile(const std::string& s) { fileTemplate = s; }
+		const std::string& getFile() const { return fileTemplate; }
+		bool getEnabled() const { return writer != nullptr; }
+
+		void setQueueSize(size_t size) { queueSize = size; }
+		size_t getQueueSize() const { return queueSize; }
+
+		/** Number of events dropped because the writer couldn't keep up */
+		int64_t getDropped() const { return dropped; }
+		int64_t getWritten() const { return written; }
+
+		~EventJournal();
+
+	private:
+		friend class Core;
+
+		EventJournal(Core& core);
+
+		void start();
+		void stop();
+
+		void onConnected(Entity& c);
+		void onState(Entity& c, int oldState);
+		void onDisconnected(Entity& c, Reason reason, const std::string& info);
+
+		struct Entry
+		{
+			journal::Record rec;
+			std::string info;
+		};
+
+		class Writer;
+		friend class Writer;
+		std::unique_ptr<Writer> writer;
+
+		std::string fileTemplate;
+		size_t queueSize;
+		std::atomic<int64_t> dropped;
+		std::atomic<int64_t> written;
+
+		ClientManager::SignalConnected::ManagedConnection connectedConn;
+		ClientManager::SignalState::ManagedConnection stateConn;
+		ClientManager::SignalDisconnected::ManagedConnection disconnectedConn;
+
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_EVENT_JOURNAL_H
@@ -0,0 +1,638 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "Handoff.h"
+#include "ClientManager.h"
+#include "Core.h"
+#include "LogManager.h"
+#include "ManagedSocket.h"
+#include "SocketManager.h"
+#include <baselib/Base32.h>
+#include <baselib/File.h>
+#include <baselib/StrUtil.h>
+
+#ifndef _WIN32
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <deque>
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace std::placeholders;
+	using namespace boost::asio;
+	using boost::system::error_code;
+
+	static const string className = "Handoff";
+
+	static const string REQUEST = "HHOF VE1";
+
+	// Records, one per line; the descriptors go along with ILSN and ICLI
+	static const uint32_t CMD_LSN = AdcCommand::toCMD('L', 'S', 'N');
+	static const uint32_t CMD_CLI = AdcCommand::toCMD('C', 'L', 'I');
+	static const uint32_t CMD_ENT = AdcCommand::toCMD('E', 'N', 'T');
+	static const uint32_t CMD_END = AdcCommand::toCMD('E', 'N', 'D');
+
+	// Flags that describe the connection rather than the user
+	static const size_t MASK_LOCAL_FLAGS = Entity::FLAG_GHOST | Entity::FLAG_VALIDATE_HBRI | Entity::FLAG_SLOW;
+
+#ifndef _WIN32
+	/** Blocking send of one record along with a descriptor, if any */
+	static bool sendRecord(int s, const string& line, int fd)
+	{
+		size_t done = 0;
+		while (done < line.size())
+		{
+			iovec iov = { const_cast<char*>(line.data()) + done, line.size() - done };
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+
+			char control[CMSG_SPACE(sizeof(int))];
+			if (fd != -1 && done == 0)
+			{
+				memset(control, 0, sizeof(control));
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+				cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type = SCM_RIGHTS;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+				memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+			}
+
+			ssize_t n = ::sendmsg(s, &msg, MSG_NOSIGNAL);
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN)
+				{
+					pollfd p = { s, POLLOUT, 0 };
+					::poll(&p, 1, -1);
+					continue;
+				}
+				return false;
+			}
+			done += n;
+		}
+		return true;
+	}
+
+	/**
+	 * The running hub's end: waits for a new process to ask, then stops accepting and reading,
+	 * lets the output buffers drain and sends everything over.
+	 */
+	class Handoff::Session : public enable_shared_from_this<Handoff::Session>
+	{
+	public:
+		Session(Handoff& h, io_service& io) : h(h), acceptor(io), sock(io), timer(io)
+		{
+		}
+
+		void listen(const string& path)
+		{
+			local::stream_protocol::endpoint endpoint(path);
+			acceptor.open(endpoint.protocol());
+			acceptor.bind(endpoint);
+			acceptor.listen();
+		}
+
+		void prepareAccept()
+		{
+			acceptor.async_accept(sock, std::bind(&Session::handleAccept, shared_from_this(), _1));
+		}
+
+		/** @return Whether the socket file is still ours */
+		bool close()
+		{
+			bool serving = acceptor.is_open();
+			error_code ec;
+			acceptor.close(ec);
+			timer.cancel(ec);
+			// The connection stays open until we're gone, which the new process waits for
+			return serving;
+		}
+
+	private:
+		struct Candidate
+		{
+			uint32_t sid;
+			int fd;
+			string pending;
+		};
+
+		void handleAccept(const error_code& ec)
+		{
+			if (ec == error::operation_aborted || !acceptor.is_open()) return;
+			if (ec)
+			{
+				prepareAccept();
+				return;
+			}
+			async_read_until(sock, request, '\n', std::bind(&Session::handleRequest, shared_from_this(), _1));
+		}
+
+		void handleRequest(const error_code& ec)
+		{
+			if (!acceptor.is_open()) return;
+
+			string line;
+			if (!ec)
+			{
+				istream is(&request);
+				getline(is, line);
+			}
+			if (line != REQUEST)
+			{
+				LOGC(h.core, className, "Ignoring an invalid hand-off request");
+				error_code ignored;
+				sock.close(ignored);
+				request.consume(request.size());
+				prepareAccept();
+				return;
+			}
+
+			begin();
+		}
+
+		void begin()
+		{
+			LOGC(h.core, className, "Handing over to a new process");
+
+			// The socket file is the new process's to replace
+			error_code ec;
+			acceptor.close(ec);
+
+			listeners = h.core.getSocketManager().handOffListeners();
+
+			// Users in the middle of logging in stay put, and reconnect once we're gone
+			auto& cm = h.core.getClientManager();
+			int fd;
+			string pending;
+			for (auto& i : cm.logins)
+				i.first->handOff(fd, pending);
+			for (auto& i : cm.queuedLogins)
+				const_cast<Client*>(i.first)->handOff(fd, pending);
+
+			for (auto& i : cm.getEntities())
+			{
+				Entity* e = i.second;
+				if (e->getType() == Entity::TYPE_CLIENT)
+					candidates.push_back(Candidate { e->getSID(), -1, string() });
+				else
+					entities.push_back(e->getSID());
+			}
+
+			deadline = time::now() + time::millisec(h.drainTimeout);
+			poll();
+		}
+
+		void poll()
+		{
+			auto& cm = h.core.getClientManager();
+
+			// Anything may have been queued since the last round, so every client is checked again
+			bool ready = true;
+			for (auto& c : candidates)
+			{
+				c.fd = -1;
+				c.pending.clear();
+
+				Entity* e = cm.getEntity(c.sid);
+				if (!e || e->getType() != Entity::TYPE_CLIENT) continue;
+
+				// A slow client has yet to get the INF updates it missed
+				if (!static_cast<Client*>(e)->handOff(c.fd, c.pending) || (c.fd != -1 && e->isSet(Entity::FLAG_SLOW)))
+				{
+					c.fd = -1;
+					ready = false;
+				}
+			}
+
+			if (ready || time::now() >= deadline)
+			{
+				send();
+				return;
+			}
+
+			timer.expires_from_now(boost::posix_time::milliseconds(10));
+			timer.async_wait(std::bind(&Session::handleTimer, shared_from_this(), _1));
+		}
+
+		void handleTimer(const error_code& ec)
+		{
+			if (!ec) poll();
+		}
+
+		void send()
+		{
+			auto& cm = h.core.getClientManager();
+
+			int s = sock.native_handle();
+
+			bool ok = true;
+			for (auto fd : listeners)
+				ok = ok && sendRecord(s, "ILSN\n", fd);
+
+			for (auto sid : entities)
+				ok = ok && sendRecord(s, AdcCommand(CMD_ENT).addParam("SI", AdcCommand::fromSID(sid)).toString(), -1);
+
+			size_t handedOver = 0, dropped = 0;
+			for (auto& c : candidates)
+			{
+				Entity* e = cm.getEntity(c.sid);
+				if (!e) continue; // Left already
+
+				if (c.fd == -1)
+				{
+					dropped++;
+					ok = ok && sendRecord(s, AdcCommand(AdcCommand::CMD_QUI).addParam("SI", AdcCommand::fromSID(c.sid)).toString(), -1);
+					continue;
+				}
+
+				AdcCommand cmd(CMD_CLI);
+				cmd.addParam("SI", AdcCommand::fromSID(c.sid));
+				cmd.addParam("ID", e->getCID().toBase32());
+				cmd.addParam("FL", Util::toString(e->getFlags() & ~MASK_LOCAL_FLAGS));
+				cmd.addParam("SU", string((const char*)e->getSUP()->data(), e->getSUP()->size()));
+				cmd.addParam("IN", string((const char*)e->getINF()->data(), e->getINF()->size()));
+				if (!c.pending.empty()) cmd.addParam("PD", Util::toBase32((const uint8_t*)c.pending.data(), c.pending.size()));
+				ok = ok && sendRecord(s, cmd.toString(), c.fd);
+				handedOver++;
+			}
+
+			ok = ok && sendRecord(s, "IEND\n", -1);
+
+			for (auto fd : listeners)
+				::close(fd);
+
+			if (ok)
+			{
+				// Our copies go without a word to the other side
+				for (auto& c : candidates)
+				{
+					Entity* e = cm.getEntity(c.sid);
+					if (e && c.fd != -1) static_cast<Client*>(e)->detach();
+				}
+				LOGC(h.core, className, "Handed over " + Util::toString(handedOver) + " users (" +
+					Util::toString(dropped) + " dropped), shutting down");
+			}
+			else
+			{
+				LOGC(h.core, className, "Hand-off failed: " + Util::translateError() + ", shutting down");
+			}
+
+			h.core.shutdown();
+		}
+
+		Handoff& h;
+		local::stream_protocol::acceptor acceptor;
+		local::stream_protocol::socket sock;
+		boost::asio::streambuf request;
+		deadline_timer timer;
+
+		vector<int> listeners;
+		vector<uint32_t> entities;
+		vector<Candidate> candidates;
+		time::ptime deadline;
+	};
+#else
+	class Handoff::Session
+	{
+	};
+#endif
+
+	Handoff::Handoff(Core& core) : drainTimeout(3000), core(core)
+	{
+	}
+
+	Handoff::~Handoff()
+	{
+		stop();
+#ifndef _WIN32
+		for (auto fd : listeners)
+			::close(fd);
+		for (auto& c : connections)
+			::close(c.fd);
+#endif
+	}
+
+	void Handoff::start()
+	{
+		if (session || path.empty()) return;
+
+#ifndef _WIN32
+		try
+		{
+			File::deleteFile(path);
+			auto s = make_shared<Session>(*this, core.getSocketManager().io);
+			s->listen(path);
+			s->prepareAccept();
+			session = s;
+		}
+		catch (const std::exception& e)
+		{
+			LOGC(core, className, "Unable to listen on " + path + ": " + e.what());
+			return;
+		}
+		LOGC(core, className, "Serving hand-offs on " + path);
+#else
+		LOGC(core, className, "Hand-offs are not supported on this platform");
+#endif
+	}
+
+	void Handoff::stop()
+	{
+#ifndef _WIN32
+		if (!session) return;
+		if (session->close()) File::deleteFile(path);
+		session.reset();
+#endif
+	}
+
+	void Handoff::receive()
+	{
+#ifndef _WIN32
+		if (path.empty()) throw Exception("No HandoffSocket configured");
+
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path)) throw Exception("Path too long: " + path);
+		memcpy(addr.sun_path, path.c_str(), path.size());
+
+		int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (s == -1) throw Exception("Unable to create a socket: " + Util::translateError());
+
+		// Bots that plugins register before adopt() mustn't take the SIDs of the users
+		auto& reserved = core.getClientManager().reservedSids;
+		vector<uint32_t> sids;
+
+		deque<int> fds;
+		auto fail = [&](const string& error) {
+			::close(s);
+			for (auto sid : sids)
+				reserved.erase(sid);
+			for (auto fd : fds)
+				::close(fd);
+			for (auto fd : listeners)
+				::close(fd);
+			for (auto& c : connections)
+				::close(c.fd);
+			listeners.clear();
+			connections.clear();
+			entities.clear();
+			dropped.clear();
+			throw Exception(error);
+		};
+
+		if (::connect(s, (sockaddr*)&addr, sizeof(addr)) != 0)
+			fail("Unable to connect to " + path + ": " + Util::translateError());
+
+		// The hub takes up to the drain timeout to answer
+		timeval tv = { (time_t)(drainTimeout / 1000 + 30), 0 };
+		::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		string request = REQUEST + '\n';
+		if (!sendRecord(s, request, -1)) fail("Unable to send the request: " + Util::translateError());
+
+		string input;
+		bool done = false;
+		while (!done)
+		{
+			char data[16 * 1024];
+			char control[CMSG_SPACE(sizeof(int) * 16)];
+			iovec iov = { data, sizeof(data) };
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+
+			ssize_t n = ::recvmsg(s, &msg, MSG_CMSG_CLOEXEC);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) fail("Unable to receive: " + Util::translateError());
+			if (n == 0) fail("The hub closed the connection");
+
+			for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			{
+				if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+				size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				for (size_t i = 0; i < count; ++i)
+				{
+					int fd;
+					memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+					fds.push_back(fd);
+				}
+			}
+			if (msg.msg_flags & MSG_CTRUNC) fail("Sockets were lost in transit");
+
+			input.append(data, n);
+
+			// Descriptors come with the first byte of their line, so they're always here by its end
+			string::size_type start = 0, end;
+			while (!done && (end = input.find('\n', start)) != string::npos)
+			{
+				string line = input.substr(start, end - start + 1);
+				start = end + 1;
+
+				try
+				{
+					if (line.size() < 5) throw ParseException("Command too short");
+
+					// ILSN and IEND come without parameters, which isn't quite ADC
+					uint32_t command = AdcCommand::toCMD(line.c_str() + 1);
+					string sid;
+					if (line.size() > 5) AdcCommand(line).getParam("SI", 0, sid);
+					if ((command == CMD_CLI || command == CMD_ENT || command == AdcCommand::CMD_QUI) && sid.size() != 4)
+						throw ParseException("Invalid SID");
+					if ((command == CMD_CLI || command == CMD_ENT) && reserved.insert(AdcCommand::toSID(sid)).second)
+						sids.push_back(AdcCommand::toSID(sid));
+
+					if (command == CMD_LSN || command == CMD_CLI)
+					{
+						if (fds.empty()) fail("Missing socket for " + line.substr(0, 4));
+						int fd = fds.front();
+						fds.pop_front();
+						if (command == CMD_LSN)
+							listeners.push_back(fd);
+						else
+							connections.push_back(Connection { fd, line });
+					}
+					else if (command == CMD_ENT)
+						entities.push_back(AdcCommand::toSID(sid));
+					else if (command == AdcCommand::CMD_QUI)
+						dropped.push_back(AdcCommand::toSID(sid));
+					else if (command == CMD_END)
+						done = true;
+				}
+				catch (const ParseException& e)
+				{
+					fail("Invalid record: " + e.getError());
+				}
+			}
+			input.erase(0, start);
+		}
+
+		// Until the old process is gone, so that the two don't get in each other's way
+		pollfd p = { s, POLLIN, 0 };
+		::poll(&p, 1, 10 * 1000);
+		::close(s);
+
+		for (auto fd : fds)
+			::close(fd);
+
+		LOGC(core, className, "Took over " + Util::toString(listeners.size()) + " listening sockets and " +
+			Util::toString(connections.size()) + " users");
+#else
+		throw Exception("Hand-offs are not supported on this platform");
+#endif
+	}
+
+	int Handoff::takeListener(const ip::tcp::endpoint& endpoint)
+	{
+#ifndef _WIN32
+		for (auto i = listeners.begin(); i != listeners.end(); ++i)
+		{
+			ip::tcp::endpoint local;
+			socklen_t len = (socklen_t) local.capacity();
+			if (::getsockname(*i, local.data(), &len) != 0) continue;
+			local.resize(len);
+			if (local == endpoint)
+			{
+				int fd = *i;
+				listeners.erase(i);
+				return fd;
+			}
+		}
+#endif
+		return -1;
+	}
+
+	void Handoff::adopt()
+	{
+#ifndef _WIN32
+		// Not listening on those anymore
+		for (auto fd : listeners)
+			::close(fd);
+		listeners.clear();
+
+		if (connections.empty() && entities.empty() && dropped.empty()) return;
+
+		auto& cm = core.getClientManager();
+		auto& sm = core.getSocketManager();
+
+		vector<pair<ManagedSocketPtr, string>> adopted;
+		vector<Client*> clients;
+		for (auto& c : connections)
+		{
+			string sid, cid, flags, sup, inf, pending;
+			try
+			{
+				AdcCommand cmd(c.state);
+				cmd.getParam("SI", 0, sid);
+				cmd.getParam("ID", 0, cid);
+				cmd.getParam("FL", 0, flags);
+				cmd.getParam("SU", 0, sup);
+				cmd.getParam("IN", 0, inf);
+				if (cmd.getParam("PD", 0, pending))
+				{
+					string data(pending.size() * 5 / 8, '\0');
+					Util::fromBase32(pending.c_str(), (uint8_t*)&data[0], data.size());
+					pending.swap(data);
+				}
+
+				AdcCommand supCmd(sup);
+				AdcCommand infCmd(inf);
+
+				auto socket = sm.adopt(c.fd);
+				if (!socket)
+				{
+					::close(c.fd);
+					dropped.push_back(AdcCommand::toSID(sid));
+					continue;
+				}
+
+				// Closes the connection if it can't stay
+				Client* client = cm.adopt(socket, AdcCommand::toSID(sid), CID(cid), supCmd, infCmd, Util::toInt(flags));
+				if (!client)
+				{
+					dropped.push_back(AdcCommand::toSID(sid));
+					continue;
+				}
+
+				clients.push_back(client);
+				adopted.push_back(make_pair(socket, pending));
+			}
+			catch (const ParseException&)
+			{
+				::close(c.fd);
+				if (sid.size() == 4) dropped.push_back(AdcCommand::toSID(sid));
+			}
+		}
+		connections.clear();
+
+		// What the users don't know yet: who's gone, and the bots and hub info of this process
+		BufferList updates;
+		for (auto sid : dropped)
+			updates.push_back(AdcCommand(AdcCommand::CMD_QUI).addParam(AdcCommand::fromSID(sid)).getBuffer());
+		for (auto sid : entities)
+		{
+			Entity* e = cm.getEntity(sid);
+			if (!e || e->getType() == Entity::TYPE_CLIENT)
+				updates.push_back(AdcCommand(AdcCommand::CMD_QUI).addParam(AdcCommand::fromSID(sid)).getBuffer());
+		}
+		updates.push_back(cm.getEntity(AdcCommand::HUB_SID)->getINF());
+		for (auto& i : cm.getEntities())
+			if (i.second->getType() != Entity::TYPE_CLIENT) updates.push_back(i.second->getINF());
+
+		for (auto c : clients)
+			for (auto& buf : updates)
+				c->send(buf);
+
+		// Only now that everyone is back
+		for (auto& i : adopted)
+			i.first->resume(i.second);
+
+		LOGC(core, className, "Resumed " + Util::toString(clients.size()) + " users, " +
+			Util::toString(dropped.size()) + " dropped");
+
+		// ClientManager::adopt released the SIDs of the users that stayed
+		for (auto sid : dropped)
+			cm.reservedSids.erase(sid);
+		for (auto sid : entities)
+			cm.reservedSids.erase(sid);
+
+		entities.clear();
+		dropped.clear();
+#endif
+	}
+
+} // namespace adchpp
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_HANDOFF_H
+#define ADCHPP_HANDOFF_H
+
+#include "forward.h"
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <string>
+#include <vector>
+
+namespace adchpp
+{
+
+	/**
+	 * Restarts without dropping users. A running hub serves a unix socket; a new hub
+	 * process started with -t connects to it, and the old one passes over its listening
+	 * sockets and the plain TCP connections of logged in users (SCM_RIGHTS) along with
+	 * their SID, CID, SUP, INF and flags, then exits. The new process resumes those
+	 * sessions where they were, so the clients don't notice. TLS connections and logins
+	 * in progress are dropped and reconnect; plugin data isn't carried over.
+	 */
+	class Handoff
+	{
+	public:
+		/** Unix socket to serve hand-offs on, empty to disable (not available on Windows) */
+		void setPath(const std::string& p) { path = p; }
+		const std::string& getPath() const { return path; }
+
+		/** Milliseconds to wait for output buffers to drain before handing the connections over;
+		 * connections that still have data queued after that are dropped */
+		void setDrainTimeout(size_t millis) { drainTimeout = millis; }
+		size_t getDrainTimeout() const { return drainTimeout; }
+
+		/**
+		 * Take over from the hub serving the hand-off socket. Blocks until everything has
+		 * been received; the connections are resumed once the hub runs.
+		 * @throw Exception if there's no hub to take over from or the transfer failed
+		 */
+		void receive();
+
+		class Session;
+
+		~Handoff();
+
+	private:
+		friend class Core;
+		friend class SocketFactory;
+		friend class SocketManager;
+
+		Handoff(Core& core);
+
+		void start();
+		void stop();
+
+		/** @return A listening socket that was handed over for the endpoint, -1 if there's none */
+		int takeListener(const boost::asio::ip::tcp::endpoint& endpoint);
+		/** Resume the sessions that were handed over */
+		void adopt();
+
+		struct Connection
+		{
+			int fd;
+			std::string state; // ICLI command
+		};
+
+		// Received
+		std::vector<int> listeners;
+		std::vector<Connection> connections;
+		std::vector<uint32_t> entities; // SIDs of the bots and the hub
+		std::vector<uint32_t> dropped;  // SIDs of users that weren't handed over
+
+		std::shared_ptr<Session> session;
+
+		std::string path;
+		size_t drainTimeout;
+
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_HANDOFF_H
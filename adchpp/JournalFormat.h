@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_JOURNAL_FORMAT_H
+#define ADCHPP_JOURNAL_FORMAT_H
+
+#include "Reason.h"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace adchpp
+{
+
+	/**
+	 * On-disk layout of the binary event journal. All integers are little endian.
+	 *
+	 * File header:
+	 *   char     magic[4]  "ADCJ"
+	 *   uint16   version
+	 *   uint16   header size
+	 *
+	 * Each record:
+	 *   uint16   size      total record size, including this field
+	 *   uint8    type      journal::Event
+	 *   uint8    reason    journal::REASONS code of a disconnect, NO_REASON otherwise
+	 *   uint32   sid
+	 *   int64    time      milliseconds since the epoch (UTC)
+	 *   uint8    cid[24]
+	 *   uint8    ip[16]    IPv6 address; IPv4 is stored as v4-mapped
+	 *   char     info[]    UTF-8 text, size - RECORD_SIZE bytes
+	 *
+	 * Version 1 stored the Reason enum bound in records without a reason, which
+	 * changed as reasons were added; readers ignore the reason of anything but a
+	 * disconnect.
+	 */
+	namespace journal
+	{
+		enum Event
+		{
+			EVENT_CONNECT = 1,
+			EVENT_LOGIN,
+			EVENT_DISCONNECT,
+			EVENT_KICK,
+			EVENT_BAN,
+			EVENT_LAST
+		};
+
+		static const char MAGIC[4] = { 'A', 'D', 'C', 'J' };
+		static const uint16_t VERSION = 2;
+		static const size_t HEADER_SIZE = 8;
+		static const size_t RECORD_SIZE = 56;
+		static const size_t MAX_INFO = 0xFFFF - RECORD_SIZE;
+
+		/** Reason code of the records that have none */
+		static const uint8_t NO_REASON = 0xFF;
+
+		/**
+		 * Reason codes as stored on disk, independent of the Reason enum. They're
+		 * part of the format: new ones are only ever appended.
+		 */
+		static const char* const REASONS[] = {
+			"BAD_STATE", "CID_CHANGE", "CID_TAKEN", "FLOODING", "HUB_FULL", "INVALID_COMMAND_TYPE",
+			"INVALID_IP", "INVALID_SID", "LOGIN_TIMEOUT", "MAX_COMMAND_SIZE", "NICK_INVALID", "NICK_TAKEN",
+			"NO_BASE_SUPPORT", "NO_TIGR_SUPPORT", "PID_MISSING", "PID_CID_LENGTH", "PID_CID_MISMATCH",
+			"PID_WITHOUT_CID", "PLUGIN", "WRITE_OVERFLOW", "NO_BANDWIDTH", "INVALID_DESCRIPTION",
+			"WRITE_TIMEOUT", "SOCKET_ERROR", "HBRI", "RATE_BYTES", "RATE_COMMANDS", "RATE_SEARCH", "RATE_CHAT",
+			"RATE_CTM", "RATE_INF", "RATE_IP_BYTES", "RATE_IP_COMMANDS"
+		};
+		static const size_t REASON_COUNT = sizeof(REASONS) / sizeof(REASONS[0]);
+
+		/** @return Name of a reason code, empty for NO_REASON and unknown codes */
+		inline const char* getReasonName(uint8_t code)
+		{
+			return code < REASON_COUNT ? REASONS[code] : "";
+		}
+
+		/** @return Code of a reason name without the REASON_ prefix, NO_REASON if there's none */
+		inline uint8_t getReasonCode(const char* name)
+		{
+			for (size_t i = 0; i < REASON_COUNT; ++i)
+				if (strcmp(name, REASONS[i]) == 0) return (uint8_t) i;
+			return NO_REASON;
+		}
+
+		/** Code of each Reason, in enum order; a new Reason needs a new code appended to REASONS */
+		static const uint8_t REASON_CODES[] = {
+			0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+			17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32
+		};
+		static_assert(sizeof(REASON_CODES) / sizeof(REASON_CODES[0]) == REASON_LAST, "Journal reason codes out of date");
+
+		/** @return Code of a reason, NO_REASON for REASON_LAST */
+		inline uint8_t getReasonCode(Reason reason)
+		{
+			return reason >= 0 && reason < REASON_LAST ? REASON_CODES[reason] : NO_REASON;
+		}
+
+		struct Record
+		{
+			uint8_t type;
+			uint8_t reason;
+			uint32_t sid;
+			int64_t time;
+			uint8_t cid[24];
+			uint8_t ip[16];
+		};
+
+		inline void put16(uint8_t* p, uint16_t v)
+		{
+			p[0] = (uint8_t) v;
+			p[1] = (uint8_t) (v >> 8);
+		}
+
+		inline void put32(uint8_t* p, uint32_t v)
+		{
+			for (int i = 0; i < 4; ++i)
+				p[i] = (uint8_t) (v >> (i * 8));
+		}
+
+		inline void put64(uint8_t* p, uint64_t v)
+		{
+			for (int i = 0; i < 8; ++i)
+				p[i] = (uint8_t) (v >> (i * 8));
+		}
+
+		inline uint16_t get16(const uint8_t* p)
+		{
+			return (uint16_t) (p[0] | (p[1] << 8));
+		}
+
+		inline uint32_t get32(const uint8_t* p)
+		{
+			uint32_t v = 0;
+			for (int i = 3; i >= 0; --i)
+				v = (v << 8) | p[i];
+			return v;
+		}
+
+		inline uint64_t get64(const uint8_t* p)
+		{
+			uint64_t v = 0;
+			for (int i = 7; i >= 0; --i)
+				v = (v << 8) | p[i];
+			return v;
+		}
+
+		inline void writeHeader(uint8_t* out)
+		{
+			memcpy(out, MAGIC, 4);
+			put16(out + 4, VERSION);
+			put16(out + 6, (uint16_t) HEADER_SIZE);
+		}
+
+		/** @return Header size, 0 if this isn't a journal file */
+		inline size_t readHeader(const uint8_t* in, size_t len)
+		{
+			if (len < HEADER_SIZE || memcmp(in, MAGIC, 4) != 0 || get16(in + 4) > VERSION) return 0;
+			return get16(in + 6);
+		}
+
+		/** Encode the fixed part of a record; out must have room for RECORD_SIZE bytes */
+		inline void writeRecord(uint8_t* out, const Record& r, size_t infoLen)
+		{
+			put16(out, (uint16_t) (RECORD_SIZE + infoLen));
+			out[2] = r.type;
+			out[3] = r.reason;
+			put32(out + 4, r.sid);
+			put64(out + 8, (uint64_t) r.time);
+			memcpy(out + 16, r.cid, sizeof(r.cid));
+			memcpy(out + 40, r.ip, sizeof(r.ip));
+		}
+
+		/** @return Total record size, 0 if the data is truncated or corrupt */
+		inline size_t readRecord(const uint8_t* in, size_t len, Record& r)
+		{
+			if (len < RECORD_SIZE) return 0;
+			size_t size = get16(in);
+			if (size < RECORD_SIZE || size > len) return 0;
+			r.type = in[2];
+			r.reason = r.type == EVENT_DISCONNECT ? in[3] : NO_REASON;
+			r.sid = get32(in + 4);
+			r.time = (int64_t) get64(in + 8);
+			memcpy(r.cid, in + 16, sizeof(r.cid));
+			memcpy(r.ip, in + 40, sizeof(r.ip));
+			return size;
+		}
+	} // namespace journal
+
+} // namespace adchpp
+
+#endif // ADCHPP_JOURNAL_FORMAT_H
@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_OPENSSL
+
+#include "KernelTLS.h"
+
+#if defined(__linux__) && defined(__has_include) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+#if __has_include(<linux/tls.h>)
+#define HAVE_KTLS
+#endif
+#endif
+
+#ifdef HAVE_KTLS
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/kdf.h>
+
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstring>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
+namespace adchpp
+{
+	using namespace std;
+
+#ifdef HAVE_KTLS
+
+	namespace
+	{
+		/** What's collected from a handshake, kept in the ex data of the SSL */
+		struct Handshake
+		{
+			Handshake() : secretLength(0), readRecords(0), writeRecords(0), keyUpdate(false)
+			{
+			}
+
+			~Handshake()
+			{
+				OPENSSL_cleanse(clientSecret, sizeof(clientSecret));
+				OPENSSL_cleanse(serverSecret, sizeof(serverSecret));
+			}
+
+			// TLS 1.3 application traffic secrets (TLS 1.2 keys come from the master secret)
+			unsigned char clientSecret[EVP_MAX_MD_SIZE];
+			unsigned char serverSecret[EVP_MAX_MD_SIZE];
+			size_t secretLength;
+
+			// Records since the last Finished message in each direction
+			uint64_t readRecords;
+			uint64_t writeRecords;
+
+			// The secrets above are stale
+			bool keyUpdate;
+		};
+
+		void freeHandshake(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+		{
+			delete static_cast<Handshake*>(ptr);
+		}
+
+		int getExIndex()
+		{
+			static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, &freeHandshake);
+			return index;
+		}
+
+		Handshake* getHandshake(const SSL* ssl, bool create)
+		{
+			auto hs = static_cast<Handshake*>(SSL_get_ex_data(ssl, getExIndex()));
+			if (!hs && create)
+			{
+				hs = new Handshake;
+				if (!SSL_set_ex_data(const_cast<SSL*>(ssl), getExIndex(), hs))
+				{
+					delete hs;
+					return nullptr;
+				}
+			}
+			return hs;
+		}
+
+		void keyLog(const SSL* ssl, const char* line)
+		{
+			// "<label> <client random> <secret>", in hex
+			static const char clientLabel[] = "CLIENT_TRAFFIC_SECRET_0 ";
+			static const char serverLabel[] = "SERVER_TRAFFIC_SECRET_0 ";
+
+			bool client = strncmp(line, clientLabel, sizeof(clientLabel) - 1) == 0;
+			if (!client && strncmp(line, serverLabel, sizeof(serverLabel) - 1) != 0) return;
+
+			auto hs = getHandshake(ssl, true);
+			if (!hs) return;
+
+			const char* hex = strrchr(line, ' ') + 1;
+			size_t length = strlen(hex) / 2;
+			if (length > EVP_MAX_MD_SIZE) return;
+
+			unsigned char* secret = client ? hs->clientSecret : hs->serverSecret;
+			for (size_t i = 0; i < length; ++i)
+				secret[i] = (unsigned char) (OPENSSL_hexchar2int(hex[2 * i]) << 4 | OPENSSL_hexchar2int(hex[2 * i + 1]));
+			hs->secretLength = length;
+		}
+
+		void message(int writing, int, int contentType, const void* buf, size_t len, SSL* ssl, void*)
+		{
+			// Only needed until enable has run, which also ends the handshake
+			auto hs = getHandshake(ssl, SSL_in_init(ssl) != 0);
+			if (!hs) return;
+
+			uint64_t& records = writing ? hs->writeRecords : hs->readRecords;
+			if (contentType == SSL3_RT_HEADER)
+			{
+				records++;
+			}
+			else if (contentType == SSL3_RT_HANDSHAKE && len > 0)
+			{
+				auto type = *static_cast<const unsigned char*>(buf);
+				if (type == SSL3_MT_FINISHED)
+					records = 0;
+				else if (type == SSL3_MT_KEY_UPDATE)
+					hs->keyUpdate = true;
+			}
+		}
+
+		bool derive(const char* name, const OSSL_PARAM* params, unsigned char* out, size_t length)
+		{
+			EVP_KDF* kdf = EVP_KDF_fetch(nullptr, name, nullptr);
+			if (!kdf) return false;
+
+			EVP_KDF_CTX* ctx = EVP_KDF_CTX_new(kdf);
+			EVP_KDF_free(kdf);
+			bool ok = ctx && EVP_KDF_derive(ctx, out, length, params) == 1;
+			EVP_KDF_CTX_free(ctx);
+			return ok;
+		}
+
+		/** HKDF-Expand-Label of RFC 8446 with an empty context */
+		bool expandLabel(const EVP_MD* md, const unsigned char* secret, size_t secretLength, const char* label, unsigned char* out, size_t length)
+		{
+			size_t labelLength = 6 + strlen(label);
+			unsigned char info[4 + 255];
+			info[0] = (unsigned char) (length >> 8);
+			info[1] = (unsigned char) length;
+			info[2] = (unsigned char) labelLength;
+			memcpy(info + 3, "tls13 ", 6);
+			memcpy(info + 9, label, labelLength - 6);
+			info[3 + labelLength] = 0;
+
+			int mode = EVP_KDF_HKDF_MODE_EXPAND_ONLY;
+			const OSSL_PARAM params[] = {
+				OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode),
+				OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char*>(EVP_MD_get0_name(md)), 0),
+				OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, const_cast<unsigned char*>(secret), secretLength),
+				OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, info, 4 + labelLength),
+				OSSL_PARAM_construct_end()
+			};
+			return derive("HKDF", params, out, length);
+		}
+
+		/** The TLS 1.2 key block */
+		bool expandMaster(SSL* ssl, const EVP_MD* md, unsigned char* out, size_t length)
+		{
+			unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+			size_t masterLength = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+
+			static const char label[] = "key expansion";
+			unsigned char seed[sizeof(label) - 1 + 2 * SSL3_RANDOM_SIZE];
+			memcpy(seed, label, sizeof(label) - 1);
+			SSL_get_server_random(ssl, seed + sizeof(label) - 1, SSL3_RANDOM_SIZE);
+			SSL_get_client_random(ssl, seed + sizeof(label) - 1 + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+
+			const OSSL_PARAM params[] = {
+				OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char*>(EVP_MD_get0_name(md)), 0),
+				OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SECRET, master, masterLength),
+				OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SEED, seed, sizeof(seed)),
+				OSSL_PARAM_construct_end()
+			};
+			bool ok = derive("TLS1-PRF", params, out, length);
+			OPENSSL_cleanse(master, sizeof(master));
+			return ok;
+		}
+
+		union CryptoInfo
+		{
+			tls12_crypto_info_aes_gcm_128 aes128;
+			tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+			tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+		};
+
+		/** Keys and state of one direction */
+		struct Direction
+		{
+			unsigned char key[32];
+			unsigned char iv[12];
+			unsigned char seq[8];
+
+			~Direction()
+			{
+				OPENSSL_cleanse(this, sizeof(*this));
+			}
+
+			void setSequence(uint64_t n)
+			{
+				for (int i = 7; i >= 0; --i, n >>= 8)
+					seq[i] = (unsigned char) n;
+			}
+		};
+
+		template <typename T> size_t fillGcm(T& info, unsigned short cipher, int version, const Direction& d)
+		{
+			info.info.version = version == TLS1_3_VERSION ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+			info.info.cipher_type = cipher;
+			memcpy(info.key, d.key, sizeof(info.key));
+			memcpy(info.salt, d.iv, sizeof(info.salt));
+			// TLS 1.2 sends the rest of the nonce with each record, the sequence number makes a good one
+			memcpy(info.iv, version == TLS1_3_VERSION ? d.iv + sizeof(info.salt) : d.seq, sizeof(info.iv));
+			memcpy(info.rec_seq, d.seq, sizeof(info.rec_seq));
+			return sizeof(info);
+		}
+
+		size_t fill(CryptoInfo& info, unsigned short cipher, int version, const Direction& d)
+		{
+			memset(&info, 0, sizeof(info));
+			switch (cipher)
+			{
+			case TLS_CIPHER_AES_GCM_128:
+				return fillGcm(info.aes128, cipher, version, d);
+			case TLS_CIPHER_AES_GCM_256:
+				return fillGcm(info.aes256, cipher, version, d);
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+			case TLS_CIPHER_CHACHA20_POLY1305:
+				info.chacha.info.version = version == TLS1_3_VERSION ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+				info.chacha.info.cipher_type = cipher;
+				memcpy(info.chacha.key, d.key, sizeof(info.chacha.key));
+				memcpy(info.chacha.iv, d.iv, sizeof(info.chacha.iv));
+				memcpy(info.chacha.rec_seq, d.seq, sizeof(info.chacha.rec_seq));
+				return sizeof(info.chacha);
+#endif
+			}
+			return 0;
+		}
+
+		int handOver(SSL* ssl, Handshake& hs, int fd, string& pending)
+		{
+			int version = SSL_version(ssl);
+			const SSL_CIPHER* suite = SSL_get_current_cipher(ssl);
+			if ((version != TLS1_2_VERSION && version != TLS1_3_VERSION) || !suite) return 0;
+
+			unsigned short cipher;
+			size_t keyLength;
+			size_t ivLength = version == TLS1_3_VERSION ? 12 : 4;
+			switch (SSL_CIPHER_get_cipher_nid(suite))
+			{
+			case NID_aes_128_gcm:
+				cipher = TLS_CIPHER_AES_GCM_128;
+				keyLength = 16;
+				break;
+			case NID_aes_256_gcm:
+				cipher = TLS_CIPHER_AES_GCM_256;
+				keyLength = 32;
+				break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+			case NID_chacha20_poly1305:
+				cipher = TLS_CIPHER_CHACHA20_POLY1305;
+				keyLength = 32;
+				ivLength = 12;
+				break;
+#endif
+			default:
+				return 0;
+			}
+
+			// Fails right away when the kernel has no TLS support
+			if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) return 0;
+
+			// Whatever the client sent right after its Finished may be buffered already; it's
+			// decrypted here, after which OpenSSL must hold nothing that the kernel should get
+			char buf[4096];
+			int n;
+			while ((n = SSL_read(ssl, buf, sizeof(buf))) > 0)
+				pending.append(buf, n);
+			int error = SSL_get_error(ssl, n);
+			ERR_clear_error();
+
+			if (error != SSL_ERROR_WANT_READ || SSL_has_pending(ssl) || hs.keyUpdate || BIO_ctrl_pending(SSL_get_rbio(ssl)) > 0 ||
+				BIO_ctrl_wpending(SSL_get_wbio(ssl)) > 0)
+				return 0;
+
+			const EVP_MD* md = SSL_CIPHER_get_handshake_digest(suite);
+			Direction rx, tx;
+			if (version == TLS1_3_VERSION)
+			{
+				if (hs.secretLength == 0 || !expandLabel(md, hs.clientSecret, hs.secretLength, "key", rx.key, keyLength) ||
+					!expandLabel(md, hs.clientSecret, hs.secretLength, "iv", rx.iv, ivLength) ||
+					!expandLabel(md, hs.serverSecret, hs.secretLength, "key", tx.key, keyLength) ||
+					!expandLabel(md, hs.serverSecret, hs.secretLength, "iv", tx.iv, ivLength))
+					return 0;
+
+				rx.setSequence(hs.readRecords);
+				tx.setSequence(hs.writeRecords);
+			}
+			else
+			{
+				unsigned char block[2 * (32 + 12)];
+				bool ok = expandMaster(ssl, md, block, 2 * (keyLength + ivLength));
+				memcpy(rx.key, block, keyLength);
+				memcpy(tx.key, block + keyLength, keyLength);
+				memcpy(rx.iv, block + 2 * keyLength, ivLength);
+				memcpy(tx.iv, block + 2 * keyLength + ivLength, ivLength);
+				OPENSSL_cleanse(block, sizeof(block));
+				if (!ok) return 0;
+
+				// The Finished messages were the first records of either side
+				rx.setSequence(hs.readRecords + 1);
+				tx.setSequence(hs.writeRecords + 1);
+			}
+
+			CryptoInfo info;
+			int ret = 0;
+			if (setsockopt(fd, SOL_TLS, TLS_RX, &info, fill(info, cipher, version, rx)) == 0)
+			{
+				ret |= KernelTLS::RX;
+				if (setsockopt(fd, SOL_TLS, TLS_TX, &info, fill(info, cipher, version, tx)) == 0) ret |= KernelTLS::TX;
+			}
+			OPENSSL_cleanse(&info, sizeof(info));
+			return ret;
+		}
+	}
+
+	bool KernelTLS::isSupported()
+	{
+		return true;
+	}
+
+	void KernelTLS::prepare(SSL_CTX* ctx)
+	{
+		SSL_CTX_set_keylog_callback(ctx, &keyLog);
+		SSL_CTX_set_msg_callback(ctx, &message);
+	}
+
+	int KernelTLS::enable(SSL* ssl, int fd, string& pending)
+	{
+		auto hs = getHandshake(ssl, false);
+		if (!hs) return 0;
+
+		int ret = handOver(ssl, *hs, fd, pending);
+
+		// The secrets aren't needed any more, whichever way it went
+		SSL_set_ex_data(ssl, getExIndex(), nullptr);
+		delete hs;
+		return ret;
+	}
+
+	void KernelTLS::sendCloseNotify(int fd)
+	{
+#ifdef TLS_SET_RECORD_TYPE
+		// The record type goes in a control message; the alert is warning(1), close_notify(0)
+		unsigned char alert[2] = { 1, 0 };
+		char control[CMSG_SPACE(sizeof(unsigned char))] = {};
+
+		iovec iov = { alert, sizeof(alert) };
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_TLS;
+		cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+		*CMSG_DATA(cmsg) = SSL3_RT_ALERT;
+
+		// The connection is going away either way
+		::sendmsg(fd, &msg, MSG_DONTWAIT);
+#endif
+	}
+
+#else
+
+	bool KernelTLS::isSupported()
+	{
+		return false;
+	}
+
+	void KernelTLS::prepare(SSL_CTX*)
+	{
+	}
+
+	int KernelTLS::enable(SSL*, int, string&)
+	{
+		return 0;
+	}
+
+	void KernelTLS::sendCloseNotify(int)
+	{
+	}
+
+#endif // HAVE_KTLS
+
+} // namespace adchpp
+
+#endif // HAVE_OPENSSL
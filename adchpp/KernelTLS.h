@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_KERNELTLS_H
+#define ADCHPP_KERNELTLS_H
+
+#ifdef HAVE_OPENSSL
+
+#include <openssl/ssl.h>
+
+#include <string>
+
+namespace adchpp
+{
+
+	/**
+	 * Hands the record layer of established TLS connections over to the kernel (Linux kTLS),
+	 * which then encrypts and decrypts in send and recv so that broadcasts no longer go
+	 * through OpenSSL on the reactor thread. OpenSSL has no API for the traffic keys and
+	 * record sequence numbers this needs, so they're collected while the handshake runs,
+	 * through the key log and message callbacks of the context.
+	 *
+	 * Only AES-GCM and ChaCha20-Poly1305 with TLS 1.2 and 1.3 can be handed over. Anything
+	 * the kernel doesn't take stays with OpenSSL.
+	 */
+	class KernelTLS
+	{
+	public:
+		enum
+		{
+			RX = 1,
+			TX = 2
+		};
+
+		/** Whether this build can use kernel TLS at all */
+		static bool isSupported();
+
+		/** Make the handshakes of a context collect what enable needs */
+		static void prepare(SSL_CTX* ctx);
+
+		/**
+		 * Move the record layer of a connection whose handshake has just finished into
+		 * its socket. Receiving is handed over first and sending only along with it, as
+		 * OpenSSL may have to answer what it reads.
+		 * @param pending Receives the data OpenSSL had already decrypted, which must be
+		 * delivered before anything read from the socket
+		 * @return The directions now handled by the kernel (RX, RX | TX), 0 if none
+		 */
+		static int enable(SSL* ssl, int fd, std::string& pending);
+
+		/** Send a close_notify alert on a socket whose sending is done by the kernel */
+		static void sendCloseNotify(int fd);
+	};
+
+} // namespace adchpp
+
+#endif // HAVE_OPENSSL
+
+#endif // ADCHPP_KERNELTLS_H
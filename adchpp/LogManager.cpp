@@ -19,15 +19,112 @@
 #include "LogManager.h"
 #include "Core.h"
 #include "AppPaths.h"
+#include "BatchWriter.h"
 #include "version.h"
 #include <baselib/File.h>
 #include <baselib/FormatUtil.h>
 #include <baselib/PathUtil.h>
+#include <baselib/StrUtil.h>
 #include <baselib/ParamExpander.h>
 
 using namespace adchpp;
 
-LogManager::LogManager(Core& core) : enabled(true), useConsole(true), core(core)
+namespace
+{
+	/** The formatted timestamp only changes once per second, keep the last one around */
+	const string& getTimePrefix(time_t t)
+	{
+		static const string format("%Y-%m-%d %H:%M:%S: ");
+		static thread_local time_t cachedTime = 0;
+		static thread_local string cachedPrefix;
+		if (t != cachedTime || cachedPrefix.empty())
+		{
+			Util::TimeParamExpander ex(t);
+			cachedPrefix = Util::formatParams(format, &ex, false);
+			cachedTime = t;
+		}
+		return cachedPrefix;
+	}
+}
+
+/** Formats the queued lines; the file is shared with synchronous logging */
+class LogManager::Writer : public BatchWriter<Entry>
+{
+public:
+	Writer(LogManager& lm, size_t queueSize) : BatchWriter<Entry>(queueSize, 512, lm.written), lm(lm), reportedDrops(0)
+	{
+	}
+
+protected:
+	time_t getTime(const Entry& e) const override
+	{
+		return e.t;
+	}
+
+	void encode(const Entry& e, string& batch) override
+	{
+		batch += getTimePrefix(e.t);
+		batch += e.line;
+	}
+
+	time_t openFile(time_t t) override
+	{
+		// Check again in a second, in case logging gets enabled
+		if (!lm.enabled) return t + 1;
+
+		Util::TimeParamExpander ex(t);
+		string tmpl;
+		string fileName = lm.makeFileName(ex, tmpl);
+		try
+		{
+			LockBase<CriticalSection> l(lm.mtx);
+			lm.openFile(fileName);
+		}
+		catch (const FileException& fe)
+		{
+			dcdebug("LogManager::Writer: %s\n", fe.getError().c_str());
+		}
+		return Utils::getNextRollover(tmpl, t);
+	}
+
+	void finishBatch(string& batch) override
+	{
+		int64_t drops = lm.dropped.load();
+		if (drops != reportedDrops)
+		{
+			batch += getTimePrefix(::time(nullptr));
+			batch += "LogManager: " + Util::toString(drops - reportedDrops) + " log messages dropped (queue full)\n";
+			reportedDrops = drops;
+		}
+	}
+
+	void write(const string& batch) override
+	{
+		if (lm.useConsole)
+		{
+			fputs(batch.c_str(), stdout);
+			fflush(stdout);
+		}
+		if (lm.enabled)
+		{
+			LockBase<CriticalSection> l(lm.mtx);
+			try
+			{
+				if (lm.file.isOpen()) lm.file.write(batch);
+			}
+			catch (const FileException& e)
+			{
+				dcdebug("LogManager::Writer: %s\n", e.getError().c_str());
+			}
+		}
+	}
+
+private:
+	LogManager& lm;
+	int64_t reportedDrops;
+};
+
+LogManager::LogManager(Core& core) : enabled(true), useConsole(true), core(core), async(false), queueSize(16384), dropped(0), written(0)
 {
 #ifdef _WIN32
 	logFileTemplate = "logs/%Y%m.log";
@@ -36,16 +133,94 @@ LogManager::LogManager(Core& core) : enabled(true), useConsole(true), core(core)
 #endif
 }
 
+LogManager::~LogManager()
+{
+	stop();
+}
+
+void LogManager::setLogFile(const string& s)
+{
+	{
+		LockBase<CriticalSection> l(mtx);
+		logFileTemplate = s;
+	}
+	if (writer) writer->resetFileName();
+}
+
+void LogManager::start()
+{
+	if (!async || writer) return;
+
+	writer.reset(new Writer(*this, queueSize));
+	try
+	{
+		writer->start(0, "LogWriter");
+	}
+	catch (const ThreadException& e)
+	{
+		writer.reset();
+		log("LogManager", "Unable to start the log writer thread: " + e.getError());
+	}
+}
+
+void LogManager::stop()
+{
+	if (!writer) return;
+
+	writer->stop();
+	writer.reset();
+}
+
+size_t LogManager::getQueued() const
+{
+	return writer ? writer->size() : 0;
+}
+
 void LogManager::log(const string& area, const string& msg) noexcept
 {
-	static const string format("%Y-%m-%d %H:%M:%S: ");
-	Util::TimeParamExpander ex(::time(nullptr));
-	string tmp = Util::formatParams(format, &ex, false);
+	time_t now = ::time(nullptr);
+	string tmp;
+	tmp.reserve(area.length() + msg.length() + 3);
 	tmp += area;
 	tmp += ": ";
 	tmp += msg;
 	if (tmp.back() != '\n') tmp += '\n';
-	doLog(ex, tmp);
+
+	if (writer)
+	{
+		if (!sig.empty()) sig(getTimePrefix(now) + tmp);
+		if (!writer->push(Entry{now, std::move(tmp)}))
+			dropped++;
+		return;
+	}
+
+	Util::TimeParamExpander ex(now);
+	doLog(ex, getTimePrefix(now) + tmp);
+}
+
+string LogManager::makeFileName(Util::ParamExpander& ex, string& fileName) const
+{
+	{
+		LockBase<CriticalSection> l(mtx);
+		fileName = logFileTemplate;
+	}
+	Util::toNativePathSeparators(fileName);
+	return Util::formatParams(AppPaths::makeAbsolutePath(core.getConfigPath(), fileName), &ex, false);
+}
+
+void LogManager::openFile(const string& newFileName)
+{
+	if (newFileName == currentFileName) return;
+	currentFileName.clear();
+	File::ensureDirectory(newFileName);
+	file.close();
+#ifdef _WIN32
+	file.init(Text::utf8ToWide(newFileName), File::WRITE, File::OPEN | File::CREATE);
+#else
+	file.init(newFileName, File::WRITE, File::OPEN | File::CREATE);
+#endif
+	file.setEndPos(0);
+	currentFileName = newFileName;
 }
 
 void LogManager::doLog(Util::ParamExpander& ex, const string& msg) noexcept
@@ -58,25 +233,12 @@ void LogManager::doLog(Util::ParamExpander& ex, const string& msg) noexcept
 	}
 	if (!enabled) return;
 
-	string fileName = logFileTemplate;
-	Util::toNativePathSeparators(fileName);
-	string newFileName = Util::formatParams(AppPaths::makeAbsolutePath(core.getConfigPath(), fileName), &ex, false);
+	string tmpl;
+	string newFileName = makeFileName(ex, tmpl);
 	LockBase<CriticalSection> l(mtx);
 	try
 	{
-		if (newFileName != currentFileName)
-		{
-			currentFileName.clear();
-			File::ensureDirectory(newFileName);
-			file.close();
-#ifdef _WIN32
-			file.init(Text::utf8ToWide(newFileName), File::WRITE, File::OPEN | File::CREATE);
-#else
-			file.init(newFileName, File::WRITE, File::OPEN | File::CREATE);
-#endif
-			file.setEndPos(0);
-			currentFileName = std::move(newFileName);
-		}
+		openFile(newFileName);
 		file.write(msg);
 		return;
 	}
@@ -23,6 +23,9 @@
 #include <baselib/File.h>
 #include "Signal.h"
 
+#include <atomic>
+#include <memory>
+
 namespace Util { class ParamExpander; }
 
 namespace adchpp
@@ -42,32 +45,73 @@ namespace adchpp
 		 */
 		void log(const std::string& area, const std::string& msg) noexcept;
 
-		void setLogFile(const std::string& s) { logFileTemplate = s; }
+		void setLogFile(const std::string& s);
 		const std::string& getLogFile() const { return logFileTemplate; }
 		void setEnabled(bool flag) { enabled = flag; }
 		bool getEnabled() const { return enabled; }
 		void setUseConsole(bool flag) { useConsole = flag; }
 		bool getUseConsole() const { return useConsole; }
 
+		/**
+		 * Hand log lines over to a writer thread instead of writing them from the
+		 * calling thread, from when the hub starts. Lines that don't fit in the queue
+		 * are dropped and counted.
+		 */
+		void setAsync(bool flag) { async = flag; }
+		bool getAsync() const { return async; }
+		/** Max number of lines waiting for the writer thread, applied when the writer starts */
+		void setQueueSize(size_t size) { queueSize = size; }
+		size_t getQueueSize() const { return queueSize; }
+
+		/** Number of lines dropped because the async queue was full */
+		int64_t getDropped() const { return dropped; }
+		/** Number of lines written by the async writer */
+		int64_t getWritten() const { return written; }
+		/** Number of lines waiting to be written */
+		size_t getQueued() const;
+
+		~LogManager();
+
 		typedef SignalTraits<void(const std::string&)> SignalLog;
 		SignalLog::Signal& signalLog() { return sig; }
 
 	private:
 		friend class Core;
 
-		CriticalSection mtx;
+		mutable CriticalSection mtx;
 		std::string logFileTemplate;
 		std::string currentFileName;
 		File file;
-		bool enabled;
-		bool useConsole;
+		// Also read by the writer thread
+		std::atomic<bool> enabled;
+		std::atomic<bool> useConsole;
 
 		LogManager(Core& core);
 
+		void start();
+		void stop();
+
 		SignalLog::Signal sig;
 		Core& core;
 
+		struct Entry
+		{
+			time_t t;
+			std::string line;
+		};
+
+		class Writer;
+		friend class Writer;
+		std::unique_ptr<Writer> writer;
+		bool async;
+		size_t queueSize;
+		std::atomic<int64_t> dropped;
+		std::atomic<int64_t> written;
+
 		void doLog(Util::ParamExpander& ex, const std::string& msg) noexcept;
+		std::string makeFileName(Util::ParamExpander& ex, std::string& tmpl) const;
+		/** Switch to another log file; mtx must be locked */
+		void openFile(const std::string& newFileName);
 	};
 
 #define LOGC(core, area, msg) (core).getLogManager().log(area, msg)
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "LoopbackStream.h"
+#include "SocketManager.h"
+
+#include <boost/asio/error.hpp>
+#include <string.h>
+
+namespace adchpp
+{
+	using namespace std;
+	using boost::system::error_code;
+
+	LoopbackStream::LoopbackStream(SocketManager& sm, const string& ip) :
+		sm(sm), ip(ip), inPos(0), readPosted(false), hubClosed(false), peerClosed(false)
+	{
+	}
+
+	LoopbackStream::~LoopbackStream()
+	{
+		dcdebug("LoopbackStream deleted\n");
+	}
+
+	size_t LoopbackStream::available()
+	{
+		return inbound.size() - inPos;
+	}
+
+	void LoopbackStream::init(const std::function<void()>& postInit)
+	{
+		postInit();
+	}
+
+	void LoopbackStream::prepareRead(const BufferPtr& buf, const Handler& handler)
+	{
+		readBuf = buf;
+		readHandler = handler;
+		if (hubClosed || peerClosed || available() > 0) scheduleRead();
+	}
+
+	size_t LoopbackStream::read(const BufferPtr& buf)
+	{
+		size_t n = min(available(), buf->size());
+		memcpy(buf->data(), inbound.data() + inPos, n);
+		inPos += n;
+		return n;
+	}
+
+	void LoopbackStream::write(const BufferList& bufs, const Handler& handler)
+	{
+		if (hubClosed)
+		{
+			sm.addJob([handler] { handler(boost::asio::error::bad_descriptor, 0); });
+			return;
+		}
+
+		// Unlike a socket, the whole queue is accepted in one go
+		auto data = make_shared<string>();
+		for (auto i = bufs.begin(), iend = bufs.end(); i != iend; ++i)
+			data->append((const char*) (*i)->data(), (*i)->size());
+
+		auto self = shared_from_this();
+		sm.addJob([self, data, handler] {
+			if (self->dataHandler && !self->peerClosed) self->dataHandler((const uint8_t*) data->data(), data->size());
+			handler(error_code(), data->size());
+		});
+	}
+
+	void LoopbackStream::shutdown(const Handler& handler)
+	{
+		auto self = shared_from_this();
+		sm.addJob([self, handler] {
+			self->notifyClose();
+			handler(error_code(), 0);
+		});
+	}
+
+	void LoopbackStream::close()
+	{
+		if (hubClosed) return;
+
+		hubClosed = true;
+		if (readHandler) scheduleRead();
+
+		auto self = shared_from_this();
+		sm.addJob([self] { self->notifyClose(); });
+	}
+
+	void LoopbackStream::send(const void* data, size_t len)
+	{
+		if (isClosed()) return;
+
+		// Drop what the hub has consumed before the buffer grows
+		if (inPos > 0 && inPos == inbound.size())
+		{
+			inbound.clear();
+			inPos = 0;
+		}
+		else if (inPos > 4096 && inPos > inbound.size() / 2)
+		{
+			inbound.erase(0, inPos);
+			inPos = 0;
+		}
+
+		inbound.append((const char*) data, len);
+		if (readHandler) scheduleRead();
+	}
+
+	void LoopbackStream::disconnect()
+	{
+		if (peerClosed) return;
+
+		peerClosed = true;
+		if (readHandler) scheduleRead();
+	}
+
+	void LoopbackStream::scheduleRead()
+	{
+		if (readPosted) return;
+
+		readPosted = true;
+		sm.addJob(std::bind(&LoopbackStream::completeRead, shared_from_this()));
+	}
+
+	void LoopbackStream::completeRead()
+	{
+		readPosted = false;
+		if (!readHandler) return;
+
+		Handler h;
+		h.swap(readHandler);
+		BufferPtr buf;
+		buf.swap(readBuf);
+
+		if (hubClosed)
+		{
+			h(boost::asio::error::operation_aborted, 0);
+		}
+		else if (!buf)
+		{
+			// Readability notification, end of file included
+			h(error_code(), 0);
+		}
+		else if (available() == 0)
+		{
+			h(boost::asio::error::eof, 0);
+		}
+		else
+		{
+			h(error_code(), read(buf));
+		}
+	}
+
+	void LoopbackStream::notifyClose()
+	{
+		hubClosed = true;
+		if (closeHandler)
+		{
+			CloseHandler h;
+			h.swap(closeHandler);
+			h();
+		}
+	}
+
+} // namespace adchpp
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_LOOPBACKSTREAM_H
+#define ADCHPP_LOOPBACKSTREAM_H
+
+#include "AsyncStream.h"
+#include "forward.h"
+
+namespace adchpp
+{
+
+	/**
+	 * In-memory connection: the hub side is an AsyncStream handed to
+	 * SocketManager::accept, the other side is driven by the owner through
+	 * send/disconnect and the data handler. Completions are posted to the
+	 * reactor like socket completions would be, so the hub sees the same
+	 * sequence of events as with a real connection, minus the kernel.
+	 */
+	class LoopbackStream : public AsyncStream, public std::enable_shared_from_this<LoopbackStream>
+	{
+	public:
+		/** Receives everything the hub writes to the connection */
+		typedef std::function<void(const uint8_t* data, size_t len)> DataHandler;
+		/** Called when the hub shuts down or closes its end of the connection */
+		typedef std::function<void()> CloseHandler;
+
+		LoopbackStream(SocketManager& sm, const std::string& ip = "127.0.0.1");
+		~LoopbackStream();
+
+		virtual size_t available();
+		virtual void init(const std::function<void()>& postInit);
+		virtual void setOptions(size_t) {}
+		virtual std::string getIp() { return ip; }
+		virtual void prepareRead(const BufferPtr& buf, const Handler& handler);
+		virtual size_t read(const BufferPtr& buf);
+		virtual void write(const BufferList& bufs, const Handler& handler);
+		virtual void shutdown(const Handler& handler);
+		virtual void close();
+
+		/** Queue data for the hub to read */
+		void send(const void* data, size_t len);
+		void send(const std::string& data) { send(data.data(), data.size()); }
+		/** Close the peer side; the hub reads end of file once the queued data is consumed */
+		void disconnect();
+
+		void setDataHandler(const DataHandler& handler) { dataHandler = handler; }
+		void setCloseHandler(const CloseHandler& handler) { closeHandler = handler; }
+
+		/** True once either side has closed the connection */
+		bool isClosed() const { return hubClosed || peerClosed; }
+
+	private:
+		void scheduleRead();
+		void completeRead();
+		void notifyClose();
+
+		SocketManager& sm;
+		std::string ip;
+
+		/** Data sent by the peer; inPos is where the hub reads next */
+		std::string inbound;
+		size_t inPos;
+
+		BufferPtr readBuf;
+		Handler readHandler;
+		bool readPosted;
+
+		bool hubClosed;
+		bool peerClosed;
+
+		DataHandler dataHandler;
+		CloseHandler closeHandler;
+	};
+
+	typedef std::shared_ptr<LoopbackStream> LoopbackStreamPtr;
+
+} // namespace adchpp
+
+#endif // ADCHPP_LOOPBACKSTREAM_H
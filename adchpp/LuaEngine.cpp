@@ -130,6 +130,11 @@ void LuaEngine::getStats(string& str) const
 	}
 }
 
+size_t LuaEngine::getMemoryUsage() const
+{
+	return (size_t) lua_gc(l, LUA_GCCOUNT, 0) * 1024 + lua_gc(l, LUA_GCCOUNTB, 0);
+}
+
 bool LuaEngine::call(const string& f, const string& arg)
 {
 	lua_getfield(l, LUA_GLOBALSINDEX, f.c_str());
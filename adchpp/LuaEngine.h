@@ -39,6 +39,7 @@ public:
 	virtual void unloadScript(Script* script, bool force = false);
 
 	virtual void getStats(std::string& str) const;
+	virtual size_t getMemoryUsage() const;
 
 private:
 	friend class LuaScript;
@@ -17,7 +17,10 @@
  */
 
 #include "ManagedSocket.h"
+#include "EgressScheduler.h"
 #include "SocketManager.h"
+#include "ZlibStream.h"
+#include <baselib/TimeUtil.h>
 #include <boost/asio/ip/address.hpp>
 
 namespace adchpp
@@ -27,38 +30,62 @@ namespace adchpp
 	using namespace boost::asio;
 
 	ManagedSocket::ManagedSocket(SocketManager& sm, const AsyncStreamPtr& sock_, const ServerInfoPtr& aServer)
-	: sock(sock_), overflow(time::not_a_date_time), disc(time::not_a_date_time),
-	  lastWrite(time::not_a_date_time), sm(sm), server(aServer)
+	: sock(sock_), outBytes(0), drainRate(0), rateStart(Util::getHighResTimestamp()), rateBytes(0), overflow(time::not_a_date_time), disc(time::not_a_date_time),
+	  lastWrite(time::not_a_date_time), egressDeficit(0), egressGrant(0), egressCost(0),
+	  preLogin(false), egressQueued(false), flushPending(false), handingOff(false), compressed(false), readPaused(false), resumeScheduled(false), resumeAt(0), events(nullptr), sm(sm), server(aServer)
 	{
+		std::fill(queuedBytes, queuedBytes + SEND_LAST, 0);
 	}
 
 	ManagedSocket::~ManagedSocket() noexcept
 	{
 		dcdebug("ManagedSocket deleted\n");
+		if (listener) listener->connections--;
+		sm.release(*this);
 	}
 
-	static size_t sum(const BufferList& l)
+	void ManagedSocket::loggedIn() noexcept
 	{
-		size_t bytes = 0;
-		for (BufferList::const_iterator i = l.begin(); i != l.end(); ++i)
-			bytes += (*i)->size();
+		sm.release(*this);
+	}
 
-		return bytes;
+	ManagedSocket::SendClass ManagedSocket::getSendClass(const Buffer& buf)
+	{
+		// Private messages stay with the control traffic
+		switch (AdcCommand::getTraffic(buf.data(), buf.size()))
+		{
+			case AdcCommand::TRAFFIC_CHAT: return SEND_CHAT;
+			case AdcCommand::TRAFFIC_INF:
+			case AdcCommand::TRAFFIC_QUI: return SEND_INF;
+			case AdcCommand::TRAFFIC_SEARCH: return SEND_SEARCH;
+			default: return SEND_CONTROL;
+		}
 	}
 
-	size_t ManagedSocket::getQueuedBytes() const
+	const char* ManagedSocket::getSendClassName(int c)
 	{
-		return sum(outBuf);
+		static const char* names[SEND_LAST] = { "control", "chat", "inf", "search" };
+		return c >= 0 && c < SEND_LAST ? names[c] : "";
 	}
 
 	void ManagedSocket::write(const BufferPtr& buf, bool lowPrio /* = false */) noexcept
 	{
 		if (buf->size() == 0 || disconnecting()) return;
+		SendClass c = getSendClass(*buf);
 		size_t queued = getQueuedBytes();
 		if (sm.getMaxBufferSize() > 0 && queued + buf->size() > sm.getMaxBufferSize())
 		{
-			if (lowPrio)
+			// Stale searches make room for anything else
+			queued -= dropSearches(queued + buf->size() - sm.getMaxBufferSize());
+		}
+		if (sm.getMaxBufferSize() > 0 && queued + buf->size() > sm.getMaxBufferSize())
+		{
+			if (lowPrio || c == SEND_SEARCH)
+			{
+				sm.getStats().dropBytes += buf->size();
+				sm.getStats().dropCalls++;
 				return;
+			}
 			if (!overflow.is_not_a_date_time() && overflow + time::millisec(sm.getOverflowTimeout()) < time::now())
 			{
 				disconnect(REASON_WRITE_OVERFLOW);
@@ -70,9 +97,77 @@ namespace adchpp
 		sm.getStats().queueBytes += buf->size();
 		sm.getStats().queueCalls++;
 
-		outBuf.push_back(buf);
+		queues[c].push_back(buf, Util::getHighResTimestamp());
+		queuedBytes[c] += buf->size();
 
-		prepareWrite();
+		if (!sm.getWriteCombining())
+		{
+			prepareWrite();
+		}
+		else if (!flushPending)
+		{
+			flushPending = true;
+			sm.scheduleFlush(shared_from_this());
+		}
+	}
+
+	size_t ManagedSocket::dropSearches(size_t bytes) noexcept
+	{
+		auto& q = queues[SEND_SEARCH];
+		size_t dropped = 0;
+		while (dropped < bytes && !q.empty())
+		{
+			dropped += q.front()->size();
+			sm.getStats().dropCalls++;
+			q.pop_front();
+		}
+		queuedBytes[SEND_SEARCH] -= dropped;
+		sm.getStats().dropBytes += dropped;
+		return dropped;
+	}
+
+	uint64_t ManagedSocket::getBacklogAge() const
+	{
+		// Classes overtake each other, so the oldest data isn't necessarily first in line
+		uint64_t oldest = 0;
+		for (auto since : outSince)
+			if (!oldest || since < oldest) oldest = since;
+		for (auto& q : queues)
+			if (!q.empty() && (!oldest || q.frontSince() < oldest)) oldest = q.frontSince();
+		return oldest ? (Util::getHighResTimestamp() - oldest) / 1000000 : 0;
+	}
+
+	double ManagedSocket::getDrainRate() const
+	{
+		uint64_t elapsed = Util::getHighResTimestamp() - rateStart;
+		// A stalled socket doesn't complete the writes that would update the average
+		if (elapsed > 2000000000ull) return rateBytes * 1e9 / elapsed;
+		return drainRate;
+	}
+
+	void ManagedSocket::fillOutput() noexcept
+	{
+		// Streams send at most about this much per call; moving little at a time lets
+		// urgent data overtake what's queued behind it. A compressing stream sends all
+		// of it, and every write costs it a flush, so it gets more at once.
+		const size_t maxBytes = compressed ? 16 * 1024 : 1024;
+		const size_t maxBuffers = 64;
+
+		for (int c = 0; c < SEND_LAST; ++c)
+		{
+			auto& q = queues[c];
+			while (!q.empty())
+			{
+				if (outBytes >= maxBytes || outBuf.size() >= maxBuffers) return;
+
+				size_t n = q.front()->size();
+				outSince.push_back(q.frontSince());
+				outBuf.push_back(std::move(q.front()));
+				q.pop_front();
+				outBytes += n;
+				queuedBytes[c] -= n;
+			}
+		}
 	}
 
 	// Simplified handlers to avoid bind complexity
@@ -123,7 +218,20 @@ namespace adchpp
 	{
 		if (!writing()) // Not writing
 		{
-			if (!outBuf.empty())
+			fillOutput();
+			if (outBuf.empty())
+			{
+				egressDeficit = 0;
+			}
+			else if (sm.getEgressScheduler().getEnabled())
+			{
+				if (!egressQueued)
+				{
+					egressQueued = true;
+					sm.getEgressScheduler().activate(shared_from_this());
+				}
+			}
+			else
 			{
 				lastWrite = time::now();
 				sock->write(outBuf, Handler<&ManagedSocket::completeWrite>(shared_from_this()));
@@ -135,26 +243,71 @@ namespace adchpp
 		}
 	}
 
+	void ManagedSocket::flush() noexcept
+	{
+		flushPending = false;
+		if (disconnecting() && !writing() && !egressQueued && getQueuedBytes() == 0)
+		{
+			// Everything queued before the disconnect was dropped in the meantime
+			sock->shutdown(Keeper(shared_from_this()));
+			return;
+		}
+		prepareWrite();
+	}
+
+	void ManagedSocket::writeGranted(size_t count, double cost) noexcept
+	{
+		egressGrant = 0;
+		for (size_t i = 0; i < count; ++i)
+			egressGrant += outBuf[i]->size();
+		egressCost = cost;
+
+		lastWrite = time::now();
+		if (count == outBuf.size())
+			sock->write(outBuf, Handler<&ManagedSocket::completeWrite>(shared_from_this()));
+		else
+			sock->write(BufferList(outBuf.begin(), outBuf.begin() + count), Handler<&ManagedSocket::completeWrite>(shared_from_this()));
+	}
+
 	void ManagedSocket::completeWrite(const boost::system::error_code& ec, size_t bytes) noexcept
 	{
 		lastWrite = time::not_a_date_time;
 
+		if (egressGrant)
+		{
+			if (!ec) sm.getEgressScheduler().complete(*this, bytes);
+			egressGrant = 0;
+		}
+
 		if (!ec)
 		{
 			sm.getStats().sendBytes += bytes;
 			sm.getStats().sendCalls++;
 
+			uint64_t now = Util::getHighResTimestamp();
+			rateBytes += bytes;
+			if (now - rateStart >= 1000000000ull)
+			{
+				double rate = rateBytes * 1e9 / (now - rateStart);
+				drainRate = drainRate > 0 ? (drainRate + rate) / 2 : rate;
+				rateStart = now;
+				rateBytes = 0;
+			}
+
 			while (bytes > 0)
 			{
 				BufferPtr& p = *outBuf.begin();
 				if (p->size() <= bytes)
 				{
 					bytes -= p->size();
+					outBytes -= p->size();
 					outBuf.erase(outBuf.begin());
+					outSince.erase(outSince.begin());
 				}
 				else
 				{
 					p = make_shared<Buffer>(p->data() + bytes, p->size() - bytes);
+					outBytes -= bytes;
 					bytes = 0;
 				}
 			}
@@ -168,7 +321,14 @@ namespace adchpp
 				}
 			}
 
-			if (disconnecting() && outBuf.empty())
+			// Idle connections keep no output array around
+			if (outBuf.empty())
+			{
+				BufferList().swap(outBuf);
+				std::vector<uint64_t>().swap(outSince);
+			}
+
+			if (disconnecting() && getQueuedBytes() == 0)
 				sock->shutdown(Keeper(shared_from_this()));
 			else
 				prepareWrite();
@@ -179,6 +339,8 @@ namespace adchpp
 
 	void ManagedSocket::prepareRead() noexcept
 	{
+		if (handingOff) return;
+
 		// We first send in an empty buffer to get notification when there's data
 		// available
 		sock->prepareRead(BufferPtr(), Handler<&ManagedSocket::prepareRead2>(shared_from_this()));
@@ -186,6 +348,9 @@ namespace adchpp
 
 	void ManagedSocket::prepareRead2(const boost::system::error_code& ec, size_t) noexcept
 	{
+		// The data stays in the socket for the process taking over
+		if (handingOff) return;
+
 		if (!ec)
 		{
 			// ADC commands are typically small - using a small buffer
@@ -216,10 +381,10 @@ namespace adchpp
 
 				inBuf->resize(bytes);
 
-				if (dataHandler) dataHandler(inBuf);
+				if (events) events->onData(inBuf);
 
 				inBuf.reset();
-				prepareRead();
+				if (!readPaused) prepareRead();
 			}
 			catch (const boost::system::system_error& e)
 			{
@@ -233,11 +398,40 @@ namespace adchpp
 		}
 	}
 
+	void ManagedSocket::pauseRead(uint64_t nanos) noexcept
+	{
+		readPaused = true;
+		resumeAt = max(resumeAt, Util::getHighResTimestamp() + nanos);
+		if (!resumeScheduled)
+		{
+			resumeScheduled = true;
+			sm.addJob(static_cast<long>(nanos / 1000000) + 1, std::bind(&ManagedSocket::resumeRead, shared_from_this()));
+		}
+	}
+
+	void ManagedSocket::resumeRead() noexcept
+	{
+		resumeScheduled = false;
+		if (disconnecting() || !events) return;
+
+		uint64_t now = Util::getHighResTimestamp();
+		if (now < resumeAt)
+		{
+			// The pause was extended in the meantime
+			pauseRead(resumeAt - now);
+			return;
+		}
+
+		readPaused = false;
+		if (events) events->onResumed();
+		if (!readPaused && !disconnecting()) prepareRead();
+	}
+
 	void ManagedSocket::completeAccept(const boost::system::error_code& ec) noexcept
 	{
 		if (!ec)
 		{
-			if (connectedHandler) connectedHandler();
+			if (events) events->onConnected();
 			sock->init(std::bind(&ManagedSocket::ready, shared_from_this()));
 		}
 		else
@@ -246,20 +440,57 @@ namespace adchpp
 
 	void ManagedSocket::ready() noexcept
 	{
-		if (readyHandler) readyHandler();
+		if (events) events->onReady();
 		prepareRead();
 	}
 
+	bool ManagedSocket::handOff(int& fd, std::string& pending) noexcept
+	{
+		handingOff = true;
+		fd = -1;
+		if (disconnecting()) return true;
+		if (inBuf || writing() || egressQueued || flushPending || getQueuedBytes() > 0) return false;
+		return sock->handOff(fd, pending);
+	}
+
+	void ManagedSocket::detach() noexcept
+	{
+		events = nullptr;
+
+		// Nothing gets written or shut down from here on
+		disc = time::now();
+		sock->close();
+	}
+
+	void ManagedSocket::resume(const std::string& pending) noexcept
+	{
+		if (!pending.empty() && events) events->onData(make_shared<Buffer>(pending));
+		if (!readPaused && !disconnecting()) prepareRead();
+	}
+
+	bool ManagedSocket::compress() noexcept
+	{
+#ifdef HAVE_ZLIB
+		if (compressed || sm.getCompressionLevel() <= 0 || disconnecting() || handingOff) return false;
+
+		// Writes are one at a time, so the next one simply goes through the new stream
+		auto zs = make_shared<ZlibStream>(sm, sock, sm.getCompressionLevel());
+		if (!zs->isValid()) return false;
+
+		sock = zs;
+		compressed = true;
+		return true;
+#else
+		return false;
+#endif
+	}
+
 	void ManagedSocket::fail(Reason reason, const std::string& info) noexcept
 	{
-		if (failedHandler)
+		if (events)
 		{
-			failedHandler(reason, info);
-
-			connectedHandler = nullptr;
-			readyHandler = nullptr;
-			dataHandler = nullptr;
-			failedHandler = nullptr;
+			events->onFailed(reason, info);
+			events = nullptr;
 		}
 	}
 
@@ -321,7 +552,8 @@ namespace adchpp
 		const auto timeout = sm.getDisconnectTimeout();
 		disc = time::now() + time::millisec(timeout);
 		sm.addJob(Reporter(shared_from_this(), &ManagedSocket::fail, reason, info));
-		if (!writing()) sock->shutdown(Keeper(shared_from_this()));
+		// Data waiting for the EgressScheduler or a flush counts as being written
+		if (!writing() && !egressQueued && !flushPending) sock->shutdown(Keeper(shared_from_this()));
 		sm.addJob(timeout, Disconnector(sock));
 	}
 
@@ -29,6 +29,24 @@
 
 namespace adchpp
 {
+	/**
+	 * Receives the events of a ManagedSocket. A connection has one receiver, so it's
+	 * kept as a single pointer rather than a std::function per event.
+	 */
+	class SocketEventHandler
+	{
+	public:
+		virtual void onConnected() noexcept = 0;
+		virtual void onReady() noexcept = 0;
+		virtual void onData(const BufferPtr& buf) noexcept = 0;
+		/** Reading resumed after pauseRead; the handler may pause again */
+		virtual void onResumed() noexcept = 0;
+		virtual void onFailed(Reason reason, const std::string& info) noexcept = 0;
+
+	protected:
+		~SocketEventHandler() { }
+	};
+
 	/**
 	 * An asynchronous socket managed by SocketManager.
 	 */
@@ -40,12 +58,47 @@ namespace adchpp
 		ManagedSocket(const ManagedSocket&) = delete;
 		ManagedSocket& operator= (const ManagedSocket&) = delete;
 
-		/** Asynchronous write */
+		/**
+		 * Output queues, sent in this order. Data keeps its order within a class.
+		 * QUI goes with INF so that a user can't leave before having joined.
+		 */
+		enum SendClass
+		{
+			SEND_CONTROL, // everything not listed below, including PMs and STA
+			SEND_CHAT,    // broadcast MSG
+			SEND_INF,     // INF and QUI
+			SEND_SEARCH,  // SCH; dropped rather than overflowing the buffer
+			SEND_LAST
+		};
+
+		static SendClass getSendClass(const Buffer& buf);
+		/** @return Name of the class in lower case, as used in the metrics */
+		static const char* getSendClassName(int c);
+
+		/** Asynchronous write. Low priority data and searches are dropped when the
+		 * output buffer is full. */
 		void write(const BufferPtr& buf, bool lowPrio = false) noexcept;
 
-		/** Returns the number of bytes in the output buffer; buffers must be locked
-		 */
-		size_t getQueuedBytes() const;
+		/** Returns the number of bytes in the output buffer */
+		size_t getQueuedBytes() const
+		{
+			return outBytes + queuedBytes[SEND_CONTROL] + queuedBytes[SEND_CHAT] + queuedBytes[SEND_INF] +
+				queuedBytes[SEND_SEARCH];
+		}
+		/** Returns the number of bytes of a class that haven't been handed to the stream yet */
+		size_t getQueuedBytes(SendClass c) const
+		{
+			return queuedBytes[c];
+		}
+
+		/** Drop queued searches, oldest first, until at least the given number of
+		 * bytes is freed. @return Number of bytes dropped */
+		size_t dropSearches(size_t bytes) noexcept;
+
+		/** @return Milliseconds that the oldest unsent data has been waiting, 0 if there is none */
+		uint64_t getBacklogAge() const;
+		/** @return Bytes per second written to the stream, averaged over the last few seconds */
+		double getDrainRate() const;
 
 		/** Asynchronous disconnect. Pending data will be written within the limits of
 		 * the DisconnectTimeout setting, but no more data will be read. */
@@ -60,28 +113,21 @@ namespace adchpp
 			ip = ip_;
 		}
 
-		typedef std::function<void()> ConnectedHandler;
-		void setConnectedHandler(const ConnectedHandler& handler)
-		{
-			connectedHandler = handler;
-		}
-
-		typedef std::function<void()> ReadyHandler;
-		void setReadyHandler(const ReadyHandler& handler)
-		{
-			readyHandler = handler;
-		}
-
-		typedef std::function<void(const BufferPtr&)> DataHandler;
-		void setDataHandler(const DataHandler& handler)
+		/** The handler isn't called any more once the connection has failed or was detached */
+		void setEventHandler(SocketEventHandler* handler)
 		{
-			dataHandler = handler;
+			events = handler;
 		}
 
-		typedef std::function<void(Reason, const std::string&)> FailedHandler;
-		void setFailedHandler(const FailedHandler& handler)
+		/**
+		 * Stop reading for at least the given time; may only be called from the
+		 * data handler or the resumed handler. Calling it again while paused
+		 * extends the pause.
+		 */
+		void pauseRead(uint64_t nanos) noexcept;
+		bool isReadPaused() const
 		{
-			failedHandler = handler;
+			return readPaused;
 		}
 
 		time::ptime getOverflow()
@@ -96,30 +142,130 @@ namespace adchpp
 
 		~ManagedSocket() noexcept;
 
+		/** The connection has logged in, which frees its place in the pre-login budget */
+		void loggedIn() noexcept;
+
+		/**
+		 * Stop reading so that the connection can be handed over to another process.
+		 * @param fd The descriptor, -1 if the connection can't be handed over
+		 * @param pending Data received but not processed yet
+		 * @return false while there's still data to write or a read to finish
+		 */
+		bool handOff(int& fd, std::string& pending) noexcept;
+		/** The connection has been handed over: forget about it without touching the connection */
+		void detach() noexcept;
+		/** Start reading a connection that was handed over, processing the data that came with it first */
+		void resume(const std::string& pending) noexcept;
+
+		/**
+		 * Compress everything written from now on (ADC ZLIF), at the level set in SocketManager.
+		 * @return false if compression is off, already on or couldn't be started
+		 */
+		bool compress() noexcept;
+		bool isCompressed() const
+		{
+			return compressed;
+		}
+
 		bool getHbriParams(AdcCommand& cmd) const noexcept;
 		bool isV6() const noexcept;
 
 	private:
+		friend class EgressScheduler;
 		friend class SocketManager;
 		friend class SocketFactory;
+		friend class LocalSocketFactory;
 
 		void completeAccept(const boost::system::error_code&) noexcept;
 		void ready() noexcept;
 		void prepareWrite() noexcept;
+		/** Start writing what was queued while writes were held back */
+		void flush() noexcept;
+		void fillOutput() noexcept;
 		void completeWrite(const boost::system::error_code& ec, size_t bytes) noexcept;
+		/** Write the first count buffers, as allowed by the EgressScheduler */
+		void writeGranted(size_t count, double cost) noexcept;
 		void prepareRead() noexcept;
 		void prepareRead2(const boost::system::error_code& ec, size_t bytes) noexcept;
 		void completeRead(const boost::system::error_code& ec, size_t bytes) noexcept;
+		void resumeRead() noexcept;
 
 		void fail(Reason reason, const std::string& info) noexcept;
 
 		bool disconnecting() const;
 		bool writing() const;
 
+		/**
+		 * FIFO of buffers that allocates nothing until it's used and gives its memory
+		 * back once drained; most connections are idle most of the time.
+		 */
+		class SendQueue
+		{
+		public:
+			SendQueue() : head(0) { }
+
+			bool empty() const
+			{
+				return head == items.size();
+			}
+			BufferPtr& front()
+			{
+				return items[head].buf;
+			}
+			/** @return Time (Util::getHighResTimestamp) that the first buffer was queued */
+			uint64_t frontSince() const
+			{
+				return items[head].since;
+			}
+			void push_back(const BufferPtr& buf, uint64_t since)
+			{
+				items.push_back(Item { buf, since });
+			}
+			void pop_front()
+			{
+				items[head++].buf.reset();
+				if (head == items.size())
+					clear();
+				else if (head >= 32 && head * 2 >= items.size())
+				{
+					items.erase(items.begin(), items.begin() + head);
+					head = 0;
+				}
+			}
+
+		private:
+			struct Item
+			{
+				BufferPtr buf;
+				uint64_t since;
+			};
+
+			void clear()
+			{
+				std::vector<Item>().swap(items);
+				head = 0;
+			}
+
+			std::vector<Item> items;
+			size_t head;
+		};
+
 		AsyncStreamPtr sock;
 
-		/** Output buffer, for storing data that's waiting to be transmitted */
+		/** Data waiting to be moved to outBuf, per SendClass */
+		SendQueue queues[SEND_LAST];
+		size_t queuedBytes[SEND_LAST];
+
+		/** Output buffer, for storing data that's being transmitted */
 		BufferList outBuf;
+		size_t outBytes;
+		/** Time (Util::getHighResTimestamp) that each buffer in outBuf was queued */
+		std::vector<uint64_t> outSince;
+
+		/** Drain rate average and the current measuring window */
+		double drainRate;
+		uint64_t rateStart;
+		size_t rateBytes;
 
 		/** Input buffer used when receiving data */
 		BufferPtr inBuf;
@@ -135,14 +281,40 @@ namespace adchpp
 
 		std::string ip;
 
-		ConnectedHandler connectedHandler;
-		ReadyHandler readyHandler;
-		DataHandler dataHandler;
-		FailedHandler failedHandler;
+		/** Network counted for in the pre-login budget of SocketManager, see preLogin */
+		std::string preLoginNetwork;
+
+		/** EgressScheduler state: waiting for a turn, deficit counter, bytes and
+		 * cost per byte of the current write */
+		double egressDeficit;
+		size_t egressGrant;
+		double egressCost;
+
+		/** The flags are kept together to save room. Counted in the pre-login budget */
+		bool preLogin;
+		/** EgressScheduler state, see above */
+		bool egressQueued;
+
+		/** Queued data waits for SocketManager::flushWrites */
+		bool flushPending;
+
+		/** No more reads, the connection is about to be handed over */
+		bool handingOff;
+
+		/** sock is a ZlibStream around the original stream */
+		bool compressed;
+
+		/** Reads are paused until resumeAt (Util::getHighResTimestamp) */
+		bool readPaused;
+		bool resumeScheduled;
+		uint64_t resumeAt;
+
+		SocketEventHandler* events;
 
 		SocketManager& sm;
 
 		ServerInfoPtr server;
+		ListenerStatsPtr listener;
 	};
 
 } // namespace adchpp
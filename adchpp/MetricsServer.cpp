@@ -0,0 +1,756 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "MetricsServer.h"
+#include "BloomManager.h"
+#include "ClientManager.h"
+#include "CommandStats.h"
+#include "Core.h"
+#include "EventJournal.h"
+#include "LogManager.h"
+#include "PluginManager.h"
+#include "ScriptManager.h"
+#include "SocketManager.h"
+#include "TLSContext.h"
+#include "TrafficCapture.h"
+#include "UringService.h"
+#include "Watchdog.h"
+#include "WorkerPool.h"
+#include "version.h"
+#include <baselib/File.h>
+#include <baselib/StrUtil.h>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace std::placeholders;
+	using namespace boost::asio;
+	using boost::system::error_code;
+
+	static const string className = "MetricsServer";
+
+	static const size_t MAX_REQUEST = 4096;
+	static const long REQUEST_TIMEOUT = 10; // seconds
+
+	class MetricsServer::Listener
+	{
+	public:
+		virtual ~Listener() {}
+		virtual void close() = 0;
+	};
+
+	template <typename Protocol> class HttpConnection : public enable_shared_from_this<HttpConnection<Protocol>>
+	{
+	public:
+		HttpConnection(io_service& io, MetricsServer& ms) : sock(io), timer(io), ms(ms), used(0)
+		{
+		}
+
+		void start()
+		{
+			timer.expires_from_now(boost::posix_time::seconds(REQUEST_TIMEOUT));
+			timer.async_wait(std::bind(&HttpConnection::onTimeout, this->shared_from_this(), _1));
+			read();
+		}
+
+		typename Protocol::socket sock;
+
+	private:
+		void read()
+		{
+			sock.async_read_some(buffer(request + used, sizeof(request) - used),
+				std::bind(&HttpConnection::onRead, this->shared_from_this(), _1, _2));
+		}
+
+		void onRead(const error_code& ec, size_t bytes)
+		{
+			if (ec)
+			{
+				close();
+				return;
+			}
+
+			used += bytes;
+			const char* end = request + used;
+			static const char terminator[] = "\r\n\r\n";
+			if (search((const char*) request, end, terminator, terminator + 4) == end)
+			{
+				if (used == sizeof(request))
+					respond("431 Request Header Fields Too Large", Util::emptyString);
+				else
+					read();
+				return;
+			}
+
+			// Request line: METHOD SP PATH SP VERSION
+			const char* method = request;
+			const char* methodEnd = find(method, end, ' ');
+			const char* path = methodEnd + 1;
+			const char* pathEnd = methodEnd == end ? end : find(path, end, ' ');
+			if (pathEnd == end)
+			{
+				respond("400 Bad Request", Util::emptyString);
+				return;
+			}
+
+			string m(method, methodEnd);
+			string p(path, find(path, pathEnd, '?'));
+			if (m != "GET" && m != "HEAD")
+				respond("405 Method Not Allowed", Util::emptyString);
+			else if (p != "/metrics" && p != "/")
+				respond("404 Not Found", Util::emptyString);
+			else
+			{
+				string body;
+				ms.getMetrics(body);
+				respond("200 OK", body, m == "HEAD");
+			}
+		}
+
+		void respond(const char* status, const string& body, bool headOnly = false)
+		{
+			response = "HTTP/1.0 ";
+			response += status;
+			response += "\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8"
+				"\r\nContent-Length: " + Util::toString(body.length()) +
+				"\r\nConnection: close\r\n\r\n";
+			if (!headOnly) response += body;
+			async_write(sock, buffer(response), std::bind(&HttpConnection::onWrite, this->shared_from_this(), _1));
+		}
+
+		void onWrite(const error_code&)
+		{
+			close();
+		}
+
+		void onTimeout(const error_code& ec)
+		{
+			if (!ec) close();
+		}
+
+		void close()
+		{
+			error_code ec;
+			sock.shutdown(socket_base::shutdown_both, ec);
+			sock.close(ec);
+			timer.cancel(ec);
+		}
+
+		deadline_timer timer;
+		MetricsServer& ms;
+
+		char request[MAX_REQUEST];
+		size_t used;
+		string response;
+	};
+
+	template <typename Protocol>
+	class HttpListener : public MetricsServer::Listener, public enable_shared_from_this<HttpListener<Protocol>>
+	{
+	public:
+		HttpListener(io_service& io, MetricsServer& ms, const typename Protocol::endpoint& endpoint) :
+			io(io), acceptor(io), ms(ms)
+		{
+			acceptor.open(endpoint.protocol());
+			acceptor.set_option(socket_base::reuse_address(true));
+			acceptor.bind(endpoint);
+			acceptor.listen(socket_base::max_connections);
+		}
+
+		void prepareAccept()
+		{
+			auto conn = make_shared<HttpConnection<Protocol>>(io, ms);
+			acceptor.async_accept(conn->sock, std::bind(&HttpListener::handleAccept, this->shared_from_this(), _1, conn));
+		}
+
+		void close() override
+		{
+			error_code ec;
+			acceptor.close(ec);
+		}
+
+	private:
+		void handleAccept(const error_code& ec, const shared_ptr<HttpConnection<Protocol>>& conn)
+		{
+			if (ec == error::operation_aborted || !acceptor.is_open()) return;
+			if (!ec) conn->start();
+			prepareAccept();
+		}
+
+		io_service& io;
+		typename Protocol::acceptor acceptor;
+		MetricsServer& ms;
+	};
+
+	MetricsServer::MetricsServer(Core& core) : core(core)
+	{
+		for (auto& count : disconnects)
+			count = 0;
+	}
+
+	MetricsServer::~MetricsServer()
+	{
+		stop();
+	}
+
+	void MetricsServer::start()
+	{
+		if (listener || address.empty()) return;
+
+		auto& io = core.getSocketManager().io;
+		try
+		{
+			if (address.compare(0, 5, "unix:") == 0)
+			{
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+				string path = address.substr(5);
+				File::deleteFile(path);
+				auto l = make_shared<HttpListener<local::stream_protocol>>(io, *this, local::stream_protocol::endpoint(path));
+				l->prepareAccept();
+				listener = l;
+#else
+				LOGC(core, className, "Unix domain sockets are not supported on this platform");
+				return;
+#endif
+			}
+			else
+			{
+				string::size_type i = address.rfind(':');
+				if (i == string::npos) throw std::runtime_error("missing port");
+				string host = address.substr(0, i);
+				if (host.length() >= 2 && host[0] == '[' && host[host.length() - 1] == ']')
+					host = host.substr(1, host.length() - 2);
+				ip::tcp::endpoint endpoint(ip::address::from_string(host), (unsigned short) Util::toInt(address.substr(i + 1)));
+				auto l = make_shared<HttpListener<ip::tcp>>(io, *this, endpoint);
+				l->prepareAccept();
+				listener = l;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			LOGC(core, className, "Unable to listen on " + address + ": " + e.what());
+			return;
+		}
+
+		LOGC(core, className, "Serving metrics on " + address);
+		disconnectedConn = manage(core.getClientManager().signalDisconnected().connect(
+			std::bind(&MetricsServer::onDisconnected, this, _1, _2, _3)));
+	}
+
+	void MetricsServer::stop()
+	{
+		if (!listener) return;
+		disconnectedConn.reset();
+		listener->close();
+		listener.reset();
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		if (address.compare(0, 5, "unix:") == 0) File::deleteFile(address.substr(5));
+#endif
+	}
+
+	void MetricsServer::onDisconnected(Entity&, Reason reason, const string&)
+	{
+		if (reason >= 0 && reason < REASON_LAST) disconnects[reason]++;
+	}
+
+	static void addFamily(string& out, const char* name, const char* type, const char* help)
+	{
+		out += "# TYPE ";
+		out += name;
+		out += ' ';
+		out += type;
+		out += "\n# HELP ";
+		out += name;
+		out += ' ';
+		out += help;
+		out += '\n';
+	}
+
+	static void addLabel(string& out, const char* name, const string& value)
+	{
+		out += out.back() == '{' ? "" : ",";
+		out += name;
+		out += "=\"";
+		for (auto c : value)
+		{
+			if (c == '\\' || c == '"')
+				out += '\\';
+			else if (c == '\n')
+			{
+				out += "\\n";
+				continue;
+			}
+			out += c;
+		}
+		out += '"';
+	}
+
+	static void addSample(string& out, const string& name, int64_t value)
+	{
+		out += name;
+		out += ' ';
+		out += Util::toString(value);
+		out += '\n';
+	}
+
+	static void addSample(string& out, const string& name, double value)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.9g", value);
+		out += name;
+		out += ' ';
+		out += buf;
+		out += '\n';
+	}
+
+	static void addCounter(string& out, const char* name, const char* help, int64_t value)
+	{
+		addFamily(out, name, "counter", help);
+		addSample(out, string(name) + "_total", value);
+	}
+
+	static void addGauge(string& out, const char* name, const char* help, int64_t value)
+	{
+		addFamily(out, name, "gauge", help);
+		addSample(out, name, value);
+	}
+
+	static const char* stateNames[] = { "protocol", "hbri", "identify", "verify", "normal", "data" };
+
+	void MetricsServer::getMetrics(string& out)
+	{
+		addFamily(out, "adchpp_build", "info", "Hub version");
+		out += "adchpp_build_info{";
+		addLabel(out, "version", versionString);
+		out += "} 1\n";
+
+		addGauge(out, "adchpp_uptime_seconds", "Time since the hub was started",
+			(time::now() - core.getStartTime()).total_seconds());
+
+		// Sockets
+		auto& sm = core.getSocketManager();
+		const SocketStats& ss = sm.getStats();
+		addCounter(out, "adchpp_socket_queue_calls", "Buffers queued for sending", (int64_t) ss.queueCalls);
+		addCounter(out, "adchpp_socket_queue_bytes", "Bytes queued for sending", ss.queueBytes);
+		addCounter(out, "adchpp_socket_drop_calls", "Buffers dropped because the output buffer was full", ss.dropCalls);
+		addCounter(out, "adchpp_socket_drop_bytes", "Bytes dropped because the output buffer was full", ss.dropBytes);
+		addCounter(out, "adchpp_socket_send_calls", "Socket write calls", (int64_t) ss.sendCalls);
+		addCounter(out, "adchpp_socket_send_bytes", "Bytes written to sockets", ss.sendBytes);
+		addCounter(out, "adchpp_socket_recv_calls", "Socket read calls", ss.recvCalls);
+		addCounter(out, "adchpp_socket_recv_bytes", "Bytes read from sockets", ss.recvBytes);
+		addCounter(out, "adchpp_socket_flushes", "Reactor passes that ended with held back writes", ss.flushCalls);
+		addCounter(out, "adchpp_socket_flushed_sockets", "Sockets that had their held back writes started", ss.flushSockets);
+
+		addGauge(out, "adchpp_compressed_connections", "Connections with ZLIF compression on", ss.compressStreams);
+		addCounter(out, "adchpp_compression_input_bytes", "Bytes compressed for ZLIF connections", ss.compressIn);
+		addCounter(out, "adchpp_compression_output_bytes", "Compressed bytes written to ZLIF connections", ss.compressOut);
+		addCounter(out, "adchpp_compression_saved_bytes", "Bytes not sent thanks to compression", ss.compressIn - ss.compressOut);
+		addFamily(out, "adchpp_compression_cpu_seconds", "counter", "Time spent compressing");
+		addSample(out, "adchpp_compression_cpu_seconds_total", ss.compressTime / 1e9);
+
+		auto& egress = sm.getEgressScheduler();
+		addGauge(out, "adchpp_egress_rate", "Hub-wide output cap in bytes per second, 0 if disabled", (int64_t) egress.getRate());
+		addGauge(out, "adchpp_egress_waiting", "Sockets waiting for the egress scheduler", (int64_t) egress.getWaiting());
+		addCounter(out, "adchpp_egress_deferred", "Ticks that sockets had to wait for egress tokens", egress.getDeferred());
+		addFamily(out, "adchpp_egress_sent_bytes", "counter", "Bytes released by the egress scheduler per traffic class");
+		for (int i = 0; i < EgressScheduler::CLASS_LAST; ++i)
+		{
+			out += "adchpp_egress_sent_bytes_total{";
+			addLabel(out, "class", EgressScheduler::getClassName(i));
+			out += "} " + Util::toString(egress.getSent((EgressScheduler::Class) i)) + "\n";
+		}
+
+		auto listeners = sm.getListenerStats();
+		addFamily(out, "adchpp_listener_connections", "gauge", "Open connections per listening endpoint");
+		for (auto i = listeners.begin(); i != listeners.end(); ++i)
+		{
+			out += "adchpp_listener_connections{";
+			addLabel(out, "listener", (*i)->address);
+			addLabel(out, "tls", (*i)->secure ? "1" : "0");
+			out += "} " + Util::toString((*i)->connections) + "\n";
+		}
+		addFamily(out, "adchpp_listener_accepted", "counter", "Accepted connections per listening endpoint");
+		for (auto i = listeners.begin(); i != listeners.end(); ++i)
+		{
+			out += "adchpp_listener_accepted_total{";
+			addLabel(out, "listener", (*i)->address);
+			addLabel(out, "tls", (*i)->secure ? "1" : "0");
+			out += "} " + Util::toString((*i)->accepted) + "\n";
+		}
+		addFamily(out, "adchpp_listener_rejected", "counter", "Connections closed on accepting because the pre-login budget was used up");
+		for (auto i = listeners.begin(); i != listeners.end(); ++i)
+		{
+			out += "adchpp_listener_rejected_total{";
+			addLabel(out, "listener", (*i)->address);
+			addLabel(out, "tls", (*i)->secure ? "1" : "0");
+			out += "} " + Util::toString((*i)->rejected) + "\n";
+		}
+		addGauge(out, "adchpp_prelogin_connections", "Connections counted in the pre-login budget", (int64_t) sm.getPreLogin());
+
+		// Clients
+		auto& cm = core.getClientManager();
+		addGauge(out, "adchpp_queued_bytes", "Bytes waiting in the client output buffers", (int64_t) cm.getQueuedBytes());
+
+		size_t classBytes[ManagedSocket::SEND_LAST] = {};
+		for (auto& e : cm.getEntities())
+		{
+			if (e.second->getType() != Entity::TYPE_CLIENT) continue;
+			for (int i = 0; i < ManagedSocket::SEND_LAST; ++i)
+				classBytes[i] += static_cast<Client*>(e.second)->getQueuedBytes((ManagedSocket::SendClass) i);
+		}
+		addCounter(out, "adchpp_slow_withheld_searches", "Searches withheld from slow clients", cm.getSlowSearches());
+		addCounter(out, "adchpp_slow_withheld_infs", "INF updates withheld from slow clients", cm.getSlowInfs());
+		addCounter(out, "adchpp_slow_resyncs", "INFs sent again to clients that caught up", cm.getSlowResyncs());
+
+		// Lagging clients only, so that the number of series stays small
+		struct Lagging
+		{
+			Client* c;
+			uint64_t age;
+		};
+		vector<Lagging> lagging;
+		for (auto& e : cm.getEntities())
+		{
+			if (e.second->getType() != Entity::TYPE_CLIENT) continue;
+			Client* c = static_cast<Client*>(e.second);
+			uint64_t age = c->getBacklogAge();
+			if (age >= 1000 || c->isSet(Entity::FLAG_SLOW)) lagging.push_back({ c, age });
+		}
+		addGauge(out, "adchpp_slow_clients", "Clients currently marked slow",
+			(int64_t) count_if(lagging.begin(), lagging.end(), [](const Lagging& l) { return l.c->isSet(Entity::FLAG_SLOW); }));
+
+		struct LagField
+		{
+			const char* name;
+			const char* help;
+		};
+		static const LagField lagFields[] = {
+			{ "adchpp_client_lag_seconds", "Time the oldest unsent output has been waiting, for clients lagging by a second or more" },
+			{ "adchpp_client_queued_bytes", "Bytes queued for lagging clients" },
+			{ "adchpp_client_drain_bytes_per_second", "Recent output rate of lagging clients" },
+		};
+		for (int f = 0; f < 3; ++f)
+		{
+			addFamily(out, lagFields[f].name, "gauge", lagFields[f].help);
+			for (auto& l : lagging)
+			{
+				out += lagFields[f].name;
+				out += "{";
+				addLabel(out, "sid", AdcCommand::fromSID(l.c->getSID()));
+				addLabel(out, "nick", l.c->getField("NI"));
+				addLabel(out, "ip", l.c->getIp());
+				addLabel(out, "slow", l.c->isSet(Entity::FLAG_SLOW) ? "1" : "0");
+				out += "} ";
+				if (f == 0)
+					out += Util::toString(l.age / 1000.0);
+				else if (f == 1)
+					out += Util::toString(l.c->getQueuedBytes());
+				else
+					out += Util::toString((int64_t) l.c->getDrainRate());
+				out += "\n";
+			}
+		}
+
+		addFamily(out, "adchpp_queued_class_bytes", "gauge", "Bytes waiting to be sent per send class, excluding data being written");
+		for (int i = 0; i < ManagedSocket::SEND_LAST; ++i)
+		{
+			out += "adchpp_queued_class_bytes{";
+			addLabel(out, "class", ManagedSocket::getSendClassName(i));
+			out += "} " + Util::toString(classBytes[i]) + "\n";
+		}
+
+		size_t states[Entity::STATE_DATA + 1];
+		cm.getStateCounts(states);
+		addFamily(out, "adchpp_clients", "gauge", "Connected clients by login state");
+		for (int i = 0; i <= Entity::STATE_DATA; ++i)
+		{
+			out += "adchpp_clients{";
+			addLabel(out, "state", stateNames[i]);
+			out += "} " + Util::toString(states[i]) + "\n";
+		}
+
+		addFamily(out, "adchpp_disconnects", "counter", "Disconnected clients by reason since the exporter was started");
+		for (int i = 0; i < REASON_LAST; ++i)
+		{
+			// The rate limit reasons only delay input, see below
+			if (i >= REASON_RATE_BYTES && i <= REASON_RATE_IP_COMMANDS) continue;
+			string reason = getReasonName(i);
+			transform(reason.begin(), reason.end(), reason.begin(), ::tolower);
+			out += "adchpp_disconnects_total{";
+			addLabel(out, "reason", reason);
+			out += "} " + Util::toString(disconnects[i]) + "\n";
+		}
+
+		auto& rl = cm.getRateLimiter();
+		addFamily(out, "adchpp_throttled", "counter", "Reads paused by the inbound rate limits");
+		for (int i = REASON_RATE_BYTES; i <= REASON_RATE_IP_COMMANDS; ++i)
+		{
+			string reason = getReasonName(i);
+			transform(reason.begin(), reason.end(), reason.begin(), ::tolower);
+			out += "adchpp_throttled_total{";
+			addLabel(out, "reason", reason);
+			out += "} " + Util::toString(rl.getThrottled((Reason) i)) + "\n";
+		}
+
+		static const double quantiles[] = { 50, 90, 99 };
+		static const char* quantileNames[] = { "0.5", "0.9", "0.99" };
+
+		// Login queue
+		addGauge(out, "adchpp_login_queue", "Logins waiting to be let into NORMAL", (int64_t) cm.getQueuedLogins());
+		const auto& wait = cm.getLoginWait();
+		addFamily(out, "adchpp_login_wait_seconds", "summary", "Time spent in the login queue");
+		for (size_t j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j)
+		{
+			string l = "{";
+			addLabel(l, "quantile", quantileNames[j]);
+			addSample(out, "adchpp_login_wait_seconds" + l + "}", wait.getPercentile(quantiles[j]) / 1e9);
+		}
+		addSample(out, "adchpp_login_wait_seconds_count", (int64_t) wait.getCount());
+		addSample(out, "adchpp_login_wait_seconds_sum", wait.getSum() / 1e9);
+
+		// Commands
+		auto& cs = core.getCommandStats();
+		if (cs.getEnabled())
+		{
+			static const char* phaseNames[CommandStats::PHASE_LAST] = { "parse", "plugins", "hub", "send" };
+
+			struct Field
+			{
+				const char* name;
+				const char* help;
+				atomic<uint64_t> CommandStats::Command::*value;
+			};
+			static const Field fields[] = {
+				{ "adchpp_command_received", "Commands handled per FourCC", &CommandStats::Command::received },
+				{ "adchpp_command_received_bytes", "Bytes received per FourCC", &CommandStats::Command::bytesIn },
+				{ "adchpp_command_recipients", "Recipients of routed commands per FourCC", &CommandStats::Command::sent },
+				{ "adchpp_command_sent_bytes", "Bytes routed to recipients per FourCC", &CommandStats::Command::bytesOut }
+			};
+
+			for (auto& f : fields)
+			{
+				addFamily(out, f.name, "counter", f.help);
+				cs.forEach([&out, &f](const CommandStats::Command& c) {
+					out += f.name;
+					out += "_total{";
+					addLabel(out, "command", c.getFourCC());
+					out += "} " + Util::toString((c.*f.value).load(memory_order_relaxed)) + "\n";
+				});
+			}
+
+			addFamily(out, "adchpp_command_duration_seconds", "summary", "Time spent in each phase of command handling");
+			cs.forEach([&out](const CommandStats::Command& c) {
+				for (int i = 0; i < CommandStats::PHASE_LAST; ++i)
+				{
+					const auto& h = c.phases[i];
+					string labels = "{";
+					addLabel(labels, "command", c.getFourCC());
+					addLabel(labels, "phase", phaseNames[i]);
+					for (size_t j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j)
+					{
+						string l = labels;
+						addLabel(l, "quantile", quantileNames[j]);
+						addSample(out, "adchpp_command_duration_seconds" + l + "}", h.getPercentile(quantiles[j]) / 1e9);
+					}
+					addSample(out, "adchpp_command_duration_seconds_count" + labels + "}", (int64_t) h.getCount());
+					addSample(out, "adchpp_command_duration_seconds_sum" + labels + "}", h.getSum() / 1e9);
+				}
+			});
+		}
+
+		// Event loop
+		auto& wd = core.getWatchdog();
+		if (wd.getEnabled())
+		{
+			const auto& lag = wd.getLag();
+			addFamily(out, "adchpp_loop_lag_seconds", "summary", "Delay of the watchdog timer behind its schedule");
+			for (size_t j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j)
+			{
+				string l = "{";
+				addLabel(l, "quantile", quantileNames[j]);
+				addSample(out, "adchpp_loop_lag_seconds" + l + "}", lag.getPercentile(quantiles[j]) / 1e9);
+			}
+			addSample(out, "adchpp_loop_lag_seconds_count", (int64_t) lag.getCount());
+			addSample(out, "adchpp_loop_lag_seconds_sum", lag.getSum() / 1e9);
+			addCounter(out, "adchpp_loop_stalls", "Watchdog ticks delayed by more than the threshold", wd.getStalls());
+
+			auto offenders = wd.getTopOffenders(20);
+			addFamily(out, "adchpp_slow_handler_calls", "counter", "Handlers that ran for longer than the watchdog threshold");
+			for (auto& o : offenders)
+			{
+				string l = "{";
+				addLabel(l, "handler", o.first);
+				addSample(out, "adchpp_slow_handler_calls_total" + l + "}", o.second.count);
+			}
+			addFamily(out, "adchpp_slow_handler_seconds", "counter", "Time spent in handlers that ran for longer than the watchdog threshold");
+			for (auto& o : offenders)
+			{
+				string l = "{";
+				addLabel(l, "handler", o.first);
+				addSample(out, "adchpp_slow_handler_seconds_total" + l + "}", o.second.total / 1e9);
+			}
+		}
+
+		// TLS handshakes
+		bool secure = false;
+		for (auto& l : listeners)
+			if (l->secure) secure = true;
+		if (secure)
+		{
+			addGauge(out, "adchpp_tls_handshake_threads", "Threads running TLS handshakes, 0 if they run on the main thread",
+				(int64_t) sm.getHandshakeThreads());
+			addFamily(out, "adchpp_tls_handshakes", "counter", "TLS handshakes per listening endpoint");
+			for (auto& l : listeners)
+			{
+				if (!l->secure) continue;
+				string ok = "{";
+				addLabel(ok, "listener", l->address);
+				string failed = ok;
+				addLabel(ok, "result", "ok");
+				addLabel(failed, "result", "failed");
+				addSample(out, "adchpp_tls_handshakes_total" + ok + "}", l->handshakes);
+				addSample(out, "adchpp_tls_handshakes_total" + failed + "}", l->handshakeFailures);
+			}
+			addFamily(out, "adchpp_tls_resumed", "counter", "TLS handshakes that resumed an earlier session");
+			for (auto& l : listeners)
+			{
+				if (!l->secure) continue;
+				string labels = "{";
+				addLabel(labels, "listener", l->address);
+				addSample(out, "adchpp_tls_resumed_total" + labels + "}", l->resumed);
+			}
+			addFamily(out, "adchpp_tls_kernel", "counter", "TLS connections handed over to kernel TLS");
+			for (auto& l : listeners)
+			{
+				if (!l->secure) continue;
+				string receive = "{";
+				addLabel(receive, "listener", l->address);
+				string send = receive;
+				addLabel(receive, "direction", "receive");
+				addLabel(send, "direction", "send");
+				addSample(out, "adchpp_tls_kernel_total" + receive + "}", l->kernelReceive);
+				addSample(out, "adchpp_tls_kernel_total" + send + "}", l->kernelSend);
+			}
+#ifdef HAVE_OPENSSL
+			struct
+			{
+				const char* name;
+				const char* type;
+				const char* suffix; // counter samples are <family>_total
+				const char* help;
+				int64_t (TLSContext::*get)() const;
+			} static const sessionMetrics[] = {
+				{ "adchpp_tls_session_cache_size", "gauge", "", "TLS sessions in the server cache", &TLSContext::getCached },
+				{ "adchpp_tls_session_cache_full", "counter", "_total", "TLS sessions dropped because the cache was full", &TLSContext::getCacheFull },
+				{ "adchpp_tls_session_cache_misses", "counter", "_total", "TLS session IDs that weren't found in the cache", &TLSContext::getCacheMisses },
+				{ "adchpp_tls_tickets_issued", "counter", "_total", "TLS session tickets issued", &TLSContext::getTicketsIssued },
+				{ "adchpp_tls_tickets_accepted", "counter", "_total", "TLS session tickets decrypted with a current key", &TLSContext::getTicketsAccepted },
+				{ "adchpp_tls_tickets_unknown", "counter", "_total", "TLS session tickets made with a retired or unknown key", &TLSContext::getTicketsUnknown },
+			};
+			auto contexts = sm.getTLSContexts();
+			for (auto& m : sessionMetrics)
+			{
+				addFamily(out, m.name, m.type, m.help);
+				for (auto& c : contexts)
+				{
+					string labels = "{";
+					addLabel(labels, "port", c->getPort());
+					addSample(out, string(m.name) + m.suffix + labels + "}", (c.get()->*m.get)());
+				}
+			}
+#endif
+
+			const auto& h = sm.getHandshakeTime();
+			addFamily(out, "adchpp_tls_handshake_seconds", "summary", "Time from accepting a TLS connection to the end of its handshake");
+			for (size_t j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j)
+			{
+				string l = "{";
+				addLabel(l, "quantile", quantileNames[j]);
+				addSample(out, "adchpp_tls_handshake_seconds" + l + "}", h.getPercentile(quantiles[j]) / 1e9);
+			}
+			addSample(out, "adchpp_tls_handshake_seconds_count", (int64_t) h.getCount());
+			addSample(out, "adchpp_tls_handshake_seconds_sum", h.getSum() / 1e9);
+		}
+
+#ifdef HAVE_IO_URING
+		if (auto uring = sm.getUring())
+		{
+			addCounter(out, "adchpp_io_uring_submits", "io_uring_enter calls that submitted operations", uring->getSubmits());
+			addCounter(out, "adchpp_io_uring_submitted", "Operations submitted to the io_uring", uring->getSubmitted());
+			addCounter(out, "adchpp_io_uring_completions", "Completions reaped from the io_uring", uring->getCompletions());
+			addCounter(out, "adchpp_io_uring_buffer_shortages", "Receives that found no free buffer in the ring", uring->getBufferShortages());
+		}
+#endif
+
+		// Worker pool
+		auto& wp = core.getWorkerPool();
+		addGauge(out, "adchpp_work_threads", "Worker threads for CPU-heavy tasks", (int64_t) wp.getThreads());
+		addGauge(out, "adchpp_work_queued", "Tasks waiting for a worker thread", (int64_t) wp.getQueued());
+		addGauge(out, "adchpp_work_active", "Tasks being run by worker threads", (int64_t) wp.getActive());
+		addCounter(out, "adchpp_work_completed", "Tasks run by the worker pool", wp.getCompleted());
+		addFamily(out, "adchpp_work_busy_seconds", "counter", "Time spent running worker tasks");
+		addSample(out, "adchpp_work_busy_seconds_total", wp.getBusyTime() / 1e9);
+		addFamily(out, "adchpp_work_wait_seconds", "counter", "Time worker tasks spent queued");
+		addSample(out, "adchpp_work_wait_seconds_total", wp.getWaitTime() / 1e9);
+
+		// Logging
+		auto& lm = core.getLogManager();
+		addCounter(out, "adchpp_log_written", "Log lines written by the asynchronous writer", lm.getWritten());
+		addCounter(out, "adchpp_log_dropped", "Log lines dropped because the queue was full", lm.getDropped());
+
+		auto& ej = core.getEventJournal();
+		if (ej.getEnabled())
+		{
+			addCounter(out, "adchpp_journal_written", "Events written to the journal", ej.getWritten());
+			addCounter(out, "adchpp_journal_dropped", "Events dropped because the queue was full", ej.getDropped());
+		}
+
+		auto& tc = core.getTrafficCapture();
+		if (tc.getEnabled())
+		{
+			addCounter(out, "adchpp_capture_written", "Records written to the traffic capture", tc.getWritten());
+			addCounter(out, "adchpp_capture_dropped", "Records dropped because the queue was full", tc.getDropped());
+		}
+
+		// Plugins
+		auto& pm = core.getPluginManager();
+		auto bm = dynamic_pointer_cast<BloomManager>(pm.getPlugin("BloomManager"));
+		if (bm)
+		{
+			addCounter(out, "adchpp_bloom_searches", "Searches sent to clients", bm->getSearches());
+			addCounter(out, "adchpp_bloom_tth_searches", "TTH searches sent to clients", bm->getTTHSearches());
+			addCounter(out, "adchpp_bloom_stopped_searches", "TTH searches stopped by bloom filters", bm->getStoppedSearches());
+		}
+
+		auto script = dynamic_pointer_cast<ScriptManager>(pm.getPlugin("ScriptManager"));
+		if (script)
+			addGauge(out, "adchpp_script_memory_bytes", "Memory used by the script engines", (int64_t) script->getMemoryUsage());
+
+		out += "# EOF\n";
+	}
+
+} // namespace adchpp
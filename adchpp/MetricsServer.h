@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_METRICS_SERVER_H
+#define ADCHPP_METRICS_SERVER_H
+
+#include "Reason.h"
+#include "Signal.h"
+#include "forward.h"
+
+#include <string>
+
+namespace adchpp
+{
+
+	/**
+	 * Minimal HTTP listener serving the hub counters in the OpenMetrics text
+	 * format on /metrics. It runs on the SocketManager's io_service, so the
+	 * counters are read from the reactor thread.
+	 */
+	class MetricsServer
+	{
+	public:
+		/**
+		 * Address to listen on: "host:port", "[host]:port" or "unix:/path" (not
+		 * available on Windows). The host must be a numeric address. Empty disables
+		 * the listener.
+		 */
+		void setAddress(const std::string& s) { address = s; }
+		const std::string& getAddress() const { return address; }
+
+		/** Append the OpenMetrics exposition of all counters */
+		void getMetrics(std::string& out);
+
+		class Listener;
+
+		~MetricsServer();
+
+	private:
+		friend class Core;
+
+		MetricsServer(Core& core);
+
+		void start();
+		void stop();
+
+		void onDisconnected(Entity& c, Reason reason, const std::string& info);
+
+		std::shared_ptr<Listener> listener;
+
+		int64_t disconnects[REASON_LAST];
+		ManagedConnectionPtr disconnectedConn;
+
+		std::string address;
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_METRICS_SERVER_H
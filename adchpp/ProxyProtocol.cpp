@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "ProxyProtocol.h"
+
+#include <baselib/StringTokenizer.h>
+#include <boost/asio/ip/address.hpp>
+#include <string.h>
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace boost::asio;
+
+	static const char v1Signature[] = "PROXY ";
+	static const uint8_t v2Signature[] = { 0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A };
+
+	int ProxyProtocol::parse(const uint8_t* data, size_t len, string& ip)
+	{
+		ip.clear();
+		size_t n = min(len, sizeof(v2Signature));
+		if (memcmp(data, v2Signature, n) == 0) return len < sizeof(v2Signature) ? 0 : parseV2(data, len, ip);
+
+		n = min(len, sizeof(v1Signature) - 1);
+		if (memcmp(data, v1Signature, n) == 0) return len < sizeof(v1Signature) - 1 ? 0 : parseV1((const char*) data, len, ip);
+
+		return -1;
+	}
+
+	int ProxyProtocol::parseV1(const char* data, size_t len, string& ip)
+	{
+		static const size_t maxLength = 107;
+
+		const char* end = (const char*) memchr(data, '\n', min(len, maxLength));
+		if (!end) return len < maxLength ? 0 : -1;
+		if (end == data || end[-1] != '\r') return -1;
+
+		// PROXY TCP4|TCP6 source destination sport dport, or PROXY UNKNOWN followed by anything
+		StringTokenizer<string> st(string(data, end - 1), ' ');
+		const auto& fields = st.getTokens();
+		if (fields.size() >= 2 && fields[1] == "UNKNOWN") return static_cast<int>(end - data + 1);
+		if (fields.size() != 6 || (fields[1] != "TCP4" && fields[1] != "TCP6")) return -1;
+
+		boost::system::error_code ec;
+		auto address = ip::address::from_string(fields[2], ec);
+		if (ec || address.is_v4() != (fields[1] == "TCP4")) return -1;
+
+		ip = address.to_string();
+		return static_cast<int>(end - data + 1);
+	}
+
+	int ProxyProtocol::parseV2(const uint8_t* data, size_t len, string& ip)
+	{
+		static const size_t fixedLength = 16;
+		if (len < fixedLength) return 0;
+
+		uint8_t version = data[12] >> 4, command = data[12] & 0x0F;
+		if (version != 2 || command > 1) return -1;
+
+		size_t total = fixedLength + (data[14] << 8 | data[15]);
+		if (total > MAX_HEADER) return -1;
+		if (len < total) return 0;
+
+		// A LOCAL command comes from the proxy itself, the addresses are to be ignored
+		if (command == 0) return static_cast<int>(total);
+
+		const uint8_t* addresses = data + fixedLength;
+		switch (data[13] >> 4)
+		{
+			case 1: // AF_INET
+			{
+				if (total < fixedLength + 12) return -1;
+				ip::address_v4::bytes_type bytes;
+				memcpy(bytes.data(), addresses, bytes.size());
+				ip = ip::address_v4(bytes).to_string();
+				break;
+			}
+			case 2: // AF_INET6
+			{
+				if (total < fixedLength + 36) return -1;
+				ip::address_v6::bytes_type bytes;
+				memcpy(bytes.data(), addresses, bytes.size());
+				ip = ip::address_v6(bytes).to_string();
+				break;
+			}
+			default: break; // AF_UNSPEC or AF_UNIX, nothing usable
+		}
+		return static_cast<int>(total);
+	}
+
+} // namespace adchpp
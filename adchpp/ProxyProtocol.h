@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef ADCHPP_PROXYPROTOCOL_H
+#define ADCHPP_PROXYPROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace adchpp
+{
+
+	/**
+	 * The PROXY protocol header (versions 1 and 2) that a front proxy sends ahead of the
+	 * connection it forwards, carrying the address of the client it serves.
+	 */
+	class ProxyProtocol
+	{
+	public:
+		/** Longest header worth reading: version 1 is at most 107 bytes, version 2 with IPv6 addresses 52 */
+		static const size_t MAX_HEADER = 232;
+
+		/**
+		 * @param ip Receives the source address; empty if the proxy connected on its own behalf
+		 * (LOCAL, UNKNOWN) or for a protocol other than IPv4 and IPv6
+		 * @return Length of the header, 0 if more data is needed, -1 if it isn't a valid header
+		 */
+		static int parse(const uint8_t* data, size_t len, std::string& ip);
+
+	private:
+		static int parseV1(const char* data, size_t len, std::string& ip);
+		static int parseV2(const uint8_t* data, size_t len, std::string& ip);
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_PROXYPROTOCOL_H
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "RateLimiter.h"
+#include "AdcCommand.h"
+#include <baselib/TimeUtil.h>
+
+namespace adchpp
+{
+
+	using namespace std;
+
+	RateLimiter::RateLimiter() : enabled(false), sweepAt(64)
+	{
+		std::fill(throttled, throttled + REASON_LAST, 0);
+	}
+
+	void RateLimiter::setLimit(Reason type, const RateLimit& limit)
+	{
+		dcassert(type >= REASON_RATE_BYTES && type <= REASON_RATE_IP_COMMANDS);
+		RateLimit& l = limits[type];
+		l = limit;
+		// Buckets that can never hold a single command would stall the connection for good
+		if (l.enabled() && l.burst < 1) l.burst = max(l.rate, 1.0);
+
+		enabled = false;
+		for (int i = REASON_RATE_BYTES; i <= REASON_RATE_IP_COMMANDS; ++i)
+			if (limits[i].enabled()) enabled = true;
+	}
+
+	unique_ptr<RateLimiter::State> RateLimiter::createState(const string& ip)
+	{
+		unique_ptr<State> s(new State);
+		if (!limits[REASON_RATE_IP_BYTES].enabled() && !limits[REASON_RATE_IP_COMMANDS].enabled()) return s;
+
+		weak_ptr<IpState>& w = ips[ip];
+		s->ip = w.lock();
+		if (!s->ip)
+		{
+			s->ip = make_shared<IpState>();
+			w = s->ip;
+		}
+
+		if (ips.size() >= sweepAt)
+		{
+			for (auto i = ips.begin(); i != ips.end();)
+			{
+				if (i->second.expired())
+					i = ips.erase(i);
+				else
+					++i;
+			}
+			sweepAt = max((size_t) 64, ips.size() * 2);
+		}
+		return s;
+	}
+
+	void RateLimiter::check(TokenBucket& bucket, Reason type, double n, uint64_t now, uint64_t& wait, Reason& reason)
+	{
+		if (!limits[type].enabled()) return;
+		uint64_t w = bucket.wait(limits[type], n, now);
+		if (w > wait)
+		{
+			wait = w;
+			reason = type;
+		}
+	}
+
+	uint64_t RateLimiter::chargeBytes(State& s, size_t bytes)
+	{
+		uint64_t now = Util::getHighResTimestamp();
+		uint64_t wait = 0;
+		Reason reason = REASON_LAST;
+		if (limits[REASON_RATE_BYTES].enabled())
+		{
+			wait = s.bytes.charge(limits[REASON_RATE_BYTES], bytes, now);
+			reason = REASON_RATE_BYTES;
+		}
+		if (s.ip && limits[REASON_RATE_IP_BYTES].enabled())
+		{
+			uint64_t w = s.ip->bytes.charge(limits[REASON_RATE_IP_BYTES], bytes, now);
+			if (w > wait)
+			{
+				wait = w;
+				reason = REASON_RATE_IP_BYTES;
+			}
+		}
+		if (wait) throttled[reason]++;
+		return wait;
+	}
+
+	uint64_t RateLimiter::takeCommand(State& s, const uint8_t* line, size_t len)
+	{
+		TokenBucket* typeBucket = nullptr;
+		Reason typeReason = REASON_LAST;
+		switch (AdcCommand::getTraffic(line, len))
+		{
+			case AdcCommand::TRAFFIC_SEARCH:
+				typeBucket = &s.search;
+				typeReason = REASON_RATE_SEARCH;
+				break;
+			case AdcCommand::TRAFFIC_CHAT:
+			case AdcCommand::TRAFFIC_PM:
+				typeBucket = &s.chat;
+				typeReason = REASON_RATE_CHAT;
+				break;
+			case AdcCommand::TRAFFIC_CTM:
+				typeBucket = &s.ctm;
+				typeReason = REASON_RATE_CTM;
+				break;
+			case AdcCommand::TRAFFIC_INF:
+				typeBucket = &s.inf;
+				typeReason = REASON_RATE_INF;
+				break;
+			default:
+				break;
+		}
+
+		uint64_t now = Util::getHighResTimestamp();
+		uint64_t wait = 0;
+		Reason reason = REASON_LAST;
+		check(s.commands, REASON_RATE_COMMANDS, 1, now, wait, reason);
+		if (typeBucket) check(*typeBucket, typeReason, 1, now, wait, reason);
+		if (s.ip) check(s.ip->commands, REASON_RATE_IP_COMMANDS, 1, now, wait, reason);
+
+		if (wait)
+		{
+			// All or nothing, so that a command held back by one limit doesn't use up the others
+			throttled[reason]++;
+			return wait;
+		}
+
+		if (limits[REASON_RATE_COMMANDS].enabled()) s.commands.take(1);
+		if (typeBucket && limits[typeReason].enabled()) typeBucket->take(1);
+		if (s.ip && limits[REASON_RATE_IP_COMMANDS].enabled()) s.ip->commands.take(1);
+		return 0;
+	}
+
+} // namespace adchpp
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_RATE_LIMITER_H
+#define ADCHPP_RATE_LIMITER_H
+
+#include "Reason.h"
+#include "forward.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace adchpp
+{
+
+	/** Refill rate (tokens per second) and capacity of a token bucket; a zero rate means no limit */
+	struct RateLimit
+	{
+		RateLimit(double rate = 0, double burst = 0) : rate(rate), burst(burst) {}
+
+		bool enabled() const { return rate > 0; }
+
+		double rate;
+		double burst;
+	};
+
+	/** Token bucket; times are in nanoseconds of Util::getHighResTimestamp */
+	class TokenBucket
+	{
+	public:
+		TokenBucket() : tokens(0), last(0) {}
+
+		/** @return Nanoseconds until n tokens are available, 0 if they're available now */
+		uint64_t wait(const RateLimit& limit, double n, uint64_t now)
+		{
+			refill(limit, now);
+			return tokens >= n ? 0 : toNanos((n - tokens) / limit.rate);
+		}
+
+		/** Remove tokens that wait() reported to be available */
+		void take(double n) { tokens -= n; }
+
+		/**
+		 * Remove n tokens even if the bucket goes into debt.
+		 * @return Nanoseconds until the debt is paid off, 0 if there is none
+		 */
+		uint64_t charge(const RateLimit& limit, double n, uint64_t now)
+		{
+			refill(limit, now);
+			tokens -= n;
+			return tokens >= 0 ? 0 : toNanos(-tokens / limit.rate);
+		}
+
+	private:
+		void refill(const RateLimit& limit, uint64_t now)
+		{
+			// A new bucket starts out full
+			tokens = last ? std::min(limit.burst, tokens + (now - last) * limit.rate / 1e9) : limit.burst;
+			last = now;
+		}
+
+		static uint64_t toNanos(double seconds) { return static_cast<uint64_t>(seconds * 1e9) + 1; }
+
+		double tokens;
+		uint64_t last;
+	};
+
+	/**
+	 * Inbound rate limits of client connections, applied to the raw input in
+	 * Client::onData before it's parsed. Input over a limit is not dropped;
+	 * instead the connection stops reading until there are enough tokens, so
+	 * that the flood backs up into the sender's TCP window.
+	 *
+	 * Limits are identified by the Reason that is counted when they delay a
+	 * connection: REASON_RATE_BYTES and REASON_RATE_COMMANDS cover all input of
+	 * a connection, REASON_RATE_SEARCH, _CHAT, _CTM and _INF the respective
+	 * commands (CTM includes RCM), and REASON_RATE_IP_BYTES and _IP_COMMANDS
+	 * are shared by all connections from the same address.
+	 */
+	class RateLimiter
+	{
+	public:
+		struct IpState
+		{
+			TokenBucket bytes;
+			TokenBucket commands;
+		};
+
+		/** Buckets of one connection */
+		struct State
+		{
+			TokenBucket bytes;
+			TokenBucket commands;
+			TokenBucket search;
+			TokenBucket chat;
+			TokenBucket ctm;
+			TokenBucket inf;
+			std::shared_ptr<IpState> ip;
+		};
+
+		RateLimiter();
+
+		void setLimit(Reason type, const RateLimit& limit);
+		const RateLimit& getLimit(Reason type) const { return limits[type]; }
+
+		/** @return True if any limit is set */
+		bool getEnabled() const { return enabled; }
+
+		/** @return Number of times a limit has delayed the input of a connection */
+		int64_t getThrottled(Reason type) const { return throttled[type]; }
+
+		std::unique_ptr<State> createState(const std::string& ip);
+
+		/**
+		 * Account for received bytes; these are never held back, but a debt stops
+		 * further reads until it's paid.
+		 * @return Nanoseconds to pause reading, 0 to continue
+		 */
+		uint64_t chargeBytes(State& s, size_t bytes);
+
+		/**
+		 * Take the tokens for one command line (including the trailing newline).
+		 * @return 0 if the command may be processed now, otherwise the nanoseconds
+		 * to wait before trying again
+		 */
+		uint64_t takeCommand(State& s, const uint8_t* line, size_t len);
+
+	private:
+		void check(TokenBucket& bucket, Reason type, double n, uint64_t now, uint64_t& wait, Reason& reason);
+
+		RateLimit limits[REASON_LAST];
+		int64_t throttled[REASON_LAST];
+		bool enabled;
+
+		std::unordered_map<std::string, std::weak_ptr<IpState>> ips;
+		size_t sweepAt;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_RATE_LIMITER_H
@@ -30,8 +30,31 @@ namespace adchpp
 		REASON_WRITE_TIMEOUT,
 		REASON_SOCKET_ERROR,
 		REASON_HBRI,
+		REASON_RATE_BYTES,
+		REASON_RATE_COMMANDS,
+		REASON_RATE_SEARCH,
+		REASON_RATE_CHAT,
+		REASON_RATE_CTM,
+		REASON_RATE_INF,
+		REASON_RATE_IP_BYTES,
+		REASON_RATE_IP_COMMANDS,
 		REASON_LAST
 	};
+
+	/** @return Name of the reason without the REASON_ prefix, empty if out of range */
+	inline const char* getReasonName(int reason)
+	{
+		static const char* names[] = {
+			"BAD_STATE", "CID_CHANGE", "CID_TAKEN", "FLOODING", "HUB_FULL", "INVALID_COMMAND_TYPE",
+			"INVALID_IP", "INVALID_SID", "LOGIN_TIMEOUT", "MAX_COMMAND_SIZE", "NICK_INVALID", "NICK_TAKEN",
+			"NO_BASE_SUPPORT", "NO_TIGR_SUPPORT", "PID_MISSING", "PID_CID_LENGTH", "PID_CID_MISMATCH",
+			"PID_WITHOUT_CID", "PLUGIN", "WRITE_OVERFLOW", "NO_BANDWIDTH", "INVALID_DESCRIPTION",
+			"WRITE_TIMEOUT", "SOCKET_ERROR", "HBRI", "RATE_BYTES", "RATE_COMMANDS", "RATE_SEARCH", "RATE_CHAT",
+			"RATE_CTM", "RATE_INF", "RATE_IP_BYTES", "RATE_IP_COMMANDS"
+		};
+		static_assert(sizeof(names) / sizeof(names[0]) == REASON_LAST, "Reason names out of date");
+		return reason >= 0 && reason < REASON_LAST ? names[reason] : "";
+	}
 }
 
 #endif // ADCHPP_REASON_H_
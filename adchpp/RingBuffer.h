@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_RING_BUFFER_H
+#define ADCHPP_RING_BUFFER_H
+
+#include <atomic>
+#include <memory>
+
+namespace adchpp
+{
+
+	/**
+	 * Bounded lock-free queue with any number of producers and consumers.
+	 * The capacity is rounded up to a power of two. push() fails instead of
+	 * blocking when the queue is full, so the caller decides what to drop.
+	 */
+	template <typename T> class RingBuffer
+	{
+	public:
+		explicit RingBuffer(size_t capacity) : head(0), tail(0)
+		{
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			mask = size - 1;
+			cells.reset(new Cell[size]);
+			for (size_t i = 0; i < size; ++i)
+				cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		RingBuffer(const RingBuffer&) = delete;
+		RingBuffer& operator= (const RingBuffer&) = delete;
+
+		bool push(T&& item)
+		{
+			size_t pos = tail.load(std::memory_order_relaxed);
+			Cell* cell;
+			for (;;)
+			{
+				cell = &cells[pos & mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+				if (diff == 0)
+				{
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = tail.load(std::memory_order_relaxed);
+			}
+			cell->data = std::move(item);
+			cell->seq.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool pop(T& item)
+		{
+			size_t pos = head.load(std::memory_order_relaxed);
+			Cell* cell;
+			for (;;)
+			{
+				cell = &cells[pos & mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+				if (diff == 0)
+				{
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = head.load(std::memory_order_relaxed);
+			}
+			item = std::move(cell->data);
+			cell->seq.store(pos + mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		/** Approximate number of queued items */
+		size_t size() const
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			size_t h = head.load(std::memory_order_relaxed);
+			return t > h ? t - h : 0;
+		}
+
+		size_t capacity() const
+		{
+			return mask + 1;
+		}
+
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			T data;
+		};
+
+		std::unique_ptr<Cell[]> cells;
+		size_t mask;
+
+		// Keep the indices on separate cache lines
+		char pad0[64];
+		std::atomic<size_t> head;
+		char pad1[64];
+		std::atomic<size_t> tail;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_RING_BUFFER_H
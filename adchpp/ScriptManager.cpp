@@ -100,6 +100,14 @@ void ScriptManager::load()
 	}
 }
 
+size_t ScriptManager::getMemoryUsage() const
+{
+	size_t total = 0;
+	for (auto i = engines.begin(), iend = engines.end(); i != iend; ++i)
+		total += (*i)->getMemoryUsage();
+	return total;
+}
+
 void ScriptManager::reload()
 {
 	clearEngines();
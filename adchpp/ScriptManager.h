@@ -45,6 +45,9 @@ public:
 
 	void load();
 
+	/** Memory used by all script engines, in bytes */
+	size_t getMemoryUsage() const;
+
 	static const std::string className;
 
 private:
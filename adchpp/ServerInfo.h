@@ -32,6 +32,16 @@ namespace adchpp
 		std::string address6;
 		std::string port;
 
+		/** Unix domain socket to listen on instead of TCP; the bind addresses and TLS don't apply */
+		std::string path;
+		/** Permissions of the socket file in octal, empty to leave them to the umask */
+		std::string mode;
+		/** Peers allowed to connect to the socket, user names or ids separated by commas;
+		 * empty to leave it to the permissions */
+		std::string trustedUsers;
+		/** Connections start with a PROXY protocol header carrying the client address */
+		bool proxy = false;
+
 		struct TLSInfo
 		{
 			std::string cert;
@@ -71,6 +71,11 @@ namespace adchpp
 			}
 		}
 
+		bool empty() const
+		{
+			return slots.empty();
+		}
+
 		template <typename T> ConnectionPtr connect(const T& f)
 		{
 			return ConnectionPtr(new SlotConnection(this, slots.insert(slots.end(), f)));
@@ -19,19 +19,40 @@
 #include "SocketManager.h"
 #include "ClientManager.h"
 #include "Core.h"
+#include "Handoff.h"
+#include "KernelTLS.h"
 #include "LogManager.h"
 #include "ManagedSocket.h"
+#include "ProxyProtocol.h"
 #include "ServerInfo.h"
+#include "TLSContext.h"
+#include "UringService.h"
+#include "Watchdog.h"
+#include <baselib/File.h>
 #include <baselib/SimpleXML.h>
+#include <baselib/StringTokenizer.h>
+#include <baselib/Thread.h>
+#include <baselib/TimeUtil.h>
 
 #ifdef HAVE_OPENSSL
 #include <boost/asio/ssl.hpp>
 #endif
 
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/v6_only.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/date_time/posix_time/time_parsers.hpp>
 
+#ifndef _WIN32
+#include <pwd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace adchpp
 {
 
@@ -42,13 +63,38 @@ namespace adchpp
 	using boost::system::system_error;
 
 	SocketManager::SocketManager(Core& core)
-	: core(core), bufferSize(1024), maxBufferSize(16 * 1024), overflowTimeout(60 * 1000),
+	: core(core), handshakeThreads(1), sessionCacheSize(20480), sessionTimeout(2 * 60 * 60), ticketKeyLifetime(12 * 60 * 60), kernelTLS(false), backend(BACKEND_ASIO), egress(*this), preLoginLimit(0), preLoginNetworkLimit(0), preLogin(0), deferAccept(0), compressionLevel(0), writeCombining(false), bufferSize(1024), maxBufferSize(16 * 1024), overflowTimeout(60 * 1000),
 	  disconnectTimeout(10 * 1000), hasV4Address(false), hasV6Address(false)
 	{
 	}
 
+	SocketManager::~SocketManager()
+	{
+		stopHandshakeThreads();
+	}
+
 	const string SocketManager::className = "SocketManager";
 
+	static string getRemoteIp(basic_socket<ip::tcp>& sock)
+	{
+		try
+		{
+			return sock.remote_endpoint().address().to_string();
+		}
+		catch (const system_error&)
+		{
+			return Util::emptyString;
+		}
+	}
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+	// Unix domain sockets have no address, their streams are told the client's
+	static string getRemoteIp(basic_socket<local::stream_protocol>&)
+	{
+		return Util::emptyString;
+	}
+#endif
+
 	template <typename T> class SocketStream : public AsyncStream
 	{
 	public:
@@ -78,17 +124,28 @@ namespace adchpp
 
 		virtual std::string getIp()
 		{
-			try
-			{
-				return sock.lowest_layer().remote_endpoint().address().to_string();
-			}
-			catch (const system_error&)
-			{
-				return Util::emptyString;
-			}
+			return getRemoteIp(sock.lowest_layer());
 		}
 
 		virtual void prepareRead(const BufferPtr& buf, const Handler& handler)
+		{
+			asyncRead(sock, buf, handler);
+		}
+
+		virtual size_t read(const BufferPtr& buf)
+		{
+			return sock.read_some(buffer(buf->data(), buf->size()));
+		}
+
+		virtual void write(const BufferList& bufs, const Handler& handler)
+		{
+			asyncWrite(sock, bufs, handler);
+		}
+
+		T sock;
+
+	protected:
+		template <typename S, typename H> static void asyncRead(S& sock, const BufferPtr& buf, const H& handler)
 		{
 			if (buf)
 			{
@@ -100,12 +157,7 @@ namespace adchpp
 			}
 		}
 
-		virtual size_t read(const BufferPtr& buf)
-		{
-			return sock.read_some(buffer(buf->data(), buf->size()));
-		}
-
-		virtual void write(const BufferList& bufs, const Handler& handler)
+		template <typename S, typename H> static void asyncWrite(S& sock, const BufferList& bufs, const H& handler)
 		{
 			if (bufs.size() == 1)
 			{
@@ -130,8 +182,6 @@ namespace adchpp
 				sock.async_write_some(buffers, handler);
 			}
 		}
-
-		T sock;
 	};
 
 	class SimpleSocketStream : public SocketStream<ip::tcp::socket>
@@ -163,7 +213,9 @@ namespace adchpp
 
 		virtual void shutdown(const Handler& handler)
 		{
-			sock.shutdown(ip::tcp::socket::shutdown_send);
+			// The peer may be gone already, which is fine as we're closing anyway
+			error_code ec;
+			sock.shutdown(ip::tcp::socket::shutdown_send, ec);
 			sock.get_executor().execute(ShutdownHandler(handler));
 		}
 
@@ -176,11 +228,28 @@ namespace adchpp
 				sock.close(ec); // Ignore errors
 			}
 		}
+
+#ifndef _WIN32
+		virtual bool handOff(int& fd, std::string&)
+		{
+			// Nothing is read ahead
+			fd = sock.is_open() ? sock.native_handle() : -1;
+			return true;
+		}
+#endif
 	};
 
 #ifdef HAVE_OPENSSL
 
-	class TLSSocketStream : public SocketStream<ssl::stream<ip::tcp::socket>>
+	/**
+	 * When handshakes are offloaded, the socket belongs to SocketManager::handshakeIo and
+	 * the handshake runs on its threads, serialized by a strand. The result is handed to
+	 * the reactor, and from then on every handler is bound to the reactor thread.
+	 *
+	 * With kernel TLS, the record layer may then move into the socket itself, after which
+	 * reads and writes bypass OpenSSL.
+	 */
+	class TLSSocketStream : public SocketStream<ssl::stream<ip::tcp::socket>>, public enable_shared_from_this<TLSSocketStream>
 	{
 		typedef SocketStream<ssl::stream<ip::tcp::socket>> Stream;
 
@@ -197,23 +266,121 @@ namespace adchpp
 		};
 
 	public:
-		TLSSocketStream(io_service& x, ssl::context& y) : Stream(x, y)
+		TLSSocketStream(SocketManager& sm, io_service& x, ssl::context& y, const ListenerStatsPtr& listener)
+		: Stream(x, y), sm(sm), strand(x), listener(listener), handshaking(false), established(false), closed(false), kernelReceive(false), kernelSend(false), start(0)
 		{
 		}
 
+		~TLSSocketStream()
+		{
+			keepSession();
+		}
+
 		virtual void init(const std::function<void()>& postInit)
 		{
-			sock.async_handshake(ssl::stream_base::server,
-				std::bind(&TLSSocketStream::handleHandshake, this,
-				std::placeholders::_1, postInit));
+			handshaking = true;
+			start = Util::getHighResTimestamp();
+			auto self = shared_from_this();
+			boost::asio::post(strand, [self, postInit] {
+				self->sock.async_handshake(ssl::stream_base::server, boost::asio::bind_executor(self->strand,
+					std::bind(&TLSSocketStream::handleHandshake, self, std::placeholders::_1, postInit)));
+			});
+		}
+
+		virtual void prepareRead(const BufferPtr& buf, const Handler& handler)
+		{
+			if (handshaking || closed)
+			{
+				sm.addJob(std::bind(handler, error_code(error::operation_aborted), 0));
+			}
+			else if (!pending.empty())
+			{
+				// Decrypted by OpenSSL before the hand-over to the kernel
+				size_t n = 0;
+				if (buf)
+				{
+					n = std::min(buf->size(), pending.size());
+					memcpy(buf->data(), pending.data(), n);
+					pending.erase(0, n);
+				}
+				sm.addJob(std::bind(handler, error_code(), n));
+			}
+			else if (kernelReceive)
+			{
+				asyncRead(sock.next_layer(), buf, boost::asio::bind_executor(sm.io, handler));
+			}
+			else
+			{
+				asyncRead(sock, buf, boost::asio::bind_executor(sm.io, handler));
+			}
+		}
+
+		virtual size_t read(const BufferPtr& buf)
+		{
+			return kernelReceive ? sock.next_layer().read_some(buffer(buf->data(), buf->size())) : Stream::read(buf);
+		}
+
+		virtual void write(const BufferList& bufs, const Handler& handler)
+		{
+			if (handshaking || closed)
+				sm.addJob(std::bind(handler, error_code(error::operation_aborted), 0));
+			else if (kernelSend)
+				asyncWrite(sock.next_layer(), bufs, boost::asio::bind_executor(sm.io, handler));
+			else
+				asyncWrite(sock, bufs, boost::asio::bind_executor(sm.io, handler));
 		}
 
 		virtual void shutdown(const Handler& handler)
 		{
-			sock.async_shutdown(ShutdownHandler(handler));
+			if (handshaking || closed)
+			{
+				// No session to close yet
+				close();
+				sm.addJob(std::bind(handler, error_code(), 0));
+				return;
+			}
+
+			if (kernelReceive)
+			{
+				// OpenSSL can't wait for the peer's close_notify any more; when sending is
+				// handed over too, ours can at least be sent
+				if (kernelSend) KernelTLS::sendCloseNotify(sock.lowest_layer().native_handle());
+				error_code ec;
+				sock.lowest_layer().shutdown(ip::tcp::socket::shutdown_send, ec);
+				sm.addJob(std::bind(handler, error_code(), 0));
+				return;
+			}
+
+			sock.async_shutdown(boost::asio::bind_executor(sm.io, ShutdownHandler(handler)));
 		}
 
 		virtual void close()
+		{
+			if (closed) return;
+			closed = true;
+
+			if (handshaking)
+			{
+				// The handshake owns the socket until it's done
+				auto self = shared_from_this();
+				boost::asio::post(strand, [self] { self->closeSocket(); });
+			}
+			else
+			{
+				keepSession();
+				closeSocket();
+			}
+		}
+
+	private:
+		void keepSession()
+		{
+			// OpenSSL evicts sessions that weren't shut down from its cache, but an
+			// abortive close doesn't make a finished handshake any less valid
+			if (established) SSL_set_shutdown(sock.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+		}
+
+		void closeSocket()
 		{
 			// Abortive close, just go away...
 			if (sock.lowest_layer().is_open())
@@ -223,14 +390,69 @@ namespace adchpp
 			}
 		}
 
-	private:
+		// Runs on the strand
 		void handleHandshake(const error_code& ec, const std::function<void()>& postInit)
 		{
-			if (!ec)
+			auto self = shared_from_this();
+			sm.addJob([self, ec, postInit] { self->completeHandshake(ec, postInit); });
+		}
+
+		void completeHandshake(const error_code& ec, const std::function<void()>& postInit)
+		{
+			handshaking = false;
+			if (ec || closed)
 			{
-				postInit();
+				listener->handshakeFailures++;
+				return;
 			}
+
+			established = true;
+			listener->handshakes++;
+			if (SSL_session_reused(sock.native_handle())) listener->resumed++;
+			sm.handshakeTime.add(Util::getHighResTimestamp() - start);
+			if (sm.getKernelTLS()) enableKernelTLS();
+			postInit();
+		}
+
+		void enableKernelTLS()
+		{
+			int directions = KernelTLS::enable(sock.native_handle(), sock.lowest_layer().native_handle(), pending);
+			kernelReceive = (directions & KernelTLS::RX) != 0;
+			kernelSend = (directions & KernelTLS::TX) != 0;
+			if (kernelReceive) listener->kernelReceive++;
+			if (kernelSend) listener->kernelSend++;
+		}
+
+		SocketManager& sm;
+		io_service::strand strand;
+		ListenerStatsPtr listener;
+
+		// Only used on the reactor thread
+		bool handshaking;
+		bool established;
+		bool closed;
+		bool kernelReceive;
+		bool kernelSend;
+		std::string pending;
+		uint64_t start;
+	};
+
+	class SocketManager::HandshakeThread : public Thread
+	{
+	public:
+		HandshakeThread(io_service& io) : io(io)
+		{
 		}
+
+	protected:
+		int run() override
+		{
+			io.run();
+			return 0;
+		}
+
+	private:
+		io_service& io;
 	};
 
 #endif
@@ -248,34 +470,43 @@ namespace adchpp
 			const SocketManager::IncomingHandler& handler_,
 			ServerInfoPtr& info,
 			const ip::tcp::endpoint& endpoint)
-		: sm(sm), acceptor(sm.io), handler(handler_), si(info)
+		: sm(sm), acceptor(sm.io), handler(handler_), si(info), stats(make_shared<ListenerStats>())
 		{
-			acceptor.open(endpoint.protocol());
-			acceptor.set_option(socket_base::reuse_address(true));
-			if (endpoint.protocol() == ip::tcp::v6())
+			int fd = sm.getCore().getHandoff().takeListener(endpoint);
+			if (fd != -1)
 			{
-				acceptor.set_option(ip::v6_only(true));
+				acceptor.assign(endpoint.protocol(), fd);
 			}
+			else
+			{
+				acceptor.open(endpoint.protocol());
+				acceptor.set_option(socket_base::reuse_address(true));
+				if (endpoint.protocol() == ip::tcp::v6())
+				{
+					acceptor.set_option(ip::v6_only(true));
+				}
 
-			auto a = endpoint.address().to_string();
+				acceptor.bind(endpoint);
+				acceptor.listen(socket_base::max_connections);
+			}
 
-			acceptor.bind(endpoint);
-			acceptor.listen(socket_base::max_connections);
+#ifdef TCP_DEFER_ACCEPT
+			// Connections that never send anything then don't get past the kernel
+			int deferAccept = sm.getDeferAccept();
+			if (deferAccept > 0 &&
+				::setsockopt(acceptor.native_handle(), IPPROTO_TCP, TCP_DEFER_ACCEPT, &deferAccept, sizeof(deferAccept)) != 0)
+			{
+				LOGC(sm.getCore(), SocketManager::className, "Couldn't defer accepting connections: " + Util::translateError());
+			}
+#endif
 
+			stats->address = formatEndpoint(endpoint);
+			stats->secure = info->secure();
 			LOGC(sm.getCore(), SocketManager::className,
-				 "Listening on " + formatEndpoint(endpoint) + " (Encrypted: " + (info->secure() ? "Yes)" : "No)"));
+				 "Listening on " + stats->address + " (Encrypted: " + (info->secure() ? "Yes)" : "No)") + (fd != -1 ? " (taken over)" : ""));
 
 #ifdef HAVE_OPENSSL
-			if (info->secure())
-			{
-				context.reset(new ssl::context(ssl::context::tls));
-
-				context->set_options(ssl::context::no_sslv2 | ssl::context::no_sslv3 | ssl::context::single_dh_use);
-				context->use_certificate_chain_file(info->TLSParams.cert);
-				context->use_private_key_file(info->TLSParams.pkey, ssl::context::pem);
-				if (!info->TLSParams.dh.empty())
-					context->use_tmp_dh_file(info->TLSParams.dh);
-			}
+			if (info->secure()) context = sm.getTLSContext(info);
 #endif
 		}
 
@@ -284,15 +515,25 @@ namespace adchpp
 
 		void prepareAccept()
 		{
-			if (!sm.work.get())
+			if (!sm.work.get() || !acceptor.is_open())
 			{
 				return;
 			}
 
+#ifdef HAVE_IO_URING
+			if (sm.uring && !si->secure())
+			{
+				sm.uring->accept(acceptor.native_handle(),
+					std::bind(&SocketFactory::handleUringAccept, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+				return;
+			}
+#endif
+
 #ifdef HAVE_OPENSSL
 			if (context)
 			{
-				auto s = make_shared<TLSSocketStream>(sm.io, *context);
+				auto& io = sm.handshakers.empty() ? sm.io : sm.handshakeIo;
+				auto s = make_shared<TLSSocketStream>(sm, io, context->get(), stats);
 				auto socket = make_shared<ManagedSocket>(sm, s, si);
 				acceptor.async_accept(s->sock.lowest_layer(),
 					std::bind(&SocketFactory::handleAccept, shared_from_this(),
@@ -312,18 +553,46 @@ namespace adchpp
 		}
 
 		void handleAccept(const error_code& ec, const ManagedSocketPtr& socket)
+		{
+			accepted(ec, socket);
+			prepareAccept();
+		}
+
+#ifdef HAVE_IO_URING
+		/** The ring keeps accepting on its own */
+		void handleUringAccept(const error_code& ec, int fd)
+		{
+			if (ec)
+			{
+				LOGC(sm.getCore(), SocketManager::className, "Error accepting on " + stats->address + ": " + ec.message());
+				return;
+			}
+			accepted(ec, make_shared<ManagedSocket>(sm, sm.uring->createStream(fd), si));
+		}
+#endif
+
+		void accepted(const error_code& ec, const ManagedSocketPtr& socket)
 		{
 			if (!ec)
 			{
-				socket->sock->setOptions(sm.getBufferSize());
 				auto ip = socket->sock->getIp();
 				auto p = ip.find("%");
 				socket->setIp(p != string::npos ? ip.substr(0, p) : ip);
+				if (!sm.admit(*socket))
+				{
+					// Before a Client gets created for it
+					stats->rejected++;
+					socket->sock->close();
+					return;
+				}
+
+				socket->sock->setOptions(sm.getBufferSize());
+				socket->listener = stats;
+				stats->accepted++;
+				stats->connections++;
 			}
 
 			completeAccept(ec, socket);
-
-			prepareAccept();
 		}
 
 		void completeAccept(const error_code& ec, const ManagedSocketPtr& socket)
@@ -334,6 +603,9 @@ namespace adchpp
 
 		void close()
 		{
+#ifdef HAVE_IO_URING
+			if (sm.uring) sm.uring->cancel(acceptor.native_handle());
+#endif
 			acceptor.close();
 		}
 
@@ -341,11 +613,256 @@ namespace adchpp
 		ip::tcp::acceptor acceptor;
 		SocketManager::IncomingHandler handler;
 		ServerInfoPtr si;
+		ListenerStatsPtr stats;
 #ifdef HAVE_OPENSSL
-		unique_ptr<ssl::context> context;
+		shared_ptr<TLSContext> context;
+#endif
+	};
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+	/** A connection to a unix domain socket listener; the address is the one the proxy passed on */
+	class LocalSocketStream : public SocketStream<local::stream_protocol::socket>
+	{
+		typedef SocketStream<local::stream_protocol::socket> Stream;
+
+	public:
+		LocalSocketStream(SocketManager& sm, io_service& x) : Stream(x), sm(sm)
+		{
+		}
+
+		virtual void init(const std::function<void()>& postInit)
+		{
+			postInit();
+		}
+
+		virtual std::string getIp()
+		{
+			return ip;
+		}
+
+		virtual void shutdown(const Handler& handler)
+		{
+			error_code ec;
+			sock.shutdown(local::stream_protocol::socket::shutdown_send, ec);
+			sm.addJob(std::bind(handler, error_code(), 0));
+		}
+
+		virtual void close()
+		{
+			if (sock.is_open())
+			{
+				error_code ec;
+				sock.close(ec);
+			}
+		}
+
+		/** Empty until the PROXY header has been read */
+		std::string ip;
+
+	private:
+		SocketManager& sm;
+	};
+
+	/**
+	 * Listens on a unix domain socket, for a front proxy or bots running on the same host.
+	 * The peer's user id decides whether it may connect at all; with Proxy set, the
+	 * client address comes from the PROXY protocol header that starts each connection,
+	 * which is read before the connection is handed to the rest of the hub.
+	 */
+	class LocalSocketFactory : public enable_shared_from_this<LocalSocketFactory>
+	{
+	public:
+		LocalSocketFactory(SocketManager& sm, const SocketManager::IncomingHandler& handler_, ServerInfoPtr& info)
+		: sm(sm), acceptor(sm.io), handler(handler_), si(info), stats(make_shared<ListenerStats>())
+		{
+			// Left behind by an earlier run, or by the process this one took over from
+			File::deleteFile(si->path);
+
+			local::stream_protocol::endpoint endpoint(si->path);
+			acceptor.open(endpoint.protocol());
+			acceptor.bind(endpoint);
+			acceptor.listen(socket_base::max_connections);
+
+			if (!si->mode.empty() && ::chmod(si->path.c_str(), (mode_t) strtoul(si->mode.c_str(), nullptr, 8)) != 0)
+				LOGC(sm.getCore(), SocketManager::className, "Couldn't set the permissions of " + si->path + ": " + Util::translateError());
+
+			string users = si->trustedUsers;
+			users.erase(std::remove(users.begin(), users.end(), ' '), users.end());
+			StringTokenizer<string> st(users, ',');
+			for (auto& name : st.getTokens())
+			{
+				if (name.empty()) continue;
+
+				struct passwd* pw = ::getpwnam(name.c_str());
+				if (pw)
+					trustedUids.push_back(pw->pw_uid);
+				else if (name.find_first_not_of("0123456789") == string::npos)
+					trustedUids.push_back((uid_t) Util::toUInt32(name));
+				else
+					LOGC(sm.getCore(), SocketManager::className, "Unknown user " + name + " in TrustedUsers of " + si->path);
+			}
+			restricted = !st.getTokens().empty();
+			if (si->proxy && !restricted)
+				LOGC(sm.getCore(), SocketManager::className, "Warning: any local user who can open " + si->path +
+					" can claim any client address; set TrustedUsers to limit the PROXY protocol to the proxy");
+
+			stats->address = "unix:" + si->path;
+			LOGC(sm.getCore(), SocketManager::className,
+				 "Listening on " + stats->address + " (Encrypted: No)" + (si->proxy ? " (PROXY protocol)" : ""));
+		}
+
+		LocalSocketFactory(const LocalSocketFactory&) = delete;
+		LocalSocketFactory& operator= (const LocalSocketFactory&) = delete;
+
+		void prepareAccept()
+		{
+			if (!sm.work.get() || !acceptor.is_open()) return;
+
+			auto s = make_shared<LocalSocketStream>(sm, sm.io);
+			acceptor.async_accept(s->sock, std::bind(&LocalSocketFactory::handleAccept, shared_from_this(), _1, s));
+		}
+
+		void handleAccept(const error_code& ec, const shared_ptr<LocalSocketStream>& s)
+		{
+			if (ec == error::operation_aborted) return;
+
+			if (!ec)
+			{
+				if (!isTrusted(*s))
+				{
+					stats->rejected++;
+					s->close();
+				}
+				else if (si->proxy)
+				{
+					// Proxies send the header right away, anything else is stuck
+					weak_ptr<LocalSocketStream> w(s);
+					auto listener = stats;
+					sm.addJob(PROXY_TIMEOUT, [w, listener] {
+						auto s = w.lock();
+						if (s && s->ip.empty() && s->sock.is_open())
+						{
+							listener->rejected++;
+							s->close();
+						}
+					});
+					readHeader(s);
+				}
+				else
+				{
+					s->ip = "127.0.0.1";
+					accepted(s);
+				}
+			}
+			else
+			{
+				LOGC(sm.getCore(), SocketManager::className, "Error accepting on " + stats->address + ": " + ec.message());
+			}
+
+			prepareAccept();
+		}
+
+		void readHeader(const shared_ptr<LocalSocketStream>& s)
+		{
+			s->sock.async_wait(socket_base::wait_read, std::bind(&LocalSocketFactory::completeHeader, shared_from_this(), _1, s));
+		}
+
+		void completeHeader(const error_code& ec, const shared_ptr<LocalSocketStream>& s)
+		{
+			if (ec || !s->sock.is_open()) return;
+
+			// Peeking leaves what follows the header for ManagedSocket to read
+			uint8_t buf[ProxyProtocol::MAX_HEADER];
+			ssize_t n = ::recv(s->sock.native_handle(), buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			{
+				readHeader(s);
+				return;
+			}
+
+			string ip;
+			int len = n > 0 ? ProxyProtocol::parse(buf, (size_t) n, ip) : -1;
+			if (len == 0)
+			{
+				// The start of the header stays readable, so waiting for more data would
+				// return right away; look again in a moment instead
+				auto self = shared_from_this();
+				sm.addJob(PROXY_RETRY, [self, s] {
+					if (s->sock.is_open()) self->readHeader(s);
+				});
+				return;
+			}
+			if (len < 0 || ::recv(s->sock.native_handle(), buf, len, MSG_DONTWAIT) != len)
+			{
+				if (n > 0) LOGC(sm.getCore(), SocketManager::className, "Invalid PROXY protocol header on " + stats->address);
+				stats->rejected++;
+				s->close();
+				return;
+			}
+
+			s->ip = ip.empty() ? "127.0.0.1" : ip;
+			accepted(s);
+		}
+
+		void accepted(const shared_ptr<LocalSocketStream>& s)
+		{
+			auto socket = make_shared<ManagedSocket>(sm, s, si);
+			socket->setIp(s->ip);
+			if (!sm.admit(*socket))
+			{
+				stats->rejected++;
+				s->close();
+				return;
+			}
+
+			socket->listener = stats;
+			stats->accepted++;
+			stats->connections++;
+
+			handler(socket);
+			socket->completeAccept(error_code());
+		}
+
+		void close()
+		{
+			acceptor.close();
+		}
+
+		SocketManager& sm;
+		local::stream_protocol::acceptor acceptor;
+		SocketManager::IncomingHandler handler;
+		ServerInfoPtr si;
+		ListenerStatsPtr stats;
+
+	private:
+		static const long PROXY_TIMEOUT = 10 * 1000;
+		// Milliseconds between looks at a header that hasn't arrived in full
+		static const long PROXY_RETRY = 10;
+
+		bool isTrusted(LocalSocketStream& s)
+		{
+			if (!restricted) return true;
+
+			uid_t uid;
+#ifdef SO_PEERCRED
+			struct ucred cred;
+			socklen_t len = sizeof(cred);
+			if (::getsockopt(s.sock.native_handle(), SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+			uid = cred.uid;
+#else
+			gid_t gid;
+			if (::getpeereid(s.sock.native_handle(), &uid, &gid) != 0) return false;
 #endif
+			return std::find(trustedUids.begin(), trustedUids.end(), uid) != trustedUids.end();
+		}
+
+		std::vector<uid_t> trustedUids;
+		bool restricted;
 	};
 
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
 	void SocketManager::prepareProtocol(ServerInfoPtr& si, bool v6)
 	{
 		const string proto = v6 ? "IPv6" : "IPv4";
@@ -390,16 +907,72 @@ namespace adchpp
 		}
 	}
 
+	void SocketManager::prepareLocal(ServerInfoPtr& si)
+	{
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		try
+		{
+			auto factory = make_shared<LocalSocketFactory>(*this, incomingHandler, si);
+			factory->prepareAccept();
+			localFactories.push_back(factory);
+		}
+		catch (const std::exception& e)
+		{
+			LOG(SocketManager::className, "Error while listening on " + si->path + ": " + e.what());
+		}
+#else
+		LOG(SocketManager::className, "Unix domain sockets are not supported on this platform, not listening on " + si->path);
+#endif
+	}
+
 	int SocketManager::run()
 	{
 		// Sleep(10000);
 		LOG(SocketManager::className, "Starting");
 
 		work.reset(new io_service::work(io));
+		startHandshakeThreads();
+
+#ifdef HAVE_OPENSSL
+		if (kernelTLS && !KernelTLS::isSupported())
+		{
+			LOG(SocketManager::className, "Kernel TLS isn't supported by this build, encryption stays with OpenSSL");
+			kernelTLS = false;
+		}
+#endif
+
+#ifndef HAVE_ZLIB
+		if (compressionLevel > 0)
+		{
+			LOG(SocketManager::className, "Compression isn't supported by this build, connections stay uncompressed");
+			compressionLevel = 0;
+		}
+#endif
+
+		if (backend == BACKEND_IO_URING)
+		{
+#ifdef HAVE_IO_URING
+			uring = make_shared<UringService>(*this);
+			auto ec = uring->start();
+			if (ec)
+			{
+				LOG(SocketManager::className, "io_uring isn't available (" + ec.message() + "), using asio for sockets");
+				uring.reset();
+			}
+#else
+			LOG(SocketManager::className, "io_uring isn't supported by this build, using asio for sockets");
+#endif
+		}
 
 		for (auto i = servers.begin(), iend = servers.end(); i != iend; ++i)
 		{
 			auto& si = *i;
+			if (!si->path.empty())
+			{
+				prepareLocal(si);
+				continue;
+			}
+
 			bool listenAll = si->bind4.empty() && si->bind6.empty();
 
 			if (!si->bind4.empty() || listenAll)
@@ -409,16 +982,186 @@ namespace adchpp
 		}
 
 		core.getClientManager().prepareSupports(hasV4Address && hasV6Address);
+		core.getHandoff().adopt();
+
+		if (!tlsContexts.empty() && ticketKeyLifetime > 0)
+			addTimedJob(ticketKeyLifetime * 1000, std::bind(&SocketManager::rotateTicketKeys, this));
+
 		io.run();
 		io.reset();
 		return 0;
 	}
 
+	ManagedSocketPtr SocketManager::accept(const AsyncStreamPtr& stream, const ServerInfoPtr& server)
+	{
+		auto socket = make_shared<ManagedSocket>(*this, stream, server);
+		socket->setIp(stream->getIp());
+		incomingHandler(socket);
+		socket->completeAccept(error_code());
+		return socket;
+	}
+
+	bool SocketManager::admit(ManagedSocket& socket)
+	{
+		if (preLoginLimit > 0 && preLogin >= preLoginLimit) return false;
+
+		string network;
+		if (preLoginNetworkLimit > 0)
+		{
+			error_code ec;
+			auto address = ip::make_address(socket.getIp(), ec);
+			if (!ec)
+			{
+				if (address.is_v4())
+				{
+					auto bytes = address.to_v4().to_bytes();
+					network.assign(reinterpret_cast<const char*>(bytes.data()), 3);
+				}
+				else
+				{
+					auto bytes = address.to_v6().to_bytes();
+					network.assign(reinterpret_cast<const char*>(bytes.data()), 8);
+				}
+
+				auto i = preLoginNetworks.find(network);
+				if (i != preLoginNetworks.end() && i->second >= preLoginNetworkLimit) return false;
+			}
+		}
+
+		preLogin++;
+		if (!network.empty()) preLoginNetworks[network]++;
+		socket.preLogin = true;
+		socket.preLoginNetwork.swap(network);
+		return true;
+	}
+
+	void SocketManager::release(ManagedSocket& socket)
+	{
+		if (!socket.preLogin) return;
+
+		socket.preLogin = false;
+		preLogin--;
+		if (!socket.preLoginNetwork.empty())
+		{
+			auto i = preLoginNetworks.find(socket.preLoginNetwork);
+			if (i != preLoginNetworks.end() && --i->second == 0) preLoginNetworks.erase(i);
+			string().swap(socket.preLoginNetwork);
+		}
+	}
+
+	vector<ListenerStatsPtr> SocketManager::getListenerStats() const
+	{
+		vector<ListenerStatsPtr> ret;
+		for (auto i = factories.begin(), iend = factories.end(); i != iend; ++i)
+			ret.push_back((*i)->stats);
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		for (auto i = localFactories.begin(), iend = localFactories.end(); i != iend; ++i)
+			ret.push_back((*i)->stats);
+#endif
+		return ret;
+	}
+
+	shared_ptr<TLSContext> SocketManager::getTLSContext(const ServerInfoPtr& si)
+	{
+#ifdef HAVE_OPENSSL
+		// The IPv4 and IPv6 listeners of a server share sessions
+		auto& context = tlsContexts[si.get()];
+		if (!context)
+		{
+			try
+			{
+				context = make_shared<TLSContext>(*si, sessionCacheSize, sessionTimeout, ticketKeyLifetime > 0, kernelTLS);
+			}
+			catch (...)
+			{
+				tlsContexts.erase(si.get());
+				throw;
+			}
+		}
+		return context;
+#else
+		return nullptr;
+#endif
+	}
+
+	vector<shared_ptr<TLSContext>> SocketManager::getTLSContexts() const
+	{
+		vector<shared_ptr<TLSContext>> ret;
+		for (auto& i : tlsContexts)
+			ret.push_back(i.second);
+		return ret;
+	}
+
+	void SocketManager::rotateTicketKeys()
+	{
+#ifdef HAVE_OPENSSL
+		for (auto& i : tlsContexts)
+			if (!i.second->rotateTicketKey())
+				LOG(SocketManager::className, "Unable to make a new session ticket key for port " + i.second->getPort());
+#endif
+	}
+
 	void SocketManager::closeFactories()
 	{
 		for (auto i = factories.begin(), iend = factories.end(); i != iend; ++i)
 			(*i)->close();
 		factories.clear();
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		// Not handed over: the process taking over makes a new socket file
+		for (auto i = localFactories.begin(), iend = localFactories.end(); i != iend; ++i)
+			(*i)->close();
+		localFactories.clear();
+#endif
+	}
+
+	vector<int> SocketManager::handOffListeners()
+	{
+		vector<int> ret;
+#ifndef _WIN32
+		for (auto& f : factories)
+		{
+			// The copy keeps listening after ours is closed
+			int fd = ::dup(f->acceptor.native_handle());
+			if (fd != -1) ret.push_back(fd);
+		}
+#endif
+		closeFactories();
+		return ret;
+	}
+
+	ManagedSocketPtr SocketManager::adopt(int fd)
+	{
+#ifndef _WIN32
+		ip::tcp::endpoint local;
+		socklen_t len = (socklen_t) local.capacity();
+		if (::getsockname(fd, local.data(), &len) != 0) return nullptr;
+		local.resize(len);
+
+		for (auto& f : factories)
+		{
+			error_code ec;
+			if (f->si->secure() || f->acceptor.local_endpoint(ec).port() != local.port() || ec) continue;
+
+			AsyncStreamPtr stream;
+#ifdef HAVE_IO_URING
+			if (uring) stream = uring->createStream(fd);
+#endif
+			if (!stream)
+			{
+				auto s = make_shared<SimpleSocketStream>(io);
+				s->sock.assign(local.protocol(), fd, ec);
+				if (ec) return nullptr;
+				stream = s;
+			}
+
+			auto socket = make_shared<ManagedSocket>(*this, stream, f->si);
+			socket->setIp(stream->getIp());
+			socket->listener = f->stats;
+			f->stats->connections++;
+			return socket;
+		}
+#endif
+		return nullptr;
 	}
 
 	void SocketManager::addJob(const Callback& callback) noexcept
@@ -426,6 +1169,24 @@ namespace adchpp
 		io.post(callback);
 	}
 
+	void SocketManager::scheduleFlush(const ManagedSocketPtr& socket)
+	{
+		// Handlers that are ready when the flush is posted run before it
+		if (flushList.empty()) addJob(std::bind(&SocketManager::flushWrites, this));
+		flushList.push_back(socket);
+	}
+
+	void SocketManager::flushWrites()
+	{
+		vector<ManagedSocketPtr> sockets;
+		sockets.swap(flushList);
+
+		stats.flushCalls++;
+		stats.flushSockets += sockets.size();
+		for (auto i = sockets.begin(), iend = sockets.end(); i != iend; ++i)
+			(*i)->flush();
+	}
+
 	void SocketManager::addJob(const long msec, const Callback& callback)
 	{
 		addJob(boost::posix_time::milliseconds(msec), callback);
@@ -478,7 +1239,11 @@ namespace adchpp
 				setTimer(timer, duration, callback);
 			}
 
-			addJob(*callback);
+			Callback job = *callback;
+			addJob([this, job] {
+				Watchdog::Scope scope(core.getWatchdog(), "timer");
+				job();
+			});
 		}
 
 		if (!run_on)
@@ -501,10 +1266,48 @@ namespace adchpp
 	void SocketManager::shutdown()
 	{
 		closeFactories();
+		stopHandshakeThreads();
 		work.reset();
 		io.stop();
 	}
 
+	void SocketManager::startHandshakeThreads()
+	{
+#ifdef HAVE_OPENSSL
+		bool secure = false;
+		for (auto& si : servers)
+			if (si->secure()) secure = true;
+		if (!secure) return;
+
+		handshakeWork.reset(new io_service::work(handshakeIo));
+		for (size_t i = 0; i < handshakeThreads; ++i)
+		{
+			unique_ptr<HandshakeThread> t(new HandshakeThread(handshakeIo));
+			try
+			{
+				t->start(0, "TLSHandshake");
+			}
+			catch (const ThreadException& e)
+			{
+				LOG(SocketManager::className, "Unable to start a TLS handshake thread: " + e.getError());
+				break;
+			}
+			handshakers.push_back(std::move(t));
+		}
+#endif
+	}
+
+	void SocketManager::stopHandshakeThreads()
+	{
+		if (handshakers.empty()) return;
+
+		handshakeWork.reset();
+		handshakeIo.stop();
+		for (auto& t : handshakers)
+			t->join();
+		handshakers.clear();
+	}
+
 	void SocketManager::onLoad(const SimpleXML& xml) noexcept
 	{
 		servers.clear();
@@ -20,12 +20,18 @@
 #define ADCHPP_SOCKETMANAGER_H
 
 #include <baselib/BaseUtil.h>
+#include "AsyncStream.h"
+#include "CommandStats.h"
+#include "EgressScheduler.h"
 #include "ServerInfo.h"
 #include "forward.h"
 
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_service.hpp>
 
+#include <map>
+#include <unordered_map>
+
 class SimpleXML;
 
 namespace adchpp
@@ -34,16 +40,45 @@ namespace adchpp
 	struct SocketStats
 	{
 		SocketStats()
-		: queueCalls(0), queueBytes(0), sendCalls(0), sendBytes(0), recvCalls(0), recvBytes(0)
+		: queueCalls(0), queueBytes(0), dropCalls(0), dropBytes(0), sendCalls(0), sendBytes(0), recvCalls(0), recvBytes(0),
+		  compressStreams(0), compressIn(0), compressOut(0), compressTime(0), flushCalls(0), flushSockets(0)
 		{
 		}
 
 		size_t queueCalls;
 		int64_t queueBytes;
+		int64_t dropCalls; // buffers dropped because the output buffer was full
+		int64_t dropBytes;
 		size_t sendCalls;
 		int64_t sendBytes;
 		int64_t recvCalls;
 		int64_t recvBytes;
+		int64_t compressStreams; // connections with ZLIF compression on
+		int64_t compressIn;
+		int64_t compressOut;
+		uint64_t compressTime; // nanoseconds spent in zlib
+		int64_t flushCalls; // combined writes flushed at the end of a reactor pass
+		int64_t flushSockets;
+	};
+
+	/** Connection counters of a single listening endpoint */
+	struct ListenerStats
+	{
+		ListenerStats() : secure(false), accepted(0), rejected(0), connections(0), handshakes(0), handshakeFailures(0), resumed(0), kernelReceive(0), kernelSend(0)
+		{
+		}
+
+		std::string address;
+		bool secure;
+		int64_t accepted;
+		int64_t rejected; // over the pre-login budget
+		int64_t connections;
+		int64_t handshakes; // completed TLS handshakes
+		int64_t handshakeFailures;
+		int64_t resumed; // handshakes that resumed an earlier session
+		// connections whose decryption / encryption was handed over to the kernel
+		int64_t kernelReceive;
+		int64_t kernelSend;
 	};
 
 	class SocketManager
@@ -89,6 +124,10 @@ namespace adchpp
 
 		int run();
 
+		/** Hand over a connected stream as if a listener had accepted it; this lets
+		 * benchmarks drive the hub without real sockets */
+		ManagedSocketPtr accept(const AsyncStreamPtr& stream, const ServerInfoPtr& server);
+
 		void setBufferSize(size_t newSize)
 		{
 			bufferSize = newSize;
@@ -130,28 +169,234 @@ namespace adchpp
 			return stats;
 		}
 
+		/** Hub-wide output bandwidth cap */
+		EgressScheduler& getEgressScheduler()
+		{
+			return egress;
+		}
+
+		std::vector<ListenerStatsPtr> getListenerStats() const;
+
+		/** Threads running TLS handshakes; 0 runs them on the reactor thread */
+		void setHandshakeThreads(size_t n)
+		{
+			handshakeThreads = n;
+		}
+		size_t getHandshakeThreads() const
+		{
+			return handshakeThreads;
+		}
+
+		/** Maximum number of TLS sessions cached per <Server>, 0 to disable the cache */
+		void setSessionCacheSize(size_t n)
+		{
+			sessionCacheSize = n;
+		}
+		size_t getSessionCacheSize() const
+		{
+			return sessionCacheSize;
+		}
+
+		/** How long TLS sessions may be resumed, in seconds */
+		void setSessionTimeout(long seconds)
+		{
+			sessionTimeout = seconds;
+		}
+		long getSessionTimeout() const
+		{
+			return sessionTimeout;
+		}
+
+		/** Seconds between session ticket key changes, 0 to disable session tickets */
+		void setTicketKeyLifetime(long seconds)
+		{
+			ticketKeyLifetime = seconds;
+		}
+		long getTicketKeyLifetime() const
+		{
+			return ticketKeyLifetime;
+		}
+
+		/** Hand the encryption of established TLS connections over to the kernel where possible */
+		void setKernelTLS(bool enable)
+		{
+			kernelTLS = enable;
+		}
+		bool getKernelTLS() const
+		{
+			return kernelTLS;
+		}
+
+		/** zlib level for clients that support ZLIF (1-9), 0 to leave their connections uncompressed */
+		void setCompressionLevel(int level)
+		{
+			compressionLevel = level;
+		}
+		int getCompressionLevel() const
+		{
+			return compressionLevel;
+		}
+
+		/** Hold writes back until the reactor has run the handlers that are ready, so that a
+		 * burst of broadcasts leaves each socket in one write instead of one per message */
+		void setWriteCombining(bool enable)
+		{
+			writeCombining = enable;
+		}
+		bool getWriteCombining() const
+		{
+			return writeCombining;
+		}
+
+		/** Connections that haven't logged in yet, across all listeners (0 = no limit);
+		 * connections past it are closed right after being accepted */
+		void setPreLoginLimit(size_t n)
+		{
+			preLoginLimit = n;
+		}
+		size_t getPreLoginLimit() const
+		{
+			return preLoginLimit;
+		}
+
+		/** The same for connections from one /24 (IPv4) or /64 (IPv6) network */
+		void setPreLoginNetworkLimit(size_t n)
+		{
+			preLoginNetworkLimit = n;
+		}
+		size_t getPreLoginNetworkLimit() const
+		{
+			return preLoginNetworkLimit;
+		}
+
+		/** Connections counted in the pre-login budget */
+		size_t getPreLogin() const
+		{
+			return preLogin;
+		}
+
+		/** Seconds the kernel may hold a new connection until the client sends something
+		 * (TCP_DEFER_ACCEPT, Linux), 0 to accept right away */
+		void setDeferAccept(int seconds)
+		{
+			deferAccept = seconds;
+		}
+		int getDeferAccept() const
+		{
+			return deferAccept;
+		}
+
+		enum Backend
+		{
+			BACKEND_ASIO,
+			BACKEND_IO_URING
+		};
+
+		/** Socket I/O for plain connections; io_uring falls back to asio where it isn't available */
+		void setBackend(Backend b)
+		{
+			backend = b;
+		}
+		Backend getBackend() const
+		{
+			return backend;
+		}
+
+		/** The io_uring backend while it's in use, null otherwise */
+		const std::shared_ptr<UringService>& getUring() const
+		{
+			return uring;
+		}
+
+		/** TLS settings and session caches, one per secure <Server> */
+		std::vector<std::shared_ptr<TLSContext>> getTLSContexts() const;
+
+		/** Time from accepting a TLS connection to the end of its handshake, in nanoseconds */
+		const CommandStats::Histogram& getHandshakeTime() const
+		{
+			return handshakeTime;
+		}
+
 		Core& getCore()
 		{
 			return core;
 		}
 
+		~SocketManager();
+
 	private:
 		friend class Core;
+		friend class Handoff;
 		friend class ManagedSocket;
+		friend class MetricsServer;
 		friend class SocketFactory;
+		friend class LocalSocketFactory;
+		friend class TLSSocketStream;
+		friend class UringService;
+
+		class HandshakeThread;
 
 		void prepareProtocol(ServerInfoPtr& si, bool v6);
+		void prepareLocal(ServerInfoPtr& si);
 		void closeFactories();
+		/** Stop accepting and give away the listening sockets @return Their descriptors */
+		std::vector<int> handOffListeners();
+		/** Take on a connection that was accepted by another hub process @return NULL if no listener matches */
+		ManagedSocketPtr adopt(int fd);
+		void startHandshakeThreads();
+		void stopHandshakeThreads();
+		std::shared_ptr<TLSContext> getTLSContext(const ServerInfoPtr& si);
+		void rotateTicketKeys();
+
+		/** Count a new connection in the pre-login budget @return false if it's over the budget */
+		bool admit(ManagedSocket& socket);
+		/** Take a connection out of the pre-login budget, if it's in */
+		void release(ManagedSocket& socket);
+
+		/** Have a socket write what it has queued once the reactor has run the handlers that are ready */
+		void scheduleFlush(const ManagedSocketPtr& socket);
+		void flushWrites();
 
 		Core& core;
 
+		// TLS sockets are created here when handshakes are offloaded, so it must outlive io
+		boost::asio::io_service handshakeIo;
+		std::unique_ptr<boost::asio::io_service::work> handshakeWork;
+		std::vector<std::unique_ptr<HandshakeThread>> handshakers;
+		size_t handshakeThreads;
+		CommandStats::Histogram handshakeTime;
+
+		std::map<const ServerInfo*, std::shared_ptr<TLSContext>> tlsContexts;
+		size_t sessionCacheSize;
+		long sessionTimeout;
+		long ticketKeyLifetime;
+		bool kernelTLS;
+
 		boost::asio::io_service io;
 		std::unique_ptr<boost::asio::io_service::work> work;
 
+		Backend backend;
+		// Uses io, so it must go first
+		std::shared_ptr<UringService> uring;
+
 		SocketStats stats;
+		EgressScheduler egress;
+
+		size_t preLoginLimit;
+		size_t preLoginNetworkLimit;
+		size_t preLogin;
+		// Connections per network prefix, kept when preLoginNetworkLimit is set
+		std::unordered_map<std::string, size_t> preLoginNetworks;
+		int deferAccept;
+		int compressionLevel;
+
+		bool writeCombining;
+		// Sockets with writes held back until flushWrites; they go before the members above
+		std::vector<ManagedSocketPtr> flushList;
 
 		ServerInfoList servers;
 		std::vector<SocketFactoryPtr> factories;
+		std::vector<LocalSocketFactoryPtr> localFactories;
 
 		IncomingHandler incomingHandler;
 
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_OPENSSL
+
+#include "TLSContext.h"
+#include "KernelTLS.h"
+
+#include <openssl/rand.h>
+#include <cstring>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+namespace adchpp
+{
+	using namespace std;
+	namespace ssl = boost::asio::ssl;
+
+	// boost::asio uses the application data of the SSL_CTX itself
+	static int getExIndex()
+	{
+		static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return index;
+	}
+
+	TLSContext::TLSContext(const ServerInfo& info, size_t cacheSize, long timeout, bool tickets, bool kernelTLS)
+	: context(ssl::context::tls), port(info.port), current(), previous(), hasPrevious(false), ticketsIssued(0), ticketsAccepted(0), ticketsUnknown(0)
+	{
+		context.set_options(ssl::context::no_sslv2 | ssl::context::no_sslv3 | ssl::context::single_dh_use);
+		context.use_certificate_chain_file(info.TLSParams.cert);
+		context.use_private_key_file(info.TLSParams.pkey, ssl::context::pem);
+		if (!info.TLSParams.dh.empty())
+			context.use_tmp_dh_file(info.TLSParams.dh);
+
+		auto ctx = context.native_handle();
+		SSL_CTX_set_ex_data(ctx, getExIndex(), this);
+
+		// Sessions are only valid for the server they were made by
+		static const unsigned char sidContext[] = "adchpp";
+		SSL_CTX_set_session_id_context(ctx, sidContext, sizeof(sidContext) - 1);
+		SSL_CTX_set_timeout(ctx, timeout);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		// Most clients just drop the connection, which would otherwise be a fatal
+		// error that also evicts the session; ADC commands are line-terminated so
+		// a truncated one is never acted on anyway
+		SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+		if (cacheSize > 0)
+		{
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(ctx, (long) cacheSize);
+		}
+		else
+		{
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		}
+
+		if (tickets && rotateTicketKey())
+		{
+			// There's nothing to fall back to yet
+			hasPrevious = false;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &TLSContext::ticketKeyCallback);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, &TLSContext::ticketKeyCallback);
+#endif
+		}
+		else
+		{
+			SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		}
+
+		if (kernelTLS) KernelTLS::prepare(ctx);
+	}
+
+	TLSContext::~TLSContext()
+	{
+		OPENSSL_cleanse(&current, sizeof(current));
+		OPENSSL_cleanse(&previous, sizeof(previous));
+	}
+
+	bool TLSContext::rotateTicketKey()
+	{
+		TicketKey key;
+		if (RAND_bytes(key.name, sizeof(key.name)) != 1 || RAND_bytes(key.aesKey, sizeof(key.aesKey)) != 1 ||
+			RAND_bytes(key.hmacKey, sizeof(key.hmacKey)) != 1)
+		{
+			// Keep using the old key rather than a predictable one
+			return false;
+		}
+
+		lock_guard<mutex> l(keyMutex);
+		previous = current;
+		hasPrevious = true;
+		current = key;
+		OPENSSL_cleanse(&key, sizeof(key));
+		return true;
+	}
+
+	int64_t TLSContext::getCached() const
+	{
+		return SSL_CTX_sess_number(const_cast<ssl::context&>(context).native_handle());
+	}
+
+	int64_t TLSContext::getCacheFull() const
+	{
+		return SSL_CTX_sess_cache_full(const_cast<ssl::context&>(context).native_handle());
+	}
+
+	int64_t TLSContext::getCacheMisses() const
+	{
+		return SSL_CTX_sess_misses(const_cast<ssl::context&>(context).native_handle());
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	bool TLSContext::initHmac(const TicketKey& key, EVP_MAC_CTX* hctx)
+	{
+		OSSL_PARAM params[] = {
+			OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key.hmacKey), sizeof(key.hmacKey)),
+			OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+			OSSL_PARAM_construct_end()
+		};
+		return EVP_MAC_CTX_set_params(hctx, params) == 1;
+	}
+
+	int TLSContext::ticketKeyCallback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* ctx, EVP_MAC_CTX* hctx, int enc)
+#else
+	bool TLSContext::initHmac(const TicketKey& key, HMAC_CTX* hctx)
+	{
+		return HMAC_Init_ex(hctx, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), nullptr) == 1;
+	}
+
+	int TLSContext::ticketKeyCallback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* ctx, HMAC_CTX* hctx, int enc)
+#endif
+	{
+		auto self = reinterpret_cast<TLSContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), getExIndex()));
+		if (!self) return -1;
+
+		lock_guard<mutex> l(self->keyMutex);
+		if (enc)
+		{
+			const TicketKey& key = self->current;
+			if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) return -1;
+			memcpy(name, key.name, sizeof(key.name));
+			if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key.aesKey, iv) != 1 || !initHmac(key, hctx)) return -1;
+			self->ticketsIssued++;
+			return 1;
+		}
+
+		bool old = false;
+		const TicketKey* key = nullptr;
+		if (memcmp(name, self->current.name, sizeof(self->current.name)) == 0)
+			key = &self->current;
+		else if (self->hasPrevious && memcmp(name, self->previous.name, sizeof(self->previous.name)) == 0)
+			key = &self->previous, old = true;
+
+		if (!key)
+		{
+			// Fall back to a full handshake
+			self->ticketsUnknown++;
+			return 0;
+		}
+
+		if (!initHmac(*key, hctx) || EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv) != 1) return -1;
+		self->ticketsAccepted++;
+		// Ask for a ticket made with the current key
+		return old ? 2 : 1;
+	}
+
+} // namespace adchpp
+
+#endif // HAVE_OPENSSL
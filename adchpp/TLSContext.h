@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_TLSCONTEXT_H
+#define ADCHPP_TLSCONTEXT_H
+
+#ifdef HAVE_OPENSSL
+
+#include "ServerInfo.h"
+
+#include <boost/asio/ssl/context.hpp>
+
+#include <atomic>
+#include <mutex>
+
+namespace adchpp
+{
+
+	/**
+	 * The TLS settings of one <Server>, shared by its IPv4 and IPv6 listeners so that a
+	 * session set up on one of them can be resumed on the other (HBRI connections).
+	 * Sessions are kept in OpenSSL's server-side cache and in session tickets, whose
+	 * encryption keys are replaced by rotateTicketKey; tickets made with the previous
+	 * key are still accepted, and renewed.
+	 */
+	class TLSContext
+	{
+	public:
+		/**
+		 * @param cacheSize Maximum number of sessions in the cache, 0 to disable it
+		 * @param timeout Session lifetime in seconds
+		 * @param tickets Whether to issue session tickets
+		 * @param kernelTLS Whether connections may be handed over to kernel TLS
+		 */
+		TLSContext(const ServerInfo& info, size_t cacheSize, long timeout, bool tickets, bool kernelTLS);
+		~TLSContext();
+
+		boost::asio::ssl::context& get() { return context; }
+
+		const std::string& getPort() const { return port; }
+
+		/** Start encrypting tickets with a new key
+		 * @return false if no key could be generated, the current one is then kept
+		 */
+		bool rotateTicketKey();
+
+		/** Sessions currently in the cache */
+		int64_t getCached() const;
+		/** Sessions dropped from the cache because it was full */
+		int64_t getCacheFull() const;
+		/** Cache lookups that found nothing (e.g. the session had expired) */
+		int64_t getCacheMisses() const;
+
+		int64_t getTicketsIssued() const { return ticketsIssued; }
+		/** Tickets decrypted with a known key */
+		int64_t getTicketsAccepted() const { return ticketsAccepted; }
+		/** Tickets encrypted with a key that is no longer known */
+		int64_t getTicketsUnknown() const { return ticketsUnknown; }
+
+		TLSContext(const TLSContext&) = delete;
+		TLSContext& operator= (const TLSContext&) = delete;
+
+	private:
+		struct TicketKey
+		{
+			unsigned char name[16];
+			unsigned char aesKey[32];
+			unsigned char hmacKey[32];
+		};
+
+		static int ticketKeyCallback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* ctx,
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			EVP_MAC_CTX* hctx,
+#else
+			HMAC_CTX* hctx,
+#endif
+			int enc);
+
+		static bool initHmac(const TicketKey& key,
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			EVP_MAC_CTX* hctx);
+#else
+			HMAC_CTX* hctx);
+#endif
+
+		boost::asio::ssl::context context;
+		std::string port;
+
+		// Accessed by the handshake threads
+		std::mutex keyMutex;
+		TicketKey current;
+		TicketKey previous;
+		bool hasPrevious;
+
+		std::atomic<int64_t> ticketsIssued;
+		std::atomic<int64_t> ticketsAccepted;
+		std::atomic<int64_t> ticketsUnknown;
+	};
+
+} // namespace adchpp
+
+#endif // HAVE_OPENSSL
+
+#endif // ADCHPP_TLSCONTEXT_H
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "TrafficCapture.h"
+#include "BatchWriter.h"
+#include "Client.h"
+#include "Core.h"
+#include "LogManager.h"
+
+#include <chrono>
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace std::placeholders;
+
+	class TrafficCapture::Writer : public BatchWriter<Entry>
+	{
+	public:
+		Writer(TrafficCapture& tc, const string& fileTemplate) : BatchWriter<Entry>(tc.queueSize, 4096, tc.written),
+			file(fileTemplate, tc.core.getDataPath(), getHeader(), "TrafficCapture")
+		{
+		}
+
+	protected:
+		time_t getTime(const Entry& e) const override
+		{
+			return (time_t) (e.rec.time / 1000000);
+		}
+
+		void encode(const Entry& e, string& batch) override
+		{
+			size_t pos = batch.size();
+			batch.resize(pos + capture::RECORD_SIZE);
+			capture::writeRecord((uint8_t*) &batch[pos], e.rec, e.data.length());
+			batch += e.data;
+		}
+
+		time_t openFile(time_t t) override
+		{
+			return file.open(t);
+		}
+
+		void write(const string& batch) override
+		{
+			file.write(batch);
+		}
+
+	private:
+		static string getHeader()
+		{
+			string header(capture::HEADER_SIZE, '\0');
+			capture::writeHeader((uint8_t*) &header[0]);
+			return header;
+		}
+
+		RotatingFile file;
+	};
+
+	TrafficCapture::TrafficCapture(Core& core) : queueSize(262144), dropped(0), written(0), core(core)
+	{
+	}
+
+	TrafficCapture::~TrafficCapture()
+	{
+		stop();
+	}
+
+	void TrafficCapture::start()
+	{
+		if (writer || fileTemplate.empty()) return;
+
+		writer.reset(new Writer(*this, fileTemplate));
+		try
+		{
+			writer->start(0, "TrafficCapture");
+		}
+		catch (const ThreadException& e)
+		{
+			writer.reset();
+			LOGC(core, "TrafficCapture", "Unable to start the capture thread: " + e.getError());
+			return;
+		}
+
+		auto& cm = core.getClientManager();
+		connectedConn = manage(cm.signalConnected().connect(std::bind(&TrafficCapture::onConnected, this, _1)));
+		disconnectedConn = manage(cm.signalDisconnected().connect(std::bind(&TrafficCapture::onDisconnected, this, _1, _2, _3)));
+	}
+
+	void TrafficCapture::stop()
+	{
+		if (!writer) return;
+		connectedConn.reset();
+		disconnectedConn.reset();
+		writer->stop();
+		writer.reset();
+	}
+
+	void TrafficCapture::record(capture::Event type, uint32_t sid, uint8_t reason, string&& data) noexcept
+	{
+		Entry e;
+		capture::Record& r = e.rec;
+		r.type = (uint8_t) type;
+		r.reason = reason;
+		r.sid = sid;
+		r.time = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+		e.data = std::move(data);
+
+		if (!writer->push(std::move(e)))
+			dropped++;
+	}
+
+	void TrafficCapture::recordLine(const Entity& c, const uint8_t* line, size_t len) noexcept
+	{
+		if (!writer) return;
+
+		string data((const char*) line, len);
+		if (len > 5 && data.compare(1, 4, "INF ") == 0)
+		{
+			// The PID is a secret; replays make up their own
+			auto i = data.find(" PD");
+			if (i != string::npos)
+			{
+				auto j = data.find(' ', i + 1);
+				data.erase(i, j == string::npos ? string::npos : j - i);
+			}
+		}
+		record(capture::EVENT_LINE, c.getSID(), capture::NO_REASON, std::move(data));
+	}
+
+	void TrafficCapture::onConnected(Entity& c)
+	{
+		if (c.getType() != Entity::TYPE_CLIENT) return;
+		record(capture::EVENT_CONNECT, c.getSID(), capture::NO_REASON, string(static_cast<Client&>(c).getIp()));
+	}
+
+	void TrafficCapture::onDisconnected(Entity& c, Reason reason, const string& info)
+	{
+		if (c.getType() != Entity::TYPE_CLIENT) return;
+		record(capture::EVENT_DISCONNECT, c.getSID(), capture::getReasonCode(reason), string(info));
+	}
+
+} // namespace adchpp
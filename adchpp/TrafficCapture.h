@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_TRAFFIC_CAPTURE_H
+#define ADCHPP_TRAFFIC_CAPTURE_H
+
+#include "CaptureFormat.h"
+#include "ClientManager.h"
+#include "Reason.h"
+#include "forward.h"
+
+namespace adchpp
+{
+
+	/**
+	 * Timestamped record of the lines clients send, with their connects and
+	 * disconnects, for replaying an incident against another build with
+	 * adchpp-replay. Records are written by a separate thread (see CaptureFormat.h).
+	 */
+	class TrafficCapture
+	{
+	public:
+		/** Record a line received from a client; len doesn't include the newline */
+		void recordLine(const Entity& c, const uint8_t* line, size_t len) noexcept;
+
+		/** Capture file, may contain strftime-like time fields. Capturing is disabled when empty. */
+		void setFile(const std::string& s) { fileTemplate = s; }
+		const std::string& getFile() const { return fileTemplate; }
+		bool getEnabled() const { return writer != nullptr; }
+
+		void setQueueSize(size_t size) { queueSize = size; }
+		size_t getQueueSize() const { return queueSize; }
+
+		/** Number of records dropped because the writer couldn't keep up */
+		int64_t getDropped() const { return dropped; }
+		int64_t getWritten() const { return written; }
+
+		~TrafficCapture();
+
+	private:
+		friend class Core;
+
+		TrafficCapture(Core& core);
+
+		void start();
+		void stop();
+
+		/** @param reason capture::getReasonCode of a disconnect, capture::NO_REASON otherwise */
+		void record(capture::Event type, uint32_t sid, uint8_t reason, std::string&& data) noexcept;
+
+		void onConnected(Entity& c);
+		void onDisconnected(Entity& c, Reason reason, const std::string& info);
+
+		struct Entry
+		{
+			capture::Record rec;
+			std::string data;
+		};
+
+		class Writer;
+		friend class Writer;
+		std::unique_ptr<Writer> writer;
+
+		std::string fileTemplate;
+		size_t queueSize;
+		std::atomic<int64_t> dropped;
+		std::atomic<int64_t> written;
+
+		ClientManager::SignalConnected::ManagedConnection connectedConn;
+		ClientManager::SignalDisconnected::ManagedConnection disconnectedConn;
+
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_TRAFFIC_CAPTURE_H
@@ -0,0 +1,766 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_IO_URING
+
+#include "UringService.h"
+
+#include "SocketManager.h"
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace adchpp
+{
+	using namespace std;
+	using boost::system::error_code;
+	using boost::system::system_category;
+
+	namespace
+	{
+		const unsigned SQ_ENTRIES = 4096;
+		// Room for a burst of completions from every connection
+		const unsigned CQ_ENTRIES = 65536;
+
+		const unsigned BUFFER_GROUP = 0;
+		const unsigned BUFFERS = 1024; // a power of two
+		const size_t BUFFER_SIZE = 4096;
+
+		// Received data held for a stream before it stops receiving
+		const size_t INPUT_LIMIT = 16 * 1024;
+
+		// The low bits of the user data of an entry tell what it is for
+		enum
+		{
+			OP_ACCEPT = 1,
+			OP_RECEIVE,
+			OP_SEND,
+			OP_CANCEL,
+			OP_MASK = 7
+		};
+
+		uint64_t tag(void* owner, int op)
+		{
+			return reinterpret_cast<uint64_t>(owner) | op;
+		}
+
+		// The rings are shared with the kernel
+		unsigned loadAcquire(const unsigned* p)
+		{
+			return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+		}
+
+		void storeRelease(unsigned* p, unsigned value)
+		{
+			__atomic_store_n(p, value, __ATOMIC_RELEASE);
+		}
+
+		int registerRing(int fd, unsigned opcode, void* arg, unsigned n)
+		{
+			return (int) syscall(__NR_io_uring_register, fd, opcode, arg, n);
+		}
+
+		error_code lastError()
+		{
+			return error_code(errno, system_category());
+		}
+
+		error_code toError(int res)
+		{
+			return res == -ECANCELED ? error_code(boost::asio::error::operation_aborted) : error_code(-res, system_category());
+		}
+	}
+
+	/**
+	 * A connection served by UringService. Received data is copied out of the shared buffers
+	 * right away and queued here until ManagedSocket reads it; past INPUT_LIMIT the multishot
+	 * receive is cancelled, leaving the rest to TCP flow control.
+	 */
+	class UringStream : public AsyncStream, public enable_shared_from_this<UringStream>
+	{
+	public:
+		UringStream(UringService& service, int fd) : service(&service), fd(fd), inflight(0), inputPos(0), receiving(false), pausing(false), stopped(false), closed(false)
+		{
+			service.streams.insert(this);
+		}
+
+		~UringStream()
+		{
+			if (service) service->streams.erase(this);
+			closeSocket();
+		}
+
+		virtual size_t available()
+		{
+			int n = 0;
+			if (fd == -1 || ::ioctl(fd, FIONREAD, &n) != 0) n = 0;
+			return unread() + n;
+		}
+
+		virtual void init(const std::function<void()>& postInit)
+		{
+			postInit();
+		}
+
+		virtual void setOptions(size_t bufferSize)
+		{
+			int n = (int) bufferSize;
+			::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+			::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
+		}
+
+		virtual std::string getIp()
+		{
+			boost::asio::ip::tcp::endpoint ep;
+			socklen_t len = (socklen_t) ep.capacity();
+			if (::getpeername(fd, ep.data(), &len) != 0) return std::string();
+			ep.resize(len);
+			return ep.address().to_string();
+		}
+
+		virtual void prepareRead(const BufferPtr& buf, const Handler& handler)
+		{
+			if (!service) return;
+			if (closed)
+			{
+				abort(handler);
+				return;
+			}
+
+			reader = handler;
+			readBuf = buf;
+			if (unread() > 0 || readError)
+			{
+				auto self = shared_from_this();
+				service->sm.addJob([self] { self->completeRead(); });
+			}
+			else
+			{
+				receive();
+			}
+		}
+
+		/** Only returns what has been received already */
+		virtual size_t read(const BufferPtr& buf)
+		{
+			size_t n = take(*buf);
+			receive();
+			return n;
+		}
+
+		virtual void write(const BufferList& bufs, const Handler& handler)
+		{
+			if (!service) return;
+			if (closed)
+			{
+				abort(handler);
+				return;
+			}
+
+			// Same limits as the asio streams
+			iov.clear();
+			if (bufs.size() == 1)
+			{
+				iov.push_back(iovec { bufs[0]->data(), bufs[0]->size() });
+			}
+			else
+			{
+				const size_t maxBytes = 1024;
+				for (size_t i = 0, n = std::min(bufs.size(), static_cast<size_t>(64)), total = 0; i < n && total < maxBytes; ++i)
+				{
+					size_t bytes = std::min(bufs[i]->size(), maxBytes - total);
+					iov.push_back(iovec { bufs[i]->data(), bytes });
+					total += bytes;
+				}
+			}
+			// The kernel reads them after this returns
+			sending.assign(bufs.begin(), bufs.begin() + iov.size());
+			writer = handler;
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov.data();
+			msg.msg_iovlen = iov.size();
+
+			auto sqe = prepare(OP_SEND);
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = fd;
+			sqe->addr = reinterpret_cast<uint64_t>(&msg);
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+		}
+
+		virtual void shutdown(const Handler& handler)
+		{
+			if (!service) return;
+
+			// The peer may be gone already, which is fine as we're closing anyway
+			::shutdown(fd, SHUT_WR);
+			service->sm.addJob(std::bind(handler, error_code(), 0));
+		}
+
+		virtual bool handOff(int& fd_, std::string& pending)
+		{
+			fd_ = -1;
+			if (!service || closed) return true;
+
+			stopped = true;
+			if (receiving)
+			{
+				if (!pausing)
+				{
+					pausing = true;
+					auto sqe = prepare(OP_CANCEL);
+					sqe->opcode = IORING_OP_ASYNC_CANCEL;
+					sqe->addr = tag(this, OP_RECEIVE);
+				}
+				return false;
+			}
+
+			// A connection that has ended stays behind
+			if (!readError)
+			{
+				fd_ = fd;
+				pending = input.substr(inputPos);
+			}
+			return true;
+		}
+
+		virtual void close()
+		{
+			if (closed) return;
+			closed = true;
+
+			input.clear();
+			inputPos = 0;
+			readError = boost::asio::error::operation_aborted;
+			if (reader)
+			{
+				auto self = shared_from_this();
+				service->sm.addJob([self] { self->completeRead(); });
+			}
+
+			if (inflight == 0)
+			{
+				closeSocket();
+				return;
+			}
+
+			// The descriptor stays open until the ring is done with it
+			auto sqe = prepare(OP_CANCEL);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = fd;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		}
+
+	private:
+		friend class UringService;
+
+		io_uring_sqe* prepare(int op)
+		{
+			if (inflight++ == 0) self = shared_from_this();
+			return service->getSqe(this, op);
+		}
+
+		/** An operation has ended
+		 * @return The stream, if nothing else in the ring keeps it alive now
+		 */
+		shared_ptr<UringStream> release()
+		{
+			if (--inflight > 0) return nullptr;
+
+			if (closed) closeSocket();
+			return std::move(self);
+		}
+
+		/** The ring is gone along with everything in it; the socket closes with it */
+		void detach()
+		{
+			service = nullptr;
+			closed = true;
+			closeSocket();
+			inflight = 0;
+			auto keep = std::move(self);
+		}
+
+		void receive()
+		{
+			if (receiving || stopped || closed || readError || unread() >= INPUT_LIMIT) return;
+
+			receiving = true;
+			auto sqe = prepare(OP_RECEIVE);
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = fd;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = BUFFER_GROUP;
+			if (service->multishotReceive) sqe->ioprio = IORING_RECV_MULTISHOT;
+		}
+
+		/**
+		 * @param more Whether the receive goes on
+		 * @param retry Whether the receive ended for a reason that doesn't concern the connection
+		 */
+		void onReceive(int res, bool more, bool retry, const char* data)
+		{
+			if (!more)
+			{
+				receiving = false;
+				pausing = false;
+			}
+			if (closed) return;
+
+			if (res > 0)
+				input.append(data, res);
+			else if (res == 0)
+				readError = boost::asio::error::eof;
+			else if (!retry)
+				readError = toError(res);
+
+			if (receiving && !pausing && unread() >= INPUT_LIMIT)
+			{
+				// Until the hub catches up
+				pausing = true;
+				auto sqe = prepare(OP_CANCEL);
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = tag(this, OP_RECEIVE);
+			}
+
+			receive();
+			completeRead();
+		}
+
+		void onSend(int res)
+		{
+			BufferList().swap(sending);
+			Handler h;
+			h.swap(writer);
+			if (h) h(res < 0 ? toError(res) : error_code(), res < 0 ? 0 : res);
+		}
+
+		void completeRead()
+		{
+			if (!reader || (unread() == 0 && !readError)) return;
+
+			Handler h;
+			h.swap(reader);
+			BufferPtr buf;
+			buf.swap(readBuf);
+
+			if (unread() == 0)
+			{
+				h(readError, 0);
+				return;
+			}
+
+			size_t n = 0;
+			if (buf)
+			{
+				n = take(*buf);
+				receive();
+			}
+			h(error_code(), n);
+		}
+
+		size_t unread() const
+		{
+			return input.size() - inputPos;
+		}
+
+		/** Copy received data to buf, moving the rest to the front only once most of it is read */
+		size_t take(Buffer& buf)
+		{
+			size_t n = std::min(buf.size(), unread());
+			memcpy(buf.data(), input.data() + inputPos, n);
+			inputPos += n;
+			if (inputPos == input.size())
+			{
+				input.clear();
+				inputPos = 0;
+			}
+			else if (inputPos * 2 > input.size())
+			{
+				input.erase(0, inputPos);
+				inputPos = 0;
+			}
+			return n;
+		}
+
+		void abort(const Handler& handler)
+		{
+			service->sm.addJob(std::bind(handler, error_code(boost::asio::error::operation_aborted), 0));
+		}
+
+		void closeSocket()
+		{
+			if (fd != -1)
+			{
+				::close(fd);
+				fd = -1;
+			}
+		}
+
+		UringService* service; // null once the service is gone
+		int fd;
+
+		// Operations in the ring, which hold on to self
+		int inflight;
+		shared_ptr<UringStream> self;
+
+		string input;
+		size_t inputPos; // start of the data that hasn't been read yet
+		error_code readError;
+		Handler reader;
+		BufferPtr readBuf;
+		bool receiving;
+		bool pausing;
+		bool stopped; // being handed off
+
+		Handler writer;
+		BufferList sending;
+		vector<iovec> iov;
+		msghdr msg;
+
+		bool closed;
+	};
+
+	UringService::UringService(SocketManager& sm)
+	: sm(sm), notify(sm.io), ringFd(-1), ring(nullptr), ringSize(0), sqes(nullptr), sqesSize(0), sqHead(nullptr), sqTail(nullptr), sqFlags(nullptr),
+	  sqLocalTail(0), sqMask(0), sqEntries(0), cqHead(nullptr), cqTail(nullptr), cqMask(0), cqes(nullptr), buffers(nullptr), bufferData(nullptr),
+	  bufferTail(0), flushing(false), multishotAccept(true), multishotReceive(true), submits(0), submitted(0), completions(0), bufferShortages(0)
+	{
+	}
+
+	UringService::~UringService()
+	{
+		error_code ec;
+		notify.close(ec);
+
+		// Ends everything in the ring, after which the streams it kept alive may go
+		if (ringFd != -1) ::close(ringFd);
+		if (ring) ::munmap(ring, ringSize);
+		if (sqes) ::munmap(sqes, sqesSize);
+		if (buffers) ::munmap(buffers, BUFFERS * sizeof(io_uring_buf));
+		if (bufferData) ::munmap(bufferData, BUFFERS * BUFFER_SIZE);
+
+		auto orphans = std::move(streams);
+		for (auto s : orphans)
+			s->detach();
+	}
+
+	error_code UringService::start()
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = CQ_ENTRIES;
+
+		ringFd = (int) syscall(__NR_io_uring_setup, SQ_ENTRIES, &p);
+		if (ringFd < 0) return lastError();
+		if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+			return make_error_code(boost::system::errc::not_supported);
+
+		ringSize = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned), p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+		void* r = ::mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		if (r == MAP_FAILED) return lastError();
+		ring = r;
+
+		sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		r = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		if (r == MAP_FAILED) return lastError();
+		sqes = static_cast<io_uring_sqe*>(r);
+
+		auto base = static_cast<char*>(ring);
+		sqHead = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+		sqTail = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+		sqFlags = reinterpret_cast<unsigned*>(base + p.sq_off.flags);
+		sqMask = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+		sqEntries = p.sq_entries;
+		sqLocalTail = *sqTail;
+		// Entries are always used in order
+		auto array = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+		for (unsigned i = 0; i < sqEntries; ++i)
+			array[i] = i;
+
+		cqHead = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+		cqMask = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+
+		r = ::mmap(nullptr, BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (r == MAP_FAILED) return lastError();
+		buffers = static_cast<io_uring_buf_ring*>(r);
+
+		r = ::mmap(nullptr, BUFFERS * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (r == MAP_FAILED) return lastError();
+		bufferData = static_cast<char*>(r);
+
+		io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = reinterpret_cast<uint64_t>(buffers);
+		reg.ring_entries = BUFFERS;
+		reg.bgid = BUFFER_GROUP;
+		if (registerRing(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return lastError();
+		for (unsigned i = 0; i < BUFFERS; ++i)
+			recycle(i);
+
+		int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0) return lastError();
+		if (registerRing(ringFd, IORING_REGISTER_EVENTFD, &fd, 1) < 0)
+		{
+			auto ec = lastError();
+			::close(fd);
+			return ec;
+		}
+		notify.assign(fd);
+
+		wait();
+		return error_code();
+	}
+
+	void UringService::accept(int fd, const AcceptHandler& handler)
+	{
+		listeners.push_back(unique_ptr<Listener>(new Listener { fd, handler, false, false }));
+		armAccept(*listeners.back());
+	}
+
+	void UringService::cancel(int fd)
+	{
+		for (auto& l : listeners)
+			if (l->fd == fd) l->cancelled = true;
+
+		auto sqe = getSqe(nullptr, OP_CANCEL);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = fd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		submit();
+	}
+
+	AsyncStreamPtr UringService::createStream(int fd)
+	{
+		return make_shared<UringStream>(*this, fd);
+	}
+
+	io_uring_sqe* UringService::getSqe(void* owner, int op)
+	{
+		io_uring_sqe* sqe;
+		if (backlog.empty() && sqLocalTail - loadAcquire(sqHead) < sqEntries)
+		{
+			sqe = &sqes[sqLocalTail++ & sqMask];
+		}
+		else
+		{
+			backlog.emplace_back();
+			sqe = &backlog.back();
+		}
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->user_data = tag(owner, op);
+
+		// Whatever else the current handlers queue goes along
+		if (!flushing)
+		{
+			flushing = true;
+			sm.addJob(std::bind(&UringService::flush, this));
+		}
+		return sqe;
+	}
+
+	bool UringService::submit()
+	{
+		storeRelease(sqTail, sqLocalTail);
+
+		unsigned pending = sqLocalTail - loadAcquire(sqHead);
+		while (pending > 0)
+		{
+			int n = (int) syscall(__NR_io_uring_enter, ringFd, pending, 0, 0, nullptr, 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0)
+			{
+				// The completion queue is full (EBUSY), try again after reaping it
+				if (!flushing)
+				{
+					flushing = true;
+					sm.addJob(std::bind(&UringService::flush, this));
+				}
+				return false;
+			}
+
+			submits++;
+			submitted += n;
+			pending -= n;
+		}
+		return true;
+	}
+
+	void UringService::flush()
+	{
+		flushing = false;
+		do
+		{
+			while (!backlog.empty() && sqLocalTail - loadAcquire(sqHead) < sqEntries)
+			{
+				sqes[sqLocalTail++ & sqMask] = backlog.front();
+				backlog.pop_front();
+			}
+		} while (submit() && !backlog.empty());
+	}
+
+	void UringService::wait()
+	{
+		notify.async_read_some(boost::asio::null_buffers(), [this](const error_code& ec, size_t) {
+			if (ec) return;
+
+			uint64_t n;
+			while (::read(notify.native_handle(), &n, sizeof(n)) > 0)
+			{
+			}
+			reap();
+			wait();
+		});
+	}
+
+	void UringService::reap()
+	{
+		for (;;)
+		{
+			unsigned head = *cqHead;
+			unsigned tail = loadAcquire(cqTail);
+			if (head == tail)
+			{
+				// The kernel keeps what didn't fit until asked for it
+				if (!(loadAcquire(sqFlags) & IORING_SQ_CQ_OVERFLOW)) break;
+				syscall(__NR_io_uring_enter, ringFd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (head == loadAcquire(cqTail)) break;
+				continue;
+			}
+
+			for (; head != tail; ++head)
+			{
+				io_uring_cqe cqe = cqes[head & cqMask];
+				storeRelease(cqHead, head + 1);
+				completions++;
+				complete(cqe);
+			}
+		}
+	}
+
+	void UringService::complete(const io_uring_cqe& cqe)
+	{
+		void* owner = reinterpret_cast<void*>(cqe.user_data & ~static_cast<uint64_t>(OP_MASK));
+		int op = (int) (cqe.user_data & OP_MASK);
+		bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+		if (op == OP_ACCEPT)
+		{
+			auto& l = *static_cast<Listener*>(owner);
+			if (!more) l.armed = false;
+
+			bool stop = false;
+			if (cqe.res >= 0)
+			{
+				if (l.cancelled)
+					::close(cqe.res);
+				else
+					l.handler(error_code(), cqe.res);
+			}
+			else if (cqe.res == -EINVAL && multishotAccept)
+			{
+				multishotAccept = false;
+			}
+			else if (!l.cancelled && cqe.res != -ECANCELED)
+			{
+				l.handler(toError(cqe.res), -1);
+				// Not a listening socket (any more)
+				stop = cqe.res == -EINVAL || cqe.res == -EBADF;
+			}
+
+			if (l.cancelled || stop)
+			{
+				if (!l.armed)
+				{
+					listeners.erase(std::find_if(listeners.begin(), listeners.end(),
+						[&l](const unique_ptr<Listener>& p) { return p.get() == &l; }));
+				}
+			}
+			else if (!l.armed)
+			{
+				armAccept(l);
+			}
+			return;
+		}
+
+		// Listeners being cancelled
+		if (!owner) return;
+
+		auto stream = static_cast<UringStream*>(owner);
+		// Keeps the stream around while it handles the result
+		auto keep = more ? nullptr : stream->release();
+
+		if (op == OP_RECEIVE)
+		{
+			const char* data = nullptr;
+			if (cqe.flags & IORING_CQE_F_BUFFER) data = bufferData + (cqe.flags >> IORING_CQE_BUFFER_SHIFT) * BUFFER_SIZE;
+
+			bool retry = cqe.res == -ENOBUFS || cqe.res == -ECANCELED;
+			if (cqe.res == -ENOBUFS) bufferShortages++;
+			if (cqe.res == -EINVAL && multishotReceive)
+			{
+				multishotReceive = false;
+				retry = true;
+			}
+
+			stream->onReceive(cqe.res, more, retry, data);
+			if (data) recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		}
+		else if (op == OP_SEND)
+		{
+			stream->onSend(cqe.res);
+		}
+	}
+
+	void UringService::armAccept(Listener& l)
+	{
+		auto sqe = getSqe(&l, OP_ACCEPT);
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = l.fd;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		if (multishotAccept) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		l.armed = true;
+	}
+
+	void UringService::recycle(unsigned id)
+	{
+		// Not through bufs, which C++ places after the empty struct of __DECLARE_FLEX_ARRAY
+		auto& b = reinterpret_cast<io_uring_buf*>(buffers)[bufferTail & (BUFFERS - 1)];
+		b.addr = reinterpret_cast<uint64_t>(bufferData + id * BUFFER_SIZE);
+		b.len = BUFFER_SIZE;
+		b.bid = (unsigned short) id;
+		__atomic_store_n(&buffers->tail, ++bufferTail, __ATOMIC_RELEASE);
+	}
+
+} // namespace adchpp
+
+#endif // HAVE_IO_URING
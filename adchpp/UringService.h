@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_URINGSERVICE_H
+#define ADCHPP_URINGSERVICE_H
+
+#ifdef HAVE_IO_URING
+
+#include "AsyncStream.h"
+#include "forward.h"
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <linux/io_uring.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace adchpp
+{
+
+	class UringStream;
+
+	/**
+	 * Socket I/O through io_uring (Linux), as an alternative to the epoll reactor of asio
+	 * for plain connections. Listening sockets use multishot accepts, and each connection a
+	 * multishot receive that takes its buffer from a ring shared by all sockets, so that an
+	 * idle connection ties up neither a buffer nor a system call. Everything queued while
+	 * the reactor runs its handlers is submitted at once, and completions are picked up on
+	 * the reactor thread when the eventfd of the ring fires.
+	 */
+	class UringService
+	{
+	public:
+		typedef std::function<void(const boost::system::error_code&, int)> AcceptHandler;
+
+		UringService(SocketManager& sm);
+		~UringService();
+
+		/** Set up the ring
+		 * @return An error if io_uring isn't usable, e.g. on older kernels or when disabled
+		 */
+		boost::system::error_code start();
+
+		/** Accept connections on a listening socket (the handler gets the new descriptor), until cancel */
+		void accept(int fd, const AcceptHandler& handler);
+
+		/** Cancel everything pending on a descriptor, before it gets closed */
+		void cancel(int fd);
+
+		/** Take over an accepted connection, which the stream closes */
+		AsyncStreamPtr createStream(int fd);
+
+		/** io_uring_enter calls */
+		int64_t getSubmits() const { return submits; }
+		/** Operations submitted */
+		int64_t getSubmitted() const { return submitted; }
+		int64_t getCompletions() const { return completions; }
+		/** Receives that found no free buffer */
+		int64_t getBufferShortages() const { return bufferShortages; }
+
+		UringService(const UringService&) = delete;
+		UringService& operator= (const UringService&) = delete;
+
+	private:
+		friend class UringStream;
+
+		struct Listener
+		{
+			int fd;
+			AcceptHandler handler;
+			bool armed;
+			bool cancelled;
+		};
+
+		io_uring_sqe* getSqe(void* owner, int op);
+		bool submit();
+		void flush();
+		void wait();
+		void reap();
+		void complete(const io_uring_cqe& cqe);
+		void armAccept(Listener& l);
+		void recycle(unsigned id);
+
+		SocketManager& sm;
+		boost::asio::posix::stream_descriptor notify;
+
+		int ringFd;
+		void* ring;
+		size_t ringSize;
+		io_uring_sqe* sqes;
+		size_t sqesSize;
+		unsigned* sqHead;
+		unsigned* sqTail;
+		unsigned* sqFlags;
+		unsigned sqLocalTail; // entries filled, published by submit
+		unsigned sqMask;
+		unsigned sqEntries;
+		unsigned* cqHead;
+		unsigned* cqTail;
+		unsigned cqMask;
+		io_uring_cqe* cqes;
+
+		io_uring_buf_ring* buffers;
+		char* bufferData;
+		unsigned short bufferTail;
+
+		// Entries that didn't fit in the submission queue
+		std::deque<io_uring_sqe> backlog;
+		bool flushing;
+
+		// Older kernels end these after each completion
+		bool multishotAccept;
+		bool multishotReceive;
+
+		std::vector<std::unique_ptr<Listener>> listeners;
+		// Live streams, detached from the ring when it goes
+		std::unordered_set<UringStream*> streams;
+
+		int64_t submits;
+		int64_t submitted;
+		int64_t completions;
+		int64_t bufferShortages;
+	};
+
+} // namespace adchpp
+
+#endif // HAVE_IO_URING
+
+#endif // ADCHPP_URINGSERVICE_H
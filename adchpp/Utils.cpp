@@ -101,4 +101,41 @@ namespace adchpp
 		return true;
 	}
 
+	time_t Utils::getNextRollover(const string& tmpl, time_t t)
+	{
+		int unit = 3; // 0 - second, 1 - minute, 2 - hour, 3 - day
+		for (string::size_type i = tmpl.find('%'); i != string::npos && i + 1 < tmpl.length(); i = tmpl.find('%', i + 2))
+		{
+			switch (tmpl[i + 1])
+			{
+				case 'S': case 'T': case 'X': case 'c': case 'r': case 's':
+					unit = 0;
+					break;
+				case 'M': case 'R':
+					unit = std::min(unit, 1);
+					break;
+				case 'H': case 'I': case 'p': case 'k': case 'l':
+					unit = std::min(unit, 2);
+					break;
+			}
+		}
+		if (unit == 0) return t + 1;
+
+		tm lt;
+#ifdef HAVE_TIME_R
+		if (!localtime_r(&t, &lt)) return t + 1;
+#else
+		const tm* plt = localtime(&t);
+		if (!plt) return t + 1;
+		lt = *plt;
+#endif
+		if (unit == 1) return t - lt.tm_sec + 60;
+		if (unit == 2) return t - lt.tm_sec - lt.tm_min * 60 + 3600;
+		lt.tm_sec = lt.tm_min = lt.tm_hour = 0;
+		lt.tm_mday++;
+		lt.tm_isdst = -1;
+		time_t next = mktime(&lt);
+		return next > t ? next : t + 1;
+	}
+
 }
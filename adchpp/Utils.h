@@ -20,6 +20,7 @@
 #define ADCHPP_UTILS_H_
 
 #include <string>
+#include <time.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 namespace adchpp
@@ -32,6 +33,9 @@ namespace adchpp
 
 		static bool isPrivateIp(std::string const& ip, bool v6);
 		static bool validateCharset(std::string const& field, int p);
+
+		/** @return The first moment when a file name built from a strftime-like template may change */
+		static time_t getNextRollover(const std::string& tmpl, time_t t);
 	};
 
 	namespace time
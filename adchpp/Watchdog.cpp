@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "Watchdog.h"
+#include "Core.h"
+#include "Entity.h"
+#include "LogManager.h"
+#include "PluginManager.h"
+#include <baselib/StrUtil.h>
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace adchpp
+{
+	using namespace std;
+	using namespace std::placeholders;
+
+	// Don't flood the log when the hub is overloaded and every tick is late
+	static const uint64_t LOG_INTERVAL = 10000000000ull;
+
+	string Watchdog::Scope::getLabel() const
+	{
+		string label = what;
+		if (cmd) label += ' ' + cmd->getFourCC();
+		return label;
+	}
+
+	Watchdog::Watchdog(Core& core) :
+		threshold(250), interval(100), thresholdNs(0), enabled(false), running(false),
+		expected(0), recentLag(0), stalls(0), suppressed(0), lastLog(0), worstStart(0), worstTime(0), core(core)
+	{
+	}
+
+	Watchdog::~Watchdog()
+	{
+		stop();
+	}
+
+	void Watchdog::start()
+	{
+		statsConn = manage(core.getPluginManager().onCommand("stats", std::bind(&Watchdog::onStats, this, _1)));
+		if (threshold <= 0 || interval <= 0) return;
+		thresholdNs = (uint64_t) threshold * 1000000;
+		enabled = running = true;
+		expected = Util::getHighResTimestamp() + (uint64_t) interval * 1000000;
+		tickTimer = core.addTimedJob(interval, std::bind(&Watchdog::onTick, this));
+	}
+
+	void Watchdog::stop()
+	{
+		statsConn.reset();
+		if (tickTimer)
+		{
+			tickTimer();
+			tickTimer = nullptr;
+		}
+		enabled = running = false;
+	}
+
+	void Watchdog::onTick()
+	{
+		if (!running) return;
+
+		uint64_t now = Util::getHighResTimestamp();
+		uint64_t step = (uint64_t) interval * 1000000;
+		// After a stall the timer catches up on the ticks it missed, which says nothing new
+		if (now + step / 2 < expected) return;
+
+		uint64_t late = now > expected ? now - expected : 0;
+		lag.add(late);
+		recentLag = (recentLag * 3 + late) / 4;
+
+		if (late > thresholdNs)
+		{
+			++stalls;
+			if (now - lastLog >= LOG_INTERVAL || !lastLog)
+			{
+				char buf[128];
+				snprintf(buf, sizeof(buf), "Event loop lagged %.1f ms", late / 1e6);
+				string msg = buf;
+				if (!worst.empty())
+				{
+					snprintf(buf, sizeof(buf), " (%.1f ms)", worstTime / 1e6);
+					msg += ", slowest handler: " + worst + buf;
+				}
+				if (suppressed) msg += ", " + Util::toString(suppressed) + " similar events not logged";
+				LOGC(core, "Watchdog", msg);
+				lastLog = now;
+				suppressed = 0;
+			}
+			else
+				++suppressed;
+		}
+
+		worst.clear();
+		worstStart = worstTime = 0;
+
+		do
+			expected += step;
+		while (expected <= now);
+	}
+
+	void Watchdog::addOffender(const string& label, uint64_t start, uint64_t elapsed) noexcept
+	{
+		auto i = offenders.find(label);
+		if (i == offenders.end())
+		{
+			if (offenders.size() < MAX_OFFENDERS)
+				i = offenders.insert(make_pair(label, Offender())).first;
+			else
+				i = offenders.insert(make_pair(string("other"), Offender())).first;
+		}
+		Offender& o = i->second;
+		o.count++;
+		o.total += elapsed;
+		if (elapsed > o.max) o.max = elapsed;
+
+		// Handlers nest (a timer calling a script function), so keep blaming the inner
+		// one as long as it accounts for most of the time of the enclosing one
+		bool nested = worstStart >= start && worstTime * 2 >= elapsed;
+		if (elapsed > worstTime && !nested)
+		{
+			worst = label;
+			worstStart = start;
+			worstTime = elapsed;
+		}
+	}
+
+	vector<pair<string, Watchdog::Offender>> Watchdog::getTopOffenders(size_t limit) const
+	{
+		vector<pair<string, Offender>> v(offenders.begin(), offenders.end());
+		sort(v.begin(), v.end(), [](const pair<string, Offender>& a, const pair<string, Offender>& b) {
+			return a.second.total > b.second.total;
+		});
+		if (v.size() > limit) v.resize(limit);
+		return v;
+	}
+
+	void Watchdog::getText(string& out) const
+	{
+		char buf[256];
+		snprintf(buf, sizeof(buf), "\nEvent loop lag (ms): p50 %.1f, p90 %.1f, p99 %.1f, max %.1f; %lld stalls over %d ms",
+			lag.getPercentile(50) / 1e6, lag.getPercentile(90) / 1e6, lag.getPercentile(99) / 1e6, lag.getMax() / 1e6,
+			(long long) stalls, threshold);
+		out += buf;
+
+		auto v = getTopOffenders(10);
+		if (v.empty()) return;
+		out += "\nSlowest handlers (count, total/max ms):";
+		for (auto i = v.begin(); i != v.end(); ++i)
+		{
+			snprintf(buf, sizeof(buf), "\t%lld, %.1f/%.1f", (long long) i->second.count,
+				i->second.total / 1e6, i->second.max / 1e6);
+			out += '\n';
+			out += i->first;
+			out += buf;
+		}
+	}
+
+	void Watchdog::onStats(Entity& c)
+	{
+		if (!enabled) return;
+		string stats;
+		getText(stats);
+		c.send(AdcCommand(AdcCommand::CMD_MSG).addParam(stats));
+	}
+
+} // namespace adchpp
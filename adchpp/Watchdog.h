@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_WATCHDOG_H
+#define ADCHPP_WATCHDOG_H
+
+#include "CommandStats.h"
+#include "Signal.h"
+#include "forward.h"
+#include <baselib/TimeUtil.h>
+
+#include <unordered_map>
+
+namespace adchpp
+{
+
+	/**
+	 * Measures how late the reactor runs a periodic tick and keeps track of the
+	 * handlers that ran for longer than the threshold (commands, script functions
+	 * and timers). Everything runs on the reactor thread.
+	 */
+	class Watchdog
+	{
+	public:
+		/** Times the enclosing block and reports it when it takes longer than the threshold */
+		class Scope
+		{
+		public:
+			Scope(Watchdog& w, const char* what, const AdcCommand* cmd = nullptr) :
+				w(w), what(what), cmd(cmd), start(w.enabled ? Util::getHighResTimestamp() : 0)
+			{
+			}
+
+			~Scope()
+			{
+				if (!start) return;
+				uint64_t elapsed = Util::getHighResTimestamp() - start;
+				if (elapsed > w.thresholdNs) w.addOffender(getLabel(), start, elapsed);
+			}
+
+			Scope(const Scope&) = delete;
+			Scope& operator= (const Scope&) = delete;
+
+		private:
+			std::string getLabel() const;
+
+			Watchdog& w;
+			const char* what;
+			const AdcCommand* cmd;
+			uint64_t start;
+		};
+
+		struct Offender
+		{
+			Offender() : count(0), total(0), max(0) {}
+
+			int64_t count;
+			uint64_t total; // nanoseconds
+			uint64_t max;
+		};
+		typedef std::unordered_map<std::string, Offender> OffenderMap;
+
+		/** Record a handler that ran for more than the threshold; start and elapsed are in nanoseconds */
+		void addOffender(const std::string& label, uint64_t start, uint64_t elapsed) noexcept;
+
+		/** Minimum handler run time / loop lag to report, in milliseconds; 0 disables the watchdog */
+		void setThreshold(int msec) { threshold = msec; }
+		int getThreshold() const { return threshold; }
+		uint64_t getThresholdNs() const { return thresholdNs; }
+		bool getEnabled() const { return enabled; }
+
+		/** Interval between the ticks used to measure the loop lag, in milliseconds */
+		void setInterval(int msec) { interval = msec; }
+		int getInterval() const { return interval; }
+
+		const CommandStats::Histogram& getLag() const { return lag; }
+		/** @return Loop lag averaged over the last few ticks, in nanoseconds */
+		uint64_t getRecentLag() const { return recentLag; }
+		int64_t getStalls() const { return stalls; }
+		const OffenderMap& getOffenders() const { return offenders; }
+
+		/** Offenders sorted by total time, at most limit entries */
+		std::vector<std::pair<std::string, Offender>> getTopOffenders(size_t limit) const;
+
+		void getText(std::string& out) const;
+
+		~Watchdog();
+
+	private:
+		friend class Core;
+
+		Watchdog(Core& core);
+
+		void start();
+		void stop();
+
+		void onTick();
+		void onStats(Entity& c);
+
+		// Bounds the memory used when every handler is slow, e.g. on an overloaded machine
+		static const size_t MAX_OFFENDERS = 256;
+
+		int threshold;
+		int interval;
+		uint64_t thresholdNs;
+		bool enabled;
+		bool running;
+
+		uint64_t expected;
+		CommandStats::Histogram lag;
+		uint64_t recentLag;
+		int64_t stalls;
+		int64_t suppressed;
+		uint64_t lastLog;
+
+		OffenderMap offenders;
+		std::string worst; // slowest handler since the last tick
+		uint64_t worstStart;
+		uint64_t worstTime;
+
+		std::function<void()> tickTimer;
+		ManagedConnectionPtr statsConn;
+
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_WATCHDOG_H
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "WorkerPool.h"
+#include "Core.h"
+#include "LogManager.h"
+#include <baselib/Thread.h>
+#include <baselib/TimeUtil.h>
+
+namespace adchpp
+{
+	using namespace std;
+
+	static const string className = "WorkerPool";
+
+	class WorkerPool::Worker : public Thread
+	{
+	public:
+		Worker(WorkerPool& pool) : pool(pool) {}
+
+	protected:
+		int run() override
+		{
+			Task task;
+			while (pool.pop(task))
+				pool.run(task);
+			return 0;
+		}
+
+	private:
+		WorkerPool& pool;
+	};
+
+	WorkerPool::WorkerPool(Core& core) : threads(2), stopping(false), active(0), completed(0), busyTime(0), waitTime(0), core(core)
+	{
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		stop();
+	}
+
+	void WorkerPool::start()
+	{
+		if (!workers.empty()) return;
+
+		stopping = false;
+		for (size_t i = 0; i < threads; ++i)
+		{
+			unique_ptr<Worker> w(new Worker(*this));
+			try
+			{
+				w->start(0, "WorkerPool");
+			}
+			catch (const ThreadException& e)
+			{
+				LOG(className, "Unable to start a worker thread: " + e.getError());
+				break;
+			}
+			workers.push_back(std::move(w));
+		}
+	}
+
+	void WorkerPool::stop()
+	{
+		if (workers.empty()) return;
+
+		{
+			lock_guard<std::mutex> l(mutex);
+			stopping = true;
+			cv.notify_all();
+		}
+		for (auto& w : workers)
+			w->join();
+		workers.clear();
+	}
+
+	void WorkerPool::add(const Callback& work, const Callback& completion) noexcept
+	{
+		Task task = { work, completion, Util::getHighResTimestamp() };
+		{
+			lock_guard<std::mutex> l(mutex);
+			if (!workers.empty() && !stopping)
+			{
+				tasks.push_back(std::move(task));
+				cv.notify_one();
+				return;
+			}
+		}
+
+		// No threads; the completion is still asynchronous so callers see the same order of events
+		run(task);
+	}
+
+	size_t WorkerPool::getQueued() const
+	{
+		lock_guard<std::mutex> l(mutex);
+		return tasks.size();
+	}
+
+	bool WorkerPool::pop(Task& task)
+	{
+		unique_lock<std::mutex> l(mutex);
+		cv.wait(l, [this] { return stopping || !tasks.empty(); });
+		// Queued tasks are still run when stopping, their completions may already be expected
+		if (tasks.empty()) return false;
+		task = std::move(tasks.front());
+		tasks.pop_front();
+		return true;
+	}
+
+	void WorkerPool::run(Task& task) noexcept
+	{
+		uint64_t start = Util::getHighResTimestamp();
+		waitTime += start - task.queued;
+		++active;
+		try
+		{
+			task.work();
+		}
+		catch (const std::exception& e)
+		{
+			// Logging isn't thread safe
+			string error = e.what();
+			core.addJob([this, error] { LOG(className, "Work failed: " + error); });
+		}
+		--active;
+		busyTime += Util::getHighResTimestamp() - start;
+		++completed;
+
+		if (task.completion)
+		{
+			// Hand the completion over so that it's also destroyed on the reactor thread; it
+			// may hold references that aren't thread safe, such as a script function
+			auto completion = new Callback(std::move(task.completion));
+			core.addJob([completion] {
+				unique_ptr<Callback> c(completion);
+				(*c)();
+			});
+		}
+		task = Task();
+	}
+
+} // namespace adchpp
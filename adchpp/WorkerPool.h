@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ADCHPP_WORKERPOOL_H
+#define ADCHPP_WORKERPOOL_H
+
+#include "forward.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace adchpp
+{
+
+	/**
+	 * A small pool of threads for CPU-heavy tasks that would otherwise stall the
+	 * reactor. The work function runs on one of the pool threads and must not touch
+	 * hub state (entities, managers, scripts); the completion is then posted back to
+	 * the reactor thread with Core::addJob, where it can safely use the result.
+	 */
+	class WorkerPool
+	{
+	public:
+		typedef std::function<void()> Callback;
+
+		/** Number of threads to start; 0 runs the work inline on the reactor thread */
+		void setThreads(size_t n) { threads = n; }
+		size_t getThreads() const { return threads; }
+
+		/** Run work on a pool thread, then completion (if set) on the reactor thread */
+		void add(const Callback& work, const Callback& completion) noexcept;
+
+		/** Tasks waiting for a free thread */
+		size_t getQueued() const;
+		/** Tasks being worked on */
+		size_t getActive() const { return active; }
+		int64_t getCompleted() const { return completed; }
+		/** Time spent in work functions, in nanoseconds */
+		uint64_t getBusyTime() const { return busyTime; }
+		/** Time tasks spent waiting for a thread, in nanoseconds */
+		uint64_t getWaitTime() const { return waitTime; }
+
+		~WorkerPool();
+
+	private:
+		friend class Core;
+
+		class Worker;
+
+		struct Task
+		{
+			Callback work;
+			Callback completion;
+			uint64_t queued;
+		};
+
+		WorkerPool(Core& core);
+
+		void start();
+		/** Finish the queued tasks and stop the threads; later tasks run inline */
+		void stop();
+
+		void run(Task& task) noexcept;
+		bool pop(Task& task);
+
+		size_t threads;
+
+		mutable std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<Task> tasks;
+		std::vector<std::unique_ptr<Worker>> workers;
+		bool stopping;
+
+		std::atomic<size_t> active;
+		std::atomic<int64_t> completed;
+		std::atomic<uint64_t> busyTime;
+		std::atomic<uint64_t> waitTime;
+
+		Core& core;
+	};
+
+} // namespace adchpp
+
+#endif // ADCHPP_WORKERPOOL_H
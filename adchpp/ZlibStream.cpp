@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifdef HAVE_ZLIB
+
+#include "ZlibStream.h"
+#include "SocketManager.h"
+
+#include <baselib/TimeUtil.h>
+#include <string.h>
+
+namespace adchpp
+{
+	using namespace std;
+	using boost::system::error_code;
+
+	ZlibStream::ZlibStream(SocketManager& sm, const AsyncStreamPtr& stream, int level) :
+		sm(sm), stream(stream), started(false), finished(false), finishing(false), outLen(0), inBytes(0)
+	{
+		memset(&zs, 0, sizeof(zs));
+		valid = deflateInit(&zs, level) == Z_OK;
+		if (valid) sm.getStats().compressStreams++;
+	}
+
+	ZlibStream::~ZlibStream()
+	{
+		dcdebug("ZlibStream deleted\n");
+		if (valid)
+		{
+			deflateEnd(&zs);
+			sm.getStats().compressStreams--;
+		}
+	}
+
+	void ZlibStream::write(const BufferList& bufs, const Handler& handler)
+	{
+		uint64_t start = Util::getHighResTimestamp();
+
+		inBytes = 0;
+		for (auto i = bufs.begin(), iend = bufs.end(); i != iend; ++i)
+			inBytes += (*i)->size();
+
+		out = make_shared<Buffer>(inBytes / 2 + 64);
+		outLen = 0;
+		if (!started)
+		{
+			static const char zon[] = "IZON\n";
+			memcpy(out->data(), zon, sizeof(zon) - 1);
+			outLen = sizeof(zon) - 1;
+			started = true;
+		}
+
+		for (auto i = bufs.begin(), iend = bufs.end(); i != iend; ++i)
+			compress((*i)->data(), (*i)->size(), Z_NO_FLUSH);
+		compress(nullptr, 0, Z_SYNC_FLUSH);
+		out->resize(outLen);
+
+		auto& stats = sm.getStats();
+		stats.compressIn += inBytes;
+		stats.compressOut += outLen;
+		stats.compressTime += Util::getHighResTimestamp() - start;
+
+		writeOut(handler);
+	}
+
+	bool ZlibStream::handOff(int& fd, std::string& pending)
+	{
+		fd = -1;
+		if (!valid) return true;
+		if (finishing) return false;
+
+		if (started && !finished)
+		{
+			// The client reads uncompressed data once the zlib stream has ended
+			out = make_shared<Buffer>(64);
+			outLen = 0;
+			inBytes = 0;
+			compress(nullptr, 0, Z_FINISH);
+			out->resize(outLen);
+			finished = true;
+			finishing = true;
+
+			auto self = shared_from_this();
+			writeOut([self](const error_code& ec, size_t) {
+				self->finishing = false;
+				if (ec) self->valid = false;
+			});
+			return false;
+		}
+
+		return stream->handOff(fd, pending);
+	}
+
+	void ZlibStream::compress(const uint8_t* data, size_t len, int flush)
+	{
+		zs.next_in = const_cast<Bytef*>(data);
+		zs.avail_in = static_cast<uInt>(len);
+		for (;;)
+		{
+			if (out->size() - outLen < 64) out->resize(out->size() * 2);
+
+			zs.next_out = out->data() + outLen;
+			zs.avail_out = static_cast<uInt>(out->size() - outLen);
+			int ret = deflate(&zs, flush);
+			outLen = out->size() - zs.avail_out;
+
+			if (ret == Z_STREAM_END || ret == Z_STREAM_ERROR) break;
+			// Space left over means that deflate had nothing more to give
+			if (flush != Z_FINISH && zs.avail_in == 0 && zs.avail_out > 0) break;
+		}
+	}
+
+	void ZlibStream::writeOut(const Handler& handler)
+	{
+		auto self = shared_from_this();
+		stream->write(BufferList(1, out), [self, handler](const error_code& ec, size_t bytes) {
+			self->completeWrite(ec, bytes, handler);
+		});
+	}
+
+	void ZlibStream::completeWrite(const error_code& ec, size_t bytes, const Handler& handler)
+	{
+		if (ec)
+		{
+			out.reset();
+			handler(ec, 0);
+			return;
+		}
+
+		if (bytes < out->size())
+		{
+			out->erase_first(bytes);
+			writeOut(handler);
+			return;
+		}
+
+		out.reset();
+		handler(ec, inBytes);
+	}
+
+} // namespace adchpp
+
+#endif // HAVE_ZLIB
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef ADCHPP_ZLIBSTREAM_H
+#define ADCHPP_ZLIBSTREAM_H
+
+#ifdef HAVE_ZLIB
+
+#include "AsyncStream.h"
+#include "forward.h"
+
+#include <zlib.h>
+
+namespace adchpp
+{
+
+	/**
+	 * Outbound compression for the ADC ZLIF extension. The first write starts with an
+	 * uncompressed IZON, and everything after it belongs to one zlib stream. Each write
+	 * ends with a sync flush, so the client can decode all that was written while the
+	 * window carries over from one write to the next: a new INF still compresses against
+	 * the ones sent before it. Reads pass straight through.
+	 *
+	 * Writes complete once all of the compressed data has been written, and report the
+	 * uncompressed size so that ManagedSocket can account for its buffers as before.
+	 */
+	class ZlibStream : public AsyncStream, public std::enable_shared_from_this<ZlibStream>
+	{
+	public:
+		ZlibStream(SocketManager& sm, const AsyncStreamPtr& stream, int level);
+		~ZlibStream();
+
+		/** @return false if zlib couldn't be set up, in which case the stream mustn't be used */
+		bool isValid() const { return valid; }
+
+		virtual size_t available() { return stream->available(); }
+		virtual void init(const std::function<void()>& postInit) { stream->init(postInit); }
+		virtual void setOptions(size_t bufferSize) { stream->setOptions(bufferSize); }
+		virtual std::string getIp() { return stream->getIp(); }
+		virtual void prepareRead(const BufferPtr& buf, const Handler& handler) { stream->prepareRead(buf, handler); }
+		virtual size_t read(const BufferPtr& buf) { return stream->read(buf); }
+		virtual void write(const BufferList& bufs, const Handler& handler);
+		virtual void shutdown(const Handler& handler) { stream->shutdown(handler); }
+		virtual void close() { stream->close(); }
+
+		/** Ends the zlib stream first, so that the process taking over can go on uncompressed */
+		virtual bool handOff(int& fd, std::string& pending);
+
+	private:
+		void compress(const uint8_t* data, size_t len, int flush);
+		void writeOut(const Handler& handler);
+		void completeWrite(const boost::system::error_code& ec, size_t bytes, const Handler& handler);
+
+		SocketManager& sm;
+		AsyncStreamPtr stream;
+
+		z_stream zs;
+		bool valid;
+		/** IZON has been written */
+		bool started;
+		/** The zlib stream has ended */
+		bool finished;
+		bool finishing;
+
+		/** Compressed data not written yet, and its length while it's being filled */
+		BufferPtr out;
+		size_t outLen;
+		/** Uncompressed bytes that the current write stands for */
+		size_t inBytes;
+	};
+
+} // namespace adchpp
+
+#endif // HAVE_ZLIB
+
+#endif // ADCHPP_ZLIBSTREAM_H
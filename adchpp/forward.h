@@ -27,11 +27,16 @@ namespace adchpp
 
 	class Client;
 	class ClientManager;
+	class CommandStats;
 	class Core;
+	class EgressScheduler;
 	class Entity;
+	class EventJournal;
+	class Handoff;
 	class LogManager;
 
 	class ManagedSocket;
+	class MetricsServer;
 	typedef std::shared_ptr<ManagedSocket> ManagedSocketPtr;
 
 	class PluginManager;
@@ -43,8 +48,24 @@ namespace adchpp
 	class SocketFactory;
 	typedef std::shared_ptr<SocketFactory> SocketFactoryPtr;
 
+	class LocalSocketFactory;
+	typedef std::shared_ptr<LocalSocketFactory> LocalSocketFactoryPtr;
+
 	class SocketManager;
 
+	struct ListenerStats;
+	typedef std::shared_ptr<ListenerStats> ListenerStatsPtr;
+
+	class TLSContext;
+
+	class TrafficCapture;
+
+	class UringService;
+
+	class Watchdog;
+
+	class WorkerPool;
+
 } // namespace adchpp
 
 #endif /*FORWARD_H_*/
@@ -18,16 +18,39 @@
 
 #include <adchpp/Core.h>
 #include <adchpp/ClientManager.h>
+#include <adchpp/CommandStats.h>
+#include <adchpp/EventJournal.h>
+#include <adchpp/Handoff.h>
 #include <adchpp/LogManager.h>
+#include <adchpp/MetricsServer.h>
 #include <adchpp/PluginManager.h>
 #include <adchpp/SocketManager.h>
+#include <adchpp/TrafficCapture.h>
+#include <adchpp/Watchdog.h>
+#include <adchpp/WorkerPool.h>
 #include <adchpp/AppPaths.h>
 #include <baselib/File.h>
 #include <baselib/SimpleXML.h>
 #include <baselib/PathUtil.h>
+#include <baselib/StrUtil.h>
 
 using namespace adchpp;
 
+static const struct
+{
+	const char* tag;
+	Reason type;
+} rateLimitTags[] = {
+	{ "ReadRate", REASON_RATE_BYTES },
+	{ "CommandRate", REASON_RATE_COMMANDS },
+	{ "SearchRate", REASON_RATE_SEARCH },
+	{ "ChatRate", REASON_RATE_CHAT },
+	{ "CtmRate", REASON_RATE_CTM },
+	{ "InfRate", REASON_RATE_INF },
+	{ "IpReadRate", REASON_RATE_IP_BYTES },
+	{ "IpCommandRate", REASON_RATE_IP_COMMANDS }
+};
+
 void loadXML(Core& core, const string& fileName)
 {
 	printf("Loading settings from %s\n", fileName.c_str());
@@ -61,6 +84,60 @@ void loadXML(Core& core, const string& fileName)
 					{
 						core.getLogManager().setLogFile(xml.getChildData());
 					}
+					else if (tag == "LogQueueSize")
+					{
+						core.getLogManager().setQueueSize(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "LogAsync")
+					{
+						core.getLogManager().setAsync(xml.getChildData() == "1");
+					}
+					else if (tag == "EventJournal")
+					{
+						core.getEventJournal().setFile(xml.getChildData());
+					}
+					else if (tag == "EventJournalQueueSize")
+					{
+						core.getEventJournal().setQueueSize(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "TrafficCapture")
+					{
+						core.getTrafficCapture().setFile(xml.getChildData());
+					}
+					else if (tag == "TrafficCaptureQueueSize")
+					{
+						core.getTrafficCapture().setQueueSize(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "CommandStats")
+					{
+						core.getCommandStats().setEnabled(xml.getChildData() == "1");
+					}
+					else if (tag == "CommandStatsDump")
+					{
+						core.getCommandStats().setDumpInterval(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "MetricsAddress")
+					{
+						core.getMetricsServer().setAddress(xml.getChildData());
+					}
+					else if (tag == "HandoffSocket")
+					{
+						const string& drain = xml.getChildAttrib("DrainTimeout");
+						if (!drain.empty()) core.getHandoff().setDrainTimeout(Util::toInt(drain));
+						core.getHandoff().setPath(xml.getChildData());
+					}
+					else if (tag == "WatchdogThreshold")
+					{
+						core.getWatchdog().setThreshold(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "WatchdogInterval")
+					{
+						core.getWatchdog().setInterval(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "WorkerThreads")
+					{
+						core.getWorkerPool().setThreads(Util::toInt(xml.getChildData()));
+					}
 					else if (tag == "DataPath")
 					{
 						string path = xml.getChildData();
@@ -80,6 +157,64 @@ void loadXML(Core& core, const string& fileName)
 					{
 						core.getSocketManager().setMaxBufferSize(Util::toInt(xml.getChildData()));
 					}
+					else if (tag == "EgressRate")
+					{
+						auto& egress = core.getSocketManager().getEgressScheduler();
+						egress.setRate(Util::toInt(xml.getChildData()));
+						const string& quantum = xml.getChildAttrib("Quantum");
+						if (!quantum.empty()) egress.setQuantum(Util::toInt(quantum));
+					}
+					else if (tag == "EgressWeights")
+					{
+						static const char* attribs[EgressScheduler::CLASS_LAST] = { "Control", "Chat", "Inf", "Search", "Result", "Ctm" };
+						auto& egress = core.getSocketManager().getEgressScheduler();
+						for (int i = 0; i < EgressScheduler::CLASS_LAST; ++i)
+						{
+							const string& weight = xml.getChildAttrib(attribs[i]);
+							if (!weight.empty()) egress.setWeight((EgressScheduler::Class) i, Util::toDouble(weight));
+						}
+					}
+					else if (tag == "TLSHandshakeThreads")
+					{
+						core.getSocketManager().setHandshakeThreads(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "TLSSessionCache")
+					{
+						const string& timeout = xml.getChildAttrib("Timeout");
+						if (!timeout.empty()) core.getSocketManager().setSessionTimeout(Util::toInt(timeout));
+						core.getSocketManager().setSessionCacheSize(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "TLSTicketKeyLifetime")
+					{
+						core.getSocketManager().setTicketKeyLifetime(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "KernelTLS")
+					{
+						core.getSocketManager().setKernelTLS(Util::toInt(xml.getChildData()) != 0);
+					}
+					else if (tag == "SocketBackend")
+					{
+						core.getSocketManager().setBackend(xml.getChildData() == "io_uring" ?
+							SocketManager::BACKEND_IO_URING : SocketManager::BACKEND_ASIO);
+					}
+					else if (tag == "WriteCombining")
+					{
+						core.getSocketManager().setWriteCombining(Util::toInt(xml.getChildData()) != 0);
+					}
+					else if (tag == "Compression")
+					{
+						core.getSocketManager().setCompressionLevel(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "PreLoginLimit")
+					{
+						const string& network = xml.getChildAttrib("PerNetwork");
+						if (!network.empty()) core.getSocketManager().setPreLoginNetworkLimit(Util::toInt(network));
+						core.getSocketManager().setPreLoginLimit(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "DeferAccept")
+					{
+						core.getSocketManager().setDeferAccept(Util::toInt(xml.getChildData()));
+					}
 					else if (tag == "OverflowTimeout")
 					{
 						core.getSocketManager().setOverflowTimeout(Util::toInt(xml.getChildData()));
@@ -88,6 +223,16 @@ void loadXML(Core& core, const string& fileName)
 					{
 						core.getSocketManager().setDisconnectTimeout(Util::toInt(xml.getChildData()));
 					}
+					else if (tag == "LoginRate")
+					{
+						const string& lag = xml.getChildAttrib("LagTarget");
+						if (!lag.empty()) core.getClientManager().setLoginLagTarget(Util::toInt(lag));
+						core.getClientManager().setLoginRate(Util::toInt(xml.getChildData()));
+					}
+					else if (tag == "SlowTimeout")
+					{
+						core.getClientManager().setSlowTimeout(Util::toInt(xml.getChildData()));
+					}
 					else if (tag == "LogTimeout")
 					{
 						core.getClientManager().setLogTimeout(Util::toInt(xml.getChildData()));
@@ -96,6 +241,15 @@ void loadXML(Core& core, const string& fileName)
 					{
 						core.getClientManager().setHbriTimeout(Util::toInt(xml.getChildData()));
 					}
+					else
+					{
+						for (const auto& rl : rateLimitTags)
+							if (tag == rl.tag)
+							{
+								RateLimit limit(Util::toDouble(xml.getChildData()), Util::toDouble(xml.getChildAttrib("Burst")));
+								core.getClientManager().getRateLimiter().setLimit(rl.type, limit);
+							}
+					}
 				}
 				xml.stepOut();
 			}
@@ -113,7 +267,13 @@ void loadXML(Core& core, const string& fileName)
 					server->address4 = xml.getChildAttrib("HubAddress4", Util::emptyString);
 					server->address6 = xml.getChildAttrib("HubAddress6", Util::emptyString);
 
-					if (xml.getBoolChildAttrib("TLS"))
+					server->path = xml.getChildAttrib("Path", Util::emptyString);
+					server->mode = xml.getChildAttrib("Mode", Util::emptyString);
+					server->trustedUsers = xml.getChildAttrib("TrustedUsers", Util::emptyString);
+					server->proxy = xml.getBoolChildAttrib("Proxy");
+
+					// TLS ends at the proxy in front of a unix domain socket
+					if (xml.getBoolChildAttrib("TLS") && server->path.empty())
 					{
 						server->TLSParams.cert = AppPaths::makeAbsolutePath(xml.getChildAttrib("Certificate"));
 						server->TLSParams.pkey = AppPaths::makeAbsolutePath(xml.getChildAttrib("PrivateKey"));
@@ -17,6 +17,7 @@
  */
 
 #include <adchpp/Core.h>
+#include <adchpp/Handoff.h>
 #include <adchpp/LogManager.h>
 #include <adchpp/AppPaths.h>
 #include <adchpp/version.h>
@@ -33,6 +34,7 @@ using namespace adchpp;
 
 static FILE* pidFile;
 static string pidFileName;
+static bool takeOver;
 static std::shared_ptr<Core> core;
 
 static void installHandler();
@@ -139,7 +141,7 @@ static void run(const string& configPath, bool asDaemon, ProfileLocker& locker)
 	if (asDaemon)
 	{
 		daemonize();
-		locker.updatePidFile();
+		if (!takeOver) locker.updatePidFile();
 	}
 	else
 		printf("Starting %s\n", appName.c_str());
@@ -147,6 +149,21 @@ static void run(const string& configPath, bool asDaemon, ProfileLocker& locker)
 	{
 		core = Core::create(configPath);
 		init(asDaemon);
+		if (takeOver)
+		{
+			core->getHandoff().receive();
+
+			// The hub we took over from may still be on its way out
+			if (!pidFileName.empty())
+			{
+				for (int i = 0; !locker.lock(); ++i)
+				{
+					if (i == 50) throw Exception("Unable to create lock file " + pidFileName);
+					usleep(100 * 1000);
+				}
+				if (asDaemon) locker.updatePidFile();
+			}
+		}
 		if (!asDaemon) printf("%s running, press Ctrl-C to exit...\n", versionString.c_str());
 		core->run();
 		core.reset();
@@ -165,6 +182,7 @@ static void printUsage()
 		"\t-c confdir\tSpecify the path of the configuration directory (default: /etc/" APPNAME ")\n"
 		"\t-d\tRun as a daemon\n"
 		"\t-p filename\tCreate PID file\n"
+		"\t-t\tTake over from the running hub, see HandoffSocket\n"
 		"\t-v\tPrint version number\n"
 		"\t-h\tShow this help message\n";
 	puts(text);
@@ -214,6 +232,10 @@ int main(int argc, char* argv[])
 			checkArg(argc, argv, i);
 			pidFileName = argv[++i];
 		}
+		else if (strcmp(argv[i], "-t") == 0)
+		{
+			takeOver = true;
+		}
 		else if (strcmp(argv[i], "-h") == 0)
 		{
 			printUsage();
@@ -231,7 +253,7 @@ int main(int argc, char* argv[])
 	{
 		pidFileName = AppPaths::makeAbsolutePath("/run/", pidFileName);
 		locker.setLockFileName(pidFileName);
-		if (!locker.lock())
+		if (!takeOver && !locker.lock())
 		{
 			fprintf(stderr, "Unable to create lock file %s\n", pidFileName.c_str());
 			return 1;
@@ -160,6 +160,7 @@ end
 local function dump_banned(c, ban)
 	local str = "You are banned" .. ban_return_info(ban)
 
+	adchpp.journalBan(c, ban.reason or "")
 	autil.dump(c, adchpp.AdcCommand_ERROR_BANNED_GENERIC, function(cmd)
 		cmd:addParam("MS" .. str)
 
@@ -1156,6 +1156,7 @@ local function dump_banned(c, cmd, update, msg, minutes)
 	else
 		str = str .. "\n\tExpires never !"
 	end
+	adchpp.journalBan(c, msg)
 	autil.dump(c, adchpp.AdcCommand_ERROR_BANNED_GENERIC, function(cmd)
 		cmd:addParam("MS" .. str)
 		local expires
@@ -1252,6 +1253,7 @@ local function dump_kicked(c, cmd, update, msg)
 			end
 		end
 	end
+	adchpp.journalKick(c, msg)
 	autil.dump(c, adchpp.AdcCommand_ERROR_BANNED_GENERIC, function(cmd)
 		cmd:addParam("MS" .. str)
 		cmd:addParam("TL" .. base.tostring(expires))
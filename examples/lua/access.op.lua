@@ -50,6 +50,7 @@ commands.kick = {
 		if string.len(reason) > 0 then
 			text = text .. " (reason: " .. reason .. ")"
 		end
+		adchpp.journalKick(victim, reason)
 		autil.dump(victim, adchpp.AdcCommand_ERROR_BANNED_GENERIC, function(cmd)
 			cmd:addParam("ID" .. adchpp.AdcCommand_fromSID(c:getSID()))
 			:addParam("MS" .. text)
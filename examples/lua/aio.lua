@@ -3,6 +3,7 @@
 local base = _G
 module('aio')
 local io = base.require('io')
+local string = base.require('string')
 local json = base.require('json')
 
 -- forward declarations.
@@ -53,6 +54,24 @@ function save_file(path, contents)
 	return write_file(path, contents)
 end
 
+-- same as save_file, but the file is written by a worker thread so that saving large files
+-- doesn't hold up the hub. callback (optional) is called once done, with the error message on
+-- failure. the worker can't see the caller's state, so contents must be a string.
+function save_file_async(path, contents, callback)
+	local adchpp = base.luadchpp
+	local chunk = "return require('aio').save_file(" .. string.format('%q', path) .. ", ...)"
+	adchpp.addWork(chunk, contents, function(ok, err)
+		if not callback then
+			return
+		end
+		if not ok or #err > 0 then
+			callback(err)
+		else
+			callback()
+		end
+	end)
+end
+
 -- wrapper around a json decoder, suitable for use as the post_load param of load_file.
 function json_loader(str)
 	local ok, ret = base.pcall(json.decode, str)
@@ -9,6 +9,8 @@
 #include <adchpp/Hub.h>
 #include <adchpp/Bot.h>
 #include <adchpp/Core.h>
+#include <adchpp/EventJournal.h>
+#include <adchpp/Watchdog.h>
 #include <adchpp/Utils.h>
 #include <adchpp/version.h>
 #include <baselib/TigerHash.h>
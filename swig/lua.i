@@ -22,6 +22,10 @@ static void free_lua_ref(void* data) {
 typedef unsigned int size_t;
 
 %{
+extern "C" {
+#include <lualib.h>
+}
+
 	static adchpp::Core *getCurrentCore(lua_State *l) {
 		lua_getglobal(l, "currentCore");
 		void *core = lua_touserdata(l, lua_gettop(l));
@@ -32,6 +36,42 @@ typedef unsigned int size_t;
 	namespace adchpp {
 		const std::string &getConfigPath(lua_State *l);
 	}
+
+	/* Run a chunk in a private Lua state, on a worker thread. The chunk gets the input string
+	as ... and can require modules from the script directory, but it sees nothing of the hub
+	nor of the calling script. Its first return value is converted to a string. */
+	static bool runIsolated(const std::string& path, const std::string& chunk, const std::string& input, std::string& result) {
+		lua_State* L = luaL_newstate();
+		if(!L) {
+			result = "Unable to create a Lua state";
+			return false;
+		}
+		luaL_openlibs(L);
+
+		if(!path.empty()) {
+			lua_getglobal(L, "package");
+			lua_getfield(L, -1, "path");
+			std::string packagePath = path + "?.lua;" + lua_tostring(L, -1);
+			lua_pop(L, 1);
+			lua_pushstring(L, packagePath.c_str());
+			lua_setfield(L, -2, "path");
+			lua_pop(L, 1);
+		}
+
+		bool ok = luaL_loadbuffer(L, chunk.data(), chunk.size(), "=work") == 0;
+		if(ok) {
+			lua_pushlstring(L, input.data(), input.size());
+			ok = lua_pcall(L, 1, 1, 0) == 0;
+		}
+
+		size_t len;
+		const char* str = lua_tolstring(L, -1, &len);
+		if(str) {
+			result.assign(str, len);
+		}
+		lua_close(L);
+		return ok;
+	}
 %}
 
 %wrapper %{
@@ -72,7 +112,10 @@ private:
 
 class LuaFunction {
 public:
-	LuaFunction(lua_State* L_) : L(L_), registryItem(new RegistryItem(L_)) { }
+	LuaFunction(lua_State* L_) : L(L_), registryItem(new RegistryItem(L_)) {
+		adchpp::Core* core = getCurrentCore(L_);
+		watchdog = core ? &core->getWatchdog() : 0;
+	}
 
 	void operator()() {
 		pushFunction();
@@ -192,6 +235,15 @@ public:
 		docall(2, 0);
 	}
 
+	void operator()(bool ok, const std::string& str) {
+		pushFunction();
+
+		lua_pushboolean(L, ok);
+		lua_pushlstring(L, str.data(), str.size());
+
+		docall(2, 0);
+	}
+
 private:
 	void pushFunction() {
 		registryItem->push();
@@ -202,7 +254,14 @@ private:
 		int base = lua_gettop(L) - narg;  /* function index */
 		lua_pushcfunction(L, traceback);  /* push traceback function */
 		lua_insert(L, base);  /* put it under chunk and args */
+		uint64_t start = watchdog && watchdog->getEnabled() ? Util::getHighResTimestamp() : 0;
 		status = lua_pcall(L, narg, nret, base);
+		if(start) {
+			uint64_t elapsed = Util::getHighResTimestamp() - start;
+			if(elapsed > watchdog->getThresholdNs()) {
+				reportSlow(start, elapsed);
+			}
+		}
 		lua_remove(L, base);  /* remove traceback function */
 		if(status == LUA_ERRRUN) {
 			if (!lua_isnil(L, -1)) {
@@ -224,8 +283,19 @@ private:
 		return status;
 	}
 
+	/* Tell the watchdog where the slow function was defined */
+	void reportSlow(uint64_t start, uint64_t elapsed) {
+		lua_Debug ar;
+		pushFunction();
+		if(!lua_getinfo(L, ">S", &ar)) {
+			return;
+		}
+		watchdog->addOffender(std::string("script ") + ar.short_src + ":" + Util::toString(ar.linedefined), start, elapsed);
+	}
+
 	lua_State* L;
 	std::shared_ptr<RegistryItem> registryItem;
+	adchpp::Watchdog* watchdog;
 };
 
 static int exec(lua_State* L) {
@@ -299,6 +369,10 @@ uint32_t, const uint32_t&
 	$1 = LuaFunction(L);
 }
 
+%typemap(in) std::function<void (bool, const std::string&) > {
+	$1 = LuaFunction(L);
+}
+
 %include "embed.i"
 
 %extend adchpp::AdcCommand {
@@ -365,6 +439,20 @@ namespace adchpp {
 	const std::string &Util_getCfgPath(lua_State *l) { return getConfigPath(l); }
 	std::string Util_getLocalIp(lua_State *l) { return Utils::getLocalIp(); }
 	std::string Util_formatBytes(lua_State *l, int64_t bytes) { return Util::formatBytes(bytes); }
+
+	void journalKick(lua_State *l, Entity &c, const std::string &info) { getCurrentCore(l)->getEventJournal().record(journal::EVENT_KICK, c, REASON_PLUGIN, info); }
+	void journalBan(lua_State *l, Entity &c, const std::string &info) { getCurrentCore(l)->getEventJournal().record(journal::EVENT_BAN, c, REASON_PLUGIN, info); }
+
+	void addWork(lua_State *l, const std::string &chunk, const std::string &input, std::function<void (bool, const std::string&)> completion) {
+		lua_getglobal(l, "scriptPath");
+		std::string path = lua_isstring(l, -1) ? lua_tostring(l, -1) : std::string();
+		lua_pop(l, 1);
+
+		auto ok = std::make_shared<bool>(false);
+		auto result = std::make_shared<std::string>();
+		getCurrentCore(l)->addWork([=] { *ok = runIsolated(path, chunk, input, *result); },
+			[=] { completion(*ok, *result); });
+	}
 }
 
 %}
@@ -2705,6 +2705,8 @@ SWIG_Lua_dostring(lua_State *L, const char *str) {
 #include <adchpp/Hub.h>
 #include <adchpp/Bot.h>
 #include <adchpp/Core.h>
+#include <adchpp/EventJournal.h>
+#include <adchpp/Watchdog.h>
 #include <adchpp/Utils.h>
 #include <adchpp/version.h>
 #include <baselib/TigerHash.h>
@@ -2888,6 +2890,10 @@ static void free_lua_ref(void* data) {
 }
 
 
+extern "C" {
+#include <lualib.h>
+}
+
 	static adchpp::Core *getCurrentCore(lua_State *l) {
 		lua_getglobal(l, "currentCore");
 		void *core = lua_touserdata(l, lua_gettop(l));
@@ -2899,6 +2905,42 @@ static void free_lua_ref(void* data) {
 		const std::string &getConfigPath(lua_State *l);
 	}
 
+	/* Run a chunk in a private Lua state, on a worker thread. The chunk gets the input string
+	as ... and can require modules from the script directory, but it sees nothing of the hub
+	nor of the calling script. Its first return value is converted to a string. */
+	static bool runIsolated(const std::string& path, const std::string& chunk, const std::string& input, std::string& result) {
+		lua_State* L = luaL_newstate();
+		if(!L) {
+			result = "Unable to create a Lua state";
+			return false;
+		}
+		luaL_openlibs(L);
+
+		if(!path.empty()) {
+			lua_getglobal(L, "package");
+			lua_getfield(L, -1, "path");
+			std::string packagePath = path + "?.lua;" + lua_tostring(L, -1);
+			lua_pop(L, 1);
+			lua_pushstring(L, packagePath.c_str());
+			lua_setfield(L, -2, "path");
+			lua_pop(L, 1);
+		}
+
+		bool ok = luaL_loadbuffer(L, chunk.data(), chunk.size(), "=work") == 0;
+		if(ok) {
+			lua_pushlstring(L, input.data(), input.size());
+			ok = lua_pcall(L, 1, 1, 0) == 0;
+		}
+
+		size_t len;
+		const char* str = lua_tolstring(L, -1, &len);
+		if(str) {
+			result.assign(str, len);
+		}
+		lua_close(L);
+		return ok;
+	}
+
 
 #define SWIG_exception(a,b)\
 { lua_pushfstring(L,"%s:%s",#a,b);SWIG_fail; }
@@ -3155,6 +3197,20 @@ namespace adchpp {
 	const std::string &Util_getCfgPath(lua_State *l) { return getConfigPath(l); }
 	std::string Util_getLocalIp(lua_State *l) { return Utils::getLocalIp(); }
 	std::string Util_formatBytes(lua_State *l, int64_t bytes) { return Util::formatBytes(bytes); }
+
+	void journalKick(lua_State *l, Entity &c, const std::string &info) { getCurrentCore(l)->getEventJournal().record(journal::EVENT_KICK, c, REASON_PLUGIN, info); }
+	void journalBan(lua_State *l, Entity &c, const std::string &info) { getCurrentCore(l)->getEventJournal().record(journal::EVENT_BAN, c, REASON_PLUGIN, info); }
+
+	void addWork(lua_State *l, const std::string &chunk, const std::string &input, std::function<void (bool, const std::string&)> completion) {
+		lua_getglobal(l, "scriptPath");
+		std::string path = lua_isstring(l, -1) ? lua_tostring(l, -1) : std::string();
+		lua_pop(l, 1);
+
+		auto ok = std::make_shared<bool>(false);
+		auto result = std::make_shared<std::string>();
+		getCurrentCore(l)->addWork([=] { *ok = runIsolated(path, chunk, input, *result); },
+			[=] { completion(*ok, *result); });
+	}
 }
 
 
@@ -3218,7 +3274,10 @@ private:
 
 class LuaFunction {
 public:
-	LuaFunction(lua_State* L_) : L(L_), registryItem(new RegistryItem(L_)) { }
+	LuaFunction(lua_State* L_) : L(L_), registryItem(new RegistryItem(L_)) {
+		adchpp::Core* core = getCurrentCore(L_);
+		watchdog = core ? &core->getWatchdog() : 0;
+	}
 
 	void operator()() {
 		pushFunction();
@@ -3338,6 +3397,15 @@ public:
 		docall(2, 0);
 	}
 
+	void operator()(bool ok, const std::string& str) {
+		pushFunction();
+
+		lua_pushboolean(L, ok);
+		lua_pushlstring(L, str.data(), str.size());
+
+		docall(2, 0);
+	}
+
 private:
 	void pushFunction() {
 		registryItem->push();
@@ -3348,7 +3416,14 @@ private:
 		int base = lua_gettop(L) - narg;  /* function index */
 		lua_pushcfunction(L, traceback);  /* push traceback function */
 		lua_insert(L, base);  /* put it under chunk and args */
+		uint64_t start = watchdog && watchdog->getEnabled() ? Util::getHighResTimestamp() : 0;
 		status = lua_pcall(L, narg, nret, base);
+		if(start) {
+			uint64_t elapsed = Util::getHighResTimestamp() - start;
+			if(elapsed > watchdog->getThresholdNs()) {
+				reportSlow(start, elapsed);
+			}
+		}
 		lua_remove(L, base);  /* remove traceback function */
 		if(status == LUA_ERRRUN) {
 			if (!lua_isnil(L, -1)) {
@@ -3370,8 +3445,19 @@ private:
 		return status;
 	}
 
+	/* Tell the watchdog where the slow function was defined */
+	void reportSlow(uint64_t start, uint64_t elapsed) {
+		lua_Debug ar;
+		pushFunction();
+		if(!lua_getinfo(L, ">S", &ar)) {
+			return;
+		}
+		watchdog->addOffender(std::string("script ") + ar.short_src + ":" + Util::toString(ar.linedefined), start, elapsed);
+	}
+
 	lua_State* L;
 	std::shared_ptr<RegistryItem> registryItem;
+	adchpp::Watchdog* watchdog;
 };
 
 static int exec(lua_State* L) {
@@ -17373,6 +17459,111 @@ fail:
 }
 
 
+static int _wrap_journalKick(lua_State* L) {
+  int SWIG_arg = 0;
+  lua_State *arg1 = (lua_State *) 0 ;
+  adchpp::Entity *arg2 = 0 ;
+  std::string *arg3 = 0 ;
+  std::string temp3 ;
+  
+  arg1 = L;
+  SWIG_check_num_args("adchpp::journalKick",2,2)
+  if(!lua_isuserdata(L,1)) SWIG_fail_arg("adchpp::journalKick",1,"adchpp::Entity &");
+  if(!lua_isstring(L,2)) SWIG_fail_arg("adchpp::journalKick",2,"std::string const &");
+  
+  if (!SWIG_IsOK(SWIG_ConvertPtr(L,1,(void**)&arg2,SWIGTYPE_p_adchpp__Entity,0))){
+    SWIG_fail_ptr("journalKick",1,SWIGTYPE_p_adchpp__Entity);
+  }
+  
+  temp3.assign(lua_tostring(L,2),lua_rawlen(L,2)); arg3=&temp3;
+  {
+    try {
+      adchpp::journalKick(arg1,*arg2,(std::string const &)*arg3);
+    } catch(const std::exception& e) {
+      SWIG_exception(SWIG_UnknownError, e.what());
+    }
+  }
+  
+  return SWIG_arg;
+  
+  if(0) SWIG_fail;
+  
+fail:
+  lua_error(L);
+  return SWIG_arg;
+}
+
+
+static int _wrap_journalBan(lua_State* L) {
+  int SWIG_arg = 0;
+  lua_State *arg1 = (lua_State *) 0 ;
+  adchpp::Entity *arg2 = 0 ;
+  std::string *arg3 = 0 ;
+  std::string temp3 ;
+  
+  arg1 = L;
+  SWIG_check_num_args("adchpp::journalBan",2,2)
+  if(!lua_isuserdata(L,1)) SWIG_fail_arg("adchpp::journalBan",1,"adchpp::Entity &");
+  if(!lua_isstring(L,2)) SWIG_fail_arg("adchpp::journalBan",2,"std::string const &");
+  
+  if (!SWIG_IsOK(SWIG_ConvertPtr(L,1,(void**)&arg2,SWIGTYPE_p_adchpp__Entity,0))){
+    SWIG_fail_ptr("journalBan",1,SWIGTYPE_p_adchpp__Entity);
+  }
+  
+  temp3.assign(lua_tostring(L,2),lua_rawlen(L,2)); arg3=&temp3;
+  {
+    try {
+      adchpp::journalBan(arg1,*arg2,(std::string const &)*arg3);
+    } catch(const std::exception& e) {
+      SWIG_exception(SWIG_UnknownError, e.what());
+    }
+  }
+  
+  return SWIG_arg;
+  
+  if(0) SWIG_fail;
+  
+fail:
+  lua_error(L);
+  return SWIG_arg;
+}
+
+
+static int _wrap_addWork(lua_State* L) {
+  int SWIG_arg = 0;
+  lua_State *arg1 = (lua_State *) 0 ;
+  std::string *arg2 = 0 ;
+  std::string *arg3 = 0 ;
+  std::function< void (bool,std::string const &) > arg4 ;
+  std::string temp2 ;
+  std::string temp3 ;
+  
+  arg1 = L;
+  SWIG_check_num_args("adchpp::addWork",3,3)
+  if(!lua_isstring(L,1)) SWIG_fail_arg("adchpp::addWork",1,"std::string const &");
+  if(!lua_isstring(L,2)) SWIG_fail_arg("adchpp::addWork",2,"std::string const &");
+  temp2.assign(lua_tostring(L,1),lua_rawlen(L,1)); arg2=&temp2;
+  temp3.assign(lua_tostring(L,2),lua_rawlen(L,2)); arg3=&temp3;
+  {
+    arg4 = LuaFunction(L);
+  }
+  {
+    try {
+      adchpp::addWork(arg1,(std::string const &)*arg2,(std::string const &)*arg3,arg4);
+    } catch(const std::exception& e) {
+      SWIG_exception(SWIG_UnknownError, e.what());
+    }
+  }
+  
+  return SWIG_arg;
+  
+  if(0) SWIG_fail;
+  
+fail:
+  lua_error(L);
+  return SWIG_arg;
+}
+
 static swig_lua_attribute swig_SwigModule_attributes[] = {
     { "appName", _wrap_appName_get, _wrap_appName_set },
     { "versionString", _wrap_versionString_get, _wrap_versionString_set },
@@ -17516,6 +17707,9 @@ static swig_lua_method swig_SwigModule_methods[]= {
     { "Util_getCfgPath", _wrap_Util_getCfgPath},
     { "Util_getLocalIp", _wrap_Util_getLocalIp},
     { "Util_formatBytes", _wrap_Util_formatBytes},
+    { "journalKick", _wrap_journalKick},
+    { "journalBan", _wrap_journalBan},
+    { "addWork", _wrap_addWork},
     {0,0}
 };
 static swig_lua_class* swig_SwigModule_classes[]= {
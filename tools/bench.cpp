@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Micro-benchmarks for the protocol and baselib hot paths; results are written as JSON
+
+#include <adchpp/AdcCommand.h>
+#include <adchpp/Bot.h>
+#include <adchpp/CID.h>
+#include <adchpp/ClientManager.h>
+#include <adchpp/Core.h>
+#include <adchpp/HashBloom.h>
+#include <adchpp/LogManager.h>
+#include <adchpp/SocketManager.h>
+#include <adchpp/version.h>
+#include <baselib/Base32.h>
+#include <baselib/StrUtil.h>
+#include <baselib/Text.h>
+#include <baselib/TigerHash.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+using namespace adchpp;
+
+static const void* volatile sink;
+
+/** Keep the compiler from optimizing away a result */
+template <typename T> static inline void keep(const T& value)
+{
+	sink = &value;
+}
+
+struct Result
+{
+	string name;
+	uint64_t iterations;
+	double nsPerOp;
+	double bytesPerOp;
+};
+
+class Runner
+{
+public:
+	Runner(double minTime, const string& filter) : minTime(minTime), filter(filter) {}
+
+	/** f(n) must perform n operations; each one processes bytesPerOp bytes (0 - not applicable) */
+	template <typename F> void run(const string& name, double bytesPerOp, F f)
+	{
+		if (!filter.empty() && name.find(filter) == string::npos) return;
+
+		// Find an iteration count that takes a measurable amount of time...
+		uint64_t n = 1;
+		double elapsed;
+		for (;;)
+		{
+			elapsed = measure(f, n);
+			if (elapsed >= minTime / 50 || n >= (1ull << 40)) break;
+			n *= elapsed > 0 ? std::min(100.0, std::max(2.0, minTime / 50 / elapsed * 1.5)) : 100;
+		}
+
+		// ...and take the median of a few rounds
+		n = std::max<uint64_t>(1, (uint64_t) (n * (minTime / ROUNDS) / elapsed));
+		double rounds[ROUNDS];
+		for (int i = 0; i < ROUNDS; ++i)
+			rounds[i] = measure(f, n) * 1e9 / n;
+		sort(rounds, rounds + ROUNDS);
+
+		Result r = { name, n * ROUNDS, rounds[ROUNDS / 2], bytesPerOp };
+		fprintf(stderr, "%-48s %12.1f ns/op", name.c_str(), r.nsPerOp);
+		if (bytesPerOp > 0) fprintf(stderr, " %10.1f MiB/s", bytesPerOp / r.nsPerOp * 1e9 / 1048576);
+		fputc('\n', stderr);
+		results.push_back(r);
+	}
+
+	void getJSON(string& out) const
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), "{\"version\":\"%s\",\"timestamp\":%lld,\"benchmarks\":[",
+			versionString.c_str(), (long long) ::time(nullptr));
+		out += buf;
+		for (auto i = results.begin(); i != results.end(); ++i)
+		{
+			snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"iterations\":%llu,\"nsPerOp\":%.3f,\"opsPerSec\":%.1f",
+				i == results.begin() ? "" : ",", i->name.c_str(), (unsigned long long) i->iterations, i->nsPerOp,
+				1e9 / i->nsPerOp);
+			out += buf;
+			if (i->bytesPerOp > 0)
+			{
+				snprintf(buf, sizeof(buf), ",\"bytesPerSec\":%.1f", i->bytesPerOp / i->nsPerOp * 1e9);
+				out += buf;
+			}
+			out += '}';
+		}
+		out += "]}\n";
+	}
+
+private:
+	enum { ROUNDS = 5 };
+
+	template <typename F> static double measure(F& f, uint64_t n)
+	{
+		auto start = chrono::steady_clock::now();
+		f(n);
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	double minTime;
+	string filter;
+	vector<Result> results;
+};
+
+/** Stream that completes every write at once and lets the benchmark push received data */
+class NullStream : public AsyncStream
+{
+public:
+	NullStream() : capture(false) {}
+
+	virtual size_t available() { return 0; }
+	virtual void init(const std::function<void()>& postInit) { postInit(); }
+	virtual void setOptions(size_t) {}
+	virtual std::string getIp() { return "127.0.0.1"; }
+
+	virtual void prepareRead(const BufferPtr& buf, const Handler& handler)
+	{
+		readBuf = buf;
+		readHandler = handler;
+	}
+
+	virtual size_t read(const BufferPtr&) { return 0; }
+
+	virtual void write(const BufferList& bufs, const Handler& handler)
+	{
+		size_t n = 0;
+		for (auto i = bufs.begin(); i != bufs.end(); ++i)
+		{
+			n += (*i)->size();
+			if (capture) written.append((const char*) (*i)->data(), (*i)->size());
+		}
+		handler(boost::system::error_code(), n);
+	}
+
+	virtual void shutdown(const Handler& handler) { handler(boost::system::error_code(), 0); }
+	virtual void close() {}
+
+	/** Hand data to the hub the same way a socket read would */
+	void feed(const char* data, size_t len)
+	{
+		while (len > 0 && readHandler)
+		{
+			Handler h;
+			h.swap(readHandler);
+			if (!readBuf)
+			{
+				// ManagedSocket waits for readability before it allocates a buffer
+				h(boost::system::error_code(), 0);
+				continue;
+			}
+			size_t n = std::min(len, readBuf->size());
+			memcpy(readBuf->data(), data, n);
+			readBuf.reset();
+			h(boost::system::error_code(), n);
+			data += n;
+			len -= n;
+		}
+	}
+
+	bool capture;
+	string written;
+
+private:
+	BufferPtr readBuf;
+	Handler readHandler;
+};
+
+static string makePID(CID& cid)
+{
+	CID pid = CID::generate();
+	TigerHash th;
+	th.update(pid.data(), CID::SIZE);
+	cid = CID(th.finalize());
+	return pid.toBase32();
+}
+
+static void benchProtocol(Runner& r)
+{
+	const string msg = "BMSG AAAB Hello\\sworld,\\sthis\\sis\\sa\\stypical\\schat\\smessage.\n";
+	const string inf = "BINF AAAB IDFQ6BZ6WDSPWIUAD5CZLGGXNTDOHSOQHFMEP6ZZI PDKU4GVDNTIPYTRMAQIAHA6ZOMSRN3DUBUPIEBCTLLQ "
+		"NIbenchmark SL3 SS123456789012 SF12345 HN1 HR0 HO0 VE++\\s0.868 SUTCP4,UDP4,ADC0 I40.0.0.0 U412345 "
+		"DEa\\sdescription\\swith\\sspaces EMuser@example.com\n";
+
+	r.run("AdcCommand::parse MSG", (double) msg.size(), [&msg](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			AdcCommand c(msg);
+			keep(c);
+		}
+	});
+
+	r.run("AdcCommand::parse INF", (double) inf.size(), [&inf](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			AdcCommand c(inf);
+			keep(c);
+		}
+	});
+
+	const string text = "Hello world, this is a typical chat message.\nWith a second line and a \\ backslash.";
+	r.run("AdcCommand::getBuffer MSG", 0, [&text](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			AdcCommand c(AdcCommand::CMD_MSG, AdcCommand::TYPE_BROADCAST, AdcCommand::toSID("AAAB"));
+			c.addParam(text);
+			keep(c.getBuffer());
+		}
+	});
+
+	r.run("AdcCommand::escape", (double) text.size(), [&text](uint64_t n) {
+		string out;
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			out.clear();
+			AdcCommand::escape(text, out);
+			keep(out);
+		}
+	});
+}
+
+static void benchClient(Runner& r, Core& core)
+{
+	auto stream = make_shared<NullStream>();
+	auto server = make_shared<ServerInfo>();
+	stream->capture = true;
+	core.getSocketManager().accept(stream, server);
+
+	string line = "HSUP ADBASE ADTIGR\n";
+	stream->feed(line.data(), line.size());
+
+	auto p = stream->written.find("ISID ");
+	if (p == string::npos || p + 9 > stream->written.size())
+	{
+		fprintf(stderr, "Client::onData: the hub didn't assign a SID\n");
+		return;
+	}
+	string sid = stream->written.substr(p + 5, 4);
+
+	CID cid;
+	string pid = makePID(cid);
+	line = "BINF " + sid + " ID" + cid.toBase32() + " PD" + pid + " NIbench SL3 SS0 SF0 HN1 HR0 HO0 I40.0.0.0\n";
+	stream->feed(line.data(), line.size());
+	stream->capture = false;
+	stream->written.clear();
+
+	string chunk;
+	const int lines = 100;
+	for (int i = 0; i < lines; ++i)
+		chunk += "BMSG " + sid + " Hello\\sworld,\\sthis\\sis\\sa\\stypical\\schat\\smessage.\n";
+
+	r.run("Client::onData MSG lines", (double) chunk.size() / lines, [&stream, &chunk](uint64_t n) {
+		for (uint64_t i = 0; i < n; i += lines)
+			stream->feed(chunk.data(), chunk.size());
+	});
+}
+
+static void benchEntity(Runner& r, Core& core)
+{
+	auto& cm = core.getClientManager();
+	Bot* bot = cm.createBot([](Bot&, const BufferPtr&) {});
+	bot->setCID(CID::generate());
+	bot->setField("NI", "InfBot");
+	bot->setField("DE", "Benchmark bot with a description");
+	bot->setField("VE", "adchpp-bench");
+	bot->setField("SS", "0");
+	bot->setField("SF", "0");
+	bot->setField("HN", "1");
+	cm.regBot(*bot);
+
+	r.run("Entity::getINF rebuild", 0, [bot](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			bot->setField("SS", Util::toString(i));
+			keep(bot->getINF());
+		}
+	});
+
+	bot->disconnect(REASON_PLUGIN, Util::emptyString);
+}
+
+static void benchBloom(Runner& r, mt19937& rng)
+{
+	ByteVector bytes(128 * 1024);
+	for (auto& b : bytes)
+		b = (uint8_t) rng();
+
+	const size_t k = 8, h = 24;
+	HashBloom bloom;
+	r.run("HashBloom::reset 128 KiB", (double) bytes.size(), [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			bloom.reset(bytes, k, h);
+			keep(bloom);
+		}
+	});
+
+	vector<TTHValue> tths(1024);
+	for (auto& t : tths)
+		for (size_t i = 0; i < TTHValue::BYTES; ++i)
+			t.data[i] = (uint8_t) rng();
+
+	r.run("HashBloom::match", 0, [&](uint64_t n) {
+		size_t matches = 0;
+		for (uint64_t i = 0; i < n; ++i)
+			matches += bloom.match(tths[i & 1023]);
+		keep(matches);
+	});
+}
+
+static void benchBaselib(Runner& r, mt19937& rng)
+{
+	vector<uint8_t> data(64 * 1024);
+	for (auto& b : data)
+		b = (uint8_t) rng();
+
+	r.run("TigerHash::update 64 KiB", (double) data.size(), [&data](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			TigerHash th;
+			th.update(data.data(), data.size());
+			keep(th.finalize());
+		}
+	});
+
+	r.run("Util::toBase32 CID", (double) CID::SIZE, [&data](uint64_t n) {
+		string out;
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			out.clear();
+			Util::toBase32(data.data() + (i & 1023), CID::SIZE, out);
+			keep(out);
+		}
+	});
+
+	const string base32 = Util::toBase32(data.data(), CID::SIZE);
+	r.run("Util::fromBase32 CID", (double) base32.size(), [&base32](uint64_t n) {
+		uint8_t out[CID::SIZE];
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			Util::fromBase32(base32.c_str(), out, sizeof(out));
+			keep(out);
+		}
+	});
+
+	// Mostly ASCII with some two and three byte sequences, like a typical chat line
+	string text;
+	while (text.size() < 4096)
+		text += "Hello world, \xc3\xa4\xc3\xb6\xc3\xbc and \xe2\x82\xac signs in a message. ";
+	r.run("Text::validateUtf8 4 KiB", (double) text.size(), [&text](uint64_t n) {
+		bool ok = true;
+		for (uint64_t i = 0; i < n; ++i)
+			ok &= Text::validateUtf8(text);
+		keep(ok);
+	});
+}
+
+static void benchFanOut(Runner& r, Core& core, int recipients)
+{
+	auto& cm = core.getClientManager();
+	uint64_t delivered = 0;
+	vector<Bot*> bots;
+	for (int i = 0; i < recipients; ++i)
+	{
+		Bot* bot = cm.createBot([&delivered](Bot&, const BufferPtr&) { delivered++; });
+		bot->setCID(CID::generate());
+		bot->setField("NI", "FanOut" + Util::toString(i));
+		cm.regBot(*bot);
+		bots.push_back(bot);
+	}
+
+	AdcCommand cmd("BMSG AAAB Hello\\sworld,\\sthis\\sis\\sa\\stypical\\schat\\smessage.\n");
+	r.run("ClientManager::send fan-out " + Util::toString(recipients), 0, [&cm, &cmd](uint64_t n) {
+		for (uint64_t i = 0; i < n; ++i)
+			cm.send(cmd);
+	});
+	keep(delivered);
+
+	for (auto bot : bots)
+		bot->disconnect(REASON_PLUGIN, Util::emptyString);
+}
+
+static void printUsage()
+{
+	const char* text = "Usage: adchpp-bench [options...]\n"
+		"Options:\n"
+		"\t-o file\t\tWrite the JSON results to this file instead of stdout\n"
+		"\t-f filter\tOnly run benchmarks whose name contains this string\n"
+		"\t-t seconds\tMeasurement time per benchmark (default: 0.5)\n"
+		"\t-n count\tRecipients in the fan-out benchmark (default: 1000)\n"
+		"\t-h\t\tShow this help message\n"
+		"Human readable results are printed to stderr.\n";
+	fputs(text, stdout);
+}
+
+static const char* getArg(int argc, char* argv[], int& i)
+{
+	if (i + 1 == argc)
+	{
+		fprintf(stderr, "Parameter %s requires an argument\n", argv[i]);
+		exit(1);
+	}
+	return argv[++i];
+}
+
+int main(int argc, char* argv[])
+{
+	const char* output = nullptr;
+	string filter;
+	double minTime = 0.5;
+	int recipients = 1000;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") == 0)
+			output = getArg(argc, argv, i);
+		else if (strcmp(argv[i], "-f") == 0)
+			filter = getArg(argc, argv, i);
+		else if (strcmp(argv[i], "-t") == 0)
+			minTime = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-n") == 0)
+			recipients = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-h") == 0)
+		{
+			printUsage();
+			return 0;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown parameter: %s\n", argv[i]);
+			return 4;
+		}
+	}
+
+	if (minTime <= 0 || recipients <= 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	// A hub that is never run: no listeners, no plugins, jobs are queued but not executed
+	auto core = Core::create("./");
+	core->getLogManager().setEnabled(false);
+	core->getLogManager().setUseConsole(false);
+	core->getClientManager().prepareSupports(false);
+
+	mt19937 rng(1);
+	Runner r(minTime, filter);
+	benchProtocol(r);
+	benchClient(r, *core);
+	benchEntity(r, *core);
+	benchBloom(r, rng);
+	benchBaselib(r, rng);
+	benchFanOut(r, *core, recipients);
+
+	string json;
+	r.getJSON(json);
+	FILE* f = output ? fopen(output, "w") : stdout;
+	if (!f)
+	{
+		fprintf(stderr, "Unable to open %s\n", output);
+		return 3;
+	}
+	fputs(json.c_str(), f);
+	if (output) fclose(f);
+	return 0;
+}
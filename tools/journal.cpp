@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Offline decoder for the binary event journal written by adchubd (see adchpp/JournalFormat.h)
+
+#include <adchpp/JournalFormat.h>
+#include <baselib/Base32.h>
+
+#include <boost/asio/ip/address_v6.hpp>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+using namespace adchpp;
+
+static const char* eventNames[] = { "?", "CONNECT", "LOGIN", "DISCONNECT", "KICK", "BAN" };
+
+struct Filter
+{
+	Filter() : types(0), reason(-1), since(0), until(0), sid(0), hasSid(false) {}
+
+	unsigned types; // bit mask of event types, 0 - all
+	int reason;
+	int64_t since;
+	int64_t until;
+	string ip;
+	string cid;
+	uint32_t sid;
+	bool hasSid;
+};
+
+struct Stats
+{
+	Stats() : records(0) {}
+
+	uint64_t records;
+	map<string, uint64_t> byType;
+	map<string, uint64_t> byReason;
+	map<string, uint64_t> byIp;
+	map<string, uint64_t> byCid;
+	map<string, uint64_t> byHour;
+};
+
+static const char* getEventName(uint8_t type)
+{
+	return type < journal::EVENT_LAST ? eventNames[type] : eventNames[0];
+}
+
+static string formatIp(const uint8_t* ip)
+{
+	boost::asio::ip::address_v6::bytes_type bytes;
+	memcpy(bytes.data(), ip, bytes.size());
+	boost::asio::ip::address_v6 addr(bytes);
+	if (addr.is_unspecified()) return "-";
+	if (addr.is_v4_mapped()) return addr.to_v4().to_string();
+	return addr.to_string();
+}
+
+static string formatSid(uint32_t sid)
+{
+	string s(reinterpret_cast<const char*>(&sid), sizeof(sid));
+	for (auto& c : s)
+		if (c < 32 || c > 126) c = '?';
+	return s;
+}
+
+static string formatTime(int64_t msec, const char* format)
+{
+	time_t t = (time_t) (msec / 1000);
+	char buf[64];
+	const tm* lt = localtime(&t);
+	if (!lt || !strftime(buf, sizeof(buf), format, lt)) return "?";
+	return buf;
+}
+
+/** Parse "YYYY-MM-DD[ HH:MM[:SS]]" (local time) into milliseconds since the epoch */
+static bool parseTime(const char* s, int64_t& result)
+{
+	tm t = {};
+	int n = sscanf(s, "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec);
+	if (n < 3) return false;
+	t.tm_year -= 1900;
+	t.tm_mon--;
+	t.tm_isdst = -1;
+	time_t v = mktime(&t);
+	if (v == (time_t) -1) return false;
+	result = (int64_t) v * 1000;
+	return true;
+}
+
+static bool parseTypes(const char* s, unsigned& types)
+{
+	string str(s);
+	size_t start = 0;
+	while (start <= str.length())
+	{
+		size_t end = str.find(',', start);
+		if (end == string::npos) end = str.length();
+		string name = str.substr(start, end - start);
+		transform(name.begin(), name.end(), name.begin(), ::toupper);
+		int found = 0;
+		for (int i = 1; i < journal::EVENT_LAST; ++i)
+			if (name == eventNames[i]) found = i;
+		if (!found) return false;
+		types |= 1 << found;
+		start = end + 1;
+	}
+	return true;
+}
+
+static bool parseReason(const char* s, int& reason)
+{
+	string name(s);
+	transform(name.begin(), name.end(), name.begin(), ::toupper);
+	if (name.compare(0, 7, "REASON_") == 0) name.erase(0, 7);
+	uint8_t code = journal::getReasonCode(name.c_str());
+	if (code == journal::NO_REASON) return false;
+	reason = code;
+	return true;
+}
+
+static bool matches(const Filter& f, const journal::Record& r, const string& ip, const string& cid)
+{
+	if (f.types && !(f.types & (1 << r.type))) return false;
+	if (f.reason >= 0 && r.reason != f.reason) return false;
+	if (f.since && r.time < f.since) return false;
+	if (f.until && r.time >= f.until) return false;
+	if (f.hasSid && r.sid != f.sid) return false;
+	if (!f.ip.empty() && ip.compare(0, f.ip.length(), f.ip) != 0) return false;
+	if (!f.cid.empty() && cid != f.cid) return false;
+	return true;
+}
+
+static bool processFile(const char* fileName, const Filter& f, Stats* stats)
+{
+	FILE* fp = fopen(fileName, "rb");
+	if (!fp)
+	{
+		fprintf(stderr, "%s: unable to open\n", fileName);
+		return false;
+	}
+
+	vector<uint8_t> data;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fp);
+
+	size_t pos = data.empty() ? 0 : journal::readHeader(&data[0], data.size());
+	if (!pos)
+	{
+		fprintf(stderr, "%s: not an event journal\n", fileName);
+		return false;
+	}
+
+	journal::Record r;
+	string cid;
+	while (pos < data.size())
+	{
+		size_t size = journal::readRecord(&data[pos], data.size() - pos, r);
+		if (!size)
+		{
+			fprintf(stderr, "%s: truncated or corrupt record at offset %u\n", fileName, (unsigned) pos);
+			break;
+		}
+
+		string ip = formatIp(r.ip);
+		Util::toBase32(r.cid, sizeof(r.cid), cid);
+		if (matches(f, r, ip, cid))
+		{
+			string info(reinterpret_cast<const char*>(&data[pos + journal::RECORD_SIZE]), size - journal::RECORD_SIZE);
+			if (stats)
+			{
+				stats->records++;
+				stats->byType[getEventName(r.type)]++;
+				if (r.type == journal::EVENT_DISCONNECT && r.reason != journal::NO_REASON)
+					stats->byReason[journal::getReasonName(r.reason)]++;
+				stats->byIp[ip]++;
+				if (r.type != journal::EVENT_CONNECT) stats->byCid[cid]++;
+				stats->byHour[formatTime(r.time, "%Y-%m-%d %H:00")]++;
+			}
+			else
+			{
+				printf("%s.%03d %-10s %s %s %-39s %-19s %s\n", formatTime(r.time, "%Y-%m-%d %H:%M:%S").c_str(),
+					(int) (r.time % 1000), getEventName(r.type), formatSid(r.sid).c_str(), cid.c_str(),
+					ip.c_str(), journal::getReasonName(r.reason), info.c_str());
+			}
+		}
+		cid.clear();
+		pos += size;
+	}
+	return true;
+}
+
+static void printTop(const char* title, const map<string, uint64_t>& m, size_t limit)
+{
+	vector<pair<uint64_t, string>> v;
+	for (auto i = m.begin(); i != m.end(); ++i)
+		v.push_back(make_pair(i->second, i->first));
+	sort(v.begin(), v.end(), [](const pair<uint64_t, string>& a, const pair<uint64_t, string>& b) { return a.first > b.first; });
+	if (v.size() > limit) v.resize(limit);
+
+	printf("\n%s:\n", title);
+	for (auto i = v.begin(); i != v.end(); ++i)
+		printf("%12llu  %s\n", (unsigned long long) i->first, i->second.c_str());
+}
+
+static void printStats(const Stats& stats, size_t limit)
+{
+	printf("Records: %llu\n", (unsigned long long) stats.records);
+	printTop("Events", stats.byType, journal::EVENT_LAST);
+	printTop("Disconnect reasons", stats.byReason, journal::REASON_COUNT);
+	printTop("Top IP addresses", stats.byIp, limit);
+	printTop("Top CIDs", stats.byCid, limit);
+
+	printf("\nEvents per hour:\n");
+	for (auto i = stats.byHour.begin(); i != stats.byHour.end(); ++i)
+		printf("%12llu  %s\n", (unsigned long long) i->second, i->first.c_str());
+}
+
+static void printUsage()
+{
+	const char* text = "Usage: adchpp-journal [options...] file...\n"
+		"Options:\n"
+		"\t-t types\tOnly show these event types (comma separated: connect,login,disconnect,kick,ban)\n"
+		"\t-r reason\tOnly show events with this disconnect reason (e.g. WRITE_OVERFLOW)\n"
+		"\t-s time\t\tOnly show events after this local time (YYYY-MM-DD[ HH:MM[:SS]])\n"
+		"\t-u time\t\tOnly show events before this local time\n"
+		"\t-i ip\t\tOnly show events for IP addresses starting with this prefix\n"
+		"\t-c cid\t\tOnly show events for this CID\n"
+		"\t-S sid\t\tOnly show events for this SID\n"
+		"\t-a\t\tPrint aggregated statistics instead of individual events\n"
+		"\t-n count\tNumber of entries in the top lists (default: 20)\n"
+		"\t-h\t\tShow this help message\n";
+	fputs(text, stdout);
+}
+
+static const char* getArg(int argc, char* argv[], int& i)
+{
+	if (i + 1 == argc)
+	{
+		fprintf(stderr, "Parameter %s requires an argument\n", argv[i]);
+		exit(1);
+	}
+	return argv[++i];
+}
+
+int main(int argc, char* argv[])
+{
+	Filter f;
+	bool aggregate = false;
+	size_t limit = 20;
+	vector<const char*> files;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-t") == 0)
+		{
+			if (!parseTypes(getArg(argc, argv, i), f.types))
+			{
+				fprintf(stderr, "Invalid event type: %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "-r") == 0)
+		{
+			if (!parseReason(getArg(argc, argv, i), f.reason))
+			{
+				fprintf(stderr, "Invalid reason: %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-u") == 0)
+		{
+			int64_t& value = argv[i][1] == 's' ? f.since : f.until;
+			if (!parseTime(getArg(argc, argv, i), value))
+			{
+				fprintf(stderr, "Invalid time: %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "-i") == 0)
+		{
+			f.ip = getArg(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "-c") == 0)
+		{
+			f.cid = getArg(argc, argv, i);
+		}
+		else if (strcmp(argv[i], "-S") == 0)
+		{
+			const char* sid = getArg(argc, argv, i);
+			if (strlen(sid) != 4)
+			{
+				fprintf(stderr, "Invalid SID: %s\n", sid);
+				return 2;
+			}
+			memcpy(&f.sid, sid, 4);
+			f.hasSid = true;
+		}
+		else if (strcmp(argv[i], "-a") == 0)
+		{
+			aggregate = true;
+		}
+		else if (strcmp(argv[i], "-n") == 0)
+		{
+			limit = (size_t) atoi(getArg(argc, argv, i));
+		}
+		else if (strcmp(argv[i], "-h") == 0)
+		{
+			printUsage();
+			return 0;
+		}
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "Unknown parameter: %s\n", argv[i]);
+			return 4;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	if (files.empty())
+	{
+		printUsage();
+		return 1;
+	}
+
+	Stats stats;
+	int result = 0;
+	for (auto i = files.begin(); i != files.end(); ++i)
+		if (!processFile(*i, f, aggregate ? &stats : nullptr))
+			result = 3;
+
+	if (aggregate) printStats(stats, limit);
+	return result;
+}
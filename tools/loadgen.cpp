@@ -0,0 +1,907 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Load generator: a swarm of simulated ADC clients connecting to a hub
+
+#include <baselib/Base32.h>
+#include <baselib/TigerHash.h>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#ifdef HAVE_OPENSSL
+#include <boost/asio/ssl.hpp>
+#endif
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+using boost::asio::io_service;
+using boost::asio::steady_timer;
+using boost::asio::ip::tcp;
+#ifdef HAVE_OPENSSL
+namespace ssl = boost::asio::ssl;
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Options
+{
+	Options() :
+		host("127.0.0.1"), port("2780"), tls(false), clients(100), connectRate(0), duration(60),
+		chatRate(0), tthRate(0), textRate(0), ctmRate(0), rcmRate(0), infRate(0), bloom(false),
+		files(1000), slowClients(0), hubPid(0)
+	{
+	}
+
+	string host;
+	string port;
+	bool tls;
+	int clients;
+	double connectRate; // connections per second, 0 - all at once
+	int duration;       // seconds after the last connection attempt
+	double chatRate;    // all rates are per second for the whole swarm
+	double tthRate;
+	double textRate;
+	double ctmRate;
+	double rcmRate;
+	double infRate;
+	bool bloom;
+	int files;
+	int slowClients;    // clients that stop reading once logged in
+	int hubPid;
+};
+
+/** Log-linear latency histogram with ~12% resolution, values in microseconds */
+class Histogram
+{
+public:
+	Histogram() : count(0), sum(0), max(0) { memset(counts, 0, sizeof(counts)); }
+
+	void add(uint64_t value)
+	{
+		counts[getBucket(value)]++;
+		count++;
+		sum += value;
+		if (value > max) max = value;
+	}
+
+	uint64_t getPercentile(double p) const
+	{
+		if (!count) return 0;
+		uint64_t target = (uint64_t) (count * p / 100);
+		if (target >= count) target = count - 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			seen += counts[i];
+			if (seen > target) return std::min(getBucketLimit(i), max);
+		}
+		return max;
+	}
+
+	uint64_t getCount() const { return count; }
+	uint64_t getMax() const { return max; }
+	double getMean() const { return count ? (double) sum / count : 0; }
+
+private:
+	enum { SUB_BITS = 3, SUB_COUNT = 1 << SUB_BITS, MAX_EXP = 40, BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT };
+
+	static int getBucket(uint64_t value)
+	{
+		if (value < SUB_COUNT) return (int) value;
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		int exp = (int) index;
+#else
+		int exp = 63 - __builtin_clzll(value);
+#endif
+		if (exp > MAX_EXP) return BUCKETS - 1;
+		return (exp - SUB_BITS + 1) * SUB_COUNT + (int) ((value >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+	}
+
+	static uint64_t getBucketLimit(int bucket)
+	{
+		if (bucket < SUB_COUNT) return bucket;
+		int shift = bucket / SUB_COUNT - 1;
+		uint64_t low = (uint64_t) (SUB_COUNT + bucket % SUB_COUNT) << shift;
+		return low + ((uint64_t) 1 << shift) - 1;
+	}
+
+	uint64_t counts[BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct Stats
+{
+	Stats() :
+		connectFailed(0), loggedIn(0), disconnected(0), errors(0), chatSent(0), chatReceived(0),
+		searches(0), connectRequests(0), infUpdates(0), blooms(0), bytesIn(0), bytesOut(0)
+	{
+	}
+
+	Histogram login;
+	Histogram delivery;
+	uint64_t connectFailed;
+	uint64_t loggedIn;
+	uint64_t disconnected;
+	uint64_t errors;
+	uint64_t chatSent;
+	uint64_t chatReceived;
+	uint64_t searches;
+	uint64_t connectRequests;
+	uint64_t infUpdates;
+	uint64_t blooms;
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	string lastError;
+};
+
+/** Plain or TLS transport */
+class Stream
+{
+public:
+	typedef std::function<void(const boost::system::error_code&, size_t)> Handler;
+	typedef std::function<void(const boost::system::error_code&)> ConnectHandler;
+
+	virtual ~Stream() {}
+	virtual void connect(const tcp::resolver::results_type& endpoints, const ConnectHandler& handler) = 0;
+	virtual void read(char* buf, size_t len, const Handler& handler) = 0;
+	virtual void write(const string& data, const Handler& handler) = 0;
+	virtual void close() = 0;
+};
+
+class SimpleStream : public Stream
+{
+public:
+	SimpleStream(io_service& io) : sock(io) {}
+
+	virtual void connect(const tcp::resolver::results_type& endpoints, const ConnectHandler& handler)
+	{
+		boost::asio::async_connect(sock, endpoints, [handler](const boost::system::error_code& ec, const tcp::endpoint&) {
+			handler(ec);
+		});
+	}
+
+	virtual void read(char* buf, size_t len, const Handler& handler) { sock.async_read_some(boost::asio::buffer(buf, len), handler); }
+	virtual void write(const string& data, const Handler& handler) { boost::asio::async_write(sock, boost::asio::buffer(data), handler); }
+
+	virtual void close()
+	{
+		boost::system::error_code ec;
+		sock.close(ec);
+	}
+
+private:
+	tcp::socket sock;
+};
+
+#ifdef HAVE_OPENSSL
+
+class TLSStream : public Stream
+{
+public:
+	TLSStream(io_service& io, ssl::context& ctx) : sock(io, ctx) {}
+
+	virtual void connect(const tcp::resolver::results_type& endpoints, const ConnectHandler& handler)
+	{
+		boost::asio::async_connect(sock.lowest_layer(), endpoints, [this, handler](const boost::system::error_code& ec, const tcp::endpoint&) {
+			if (ec)
+			{
+				handler(ec);
+				return;
+			}
+			sock.async_handshake(ssl::stream_base::client, handler);
+		});
+	}
+
+	virtual void read(char* buf, size_t len, const Handler& handler) { sock.async_read_some(boost::asio::buffer(buf, len), handler); }
+	virtual void write(const string& data, const Handler& handler) { boost::asio::async_write(sock, boost::asio::buffer(data), handler); }
+
+	virtual void close()
+	{
+		boost::system::error_code ec;
+		sock.lowest_layer().close(ec);
+	}
+
+private:
+	ssl::stream<tcp::socket> sock;
+};
+
+#endif
+
+class Swarm;
+
+class Client : public std::enable_shared_from_this<Client>
+{
+public:
+	enum State { STATE_CONNECTING, STATE_PROTOCOL, STATE_IDENTIFY, STATE_NORMAL, STATE_CLOSED };
+
+	Client(Swarm& swarm, int index, unique_ptr<Stream>&& stream) :
+		swarm(swarm), index(index), state(STATE_CONNECTING), stream(move(stream)), start(0), writing(false)
+	{
+		uint8_t pid[TigerHash::BYTES];
+		for (size_t i = 0; i < sizeof(pid); ++i)
+			pid[i] = (uint8_t) rng();
+		TigerHash th;
+		th.update(pid, sizeof(pid));
+		this->pid = Util::toBase32(pid, sizeof(pid));
+		cid = Util::toBase32(th.finalize(), TigerHash::BYTES);
+	}
+
+	void connect(const tcp::resolver::results_type& endpoints);
+	void send(const string& line);
+	void close();
+
+	State getState() const { return state; }
+	const string& getSID() const { return sid; }
+
+	static mt19937 rng;
+
+private:
+	void onConnected(const boost::system::error_code& ec);
+	void prepareRead();
+	void onRead(const boost::system::error_code& ec, size_t bytes);
+	void flush();
+	void onWritten(const boost::system::error_code& ec, size_t bytes);
+	void onLine(const string& line);
+	void fail(const string& error);
+
+	Swarm& swarm;
+	int index;
+	State state;
+	unique_ptr<Stream> stream;
+	int64_t start;
+
+	string pid;
+	string cid;
+	string sid;
+
+	char readBuf[16384];
+	string in;
+	string out;     // being written
+	string pending; // queued while a write is in progress
+	bool writing;
+};
+
+mt19937 Client::rng(random_device{}());
+
+class Swarm
+{
+public:
+	Swarm(io_service& io, const Options& options) :
+		io(io), options(options), resolver(io), connectTimer(io), actionTimer(io), endTimer(io), started(0),
+		lastAction(0)
+#ifdef HAVE_OPENSSL
+		, ctx(ssl::context::tls_client)
+#endif
+	{
+		memset(credit, 0, sizeof(credit));
+#ifdef HAVE_OPENSSL
+		ctx.set_verify_mode(ssl::verify_none);
+#endif
+	}
+
+	bool start();
+	void stop();
+
+	void onLogin(const shared_ptr<Client>& c) { online.push_back(c); }
+	void onClosed(Client& c);
+
+	const Options& getOptions() const { return options; }
+	Stats& getStats() { return stats; }
+
+private:
+	enum Action { ACTION_CHAT, ACTION_TTH, ACTION_TEXT, ACTION_CTM, ACTION_RCM, ACTION_INF, ACTION_LAST };
+
+	void connectNext();
+	void onActionTimer();
+	void perform(Action action);
+	Client* pickOnline();
+
+	io_service& io;
+	Options options;
+	tcp::resolver resolver;
+	tcp::resolver::results_type endpoints;
+	steady_timer connectTimer;
+	steady_timer actionTimer;
+	steady_timer endTimer;
+
+	vector<shared_ptr<Client>> clients;
+	vector<weak_ptr<Client>> online;
+	int started;
+	int64_t lastAction;
+	double credit[ACTION_LAST];
+
+	Stats stats;
+
+#ifdef HAVE_OPENSSL
+	ssl::context ctx;
+#endif
+};
+
+static string randomBase32(size_t bytes)
+{
+	vector<uint8_t> data(bytes);
+	for (auto& b : data)
+		b = (uint8_t) Client::rng();
+	return Util::toBase32(data.data(), data.size());
+}
+
+static string randomToken()
+{
+	return to_string(Client::rng() % 100000000);
+}
+
+void Client::connect(const tcp::resolver::results_type& endpoints)
+{
+	start = now();
+	auto self = shared_from_this();
+	stream->connect(endpoints, [self](const boost::system::error_code& ec) { self->onConnected(ec); });
+}
+
+void Client::onConnected(const boost::system::error_code& ec)
+{
+	if (state == STATE_CLOSED) return;
+	if (ec)
+	{
+		swarm.getStats().connectFailed++;
+		fail("Connect failed: " + ec.message());
+		return;
+	}
+
+	state = STATE_PROTOCOL;
+	string sup = "HSUP ADBASE ADTIGR";
+	if (swarm.getOptions().bloom) sup += " ADBLO0";
+	send(sup + "\n");
+	prepareRead();
+}
+
+void Client::prepareRead()
+{
+	auto self = shared_from_this();
+	stream->read(readBuf, sizeof(readBuf), [self](const boost::system::error_code& ec, size_t bytes) { self->onRead(ec, bytes); });
+}
+
+void Client::onRead(const boost::system::error_code& ec, size_t bytes)
+{
+	if (state == STATE_CLOSED) return;
+	if (ec)
+	{
+		fail(state == STATE_NORMAL ? string() : "Disconnected during login: " + ec.message());
+		return;
+	}
+
+	swarm.getStats().bytesIn += bytes;
+	in.append(readBuf, bytes);
+	size_t pos = 0, next;
+	while ((next = in.find('\n', pos)) != string::npos)
+	{
+		if (next > pos) onLine(in.substr(pos, next - pos));
+		if (state == STATE_CLOSED) return;
+		pos = next + 1;
+	}
+	in.erase(0, pos);
+	if (state == STATE_NORMAL && index < swarm.getOptions().slowClients) return;
+	prepareRead();
+}
+
+void Client::send(const string& line)
+{
+	if (state == STATE_CLOSED || state == STATE_CONNECTING) return;
+	pending += line;
+	if (!writing) flush();
+}
+
+void Client::flush()
+{
+	if (pending.empty()) return;
+	out.swap(pending);
+	pending.clear();
+	writing = true;
+	auto self = shared_from_this();
+	stream->write(out, [self](const boost::system::error_code& ec, size_t bytes) { self->onWritten(ec, bytes); });
+}
+
+void Client::onWritten(const boost::system::error_code& ec, size_t bytes)
+{
+	writing = false;
+	if (state == STATE_CLOSED) return;
+	if (ec)
+	{
+		fail("Write failed: " + ec.message());
+		return;
+	}
+	swarm.getStats().bytesOut += bytes;
+	out.clear();
+	flush();
+}
+
+void Client::onLine(const string& line)
+{
+	vector<string> params;
+	size_t pos = 0, next;
+	while ((next = line.find(' ', pos)) != string::npos)
+	{
+		params.push_back(line.substr(pos, next - pos));
+		pos = next + 1;
+	}
+	params.push_back(line.substr(pos));
+	if (params[0].length() != 4) return;
+
+	const string cmd = params[0].substr(1);
+	Stats& stats = swarm.getStats();
+	const Options& options = swarm.getOptions();
+
+	if (cmd == "SID" && params.size() >= 2 && state == STATE_PROTOCOL)
+	{
+		sid = params[1];
+		state = STATE_IDENTIFY;
+		string inf = "BINF " + sid + " ID" + cid + " PD" + pid + " NIloadgen" + to_string(index) +
+			" SL3 SS" + to_string((int64_t) options.files * 100000000) + " SF" + to_string(options.files) +
+			" HN1 HR0 HO0 VEadchpp-loadgen I40.0.0.0 SUTCP4";
+		if (options.bloom) inf += ",BLO0";
+		send(inf + "\n");
+	}
+	else if (cmd == "INF" && params.size() >= 2 && params[1] == sid)
+	{
+		if (state == STATE_IDENTIFY)
+		{
+			state = STATE_NORMAL;
+			stats.loggedIn++;
+			stats.login.add((now() - start) / 1000);
+			swarm.onLogin(shared_from_this());
+		}
+	}
+	else if (cmd == "MSG" && params.size() >= 3)
+	{
+		const string& text = params[2];
+		if (text.compare(0, 8, "loadgen:") == 0)
+		{
+			int64_t sent = strtoll(text.c_str() + 8, nullptr, 10);
+			stats.chatReceived++;
+			stats.delivery.add((now() - sent) / 1000);
+		}
+	}
+	else if (cmd == "GET" && params.size() >= 5 && params[1] == "blom")
+	{
+		// Zero filter - it matches nothing, which keeps the TTH searches off this client
+		size_t bytes = (size_t) strtoul(params[4].c_str(), nullptr, 10);
+		send("HSND blom / 0 " + params[4] + "\n" + string(bytes, '\0'));
+		stats.blooms++;
+	}
+	else if (cmd == "GPA")
+	{
+		fail("Hub requires a password");
+	}
+	else if (cmd == "STA" && params.size() >= 2 && params[1][0] == '2')
+	{
+		fail("Fatal error from hub: " + line);
+	}
+	else if (cmd == "QUI" && params.size() >= 2 && params[1] == sid)
+	{
+		fail("Disconnected by hub: " + line);
+	}
+}
+
+void Client::fail(const string& error)
+{
+	if (state == STATE_CLOSED) return;
+	if (state == STATE_NORMAL) swarm.getStats().disconnected++;
+	if (!error.empty())
+	{
+		swarm.getStats().errors++;
+		swarm.getStats().lastError = error;
+	}
+	close();
+}
+
+void Client::close()
+{
+	if (state == STATE_CLOSED) return;
+	state = STATE_CLOSED;
+	stream->close();
+	swarm.onClosed(*this);
+}
+
+bool Swarm::start()
+{
+	boost::system::error_code ec;
+	endpoints = resolver.resolve(options.host, options.port, ec);
+	if (ec)
+	{
+		fprintf(stderr, "Unable to resolve %s: %s\n", options.host.c_str(), ec.message().c_str());
+		return false;
+	}
+
+	lastAction = now();
+	connectNext();
+	onActionTimer();
+	return true;
+}
+
+void Swarm::connectNext()
+{
+	int batch = options.clients - started;
+	if (options.connectRate > 0)
+	{
+		// Spread the attempts over 10 ms slots
+		batch = std::min(batch, std::max(1, (int) (options.connectRate / 100)));
+	}
+
+	for (int i = 0; i < batch; ++i, ++started)
+	{
+		unique_ptr<Stream> stream;
+#ifdef HAVE_OPENSSL
+		if (options.tls)
+			stream.reset(new TLSStream(io, ctx));
+		else
+#endif
+			stream.reset(new SimpleStream(io));
+		auto c = make_shared<Client>(*this, started, move(stream));
+		clients.push_back(c);
+		c->connect(endpoints);
+	}
+
+	if (started < options.clients)
+	{
+		double interval = options.connectRate > 0 ? batch * 1000.0 / options.connectRate : 0;
+		connectTimer.expires_after(std::chrono::microseconds((int64_t) (interval * 1000)));
+		connectTimer.async_wait([this](const boost::system::error_code& ec) {
+			if (!ec) connectNext();
+		});
+	}
+	else
+	{
+		endTimer.expires_after(std::chrono::seconds(options.duration));
+		endTimer.async_wait([this](const boost::system::error_code& ec) {
+			if (!ec) stop();
+		});
+	}
+}
+
+void Swarm::stop()
+{
+	connectTimer.cancel();
+	actionTimer.cancel();
+	endTimer.cancel();
+	auto tmp = clients;
+	for (auto& c : tmp)
+		c->close();
+}
+
+void Swarm::onClosed(Client& c)
+{
+	for (auto i = clients.begin(); i != clients.end(); ++i)
+	{
+		if (i->get() == &c)
+		{
+			*i = clients.back();
+			clients.pop_back();
+			break;
+		}
+	}
+}
+
+Client* Swarm::pickOnline()
+{
+	while (!online.empty())
+	{
+		size_t i = Client::rng() % online.size();
+		auto c = online[i].lock();
+		if (c && c->getState() == Client::STATE_NORMAL) return c.get();
+		online[i] = online.back();
+		online.pop_back();
+	}
+	return nullptr;
+}
+
+void Swarm::onActionTimer()
+{
+	const double rates[ACTION_LAST] = {
+		options.chatRate, options.tthRate, options.textRate, options.ctmRate, options.rcmRate, options.infRate
+	};
+
+	int64_t t = now();
+	double elapsed = (t - lastAction) / 1e9;
+	lastAction = t;
+
+	for (int i = 0; i < ACTION_LAST; ++i)
+	{
+		credit[i] += rates[i] * elapsed;
+		for (; credit[i] >= 1; credit[i] -= 1)
+			perform((Action) i);
+	}
+
+	actionTimer.expires_after(std::chrono::milliseconds(10));
+	actionTimer.async_wait([this](const boost::system::error_code& ec) {
+		if (!ec) onActionTimer();
+	});
+}
+
+void Swarm::perform(Action action)
+{
+	Client* c = pickOnline();
+	if (!c) return;
+	const string& sid = c->getSID();
+
+	switch (action)
+	{
+	case ACTION_CHAT:
+		c->send("BMSG " + sid + " loadgen:" + to_string(now()) + "\n");
+		stats.chatSent++;
+		break;
+	case ACTION_TTH:
+		c->send("BSCH " + sid + " TR" + randomBase32(TigerHash::BYTES) + " TO" + randomToken() + "\n");
+		stats.searches++;
+		break;
+	case ACTION_TEXT:
+		c->send("BSCH " + sid + " AN" + randomBase32(5) + " AN" + randomBase32(5) + " TO" + randomToken() + "\n");
+		stats.searches++;
+		break;
+	case ACTION_CTM:
+	case ACTION_RCM:
+	{
+		Client* target = pickOnline();
+		if (!target || target == c) break;
+		if (action == ACTION_CTM)
+			c->send("DCTM " + sid + " " + target->getSID() + " ADC/1.0 " + to_string(1024 + Client::rng() % 60000) + " " + randomToken() + "\n");
+		else
+			c->send("DRCM " + sid + " " + target->getSID() + " ADC/1.0 " + randomToken() + "\n");
+		stats.connectRequests++;
+		break;
+	}
+	case ACTION_INF:
+		c->send("BINF " + sid + " SS" + to_string((int64_t) (Client::rng() % 1000000) * 1000000) + "\n");
+		stats.infUpdates++;
+		break;
+	default:
+		break;
+	}
+}
+
+struct ProcessStats
+{
+	ProcessStats() : cpu(0), rss(0), peakRss(0) {}
+
+	double cpu; // seconds
+	int64_t rss;
+	int64_t peakRss;
+};
+
+static bool getProcessStats(int pid, ProcessStats& ps)
+{
+#ifdef __linux__
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	FILE* f = fopen(path, "r");
+	if (!f) return false;
+	char buf[1024];
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = 0;
+
+	// The process name may contain spaces, skip past it
+	const char* p = strrchr(buf, ')');
+	if (!p) return false;
+	unsigned long utime, stime;
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return false;
+	ps.cpu = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	f = fopen(path, "r");
+	if (!f) return false;
+	while (fgets(buf, sizeof(buf), f))
+	{
+		long long kb;
+		if (sscanf(buf, "VmRSS: %lld", &kb) == 1) ps.rss = kb * 1024;
+		else if (sscanf(buf, "VmHWM: %lld", &kb) == 1) ps.peakRss = kb * 1024;
+	}
+	fclose(f);
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void printHistogram(const char* name, const Histogram& h)
+{
+	printf("%-18s %10llu  mean %9.0f  p50 %9llu  p90 %9llu  p99 %9llu  p99.9 %9llu  max %9llu\n", name,
+		(unsigned long long) h.getCount(), h.getMean(),
+		(unsigned long long) h.getPercentile(50), (unsigned long long) h.getPercentile(90),
+		(unsigned long long) h.getPercentile(99), (unsigned long long) h.getPercentile(99.9),
+		(unsigned long long) h.getMax());
+}
+
+static void printReport(Stats& stats, double elapsed, const ProcessStats* before, const ProcessStats* after)
+{
+	printf("\nRun time: %.1f s\n", elapsed);
+	printf("Logged in: %llu, connect failures: %llu, errors: %llu, disconnected by hub: %llu\n",
+		(unsigned long long) stats.loggedIn, (unsigned long long) stats.connectFailed,
+		(unsigned long long) stats.errors, (unsigned long long) stats.disconnected);
+	if (!stats.lastError.empty()) printf("Last error: %s\n", stats.lastError.c_str());
+	printf("Sent: %llu chat, %llu searches, %llu connect requests, %llu INF updates, %llu blooms\n",
+		(unsigned long long) stats.chatSent, (unsigned long long) stats.searches,
+		(unsigned long long) stats.connectRequests, (unsigned long long) stats.infUpdates,
+		(unsigned long long) stats.blooms);
+	printf("Traffic: %.1f MiB in, %.1f MiB out\n", stats.bytesIn / 1048576.0, stats.bytesOut / 1048576.0);
+
+	printf("\nLatency (microseconds):\n");
+	printHistogram("login", stats.login);
+	printHistogram("chat delivery", stats.delivery);
+
+	if (before && after)
+	{
+		double cpu = after->cpu - before->cpu;
+		printf("\nHub: CPU %.2f s (%.1f%%), RSS %.1f MiB (peak %.1f MiB)\n", cpu, elapsed > 0 ? cpu * 100 / elapsed : 0,
+			after->rss / 1048576.0, after->peakRss / 1048576.0);
+	}
+}
+
+static void printUsage()
+{
+	const char* text = "Usage: adchpp-loadgen [options...]\n"
+		"Options:\n"
+		"\t-H host\t\tHub address (default: 127.0.0.1)\n"
+		"\t-p port\t\tHub port (default: 2780)\n"
+#ifdef HAVE_OPENSSL
+		"\t-s\t\tConnect using TLS\n"
+#endif
+		"\t-n count\tNumber of clients (default: 100)\n"
+		"\t-r rate\t\tConnection attempts per second (default: all at once)\n"
+		"\t-d seconds\tRun time after the last connection attempt (default: 60)\n"
+		"\t-c rate\t\tChat messages per second\n"
+		"\t-t rate\t\tTTH searches per second\n"
+		"\t-x rate\t\tText searches per second\n"
+		"\t-m rate\t\tCTM requests per second\n"
+		"\t-R rate\t\tRCM requests per second\n"
+		"\t-i rate\t\tINF updates per second\n"
+		"\t-b\t\tAdvertise BLO0 and upload bloom filters\n"
+		"\t-f count\tShared files per client (default: 1000)\n"
+		"\t-S count\tClients that stop reading once logged in\n"
+		"\t-P pid\t\tReport CPU and memory usage of this hub process\n"
+		"\t-h\t\tShow this help message\n"
+		"All rates are for the whole swarm, actions are performed by random logged in clients.\n";
+	fputs(text, stdout);
+}
+
+static const char* getArg(int argc, char* argv[], int& i)
+{
+	if (i + 1 == argc)
+	{
+		fprintf(stderr, "Parameter %s requires an argument\n", argv[i]);
+		exit(1);
+	}
+	return argv[++i];
+}
+
+static io_service* ioPtr;
+
+static void onSignal(int)
+{
+	if (ioPtr) ioPtr->stop();
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-H") == 0)
+			options.host = getArg(argc, argv, i);
+		else if (strcmp(argv[i], "-p") == 0)
+			options.port = getArg(argc, argv, i);
+#ifdef HAVE_OPENSSL
+		else if (strcmp(argv[i], "-s") == 0)
+			options.tls = true;
+#endif
+		else if (strcmp(argv[i], "-n") == 0)
+			options.clients = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-r") == 0)
+			options.connectRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-d") == 0)
+			options.duration = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-c") == 0)
+			options.chatRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-t") == 0)
+			options.tthRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-x") == 0)
+			options.textRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-m") == 0)
+			options.ctmRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-R") == 0)
+			options.rcmRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-i") == 0)
+			options.infRate = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-b") == 0)
+			options.bloom = true;
+		else if (strcmp(argv[i], "-f") == 0)
+			options.files = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-S") == 0)
+			options.slowClients = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-P") == 0)
+			options.hubPid = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-h") == 0)
+		{
+			printUsage();
+			return 0;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown parameter: %s\n", argv[i]);
+			return 4;
+		}
+	}
+
+	if (options.clients <= 0 || options.duration < 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	ProcessStats before, after;
+	bool haveProcess = options.hubPid && getProcessStats(options.hubPid, before);
+	if (options.hubPid && !haveProcess) fprintf(stderr, "Unable to read the statistics of process %d\n", options.hubPid);
+
+	io_service io;
+	Swarm swarm(io, options);
+	if (!swarm.start()) return 3;
+
+	ioPtr = &io;
+	signal(SIGINT, onSignal);
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	printf("Connecting %d clients to %s:%s...\n", options.clients, options.host.c_str(), options.port.c_str());
+	int64_t startTime = now();
+	io.run();
+	double elapsed = (now() - startTime) / 1e9;
+
+	if (haveProcess) haveProcess = getProcessStats(options.hubPid, after);
+	printReport(swarm.getStats(), elapsed, haveProcess ? &before : nullptr, haveProcess ? &after : nullptr);
+	return 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Drives the hub with in-memory connections to measure protocol and fan-out throughput
+// without the kernel's networking costs, or the memory held by idle connections;
+// results are written as JSON
+
+#include <adchpp/CID.h>
+#include <adchpp/ClientManager.h>
+#include <adchpp/Core.h>
+#include <adchpp/Entity.h>
+#include <adchpp/LogManager.h>
+#include <adchpp/LoopbackStream.h>
+#include <adchpp/SocketManager.h>
+#include <adchpp/version.h>
+#include <baselib/StrUtil.h>
+#include <baselib/TigerHash.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace std::placeholders;
+using namespace adchpp;
+
+static const string CHAT_TEXT = "Hello\\sworld,\\sthis\\sis\\sa\\stypical\\schat\\smessage.";
+
+struct Options
+{
+	int clients = 1000;
+	int rounds = 10;
+	int batch = 1;
+	int timeout = 60;
+	int maxBuffer = 0;
+	/** Connections to park before logging in, 0 to run the throughput benchmarks */
+	int idle = 0;
+};
+
+struct Result
+{
+	string name;
+	uint64_t ops;
+	double seconds;
+	int64_t bytes;
+};
+
+/** Heap in use and resident set size, in bytes; -1 where the platform doesn't tell */
+struct MemoryUsage
+{
+	int64_t heap = -1;
+	int64_t rss = -1;
+
+	static MemoryUsage get()
+	{
+		MemoryUsage ret;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+		struct mallinfo2 mi = mallinfo2();
+		ret.heap = (int64_t) (mi.uordblks + mi.hblkhd);
+#endif
+#ifdef __linux__
+		FILE* f = fopen("/proc/self/statm", "r");
+		if (f)
+		{
+			long size, resident;
+			if (fscanf(f, "%ld %ld", &size, &resident) == 2) ret.rss = (int64_t) resident * sysconf(_SC_PAGESIZE);
+			fclose(f);
+		}
+#endif
+		return ret;
+	}
+};
+
+struct MemoryResult
+{
+	string name;
+	size_t connections;
+	MemoryUsage before;
+	MemoryUsage after;
+
+	double getHeapPerConnection() const { return (double) (after.heap - before.heap) / connections; }
+	double getRssPerConnection() const { return (double) (after.rss - before.rss) / connections; }
+};
+
+struct VirtualClient
+{
+	int index = 0;
+	LoopbackStreamPtr stream;
+	string sid;
+	string pending;
+	bool loggedIn = false;
+	string direct;
+	string broadcast;
+};
+
+class Harness
+{
+public:
+	Harness(Core& core, const Options& options) :
+		core(core), options(options), server(make_shared<ServerInfo>()), phase(LOGIN), round(0),
+		loggedIn(0), parked(0), disconnected(0), received(0), expected(0), bytes(0), failed(false)
+	{
+	}
+
+	/** Runs on the reactor; shuts the hub down when all phases are done */
+	void start()
+	{
+		auto& sm = core.getSocketManager();
+		core.addJob(options.timeout * 1000, std::bind(&Harness::onTimeout, this));
+		disconnectedConn = manage(&core.getClientManager().signalDisconnected(),
+			std::bind(&Harness::onDisconnected, this, _1, _2, _3));
+
+		clients.resize(options.idle ? options.idle : options.clients);
+		beginPhase();
+		memoryBefore = MemoryUsage::get();
+		for (int i = 0, n = (int) clients.size(); i < n; ++i)
+		{
+			auto& c = clients[i];
+			c.index = i;
+			c.stream = make_shared<LoopbackStream>(sm, "10." + Util::toString(i >> 16) + "." +
+				Util::toString((i >> 8) & 0xff) + "." + Util::toString(i & 0xff));
+			c.stream->setDataHandler(std::bind(&Harness::onData, this, i, _1, _2));
+			sm.accept(c.stream, server);
+			c.stream->send("HSUP ADBASE ADTIGR\n");
+		}
+	}
+
+	bool hasFailed() const { return failed; }
+
+	void getJSON(string& out) const
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), "{\"version\":\"%s\",\"timestamp\":%lld,\"clients\":%d,\"benchmarks\":[",
+			versionString.c_str(), (long long) ::time(nullptr), (int) clients.size());
+		out += buf;
+		for (auto i = results.begin(); i != results.end(); ++i)
+		{
+			snprintf(buf, sizeof(buf),
+				"%s{\"name\":\"%s\",\"iterations\":%llu,\"nsPerOp\":%.3f,\"opsPerSec\":%.1f,\"bytesPerSec\":%.1f}",
+				i == results.begin() ? "" : ",", i->name.c_str(), (unsigned long long) i->ops,
+				i->seconds * 1e9 / i->ops, i->ops / i->seconds, i->bytes / i->seconds);
+			out += buf;
+		}
+		out += "],\"memory\":[";
+		for (auto i = memory.begin(); i != memory.end(); ++i)
+		{
+			snprintf(buf, sizeof(buf),
+				"%s{\"name\":\"%s\",\"connections\":%llu,\"heapBytesPerConnection\":%.1f,\"rssBytesPerConnection\":%.1f}",
+				i == memory.begin() ? "" : ",", i->name.c_str(), (unsigned long long) i->connections,
+				i->before.heap < 0 ? 0.0 : i->getHeapPerConnection(), i->before.rss < 0 ? 0.0 : i->getRssPerConnection());
+			out += buf;
+		}
+		out += "]}\n";
+	}
+
+private:
+	enum Phase { LOGIN, DIRECT, BROADCAST, LOGOUT, DONE };
+
+	void beginPhase()
+	{
+		received = expected = 0;
+		bytes = 0;
+		round = 0;
+		phaseStart = chrono::steady_clock::now();
+	}
+
+	void endPhase(const string& name, uint64_t ops)
+	{
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - phaseStart).count();
+		Result r = { name, ops, seconds, bytes };
+		fprintf(stderr, "%-28s %10llu ops %9.3f s %12.1f ops/s %10.1f MiB/s\n", name.c_str(), (unsigned long long) ops,
+			seconds, ops / seconds, bytes / seconds / 1048576);
+		results.push_back(r);
+
+		// Idle connections go straight to logging out once they're measured
+		phase = options.idle && phase == LOGIN ? LOGOUT : static_cast<Phase>(phase + 1);
+		// Let the hub finish whatever it's doing before the next phase starts
+		core.addJob(std::bind(&Harness::nextPhase, this));
+	}
+
+	/** Memory held by the connections since the start, with the reactor idle */
+	void measure(const string& name)
+	{
+		MemoryResult m = { name, clients.size(), memoryBefore, MemoryUsage::get() };
+		if (m.before.heap >= 0)
+			fprintf(stderr, "%-28s %10llu conns %9.1f heap bytes/conn %9.1f rss bytes/conn\n", name.c_str(),
+				(unsigned long long) m.connections, m.getHeapPerConnection(), m.getRssPerConnection());
+		memory.push_back(m);
+	}
+
+	void nextPhase()
+	{
+		if (options.idle && phase == LOGOUT) measure("idle");
+
+		beginPhase();
+		switch (phase)
+		{
+			case DIRECT:
+				measure("logged in");
+				prepareMessages();
+				sendRound();
+				break;
+			case BROADCAST:
+				sendRound();
+				break;
+			case LOGOUT:
+				for (auto i = clients.begin(), iend = clients.end(); i != iend; ++i)
+					i->stream->disconnect();
+				break;
+			default:
+				core.shutdown();
+				break;
+		}
+	}
+
+	/** Each client sends a batch; the round ends when every copy has been delivered */
+	void sendRound()
+	{
+		uint64_t n = clients.size();
+		expected += phase == DIRECT ? n * options.batch : n * n * options.batch;
+		for (auto i = clients.begin(), iend = clients.end(); i != iend; ++i)
+			i->stream->send(phase == DIRECT ? i->direct : i->broadcast);
+	}
+
+	void onData(int index, const uint8_t* data, size_t len)
+	{
+		auto& c = clients[index];
+		bytes += len;
+
+		const char* p = (const char*) data;
+		const char* end = p + len;
+		while (p < end)
+		{
+			const char* nl = (const char*) memchr(p, '\n', end - p);
+			if (!nl)
+			{
+				c.pending.append(p, end);
+				break;
+			}
+
+			if (c.pending.empty())
+			{
+				onLine(c, p, nl - p);
+			}
+			else
+			{
+				c.pending.append(p, nl);
+				onLine(c, c.pending.data(), c.pending.size());
+				c.pending.clear();
+			}
+			p = nl + 1;
+		}
+	}
+
+	void onLine(VirtualClient& c, const char* line, size_t len)
+	{
+		if (len < 4) return;
+
+		if (!c.loggedIn)
+		{
+			if (len >= 9 && memcmp(line, "ISID ", 5) == 0)
+			{
+				c.sid.assign(line + 5, 4);
+				if (options.idle)
+				{
+					// Stay in IDENTIFY; the hub keeps the connection until LogTimeout
+					if (++parked == clients.size()) endPhase("connect", parked);
+					return;
+				}
+
+				CID pid = CID::generate();
+				TigerHash th;
+				th.update(pid.data(), CID::SIZE);
+				CID cid(th.finalize());
+				c.stream->send("BINF " + c.sid + " ID" + cid.toBase32() + " PD" + pid.toBase32() + " NIloopback" +
+					Util::toString(c.index) + " SL3 SS0 SF0 HN1 HR0 HO0 I40.0.0.0\n");
+			}
+			else if (len >= 9 && memcmp(line, "BINF ", 5) == 0 && memcmp(line + 5, c.sid.data(), 4) == 0)
+			{
+				c.loggedIn = true;
+				if (++loggedIn == clients.size()) endPhase("login", loggedIn);
+			}
+			return;
+		}
+
+		if ((phase == DIRECT && memcmp(line, "DMSG", 4) == 0) || (phase == BROADCAST && memcmp(line, "BMSG", 4) == 0))
+		{
+			if (++received == expected) onRoundDone();
+		}
+	}
+
+	void prepareMessages()
+	{
+		for (size_t i = 0, n = clients.size(); i < n; ++i)
+		{
+			auto& c = clients[i];
+			auto& to = clients[(i + 1) % n];
+			for (int j = 0; j < options.batch; ++j)
+			{
+				c.direct += "DMSG " + c.sid + " " + to.sid + " " + CHAT_TEXT + "\n";
+				c.broadcast += "BMSG " + c.sid + " " + CHAT_TEXT + "\n";
+			}
+		}
+	}
+
+	void onRoundDone()
+	{
+		if (++round < options.rounds)
+		{
+			sendRound();
+			return;
+		}
+		endPhase(phase == DIRECT ? "direct message" : "broadcast fan-out " + Util::toString(clients.size()), received);
+	}
+
+	void onDisconnected(Entity& c, Reason, const string& info)
+	{
+		++disconnected;
+		if (phase != LOGOUT)
+		{
+			fprintf(stderr, "%s was disconnected by the hub: %s\n", c.getField("NI").c_str(), info.c_str());
+			return;
+		}
+		if (disconnected == clients.size()) endPhase("logout", disconnected);
+	}
+
+	void onTimeout()
+	{
+		if (phase == DONE) return;
+
+		fprintf(stderr, "Timed out after %d s (%llu of %llu deliveries, %d of %d clients logged in, %d parked)\n",
+			options.timeout, (unsigned long long) received, (unsigned long long) expected, (int) loggedIn,
+			(int) clients.size(), (int) parked);
+		failed = true;
+		phase = DONE;
+		core.shutdown();
+	}
+
+	Core& core;
+	Options options;
+	ServerInfoPtr server;
+	ManagedConnectionPtr disconnectedConn;
+
+	vector<VirtualClient> clients;
+	vector<Result> results;
+	vector<MemoryResult> memory;
+	MemoryUsage memoryBefore;
+
+	Phase phase;
+	int round;
+	size_t loggedIn;
+	size_t parked;
+	size_t disconnected;
+	uint64_t received;
+	uint64_t expected;
+	int64_t bytes;
+	bool failed;
+	chrono::steady_clock::time_point phaseStart;
+};
+
+static void printUsage()
+{
+	const char* text = "Usage: adchpp-loopback [options...]\n"
+		"Options:\n"
+		"\t-n count\tNumber of virtual clients (default: 1000)\n"
+		"\t-r count\tRounds of direct and broadcast messages (default: 10)\n"
+		"\t-b count\tMessages each client sends per round (default: 1)\n"
+		"\t-B bytes\tPer connection send queue limit, 0 for none (default: 0)\n"
+		"\t-I count\tOnly measure the memory held by this many idle connections, waiting\n"
+		"\t\t\tto log in, instead of the throughput (try 100000)\n"
+		"\t-T seconds\tGive up after this long (default: 60)\n"
+		"\t-o file\t\tWrite the JSON results to this file instead of stdout\n"
+		"\t-h\t\tShow this help message\n"
+		"Human readable results are printed to stderr.\n";
+	fputs(text, stdout);
+}
+
+static const char* getArg(int argc, char* argv[], int& i)
+{
+	if (i + 1 == argc)
+	{
+		fprintf(stderr, "Parameter %s requires an argument\n", argv[i]);
+		exit(1);
+	}
+	return argv[++i];
+}
+
+int main(int argc, char* argv[])
+{
+	const char* output = nullptr;
+	Options options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0)
+			options.clients = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-r") == 0)
+			options.rounds = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-b") == 0)
+			options.batch = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-B") == 0)
+			options.maxBuffer = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-I") == 0)
+			options.idle = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-T") == 0)
+			options.timeout = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-o") == 0)
+			output = getArg(argc, argv, i);
+		else if (strcmp(argv[i], "-h") == 0)
+		{
+			printUsage();
+			return 0;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown parameter: %s\n", argv[i]);
+			return 4;
+		}
+	}
+
+	if (options.clients <= 0 || options.rounds <= 0 || options.batch <= 0 || options.timeout <= 0 || options.maxBuffer < 0 ||
+		options.idle < 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	// A hub without listeners or plugins; every connection is a LoopbackStream
+	auto core = Core::create("./");
+	core->setDataPath("./");
+	core->getLogManager().setEnabled(false);
+	core->getLogManager().setUseConsole(false);
+	// Everything is queued at once when thousands of clients log in together; with the
+	// default limit the hub would start refusing them for lack of bandwidth
+	core->getSocketManager().setMaxBufferSize(options.maxBuffer);
+	// Idle connections must outlive the benchmark
+	if (options.idle) core->getClientManager().setLogTimeout(options.timeout * 2000);
+
+	Harness harness(*core, options);
+	core->addJob(std::bind(&Harness::start, &harness));
+	core->run();
+
+	if (harness.hasFailed()) return 2;
+
+	string json;
+	harness.getJSON(json);
+	FILE* f = output ? fopen(output, "w") : stdout;
+	if (!f)
+	{
+		fprintf(stderr, "Unable to open %s\n", output);
+		return 3;
+	}
+	fputs(json.c_str(), f);
+	if (output) fclose(f);
+	return 0;
+}
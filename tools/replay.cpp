@@ -0,0 +1,656 @@
+/*
+ * Copyright (C) 2006-2018 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Replays a traffic capture (see adchpp/CaptureFormat.h) against a hub: either one built
+// into this tool and driven through in-memory connections, or a running hub over TCP
+
+#include <adchpp/CID.h>
+#include <adchpp/CaptureFormat.h>
+#include <adchpp/ClientManager.h>
+#include <adchpp/Core.h>
+#include <adchpp/LogManager.h>
+#include <adchpp/LoopbackStream.h>
+#include <adchpp/SocketManager.h>
+#include <baselib/TigerHash.h>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace adchpp;
+using boost::asio::io_service;
+using boost::asio::steady_timer;
+using boost::asio::ip::tcp;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Event
+{
+	int64_t time;
+	uint32_t sid;
+	uint8_t type;
+	string data;
+};
+
+static bool loadCapture(const char* path, vector<Event>& events)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "Unable to open %s\n", path);
+		return false;
+	}
+
+	vector<uint8_t> buf;
+	uint8_t chunk[65536];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		buf.insert(buf.end(), chunk, chunk + n);
+	fclose(f);
+
+	size_t pos = capture::readHeader(buf.data(), buf.size());
+	if (pos == 0)
+	{
+		fprintf(stderr, "%s is not a traffic capture\n", path);
+		return false;
+	}
+
+	capture::Record r;
+	while (pos < buf.size())
+	{
+		size_t size = capture::readRecord(&buf[pos], buf.size() - pos, r);
+		if (size == 0)
+		{
+			fprintf(stderr, "%s: truncated record at offset %llu\n", path, (unsigned long long) pos);
+			break;
+		}
+		Event e = { r.time, r.sid, r.type, string((const char*) &buf[pos + capture::RECORD_SIZE], size - capture::RECORD_SIZE) };
+		events.push_back(std::move(e));
+		pos += size;
+	}
+	return true;
+}
+
+/** One replayed client connection */
+class Link
+{
+public:
+	typedef function<void(const char* data, size_t len)> DataHandler;
+
+	virtual void send(const string& data) = 0;
+	/** Close once everything sent so far has been written */
+	virtual void close() = 0;
+	/** True when the hub has taken everything sent so far */
+	virtual bool idle() = 0;
+
+	virtual ~Link() {}
+};
+
+typedef shared_ptr<Link> LinkPtr;
+
+class Transport
+{
+public:
+	typedef function<void()> Callback;
+
+	virtual LinkPtr connect(const string& ip, const Link::DataHandler& handler) = 0;
+	/** Run f on the transport's thread after msec milliseconds (0 - as soon as possible) */
+	virtual void post(long msec, const Callback& f) = 0;
+	virtual void run() = 0;
+	virtual void stop() = 0;
+
+	virtual ~Transport() {}
+};
+
+/** Connections to a hub running in this process */
+class LoopbackTransport : public Transport
+{
+public:
+	LoopbackTransport(size_t maxBuffer) : core(Core::create("./")), server(make_shared<ServerInfo>())
+	{
+		core->setDataPath("./");
+		core->getLogManager().setEnabled(false);
+		core->getLogManager().setUseConsole(false);
+		core->getSocketManager().setMaxBufferSize(maxBuffer);
+	}
+
+	virtual LinkPtr connect(const string& ip, const Link::DataHandler& handler)
+	{
+		auto stream = make_shared<LoopbackStream>(core->getSocketManager(), ip.empty() ? "127.0.0.1" : ip);
+		stream->setDataHandler([handler](const uint8_t* data, size_t len) { handler((const char*) data, len); });
+		core->getSocketManager().accept(stream, server);
+		return make_shared<LoopbackLink>(stream);
+	}
+
+	virtual void post(long msec, const Callback& f)
+	{
+		if (msec == 0)
+			core->addJob(f);
+		else
+			core->addJob(msec, f);
+	}
+
+	virtual void run() { core->run(); }
+	virtual void stop() { core->shutdown(); }
+
+private:
+	class LoopbackLink : public Link
+	{
+	public:
+		LoopbackLink(const LoopbackStreamPtr& stream) : stream(stream) {}
+
+		virtual void send(const string& data) { stream->send(data); }
+		virtual void close()
+		{
+			stream->setDataHandler(nullptr);
+			stream->disconnect();
+		}
+		virtual bool idle() { return stream->available() == 0; }
+
+	private:
+		LoopbackStreamPtr stream;
+	};
+
+	shared_ptr<Core> core;
+	ServerInfoPtr server;
+};
+
+/** Plain TCP connections to a running hub */
+class TcpTransport : public Transport
+{
+public:
+	TcpTransport(const string& host, const string& port)
+	{
+		tcp::resolver resolver(io);
+		endpoints = resolver.resolve(host, port);
+	}
+
+	virtual LinkPtr connect(const string&, const Link::DataHandler& handler)
+	{
+		auto c = make_shared<TcpLink>(io, handler);
+		c->start(endpoints);
+		return c;
+	}
+
+	virtual void post(long msec, const Callback& f)
+	{
+		auto timer = make_shared<steady_timer>(io, std::chrono::milliseconds(msec));
+		timer->async_wait([timer, f](const boost::system::error_code& ec) {
+			if (!ec) f();
+		});
+	}
+
+	virtual void run() { io.run(); }
+	virtual void stop() { io.stop(); }
+
+private:
+	class TcpLink : public Link, public std::enable_shared_from_this<TcpLink>
+	{
+	public:
+		TcpLink(io_service& io, const DataHandler& handler) :
+			sock(io), handler(handler), connected(false), writing(false), closing(false)
+		{
+		}
+
+		void start(const tcp::resolver::results_type& endpoints)
+		{
+			auto self = shared_from_this();
+			boost::asio::async_connect(sock, endpoints, [self](const boost::system::error_code& ec, const tcp::endpoint&) {
+				if (ec)
+				{
+					fprintf(stderr, "Connect failed: %s\n", ec.message().c_str());
+					return;
+				}
+				self->connected = true;
+				self->read();
+				self->flush();
+			});
+		}
+
+		virtual void send(const string& data)
+		{
+			outbox += data;
+			flush();
+		}
+
+		virtual void close()
+		{
+			closing = true;
+			handler = nullptr;
+			flush();
+		}
+
+		virtual bool idle() { return !connected || (!writing && outbox.empty()); }
+
+	private:
+		void read()
+		{
+			auto self = shared_from_this();
+			sock.async_read_some(boost::asio::buffer(buf, sizeof(buf)), [self](const boost::system::error_code& ec, size_t n) {
+				if (ec) return;
+				if (self->handler) self->handler(self->buf, n);
+				self->read();
+			});
+		}
+
+		void flush()
+		{
+			if (!connected || writing) return;
+			if (outbox.empty())
+			{
+				if (closing)
+				{
+					boost::system::error_code ec;
+					sock.shutdown(tcp::socket::shutdown_send, ec);
+				}
+				return;
+			}
+
+			writing = true;
+			sending.swap(outbox);
+			auto self = shared_from_this();
+			boost::asio::async_write(sock, boost::asio::buffer(sending), [self](const boost::system::error_code& ec, size_t) {
+				self->writing = false;
+				self->sending.clear();
+				if (!ec) self->flush();
+			});
+		}
+
+		tcp::socket sock;
+		DataHandler handler;
+		char buf[4096];
+		string outbox;
+		string sending;
+		bool connected;
+		bool writing;
+		bool closing;
+	};
+
+	io_service io;
+	tcp::resolver::results_type endpoints;
+};
+
+class Replayer
+{
+public:
+	/** speed - 1 for real time, 0 for as fast as possible; keepIp - send the captured
+	 * I4/I6 fields (only valid if the hub sees the captured addresses) */
+	Replayer(Transport& transport, const vector<Event>& events, double speed, bool keepIp) :
+		transport(transport), events(events), speed(speed), keepIp(keepIp), next(0), sessions(0), lines(0),
+		skipped(0), bytes(0), maxLag(0)
+	{
+	}
+
+	void start()
+	{
+		startTime = Clock::now();
+		tick();
+	}
+
+	void printReport() const
+	{
+		double elapsed = std::chrono::duration<double>(endTime - startTime).count();
+		printf("Replayed %llu records in %.3f s (%.1f records/s)\n", (unsigned long long) next, elapsed, next / elapsed);
+		printf("Sessions: %llu, lines sent: %llu, lines without a session: %llu\n", (unsigned long long) sessions,
+			(unsigned long long) lines, (unsigned long long) skipped);
+		printf("Received from the hub: %.1f MiB\n", bytes / 1048576.0);
+		if (speed > 0) printf("Largest delay behind the capture schedule: %.1f ms\n", maxLag / 1000.0);
+	}
+
+private:
+	enum { BATCH = 256 };
+
+	struct Session
+	{
+		LinkPtr conn;
+		string oldSid;
+		string sid;
+		string cid;
+		string pid;
+		deque<string> pending;
+		string partial;
+		bool closing = false;
+		bool closed = false;
+	};
+
+	typedef shared_ptr<Session> SessionPtr;
+
+	int64_t getElapsed() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startTime).count();
+	}
+
+	void tick()
+	{
+		int64_t t0 = events.empty() ? 0 : events[0].time;
+		for (size_t n = 0; next < events.size() && n < BATCH; ++n)
+		{
+			if (speed > 0)
+			{
+				// Microseconds from the start of the replay
+				int64_t due = (int64_t) ((events[next].time - t0) / speed);
+				int64_t elapsed = getElapsed();
+				if (due > elapsed)
+				{
+					transport.post(std::max<long>(1, std::min<long>(100, (long) ((due - elapsed) / 1000))),
+						std::bind(&Replayer::tick, this));
+					return;
+				}
+				maxLag = std::max(maxLag, elapsed - due);
+			}
+			dispatch(events[next++]);
+		}
+
+		if (next < events.size())
+		{
+			// Let the hub run between batches
+			transport.post(0, std::bind(&Replayer::tick, this));
+			return;
+		}
+
+		endTime = Clock::now();
+		for (auto i = live.begin(); i != live.end(); ++i)
+			finish(i->second);
+		live.clear();
+		waitForDrain();
+	}
+
+	void waitForDrain()
+	{
+		for (auto i = draining.begin(); i != draining.end();)
+		{
+			if ((*i)->closed && (*i)->conn->idle())
+				i = draining.erase(i);
+			else
+				++i;
+		}
+
+		// Sessions the hub never assigned a SID to are given up after a while
+		if (!draining.empty() && Clock::now() - endTime < std::chrono::seconds(10))
+		{
+			transport.post(10, std::bind(&Replayer::waitForDrain, this));
+			return;
+		}
+		endTime = Clock::now();
+		// Give the hub a moment to process the last lines before stopping it
+		transport.post(500, std::bind(&Transport::stop, &transport));
+	}
+
+	void dispatch(const Event& e)
+	{
+		switch (e.type)
+		{
+			case capture::EVENT_CONNECT:
+			{
+				auto i = live.find(e.sid);
+				if (i != live.end())
+				{
+					finish(i->second);
+					live.erase(i);
+				}
+
+				auto s = make_shared<Session>();
+				s->oldSid = AdcCommand::fromSID(e.sid);
+				CID pid = CID::generate();
+				TigerHash th;
+				th.update(pid.data(), CID::SIZE);
+				s->cid = CID(th.finalize()).toBase32();
+				s->pid = pid.toBase32();
+				weak_ptr<Session> ws = s;
+				s->conn = transport.connect(e.data, [this, ws](const char* data, size_t len) {
+					auto s = ws.lock();
+					if (s) onData(s, data, len);
+				});
+				live[e.sid] = s;
+				sessions++;
+				break;
+			}
+			case capture::EVENT_LINE:
+			{
+				auto i = live.find(e.sid);
+				if (i == live.end())
+				{
+					// The capture started after this client connected
+					skipped++;
+					break;
+				}
+				i->second->pending.push_back(e.data);
+				flush(i->second);
+				break;
+			}
+			case capture::EVENT_DISCONNECT:
+			{
+				auto i = live.find(e.sid);
+				if (i != live.end())
+				{
+					finish(i->second);
+					live.erase(i);
+				}
+				break;
+			}
+		}
+	}
+
+	/** Close the session once its remaining lines have been sent */
+	void finish(const SessionPtr& s)
+	{
+		s->closing = true;
+		draining.insert(s);
+		flush(s);
+	}
+
+	static bool hasSid(const string& line)
+	{
+		return line.size() >= 9 && (line[0] == 'B' || line[0] == 'D' || line[0] == 'E' || line[0] == 'F');
+	}
+
+	void flush(const SessionPtr& s)
+	{
+		while (!s->pending.empty())
+		{
+			string& line = s->pending.front();
+			if (hasSid(line))
+			{
+				// Wait until the hub has assigned this session its SID
+				if (s->sid.empty()) return;
+				rewrite(*s, line);
+			}
+			line += '\n';
+			s->conn->send(line);
+			s->pending.pop_front();
+			lines++;
+		}
+
+		if (s->closing && !s->closed)
+		{
+			// Stays in draining until the hub has read everything
+			s->conn->close();
+			s->closed = true;
+			auto i = sids.find(s->oldSid);
+			if (i != sids.end() && i->second == s->sid) sids.erase(i);
+		}
+	}
+
+	/** Map the SIDs of the capture to the ones of this replay and give the client a fresh CID/PID */
+	void rewrite(const Session& s, string& line)
+	{
+		line.replace(5, 4, s.sid);
+		if ((line[0] == 'D' || line[0] == 'E') && line.size() >= 14)
+		{
+			auto i = sids.find(line.substr(10, 4));
+			if (i != sids.end()) line.replace(10, 4, i->second);
+		}
+
+		if (line.compare(1, 4, "INF ") == 0)
+		{
+			auto i = line.find(" ID");
+			if (i != string::npos) replaceField(line, i, " ID" + s.cid + " PD" + s.pid);
+
+			if (!keepIp)
+			{
+				// Let the hub fill in the address it sees
+				i = line.find(" I4");
+				if (i != string::npos) replaceField(line, i, " I40.0.0.0");
+				i = line.find(" I6");
+				if (i != string::npos) replaceField(line, i, string());
+			}
+		}
+	}
+
+	/** Replace the field that starts with the space at pos */
+	static void replaceField(string& line, size_t pos, const string& field)
+	{
+		auto end = line.find(' ', pos + 1);
+		line.replace(pos, end == string::npos ? string::npos : end - pos, field);
+	}
+
+	void onData(const SessionPtr& s, const char* data, size_t len)
+	{
+		bytes += len;
+		if (!s->sid.empty()) return;
+
+		s->partial.append(data, len);
+		auto i = s->partial.find("ISID ");
+		if (i == string::npos || s->partial.size() < i + 9)
+		{
+			if (s->partial.size() > 65536) s->partial.erase(0, s->partial.size() - 8);
+			return;
+		}
+
+		s->sid = s->partial.substr(i + 5, 4);
+		s->partial.clear();
+		sids[s->oldSid] = s->sid;
+		flush(s);
+	}
+
+	Transport& transport;
+	const vector<Event>& events;
+	double speed;
+	bool keepIp;
+	size_t next;
+
+	unordered_map<uint32_t, SessionPtr> live;
+	unordered_set<SessionPtr> draining;
+	/** SID in the capture -> SID in this replay */
+	unordered_map<string, string> sids;
+
+	uint64_t sessions;
+	uint64_t lines;
+	uint64_t skipped;
+	uint64_t bytes;
+	int64_t maxLag;
+	Clock::time_point startTime;
+	Clock::time_point endTime;
+};
+
+static void printUsage()
+{
+	const char* text = "Usage: adchpp-replay [options...] capture...\n"
+		"Options:\n"
+		"\t-x speed\tReplay speed relative to the capture, 0 for as fast as possible; that only\n"
+		"\t\t\tkeeps the order of each client's lines (default: 1)\n"
+		"\t-H host\t\tReplay over TCP to this hub instead of one running in this process\n"
+		"\t-p port\t\tHub port (default: 2780)\n"
+		"\t-B bytes\tIn-process hub: per connection send queue limit, 0 for none (default: 0)\n"
+		"\t-h\t\tShow this help message\n"
+		"Captures are written by the hub when TrafficCapture is set and replayed in the order given.\n"
+		"Registered users can't log in during a replay since password hashes depend on a random salt.\n";
+	fputs(text, stdout);
+}
+
+static const char* getArg(int argc, char* argv[], int& i)
+{
+	if (i + 1 == argc)
+	{
+		fprintf(stderr, "Parameter %s requires an argument\n", argv[i]);
+		exit(1);
+	}
+	return argv[++i];
+}
+
+int main(int argc, char* argv[])
+{
+	double speed = 1;
+	string host;
+	string port = "2780";
+	int maxBuffer = 0;
+	vector<Event> events;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-x") == 0)
+			speed = atof(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-H") == 0)
+			host = getArg(argc, argv, i);
+		else if (strcmp(argv[i], "-p") == 0)
+			port = getArg(argc, argv, i);
+		else if (strcmp(argv[i], "-B") == 0)
+			maxBuffer = atoi(getArg(argc, argv, i));
+		else if (strcmp(argv[i], "-h") == 0)
+		{
+			printUsage();
+			return 0;
+		}
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "Unknown parameter: %s\n", argv[i]);
+			return 4;
+		}
+		else if (!loadCapture(argv[i], events))
+			return 3;
+	}
+
+	if (events.empty() || speed < 0 || maxBuffer < 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	unique_ptr<Transport> transport;
+	try
+	{
+		if (host.empty())
+			transport.reset(new LoopbackTransport(maxBuffer));
+		else
+			transport.reset(new TcpTransport(host, port));
+	}
+	catch (const boost::system::system_error& e)
+	{
+		fprintf(stderr, "Unable to resolve %s: %s\n", host.c_str(), e.what());
+		return 2;
+	}
+
+	Replayer replayer(*transport, events, speed, host.empty());
+	transport->post(0, std::bind(&Replayer::start, &replayer));
+	transport->run();
+
+	replayer.printReport();
+	return 0;
+}